@@ -0,0 +1,417 @@
+// Copyright 2022 Daniel Liu
+
+#include "access_log.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+
+#include "socket.h"
+
+namespace cppserver {
+
+namespace {
+
+std::atomic<uint64_t> next_log_id {1};
+
+constexpr std::pair<std::string_view, AccessLogMethod> kMethods[] = {
+  {"GET", AccessLogMethod::kGet},
+  {"HEAD", AccessLogMethod::kHead},
+  {"POST", AccessLogMethod::kPost},
+  {"PUT", AccessLogMethod::kPut},
+  {"DELETE", AccessLogMethod::kDelete},
+  {"PATCH", AccessLogMethod::kPatch},
+  {"OPTIONS", AccessLogMethod::kOptions},
+};
+
+bool WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t result = write(fd, data, size);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += result;
+    size -= result;
+  }
+  return true;
+}
+
+std::string FormatPeer(const AccessLogRecord& record) {
+  char address[INET6_ADDRSTRLEN] = "-";
+  if (record.peer_family == AF_INET || record.peer_family == AF_INET6) {
+    inet_ntop(record.peer_family, record.peer_address, address,
+              sizeof(address));
+  }
+  return address;
+}
+
+std::string FormatTimestamp(int64_t timestamp_ns) {
+  time_t seconds = timestamp_ns / 1000000000;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  char buffer[64];
+  size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+  snprintf(buffer + length, sizeof(buffer) - length, ".%06dZ",
+           static_cast<int>((timestamp_ns % 1000000000) / 1000));
+  return buffer;
+}
+
+// The length of the well-formed UTF-8 sequence at the start of `bytes`, or
+// 0 if there is none (RFC 3629, section 4).
+size_t Utf8SequenceLength(const uint8_t* bytes, size_t size) {
+  uint8_t lead = bytes[0];
+  if (lead < 0x80) {
+    return 1;
+  }
+  size_t length;
+  uint8_t low = 0x80, high = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    length = 2;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    length = 3;
+    if (lead == 0xE0) {
+      low = 0xA0;
+    } else if (lead == 0xED) {
+      high = 0x9F;
+    }
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    length = 4;
+    if (lead == 0xF0) {
+      low = 0x90;
+    } else if (lead == 0xF4) {
+      high = 0x8F;
+    }
+  } else {
+    return 0;
+  }
+  if (size < length || bytes[1] < low || bytes[1] > high) {
+    return 0;
+  }
+  for (size_t i = 2; i < length; ++i) {
+    if ((bytes[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+// Escapes `value` for a JSON string. Bytes that aren't part of valid UTF-8
+// are written as the code point of the same value, so the output stays
+// valid JSON and the original bytes can still be told apart.
+std::string EscapeJSON(std::string_view value) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(value.data());
+  std::string escaped;
+  size_t i = 0;
+  while (i < value.size()) {
+    uint8_t c = bytes[i];
+    size_t length = Utf8SequenceLength(bytes + i, value.size() - i);
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c < 0x20 || c == 0x7F || length == 0) {
+      char buffer[8];
+      snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      escaped += buffer;
+    } else {
+      escaped.append(value.data() + i, length);
+      i += length;
+      continue;
+    }
+    ++i;
+  }
+  return escaped;
+}
+
+}  // namespace
+
+AccessLogMethod ParseAccessLogMethod(std::string_view method) {
+  for (const auto& [name, value] : kMethods) {
+    if (name == method) {
+      return value;
+    }
+  }
+  return AccessLogMethod::kOther;
+}
+
+std::string_view AccessLogMethodName(AccessLogMethod method) {
+  for (const auto& [name, value] : kMethods) {
+    if (value == method) {
+      return name;
+    }
+  }
+  return "OTHER";
+}
+
+void AccessLogRecord::SetTarget(std::string_view target_in) {
+  target_length = std::min<size_t>(target_in.size(), UINT16_MAX);
+  size_t stored = std::min(target_in.size(), kAccessLogTargetSize);
+  std::memcpy(target, target_in.data(), stored);
+  std::memset(target + stored, 0, kAccessLogTargetSize - stored);
+}
+
+void AccessLogRecord::SetPeer(const SocketSockAddr& peer) {
+  const struct sockaddr& addr = peer.rawValue();
+  std::memset(peer_address, 0, sizeof(peer_address));
+  peer_port = 0;
+  peer_family = addr.sa_family;
+  if (addr.sa_family == AF_INET) {
+    struct sockaddr_in addr_in;
+    std::memcpy(&addr_in, &addr, sizeof(addr_in));
+    std::memcpy(peer_address, &addr_in.sin_addr, sizeof(addr_in.sin_addr));
+    peer_port = ntohs(addr_in.sin_port);
+  } else if (addr.sa_family == AF_INET6) {
+    struct sockaddr_in6 addr_in6;
+    std::memcpy(&addr_in6, &addr, sizeof(addr_in6));
+    std::memcpy(peer_address, &addr_in6.sin6_addr,
+                sizeof(addr_in6.sin6_addr));
+    peer_port = ntohs(addr_in6.sin6_port);
+  } else {
+    peer_family = AF_UNSPEC;
+  }
+}
+
+std::string FormatAccessLogRecord(const AccessLogRecord& record,
+                                  AccessLogFormat format) {
+  std::string_view target(
+      record.target, std::min<size_t>(record.target_length,
+                                      kAccessLogTargetSize));
+  bool truncated = record.target_length > kAccessLogTargetSize;
+  std::string peer = FormatPeer(record);
+  std::string timestamp = FormatTimestamp(record.timestamp_ns);
+  std::string_view method = AccessLogMethodName(record.method);
+
+  if (format == AccessLogFormat::kText) {
+    if (record.peer_family == AF_INET6) {
+      peer = absl::StrCat("[", peer, "]");
+    }
+    return absl::StrCat(timestamp, " ", peer, ":", record.peer_port, " \"",
+                        method, " ", target, truncated ? "..." : "", "\" ",
+                        record.status, " ", record.bytes_sent, " ",
+                        record.latency_us, "us");
+  }
+  return absl::StrCat(
+      "{\"time\":\"", timestamp, "\",\"peer\":\"", peer,
+      "\",\"port\":", record.peer_port, ",\"method\":\"", method,
+      "\",\"target\":\"", EscapeJSON(target),
+      "\",\"target_truncated\":", truncated ? "true" : "false",
+      ",\"status\":", record.status, ",\"bytes_sent\":", record.bytes_sent,
+      ",\"latency_us\":", record.latency_us, "}");
+}
+
+absl::Status ReadAccessLogFile(
+    const std::string& path,
+    absl::FunctionRef<void(const AccessLogRecord&)> visit) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat(path, ": ", std::strerror(errno)));
+  }
+
+  AccessLogFileHeader header;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1;
+  if (!ok || std::memcmp(header.magic, kAccessLogMagic,
+                         sizeof(header.magic)) != 0) {
+    fclose(file);
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, ": not an access log"));
+  }
+  if (header.byte_order_mark != kAccessLogByteOrderMark) {
+    fclose(file);
+    return absl::FailedPreconditionError(absl::StrCat(
+        path, ": written on a machine with different byte order"));
+  }
+  if (header.version != kAccessLogVersion
+      || header.record_size != sizeof(AccessLogRecord)) {
+    fclose(file);
+    return absl::FailedPreconditionError(absl::StrCat(
+        path, ": unsupported version ", header.version, " (record size ",
+        header.record_size, ")"));
+  }
+
+  std::vector<AccessLogRecord> records(1024);
+  size_t count;
+  while ((count = fread(records.data(), sizeof(AccessLogRecord),
+                        records.size(), file)) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      visit(records[i]);
+    }
+  }
+  fclose(file);
+  return absl::OkStatus();
+}
+
+AccessLog::AccessLog(Options options)
+    : options_{std::move(options)},
+      id_{next_log_id.fetch_add(1, std::memory_order_relaxed)} {}
+
+absl::StatusOr<std::unique_ptr<AccessLog>> AccessLog::Open(Options options) {
+  std::unique_ptr<AccessLog> log(new AccessLog(std::move(options)));
+  auto status = log->OpenFile();
+  if (!status.ok()) {
+    return status;
+  }
+  log->flush_thread_ = std::thread(&AccessLog::Run, log.get());
+  return log;
+}
+
+AccessLog::~AccessLog() {
+  {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_one();
+  if (flush_thread_.joinable()) {
+    flush_thread_.join();
+  }
+  Flush();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+absl::Status AccessLog::OpenFile() {
+  fd_ = open(options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+             0644);
+  if (fd_ < 0) {
+    return absl::InternalError(absl::StrCat("Failed to open access log ",
+                                            options_.path, ": ",
+                                            std::strerror(errno)));
+  }
+  off_t size = lseek(fd_, 0, SEEK_END);
+  file_size_ = size > 0 ? size : 0;
+  if (file_size_ == 0) {
+    AccessLogFileHeader header = {};
+    std::memcpy(header.magic, kAccessLogMagic, sizeof(header.magic));
+    header.version = kAccessLogVersion;
+    header.record_size = sizeof(AccessLogRecord);
+    header.byte_order_mark = kAccessLogByteOrderMark;
+    if (!WriteFully(fd_, reinterpret_cast<const char*>(&header),
+                    sizeof(header))) {
+      return absl::InternalError("Failed to write access log header");
+    }
+    file_size_ = sizeof(header);
+  }
+  return absl::OkStatus();
+}
+
+AccessLog::Buffer* AccessLog::ThreadBuffer() {
+  thread_local BufferLease lease;
+  if (lease.log_id == id_) {
+    return lease.buffer.get();
+  }
+  if (lease.buffer) {
+    lease.buffer->orphaned.store(true, std::memory_order_release);
+  }
+  lease.buffer = std::make_shared<Buffer>();
+  lease.buffer->records.reserve(kbatch_records_);
+  lease.log_id = id_;
+  std::lock_guard<std::mutex> lock(buffers_mutex_);
+  buffers_.push_back(lease.buffer);
+  return lease.buffer.get();
+}
+
+void AccessLog::Record(const AccessLogRecord& record) {
+  Buffer* buffer = ThreadBuffer();
+  std::vector<AccessLogRecord> full;
+  {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->records.push_back(record);
+    if (buffer->records.size() < kbatch_records_) {
+      return;
+    }
+    full.reserve(kbatch_records_);
+    full.swap(buffer->records);
+  }
+  Write(full);
+}
+
+void AccessLog::Flush() {
+  std::vector<std::shared_ptr<Buffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    buffers = buffers_;
+    // Buffers of exited threads only need one last drain.
+    buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                  [](const auto& buffer) {
+                                    return buffer->orphaned.load(
+                                        std::memory_order_acquire);
+                                  }),
+                   buffers_.end());
+  }
+
+  std::vector<AccessLogRecord> batch;
+  for (const auto& buffer : buffers) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    batch.insert(batch.end(), buffer->records.begin(), buffer->records.end());
+    buffer->records.clear();
+  }
+  Write(batch);
+}
+
+void AccessLog::Write(const std::vector<AccessLogRecord>& records) {
+  if (records.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  size_t bytes = records.size() * sizeof(AccessLogRecord);
+
+  if (file_size_ + bytes > options_.max_file_size
+      && file_size_ > sizeof(AccessLogFileHeader)) {
+    close(fd_);
+    for (int i = options_.max_files - 1; i >= 1; --i) {
+      std::string from = i == 1 ? options_.path
+                                : absl::StrCat(options_.path, ".", i - 1);
+      std::rename(from.c_str(), absl::StrCat(options_.path, ".", i).c_str());
+    }
+    if (options_.max_files <= 1) {
+      unlink(options_.path.c_str());
+    }
+    if (!OpenFile().ok()) {
+      fd_ = -1;
+    }
+  }
+
+  if (fd_ < 0) {
+    return;
+  }
+  if (WriteFully(fd_, reinterpret_cast<const char*>(records.data()), bytes)) {
+    file_size_ += bytes;
+  }
+}
+
+void AccessLog::Run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(stop_mutex_);
+      if (stop_cv_.wait_for(lock, options_.flush_interval,
+                            [this] { return stopping_; })) {
+        return;
+      }
+    }
+    Flush();
+  }
+}
+
+}  // namespace cppserver
@@ -0,0 +1,184 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_ACCESS_LOG_H_
+#define _CPPSERVER_ACCESS_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+#include "socket.h"
+
+namespace cppserver {
+
+enum class AccessLogMethod : uint8_t {
+  kOther,
+  kGet,
+  kHead,
+  kPost,
+  kPut,
+  kDelete,
+  kPatch,
+  kOptions,
+};
+
+AccessLogMethod ParseAccessLogMethod(std::string_view method);
+
+std::string_view AccessLogMethodName(AccessLogMethod method);
+
+// Request targets longer than this are truncated in the log.
+constexpr size_t kAccessLogTargetSize = 100;
+
+// One request, as stored in the access log. Records are fixed-size and
+// written in native byte order; see AccessLogFileHeader.
+struct AccessLogRecord {
+  // Unix time the request was accepted, in nanoseconds.
+  int64_t timestamp_ns;
+  uint64_t bytes_sent;
+  uint32_t latency_us;
+  uint16_t status;
+  uint16_t peer_port;
+  AccessLogMethod method;
+  // AF_INET, AF_INET6, or AF_UNSPEC for peers without an IP address.
+  uint8_t peer_family;
+  // Length of the full target, which may exceed kAccessLogTargetSize.
+  uint16_t target_length;
+  uint8_t peer_address[16];
+  char target[kAccessLogTargetSize];
+
+  void SetTarget(std::string_view target);
+
+  void SetPeer(const SocketSockAddr& peer);
+};
+
+static_assert(sizeof(AccessLogRecord) == 144,
+              "AccessLogRecord layout is part of the file format");
+static_assert(offsetof(AccessLogRecord, target_length) == 26
+              && offsetof(AccessLogRecord, peer_address) == 28
+              && offsetof(AccessLogRecord, target) == 44,
+              "AccessLogRecord layout is part of the file format");
+static_assert(std::is_trivially_copyable_v<AccessLogRecord>,
+              "AccessLogRecord is written to the file as raw bytes");
+
+// Every access log file starts with this header.
+struct AccessLogFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  // kAccessLogByteOrderMark as written by the producing machine.
+  uint32_t byte_order_mark;
+  uint32_t reserved;
+};
+
+constexpr char kAccessLogMagic[8] = {'C', 'P', 'P', 'S', 'A', 'L', 'O', 'G'};
+constexpr uint32_t kAccessLogVersion = 1;
+constexpr uint32_t kAccessLogByteOrderMark = 0x01020304;
+
+enum class AccessLogFormat { kText, kJSON };
+
+// Formats `record` as a single line, without the newline. JSON output is
+// valid UTF-8 even when the request target is not.
+std::string FormatAccessLogRecord(const AccessLogRecord& record,
+                                  AccessLogFormat format);
+
+// Calls `visit` with each record of the access log file at `path`, in
+// order, after checking that it was written by a compatible producer.
+absl::Status ReadAccessLogFile(
+    const std::string& path,
+    absl::FunctionRef<void(const AccessLogRecord&)> visit);
+
+// Records requests into per-thread buffers and writes them out in large
+// batches, so logging a request costs a memcpy and an uncontended lock.
+// Files are rotated once they reach a size limit: `path` is renamed to
+// `path.1`, `path.1` to `path.2` and so on, keeping at most `max_files`.
+//
+// Use `access_log_decode` to convert the files to text or JSON.
+class AccessLog {
+ public:
+  struct Options {
+    std::string path;
+    size_t max_file_size = 256 * 1024 * 1024;
+    int max_files = 8;
+    // Buffered records are written out at least this often.
+    std::chrono::milliseconds flush_interval {1000};
+  };
+
+  static absl::StatusOr<std::unique_ptr<AccessLog>> Open(Options options);
+
+  // Writes out everything buffered and stops the flushing thread.
+  ~AccessLog();
+
+  AccessLog(const AccessLog&) = delete;
+  AccessLog& operator=(const AccessLog&) = delete;
+
+  void Record(const AccessLogRecord& record);
+
+  // Writes out everything buffered so far.
+  void Flush();
+
+ private:
+  // A thread's buffer is written out as soon as it holds this many records.
+  static constexpr size_t kbatch_records_ = 256;
+
+  struct Buffer {
+    std::mutex mutex;
+    std::vector<AccessLogRecord> records;
+    // Set when the owning thread exits.
+    std::atomic<bool> orphaned {false};
+  };
+
+  struct BufferLease {
+    ~BufferLease() {
+      if (buffer) {
+        buffer->orphaned.store(true, std::memory_order_release);
+      }
+    }
+
+    uint64_t log_id = 0;
+    std::shared_ptr<Buffer> buffer;
+  };
+
+  explicit AccessLog(Options options);
+
+  absl::Status OpenFile();
+
+  Buffer* ThreadBuffer();
+
+  void Write(const std::vector<AccessLogRecord>& records);
+
+  void Run();
+
+  Options options_;
+  uint64_t id_;
+
+  // Guards the file and its rotation.
+  std::mutex file_mutex_;
+  int fd_ = -1;
+  size_t file_size_ = 0;
+
+  std::mutex buffers_mutex_;
+  std::vector<std::shared_ptr<Buffer>> buffers_;
+
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_ = false;
+
+  std::thread flush_thread_;
+};
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,58 @@
+// Copyright 2022 Daniel Liu
+
+// Converts binary access logs written by cppserver::AccessLog to text.
+//
+// Usage: access_log_decode [--format=text|json] FILE...
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "access_log.h"
+
+namespace {
+
+bool DecodeFile(const char* path, cppserver::AccessLogFormat format) {
+  auto status = cppserver::ReadAccessLogFile(
+      path, [format](const cppserver::AccessLogRecord& record) {
+        printf("%s\n",
+               cppserver::FormatAccessLogRecord(record, format).c_str());
+      });
+  if (!status.ok()) {
+    fprintf(stderr, "%.*s\n", static_cast<int>(status.message().size()),
+            status.message().data());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cppserver::AccessLogFormat format = cppserver::AccessLogFormat::kText;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--format=text") {
+      format = cppserver::AccessLogFormat::kText;
+    } else if (arg == "--format=json") {
+      format = cppserver::AccessLogFormat::kJSON;
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      fprintf(stderr, "Unknown flag %s\n", argv[i]);
+      return 2;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "Usage: %s [--format=text|json] FILE...\n", argv[0]);
+    return 2;
+  }
+
+  bool ok = true;
+  for (const char* path : paths) {
+    ok = DecodeFile(path, format) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "access_log.h"
+#include "socket.h"
+
+using namespace cppserver;
+
+namespace {
+
+AccessLogRecord MakeRecord(int64_t timestamp_ns, std::string_view target) {
+  AccessLogRecord record = {};
+  record.timestamp_ns = timestamp_ns;
+  record.bytes_sent = 512;
+  record.latency_us = 250;
+  record.status = 200;
+  record.method = AccessLogMethod::kGet;
+  record.SetTarget(target);
+  record.SetPeer(SocketSockAddr("10.0.0.1", 1234));
+  return record;
+}
+
+std::vector<AccessLogRecord> ReadAll(const std::string& path) {
+  std::vector<AccessLogRecord> records;
+  auto status = ReadAccessLogFile(path, [&](const AccessLogRecord& record) {
+    records.push_back(record);
+  });
+  EXPECT_TRUE(status.ok()) << status;
+  return records;
+}
+
+}  // namespace
+
+TEST(AccessLogTests, RoundTripsAcrossRotation) {
+  std::string path = testing::TempDir() + "access_log_test.log";
+  unlink(path.c_str());
+  unlink((path + ".1").c_str());
+
+  {
+    AccessLog::Options options;
+    options.path = path;
+    options.max_file_size =
+        sizeof(AccessLogFileHeader) + 3 * sizeof(AccessLogRecord);
+    auto log = AccessLog::Open(options);
+    ASSERT_TRUE(log.ok()) << log.status();
+    for (int i = 0; i < 3; ++i) {
+      (*log)->Record(MakeRecord(i, "/first"));
+    }
+    (*log)->Flush();
+    // These don't fit, so the first file is rotated out of the way.
+    (*log)->Record(MakeRecord(3, "/second"));
+    (*log)->Record(MakeRecord(4, "/second"));
+  }
+
+  auto rotated = ReadAll(path + ".1");
+  ASSERT_EQ(rotated.size(), 3);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(rotated[i].timestamp_ns, i);
+    EXPECT_EQ(std::string(rotated[i].target, rotated[i].target_length),
+              "/first");
+  }
+  auto current = ReadAll(path);
+  ASSERT_EQ(current.size(), 2);
+  EXPECT_EQ(current[0].timestamp_ns, 3);
+  EXPECT_EQ(current[1].timestamp_ns, 4);
+
+  EXPECT_EQ(FormatAccessLogRecord(current[0], AccessLogFormat::kText),
+            "1970-01-01T00:00:00.000000Z 10.0.0.1:1234 \"GET /second\" "
+            "200 512 250us");
+  EXPECT_EQ(FormatAccessLogRecord(current[0], AccessLogFormat::kJSON),
+            "{\"time\":\"1970-01-01T00:00:00.000000Z\",\"peer\":\"10.0.0.1\","
+            "\"port\":1234,\"method\":\"GET\",\"target\":\"/second\","
+            "\"target_truncated\":false,\"status\":200,\"bytes_sent\":512,"
+            "\"latency_us\":250}");
+  unlink(path.c_str());
+  unlink((path + ".1").c_str());
+}
+
+TEST(AccessLogTests, RecordsIPv6Peers) {
+  struct sockaddr_in6 addr = {};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(8080);
+  ASSERT_EQ(inet_pton(AF_INET6, "2001:db8::1", &addr.sin6_addr), 1);
+  AccessLogRecord record = MakeRecord(0, "/");
+  record.SetPeer(SocketSockAddr(reinterpret_cast<const struct sockaddr*>(&addr),
+                                sizeof(addr)));
+  EXPECT_EQ(record.peer_family, AF_INET6);
+  EXPECT_EQ(record.peer_port, 8080);
+  std::string text = FormatAccessLogRecord(record, AccessLogFormat::kText);
+  EXPECT_NE(text.find(" [2001:db8::1]:8080 "), std::string::npos) << text;
+  std::string json = FormatAccessLogRecord(record, AccessLogFormat::kJSON);
+  EXPECT_NE(json.find("\"peer\":\"2001:db8::1\",\"port\":8080"),
+            std::string::npos) << json;
+}
+
+TEST(AccessLogTests, RejectsOtherFiles) {
+  std::string path = testing::TempDir() + "access_log_test.other";
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  fputs("GET / HTTP/1.1\r\n\r\n and then some more bytes", file);
+  fclose(file);
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      ReadAccessLogFile(path, [](const AccessLogRecord&) {})));
+  unlink(path.c_str());
+}
+
+TEST(AccessLogTests, FormatsTruncatedTargets) {
+  std::string target = "/" + std::string(150, 'a');
+  AccessLogRecord record = MakeRecord(1'500'000'000'123'456'789, target);
+  EXPECT_EQ(record.target_length, target.size());
+  std::string text = FormatAccessLogRecord(record, AccessLogFormat::kText);
+  EXPECT_EQ(text, "2017-07-14T02:40:00.123456Z 10.0.0.1:1234 \"GET "
+                  + target.substr(0, kAccessLogTargetSize)
+                  + "...\" 200 512 250us");
+  std::string json = FormatAccessLogRecord(record, AccessLogFormat::kJSON);
+  EXPECT_NE(json.find("\"target_truncated\":true"), std::string::npos);
+}
+
+TEST(AccessLogTests, EscapesTargetsInJSON) {
+  // Valid UTF-8 passes through; stray bytes, quotes and controls don't.
+  AccessLogRecord record =
+      MakeRecord(0, "/caf\xC3\xA9/\xFF\xC3\"\\\x01\xED\xA0\x80");
+  std::string json = FormatAccessLogRecord(record, AccessLogFormat::kJSON);
+  EXPECT_NE(json.find("\"target\":\"/caf\xC3\xA9/\\u00ff\\u00c3\\\"\\\\"
+                      "\\u0001\\u00ed\\u00a0\\u0080\""),
+            std::string::npos) << json;
+}
@@ -0,0 +1,48 @@
+// Copyright 2022 Daniel Liu
+
+#include "admission.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+AdmissionController::AdmissionController(AdmissionOptions options)
+    : options_{options}, min_delay_{0} {}
+
+bool AdmissionController::Admit(std::chrono::nanoseconds queue_delay,
+                                RequestPriority priority,
+                                std::chrono::steady_clock::time_point now) {
+  bool overloaded;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (now >= interval_end_) {
+      // An interval with no requests at all ended with an empty queue.
+      bool consecutive = now < interval_end_ + options_.interval;
+      overloaded_ = consecutive && min_delay_ > options_.target;
+      min_delay_ = std::chrono::nanoseconds::max();
+      interval_end_ = now + options_.interval;
+    }
+    min_delay_ = std::min(min_delay_, queue_delay);
+    overloaded = overloaded_;
+  }
+
+  switch (priority) {
+    case RequestPriority::kCritical:
+      return true;
+    case RequestPriority::kNormal:
+      return queue_delay <= (overloaded ? options_.target : options_.interval);
+    case RequestPriority::kSheddable:
+      return !overloaded && queue_delay <= options_.interval;
+  }
+  return true;
+}
+
+bool AdmissionController::Overloaded() const {
+  absl::MutexLock lock(&mutex_);
+  return overloaded_;
+}
+
+}  // namespace cppserver
@@ -0,0 +1,70 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_ADMISSION_H_
+#define _CPPSERVER_ADMISSION_H_
+
+#include <chrono>
+
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+// Which requests go first when the server sheds load.
+enum class RequestPriority {
+  // Never shed for queueing, e.g. health checks and metrics.
+  kCritical,
+  kNormal,
+  // Shed as soon as the server is overloaded, e.g. expensive pages.
+  kSheddable,
+};
+
+struct AdmissionOptions {
+  // The queue delay the worker pool should stay under. Requests queue
+  // briefly in bursts, so this only counts once it's sustained.
+  std::chrono::milliseconds target = std::chrono::milliseconds(5);
+  // How long the queue delay must stay above `target` before the server
+  // counts as overloaded, and the longest a request may wait otherwise.
+  std::chrono::milliseconds interval = std::chrono::milliseconds(100);
+  // Sent with shed requests in Retry-After.
+  std::chrono::seconds retry_after = std::chrono::seconds(1);
+};
+
+// Decides whether a request that has waited for a worker is still worth
+// handling, following CoDel: if even the shortest wait over an interval was
+// above the target, the queue is standing rather than absorbing a burst, and
+// requests that waited longer than the target are turned away so the queue
+// drains instead of every request getting slower. Otherwise only requests
+// that waited a whole interval are.
+//
+// Shedding a request is cheap, so while overloaded, sheddable requests are
+// all turned away to make room for the rest. Thread-safe.
+class AdmissionController {
+ public:
+  explicit AdmissionController(AdmissionOptions options = {});
+
+  AdmissionController(const AdmissionController&) = delete;
+  AdmissionController& operator=(const AdmissionController&) = delete;
+
+  // Records that a request waited `queue_delay` for a worker, and returns
+  // whether to handle it.
+  bool Admit(std::chrono::nanoseconds queue_delay, RequestPriority priority,
+             std::chrono::steady_clock::time_point now);
+
+  // Whether the last full interval's queue delay stayed above the target.
+  bool Overloaded() const;
+
+  const AdmissionOptions& Options() const { return options_; }
+
+ private:
+  const AdmissionOptions options_;
+
+  mutable absl::Mutex mutex_;
+  std::chrono::steady_clock::time_point interval_end_ ABSL_GUARDED_BY(mutex_);
+  // The shortest queue delay seen in the current interval.
+  std::chrono::nanoseconds min_delay_ ABSL_GUARDED_BY(mutex_);
+  bool overloaded_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace cppserver
+
+#endif
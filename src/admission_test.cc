@@ -0,0 +1,71 @@
+
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+#include "admission.h"
+
+using namespace cppserver;
+using std::chrono::milliseconds;
+
+namespace {
+
+const std::chrono::steady_clock::time_point kStart{};
+
+}  // namespace
+
+TEST(AdmissionControllerTests, AdmitsShortBursts) {
+  AdmissionController admission;
+  // A request now and then waits past the target, but others don't.
+  for (int i = 0; i < 100; ++i) {
+    auto delay = milliseconds(i % 10 == 0 ? 50 : 1);
+    EXPECT_TRUE(admission.Admit(delay, RequestPriority::kSheddable,
+                                kStart + milliseconds(i * 10)));
+  }
+  EXPECT_FALSE(admission.Overloaded());
+  // Requests that waited a whole interval are too late either way.
+  EXPECT_FALSE(admission.Admit(milliseconds(101), RequestPriority::kNormal,
+                               kStart + milliseconds(1000)));
+  EXPECT_TRUE(admission.Admit(milliseconds(101), RequestPriority::kCritical,
+                              kStart + milliseconds(1000)));
+}
+
+TEST(AdmissionControllerTests, ShedsWhileTheQueueStands) {
+  AdmissionController admission;
+  // Every request in the first interval waits past the target.
+  for (int i = 0; i <= 10; ++i) {
+    admission.Admit(milliseconds(20), RequestPriority::kNormal,
+                    kStart + milliseconds(i * 10));
+  }
+  EXPECT_FALSE(admission.Admit(milliseconds(20), RequestPriority::kNormal,
+                               kStart + milliseconds(101)));
+  EXPECT_TRUE(admission.Overloaded());
+
+  auto now = kStart + milliseconds(110);
+  EXPECT_TRUE(admission.Admit(milliseconds(20), RequestPriority::kCritical,
+                              now));
+  EXPECT_TRUE(admission.Admit(milliseconds(4), RequestPriority::kNormal, now));
+  EXPECT_FALSE(admission.Admit(milliseconds(4), RequestPriority::kSheddable,
+                               now));
+
+  // Once the queue empties for a moment, the next interval is back to
+  // normal.
+  admission.Admit(milliseconds(0), RequestPriority::kNormal,
+                  kStart + milliseconds(150));
+  EXPECT_TRUE(admission.Admit(milliseconds(20), RequestPriority::kSheddable,
+                              kStart + milliseconds(250)));
+  EXPECT_FALSE(admission.Overloaded());
+}
+
+TEST(AdmissionControllerTests, ForgetsOverloadAfterAnIdleInterval) {
+  AdmissionController admission;
+  for (int i = 0; i <= 10; ++i) {
+    admission.Admit(milliseconds(20), RequestPriority::kNormal,
+                    kStart + milliseconds(i * 10));
+  }
+  EXPECT_TRUE(admission.Overloaded());
+  // No requests at all for an interval.
+  EXPECT_TRUE(admission.Admit(milliseconds(20), RequestPriority::kSheddable,
+                              kStart + milliseconds(500)));
+  EXPECT_FALSE(admission.Overloaded());
+}
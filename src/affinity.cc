@@ -0,0 +1,93 @@
+// Copyright 2022 Daniel Liu
+
+#include "affinity.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+
+namespace cppserver {
+
+absl::StatusOr<std::vector<int>> ParseCpuList(std::string_view list) {
+  std::vector<int> cpus;
+  for (std::string_view range : absl::StrSplit(list, ',', absl::SkipEmpty())) {
+    std::pair<std::string_view, std::string_view> bounds =
+        absl::StrSplit(range, absl::MaxSplits('-', 1));
+    int first, last;
+    if (!absl::SimpleAtoi(bounds.first, &first)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid CPU list: ", list));
+    }
+    last = first;
+    if (range.find('-') != std::string_view::npos
+        && !absl::SimpleAtoi(bounds.second, &last)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid CPU list: ", list));
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid CPU range: ", range));
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+absl::Status PinCurrentThread(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return absl::InvalidArgumentError(absl::StrCat("Invalid CPU ", cpu));
+    }
+    CPU_SET(cpu, &set);
+  }
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to pin thread: ", std::strerror(error)));
+  }
+  return absl::OkStatus();
+}
+
+std::vector<int> CpuNodes() {
+  long count = sysconf(_SC_NPROCESSORS_CONF);
+  std::vector<int> nodes(count > 0 ? count : 0, 0);
+  // Each CPU's sysfs directory links to its node as `node<N>`.
+  for (size_t cpu = 0; cpu < nodes.size(); ++cpu) {
+    std::string path = absl::StrCat("/sys/devices/system/cpu/cpu", cpu);
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+      continue;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+      std::string_view name = entry->d_name;
+      int node;
+      if (absl::StartsWith(name, "node")
+          && absl::SimpleAtoi(name.substr(4), &node)) {
+        nodes[cpu] = node;
+        break;
+      }
+    }
+    closedir(dir);
+  }
+  return nodes;
+}
+
+}  // namespace cppserver
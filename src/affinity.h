@@ -0,0 +1,28 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_AFFINITY_H_
+#define _CPPSERVER_AFFINITY_H_
+
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace cppserver {
+
+// Parses a CPU list in the kernel's format, e.g. "0-3,8,10-11".
+absl::StatusOr<std::vector<int>> ParseCpuList(std::string_view list);
+
+// Restricts the calling thread to `cpus`. Memory the thread touches first
+// afterwards is allocated on their NUMA node, so pin threads before they
+// set up their buffers.
+absl::Status PinCurrentThread(const std::vector<int>& cpus);
+
+// The NUMA node of each CPU, indexed by CPU number. CPUs the system doesn't
+// place on a node are on node 0.
+std::vector<int> CpuNodes();
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,36 @@
+
+#include <sched.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "affinity.h"
+
+using namespace cppserver;
+
+TEST(AffinityTests, ParsesCpuLists) {
+  EXPECT_EQ(*ParseCpuList("0-3,8,10-11"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(*ParseCpuList("5"), std::vector<int>{5});
+  EXPECT_TRUE(ParseCpuList("")->empty());
+  EXPECT_FALSE(ParseCpuList("3-1").ok());
+  EXPECT_FALSE(ParseCpuList("a").ok());
+  EXPECT_FALSE(ParseCpuList("1-").ok());
+}
+
+TEST(AffinityTests, PinsTheCurrentThread) {
+  int cpu = sched_getcpu();
+  ASSERT_GE(cpu, 0);
+  ASSERT_TRUE(PinCurrentThread({cpu}).ok());
+  EXPECT_EQ(sched_getcpu(), cpu);
+
+  cpu_set_t set;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(set), &set), 0);
+  EXPECT_EQ(CPU_COUNT(&set), 1);
+  EXPECT_FALSE(PinCurrentThread({-1}).ok());
+
+  auto nodes = CpuNodes();
+  ASSERT_GT(nodes.size(), static_cast<size_t>(cpu));
+  EXPECT_GE(nodes[cpu], 0);
+}
@@ -0,0 +1,47 @@
+// Copyright 2022 Daniel Liu
+
+#include "arena.h"
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+
+namespace cppserver {
+
+namespace {
+
+thread_local std::unique_ptr<std::byte[]> thread_block;
+thread_local bool thread_block_taken = false;
+
+}  // namespace
+
+void RequestArena::PrepareThread() {
+  if (!thread_block) {
+    thread_block.reset(new std::byte[kBlockSize]);
+    std::memset(thread_block.get(), 0, kBlockSize);
+  }
+}
+
+RequestArena::RequestArena() : block_{nullptr} {
+  if (!thread_block_taken) {
+    if (!thread_block) {
+      // Left uninitialized; the arena never reads memory it hasn't written.
+      thread_block.reset(new std::byte[kBlockSize]);
+    }
+    thread_block_taken = true;
+    block_ = thread_block.get();
+    resource_.emplace(block_, kBlockSize);
+  } else {
+    resource_.emplace(kBlockSize);
+  }
+}
+
+RequestArena::~RequestArena() {
+  resource_.reset();
+  if (block_) {
+    thread_block_taken = false;
+  }
+}
+
+}  // namespace cppserver
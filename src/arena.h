@@ -0,0 +1,52 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_ARENA_H_
+#define _CPPSERVER_ARENA_H_
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+
+namespace cppserver {
+
+// A bump allocator for the memory of a single request. Allocations are carved
+// out of a block owned by the calling thread and reused by each request it
+// handles; a request that outgrows the block continues in heap chunks.
+// Nothing is freed individually: destroying the arena, or calling Reset,
+// releases everything at once.
+//
+//    RequestArena arena;
+//    auto request = ParseHTTPRequest(msg, arena.Resource());
+//
+// Only one arena per thread uses the thread's block at a time. Arenas
+// created while it is taken start out in heap chunks.
+class RequestArena {
+ public:
+  // Size of each thread's reusable block.
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  RequestArena();
+  ~RequestArena();
+
+  RequestArena(const RequestArena&) = delete;
+  RequestArena& operator=(const RequestArena&) = delete;
+
+  std::pmr::memory_resource* Resource() { return &*resource_; }
+
+  // Allocates the calling thread's block now rather than on its first
+  // request, and touches it so its pages are placed on the NUMA node the
+  // thread is running on.
+  static void PrepareThread();
+
+  // Releases everything allocated from the arena, which can then be reused.
+  void Reset() { resource_->release(); }
+
+ private:
+  // The thread's block, if this arena holds it.
+  std::byte* block_;
+  std::optional<std::pmr::monotonic_buffer_resource> resource_;
+};
+
+}  // namespace cppserver
+
+#endif
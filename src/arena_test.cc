@@ -0,0 +1,51 @@
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "arena.h"
+
+using namespace cppserver;
+
+namespace {
+
+// The address of a small allocation from `arena`.
+std::byte* Allocate(RequestArena& arena) {
+  return static_cast<std::byte*>(arena.Resource()->allocate(16));
+}
+
+}  // namespace
+
+TEST(RequestArenaTests, ReusesTheThreadBlock) {
+  std::byte* first;
+  {
+    RequestArena arena;
+    first = Allocate(arena);
+    std::pmr::vector<std::pmr::string> strings(arena.Resource());
+    for (int i = 0; i < 100; ++i) {
+      strings.emplace_back("a string too long for the small string buffer");
+    }
+  }
+  RequestArena arena;
+  EXPECT_EQ(Allocate(arena), first);
+}
+
+TEST(RequestArenaTests, ResetReleasesEverything) {
+  RequestArena arena;
+  std::byte* first = Allocate(arena);
+  EXPECT_NE(arena.Resource()->allocate(4 * RequestArena::kBlockSize), nullptr);
+  arena.Reset();
+  EXPECT_EQ(Allocate(arena), first);
+}
+
+TEST(RequestArenaTests, NestedArenasDontShareTheBlock) {
+  RequestArena outer;
+  std::byte* block = Allocate(outer);
+  RequestArena inner;
+  std::byte* allocation = Allocate(inner);
+  EXPECT_TRUE(allocation < block
+              || allocation >= block + RequestArena::kBlockSize);
+}
@@ -0,0 +1,286 @@
+// Copyright 2022 Daniel Liu
+
+#include "compression.h"
+
+#include <zlib.h>
+
+#ifdef CPPSERVER_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+namespace cppserver {
+
+namespace {
+
+// Output is produced in chunks of this size.
+constexpr size_t kChunkSize = 16 * 1024;
+
+class ZlibCompressor : public StreamingCompressor {
+ public:
+  ~ZlibCompressor() override {
+    deflateEnd(&stream_);
+  }
+
+  static absl::StatusOr<std::unique_ptr<StreamingCompressor>> Create(
+      ContentEncoding encoding, int level) {
+    auto compressor = std::unique_ptr<ZlibCompressor>(new ZlibCompressor());
+    // 15 window bits gives the zlib format; adding 16 gives gzip instead.
+    int window_bits = encoding == ContentEncoding::kGzip ? 15 + 16 : 15;
+    int result = deflateInit2(&compressor->stream_, level, Z_DEFLATED,
+                              window_bits, 8, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK) {
+      return absl::InternalError("deflateInit2 failed");
+    }
+    return compressor;
+  }
+
+  absl::Status Write(std::string_view input, std::string& out) override {
+    return Deflate(input, Z_NO_FLUSH, out);
+  }
+
+  absl::Status Finish(std::string& out) override {
+    return Deflate({}, Z_FINISH, out);
+  }
+
+ private:
+  ZlibCompressor() : stream_{} {}
+
+  absl::Status Deflate(std::string_view input, int flush, std::string& out) {
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream_.avail_in = input.size();
+    do {
+      size_t offset = out.size();
+      out.resize(offset + kChunkSize);
+      stream_.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+      stream_.avail_out = kChunkSize;
+      int result = deflate(&stream_, flush);
+      out.resize(out.size() - stream_.avail_out);
+      if (result == Z_STREAM_ERROR) {
+        return absl::InternalError("deflate failed");
+      }
+      if (result == Z_STREAM_END) {
+        break;
+      }
+    } while (stream_.avail_out == 0 || stream_.avail_in > 0 ||
+             flush == Z_FINISH);
+    return absl::OkStatus();
+  }
+
+  z_stream stream_;
+};
+
+#ifdef CPPSERVER_HAVE_BROTLI
+class BrotliCompressor : public StreamingCompressor {
+ public:
+  ~BrotliCompressor() override {
+    BrotliEncoderDestroyInstance(state_);
+  }
+
+  static absl::StatusOr<std::unique_ptr<StreamingCompressor>> Create(
+      int quality) {
+    BrotliEncoderState* state = BrotliEncoderCreateInstance(
+        nullptr, nullptr, nullptr);
+    if (state == nullptr) {
+      return absl::InternalError("BrotliEncoderCreateInstance failed");
+    }
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, quality);
+    return std::unique_ptr<StreamingCompressor>(new BrotliCompressor(state));
+  }
+
+  absl::Status Write(std::string_view input, std::string& out) override {
+    return Compress(input, BROTLI_OPERATION_PROCESS, out);
+  }
+
+  absl::Status Finish(std::string& out) override {
+    return Compress({}, BROTLI_OPERATION_FINISH, out);
+  }
+
+ private:
+  explicit BrotliCompressor(BrotliEncoderState* state) : state_{state} {}
+
+  absl::Status Compress(std::string_view input, BrotliEncoderOperation op,
+                        std::string& out) {
+    size_t available_in = input.size();
+    const uint8_t* next_in = reinterpret_cast<const uint8_t*>(input.data());
+    while (true) {
+      size_t offset = out.size();
+      out.resize(offset + kChunkSize);
+      size_t available_out = kChunkSize;
+      uint8_t* next_out = reinterpret_cast<uint8_t*>(out.data() + offset);
+      if (!BrotliEncoderCompressStream(state_, op, &available_in, &next_in,
+                                       &available_out, &next_out, nullptr)) {
+        out.resize(offset);
+        return absl::InternalError("BrotliEncoderCompressStream failed");
+      }
+      out.resize(out.size() - available_out);
+      bool done = op == BROTLI_OPERATION_FINISH
+          ? BrotliEncoderIsFinished(state_)
+          : available_in == 0 && !BrotliEncoderHasMoreOutput(state_);
+      if (done) {
+        return absl::OkStatus();
+      }
+    }
+  }
+
+  BrotliEncoderState* state_;
+};
+#endif
+
+}  // namespace
+
+double AcceptEncodingQuality(std::string_view accept_encoding,
+                             std::string_view coding) {
+  double wildcard = -1;
+  for (std::string_view entry : absl::StrSplit(accept_encoding, ',')) {
+    std::vector<std::string_view> params = absl::StrSplit(entry, ';');
+    std::string_view name = absl::StripAsciiWhitespace(params[0]);
+
+    double quality = 1;
+    for (size_t i = 1; i < params.size(); ++i) {
+      std::string_view param = absl::StripAsciiWhitespace(params[i]);
+      if (absl::StartsWithIgnoreCase(param, "q=")) {
+        if (!absl::SimpleAtod(param.substr(2), &quality)) {
+          quality = 0;
+        }
+      }
+    }
+
+    if (absl::EqualsIgnoreCase(name, coding)) {
+      return quality;
+    }
+    if (name == "*") {
+      wildcard = quality;
+    }
+  }
+  return wildcard;
+}
+
+std::string_view ContentEncodingName(ContentEncoding encoding) {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      return "gzip";
+    case ContentEncoding::kDeflate:
+      return "deflate";
+    case ContentEncoding::kBrotli:
+      return "br";
+    case ContentEncoding::kIdentity:
+      break;
+  }
+  return "identity";
+}
+
+std::string_view ContentEncodingExtension(ContentEncoding encoding) {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      return ".gz";
+    case ContentEncoding::kBrotli:
+      return ".br";
+    case ContentEncoding::kDeflate:
+    case ContentEncoding::kIdentity:
+      break;
+  }
+  return "";
+}
+
+bool IsContentEncodingSupported(ContentEncoding encoding) {
+#ifdef CPPSERVER_HAVE_BROTLI
+  return true;
+#else
+  return encoding != ContentEncoding::kBrotli;
+#endif
+}
+
+ContentEncoding NegotiateContentEncoding(
+    std::string_view accept_encoding,
+    const std::vector<ContentEncoding>& available) {
+  ContentEncoding best = ContentEncoding::kIdentity;
+  double best_quality = 0;
+  for (ContentEncoding encoding : available) {
+    double quality = AcceptEncodingQuality(accept_encoding,
+                                           ContentEncodingName(encoding));
+    // Ties go to the earlier (preferred) encoding.
+    if (quality > best_quality) {
+      best = encoding;
+      best_quality = quality;
+    }
+  }
+  return best;
+}
+
+bool CompressionPolicy::ShouldCompress(std::string_view content_type,
+                                       size_t size) const {
+  if (!enabled || size < min_size) {
+    return false;
+  }
+  // Ignore parameters such as "; charset=utf-8".
+  content_type = content_type.substr(0, content_type.find(';'));
+  content_type = absl::StripAsciiWhitespace(content_type);
+  for (const auto& allowed : content_types) {
+    if (allowed.empty()) {
+      continue;
+    }
+    bool matches = allowed.back() == '/'
+        ? absl::StartsWithIgnoreCase(content_type, allowed)
+        : absl::EqualsIgnoreCase(content_type, allowed);
+    if (matches) {
+      return true;
+    }
+  }
+  return false;
+}
+
+absl::StatusOr<std::unique_ptr<StreamingCompressor>> StreamingCompressor::Create(
+    ContentEncoding encoding, const CompressionPolicy& policy) {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+    case ContentEncoding::kDeflate:
+      return ZlibCompressor::Create(encoding, policy.zlib_level);
+    case ContentEncoding::kBrotli:
+#ifdef CPPSERVER_HAVE_BROTLI
+      return BrotliCompressor::Create(policy.brotli_quality);
+#else
+      return absl::UnimplementedError("Built without brotli support");
+#endif
+    case ContentEncoding::kIdentity:
+      break;
+  }
+  return absl::InvalidArgumentError("No compressor for identity encoding");
+}
+
+absl::StatusOr<std::string> Compress(std::string_view input,
+                                     ContentEncoding encoding,
+                                     const CompressionPolicy& policy) {
+  auto compressor = StreamingCompressor::Create(encoding, policy);
+  if (!compressor.ok()) {
+    return compressor.status();
+  }
+  std::string out;
+  // Compressible text usually shrinks by at least 2/3.
+  out.reserve(input.size() / 3 + kChunkSize);
+  auto status = (*compressor)->Write(input, out);
+  if (!status.ok()) {
+    return status;
+  }
+  status = (*compressor)->Finish(out);
+  if (!status.ok()) {
+    return status;
+  }
+  return out;
+}
+
+}  // namespace cppserver
@@ -0,0 +1,99 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_COMPRESSION_H_
+#define _CPPSERVER_COMPRESSION_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace cppserver {
+
+enum class ContentEncoding {
+  kIdentity,
+  kGzip,
+  kDeflate,
+  kBrotli,
+};
+
+// Returns the content-coding token for `encoding`, e.g. "gzip".
+std::string_view ContentEncodingName(ContentEncoding encoding);
+
+// Returns the file extension used for precompressed variants of static
+// files, e.g. ".gz", or an empty string if there is none.
+std::string_view ContentEncodingExtension(ContentEncoding encoding);
+
+// Returns true if this build can compress with `encoding` at runtime.
+// Brotli is only available when built with `--define brotli=true`.
+bool IsContentEncodingSupported(ContentEncoding encoding);
+
+// Returns the q-value an Accept-Encoding header assigns to `coding`, or -1
+// if it doesn't mention it (or a wildcard covering it).
+double AcceptEncodingQuality(std::string_view accept_encoding,
+                             std::string_view coding);
+
+// Picks the best encoding out of `available` (in order of our preference)
+// that the client accepts according to its Accept-Encoding header.
+// Falls back to kIdentity.
+ContentEncoding NegotiateContentEncoding(
+    std::string_view accept_encoding,
+    const std::vector<ContentEncoding>& available);
+
+// Controls which responses get compressed on the fly.
+struct CompressionPolicy {
+  bool enabled = true;
+
+  // Bodies smaller than this aren't worth the CPU or the framing overhead.
+  size_t min_size = 1024;
+
+  // Content types eligible for compression. An entry ending in '/' matches
+  // every subtype, e.g. "text/".
+  std::vector<std::string> content_types = {
+    "text/",
+    "application/json",
+    "application/javascript",
+    "application/xml",
+    "image/svg+xml",
+  };
+
+  // zlib compression level (1-9) for gzip and deflate.
+  int zlib_level = 6;
+
+  // Brotli quality (0-11). Dynamic content favors speed over ratio.
+  int brotli_quality = 5;
+
+  // Returns true if a body of `size` bytes with `content_type` should be
+  // compressed under this policy.
+  bool ShouldCompress(std::string_view content_type, size_t size) const;
+};
+
+// Incrementally compresses a body, so callers can feed it in chunks as it is
+// produced instead of holding the whole input and output at once.
+class StreamingCompressor {
+ public:
+  virtual ~StreamingCompressor() = default;
+
+  // Creates a compressor for `encoding`, which must be supported and must not
+  // be kIdentity.
+  static absl::StatusOr<std::unique_ptr<StreamingCompressor>> Create(
+      ContentEncoding encoding, const CompressionPolicy& policy);
+
+  // Compresses `input`, appending any available output to `out`.
+  virtual absl::Status Write(std::string_view input, std::string& out) = 0;
+
+  // Flushes the remaining output and ends the stream.
+  virtual absl::Status Finish(std::string& out) = 0;
+};
+
+// Convenience wrapper that compresses `input` in one go.
+absl::StatusOr<std::string> Compress(std::string_view input,
+                                     ContentEncoding encoding,
+                                     const CompressionPolicy& policy);
+
+}  // namespace cppserver
+
+#endif
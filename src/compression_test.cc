@@ -0,0 +1,146 @@
+
+#include <zlib.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "compression.h"
+
+using namespace cppserver;
+
+namespace {
+
+const std::vector<ContentEncoding> kGzipAndDeflate = {
+  ContentEncoding::kGzip, ContentEncoding::kDeflate,
+};
+
+// Inflates `compressed`, detecting a gzip or zlib header.
+std::string Inflate(const std::string& compressed) {
+  z_stream stream = {};
+  // 32 added to the window bits accepts either header.
+  EXPECT_EQ(inflateInit2(&stream, 15 + 32), Z_OK);
+  stream.next_in = reinterpret_cast<Bytef*>(
+      const_cast<char*>(compressed.data()));
+  stream.avail_in = compressed.size();
+  std::string out;
+  char buffer[4096];
+  int result;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (result == Z_OK);
+  EXPECT_EQ(result, Z_STREAM_END);
+  inflateEnd(&stream);
+  return out;
+}
+
+std::string SampleBody() {
+  std::string body;
+  for (int i = 0; i < 1000; ++i) {
+    body += "<li>item " + std::to_string(i) + "</li>\n";
+  }
+  return body;
+}
+
+}  // namespace
+
+TEST(CompressionTests, AcceptEncodingQuality) {
+  EXPECT_EQ(AcceptEncodingQuality("gzip, deflate", "gzip"), 1);
+  EXPECT_EQ(AcceptEncodingQuality("gzip;q=0.5, deflate", "gzip"), 0.5);
+  EXPECT_EQ(AcceptEncodingQuality("GZIP ; Q=0.25", "gzip"), 0.25);
+  EXPECT_EQ(AcceptEncodingQuality("gzip;q=0", "gzip"), 0);
+  EXPECT_EQ(AcceptEncodingQuality("gzip;q=oops", "gzip"), 0);
+  EXPECT_EQ(AcceptEncodingQuality("deflate", "gzip"), -1);
+  EXPECT_EQ(AcceptEncodingQuality("", "gzip"), -1);
+  // Wildcards cover codings that aren't named, wherever they appear.
+  EXPECT_EQ(AcceptEncodingQuality("*;q=0.1", "br"), 0.1);
+  EXPECT_EQ(AcceptEncodingQuality("br;q=0.7, *;q=0.1", "br"), 0.7);
+  EXPECT_EQ(AcceptEncodingQuality("*;q=0.1, br;q=0.7", "br"), 0.7);
+}
+
+TEST(CompressionTests, NegotiatesByQuality) {
+  EXPECT_EQ(NegotiateContentEncoding("gzip, deflate", kGzipAndDeflate),
+            ContentEncoding::kGzip);
+  EXPECT_EQ(NegotiateContentEncoding("gzip;q=0.5, deflate", kGzipAndDeflate),
+            ContentEncoding::kDeflate);
+  EXPECT_EQ(NegotiateContentEncoding("deflate;q=0.5, gzip;q=0.5",
+                                     kGzipAndDeflate),
+            ContentEncoding::kGzip);
+  EXPECT_EQ(NegotiateContentEncoding("br", kGzipAndDeflate),
+            ContentEncoding::kIdentity);
+  EXPECT_EQ(NegotiateContentEncoding("", kGzipAndDeflate),
+            ContentEncoding::kIdentity);
+}
+
+TEST(CompressionTests, NegotiationHonorsExclusions) {
+  EXPECT_EQ(NegotiateContentEncoding("gzip;q=0, deflate", kGzipAndDeflate),
+            ContentEncoding::kDeflate);
+  EXPECT_EQ(NegotiateContentEncoding("gzip;q=0, deflate;q=0",
+                                     kGzipAndDeflate),
+            ContentEncoding::kIdentity);
+  EXPECT_EQ(NegotiateContentEncoding("*", kGzipAndDeflate),
+            ContentEncoding::kGzip);
+  EXPECT_EQ(NegotiateContentEncoding("*;q=0", kGzipAndDeflate),
+            ContentEncoding::kIdentity);
+  EXPECT_EQ(NegotiateContentEncoding("*;q=0, deflate", kGzipAndDeflate),
+            ContentEncoding::kDeflate);
+  // Refusing identity doesn't make an unacceptable coding acceptable; the
+  // response still falls back to it.
+  EXPECT_EQ(NegotiateContentEncoding("identity;q=0, gzip", kGzipAndDeflate),
+            ContentEncoding::kGzip);
+  EXPECT_EQ(NegotiateContentEncoding("identity;q=0", kGzipAndDeflate),
+            ContentEncoding::kIdentity);
+}
+
+TEST(CompressionTests, PolicyChecksSizeAndContentType) {
+  CompressionPolicy policy;
+  EXPECT_TRUE(policy.ShouldCompress("text/html; charset=utf-8", 4096));
+  EXPECT_TRUE(policy.ShouldCompress("TEXT/CSS", 4096));
+  EXPECT_TRUE(policy.ShouldCompress("application/json", 4096));
+  EXPECT_FALSE(policy.ShouldCompress("application/jsonx", 4096));
+  EXPECT_FALSE(policy.ShouldCompress("image/png", 4096));
+  EXPECT_FALSE(policy.ShouldCompress("", 4096));
+  EXPECT_TRUE(policy.ShouldCompress("text/html", policy.min_size));
+  EXPECT_FALSE(policy.ShouldCompress("text/html", policy.min_size - 1));
+
+  policy.content_types = {"image/svg+xml"};
+  EXPECT_FALSE(policy.ShouldCompress("text/html", 4096));
+  EXPECT_TRUE(policy.ShouldCompress("image/svg+xml", 4096));
+  policy.enabled = false;
+  EXPECT_FALSE(policy.ShouldCompress("image/svg+xml", 4096));
+}
+
+TEST(CompressionTests, RoundTripsThroughZlib) {
+  std::string body = SampleBody();
+  CompressionPolicy policy;
+  for (auto encoding : kGzipAndDeflate) {
+    auto compressed = Compress(body, encoding, policy);
+    ASSERT_TRUE(compressed.ok()) << compressed.status();
+    EXPECT_LT(compressed->size(), body.size() / 4);
+    EXPECT_EQ(Inflate(*compressed), body) << ContentEncodingName(encoding);
+  }
+  // gzip has the gzip magic; deflate is the zlib format, per RFC 7230.
+  auto gzip = Compress(body, ContentEncoding::kGzip, policy);
+  EXPECT_EQ(gzip->substr(0, 2), "\x1f\x8b");
+  auto deflate = Compress(body, ContentEncoding::kDeflate, policy);
+  EXPECT_EQ(static_cast<unsigned char>((*deflate)[0]) & 0x0f, 8);
+}
+
+TEST(CompressionTests, StreamsInChunks) {
+  std::string body = SampleBody();
+  auto compressor = StreamingCompressor::Create(ContentEncoding::kGzip,
+                                                CompressionPolicy());
+  ASSERT_TRUE(compressor.ok()) << compressor.status();
+  std::string out;
+  for (size_t i = 0; i < body.size(); i += 1000) {
+    ASSERT_TRUE((*compressor)->Write(
+        std::string_view(body).substr(i, 1000), out).ok());
+  }
+  ASSERT_TRUE((*compressor)->Finish(out).ok());
+  EXPECT_EQ(Inflate(out), body);
+}
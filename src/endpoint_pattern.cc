@@ -0,0 +1,47 @@
+// Copyright 2022 Daniel Liu
+
+#include "endpoint_pattern.h"
+
+#include <memory_resource>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace cppserver {
+
+EndpointPattern::EndpointPattern(std::string endpoint)
+    : endpoint_{std::move(endpoint)} {
+  // Get each component (within <>).
+  std::regex component_regex("<([^>]*)>");
+  std::sregex_iterator component_it(endpoint_.begin(), endpoint_.end(),
+      component_regex);
+  std::sregex_iterator component_end;
+  while (component_it != component_end) {
+    std::smatch match = *component_it;
+    components_.push_back(match[1]);
+    ++component_it;
+  }
+  // Preprocess the string, replacing `<...>` with `(.*)`.
+  regex_ = std::regex(std::regex_replace(endpoint_,
+      std::regex("<[^>]*>"), "(.*)"));
+}
+
+std::optional<EndpointParams> EndpointPattern::Match(
+    std::string_view path, std::pmr::memory_resource* resource) const {
+  std::pmr::cmatch match(resource);
+  if (!std::regex_match(path.data(), path.data() + path.size(), match,
+                        regex_)) {
+    return std::nullopt;
+  }
+  EndpointParams params(components_.size(), resource);
+  for (size_t i = 0; i < components_.size(); ++i) {
+    params.try_emplace(std::pmr::string(components_[i], resource),
+                       match[i + 1].first, match[i + 1].second);
+  }
+  return params;
+}
+
+}  // namespace cppserver
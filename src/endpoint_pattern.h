@@ -0,0 +1,43 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_ENDPOINT_PATTERN_H_
+#define _CPPSERVER_ENDPOINT_PATTERN_H_
+
+#include <memory_resource>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cppserver {
+
+// The values of an endpoint's parameters, keyed by name.
+using EndpointParams =
+    std::pmr::unordered_map<std::pmr::string, std::pmr::string>;
+
+// An endpoint such as "/posts/<post_id>/", compiled for matching against
+// request targets. Each `<param_name>` component matches any text.
+class EndpointPattern {
+ public:
+  explicit EndpointPattern(std::string endpoint);
+
+  // Returns the values of the endpoint's parameters, allocated from
+  // `resource`, if `path` matches the endpoint.
+  std::optional<EndpointParams> Match(
+      std::string_view path,
+      std::pmr::memory_resource* resource =
+          std::pmr::get_default_resource()) const;
+
+  const std::string& Endpoint() const { return endpoint_; }
+
+ private:
+  std::string endpoint_;
+  std::regex regex_;
+  std::vector<std::string> components_;
+};
+
+}  // namespace cppserver
+
+#endif
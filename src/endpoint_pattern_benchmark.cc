@@ -0,0 +1,56 @@
+// Copyright 2022 Daniel Liu
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "endpoint_pattern.h"
+
+namespace {
+
+// Matches `target` against the patterns in order, as Server does.
+bool Route(const std::vector<cppserver::EndpointPattern>& patterns,
+           const std::string& target) {
+  for (const auto& pattern : patterns) {
+    if (auto params = pattern.Match(target)) {
+      benchmark::DoNotOptimize(params);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<cppserver::EndpointPattern> MakeRoutes() {
+  std::vector<cppserver::EndpointPattern> patterns;
+  for (const char* endpoint : {
+           "/",
+           "/about/",
+           "/login/",
+           "/logout/",
+           "/metrics",
+           "/static/<file>",
+           "/users/<user_id>/",
+           "/users/<user_id>/posts/",
+           "/posts/<post_id>/",
+           "/posts/<post_id>/comments/<comment_id>/",
+       }) {
+    patterns.emplace_back(endpoint);
+  }
+  return patterns;
+}
+
+void BM_RouteMatch(benchmark::State& state, const std::string& target) {
+  auto patterns = MakeRoutes();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Route(patterns, target));
+  }
+}
+BENCHMARK_CAPTURE(BM_RouteMatch, first, std::string("/"));
+BENCHMARK_CAPTURE(BM_RouteMatch, parameter,
+                  std::string("/users/1234/posts/"));
+BENCHMARK_CAPTURE(BM_RouteMatch, last,
+                  std::string("/posts/42/comments/7/"));
+BENCHMARK_CAPTURE(BM_RouteMatch, miss, std::string("/favicon.ico"));
+
+}  // namespace
@@ -0,0 +1,189 @@
+// Copyright 2022 Daniel Liu
+
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+namespace {
+
+// Events handled per epoll_wait call.
+constexpr int kMaxEvents = 256;
+
+}  // namespace
+
+EventLoop::EventLoop()
+    : epoll_fd_{epoll_create1(EPOLL_CLOEXEC)},
+      wake_fd_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+      timers_{kTimerTick, std::chrono::steady_clock::now()} {
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    LOG(FATAL) << "Failed to create event loop, errno = " << errno;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_fd_;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
+
+EventLoop::~EventLoop() {
+  close(wake_fd_);
+  close(epoll_fd_);
+}
+
+void EventLoop::Add(int fd, uint32_t events, Callback callback) {
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    LOG(ERROR) << "Failed to watch fd " << fd << ", errno = " << errno;
+    return;
+  }
+  callbacks_[fd] = std::make_shared<Callback>(std::move(callback));
+}
+
+void EventLoop::Modify(int fd, uint32_t events) {
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) < 0) {
+    LOG(ERROR) << "Failed to modify fd " << fd << ", errno = " << errno;
+  }
+}
+
+void EventLoop::Remove(int fd) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  callbacks_.erase(fd);
+}
+
+void EventLoop::Post(std::function<void()> task) {
+  {
+    absl::MutexLock lock(&posted_mutex_);
+    posted_.push_back(std::move(task));
+  }
+  Wake();
+}
+
+EventLoop::TimerId EventLoop::AddTimer(
+    std::chrono::steady_clock::duration delay,
+    std::function<void()> callback) {
+  TimerId id;
+  bool first;
+  {
+    absl::MutexLock lock(&timers_mutex_);
+    first = timers_.empty();
+    id = timers_.Add(std::chrono::steady_clock::now() + delay,
+                     std::move(callback));
+  }
+  // The loop only ticks while timers are armed.
+  if (first && !InLoopThread()) {
+    Wake();
+  }
+  return id;
+}
+
+bool EventLoop::CancelTimer(TimerId id) {
+  absl::MutexLock lock(&timers_mutex_);
+  if (timers_.Cancel(id)) {
+    return true;
+  }
+  if (!InLoopThread()) {
+    auto finished = [this, id] { return running_timer_ != id; };
+    timers_mutex_.Await(absl::Condition(&finished));
+  }
+  return false;
+}
+
+void EventLoop::Stop() {
+  running_.store(false, std::memory_order_relaxed);
+  Wake();
+}
+
+void EventLoop::Wake() {
+  uint64_t one = 1;
+  [[maybe_unused]] ssize_t result = write(wake_fd_, &one, sizeof(one));
+}
+
+void EventLoop::RunPosted() {
+  uint64_t count;
+  [[maybe_unused]] ssize_t result = read(wake_fd_, &count, sizeof(count));
+
+  std::vector<std::function<void()>> tasks;
+  {
+    absl::MutexLock lock(&posted_mutex_);
+    tasks.swap(posted_);
+  }
+  for (auto& task : tasks) {
+    task();
+  }
+}
+
+void EventLoop::RunTimers() {
+  timers_mutex_.Lock();
+  timers_.Advance(std::chrono::steady_clock::now());
+  TimerId id;
+  TimerWheel::Callback callback;
+  while (timers_.PopExpired(&id, &callback)) {
+    // Run without the lock, so callbacks can arm timers; CancelTimer waits
+    // on running_timer_ instead.
+    running_timer_ = id;
+    timers_mutex_.Unlock();
+    callback();
+    callback = nullptr;
+    timers_mutex_.Lock();
+    running_timer_ = 0;
+  }
+  timers_mutex_.Unlock();
+}
+
+void EventLoop::Run() {
+  loop_thread_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  running_.store(true, std::memory_order_relaxed);
+
+  struct epoll_event events[kMaxEvents];
+  while (running_.load(std::memory_order_relaxed)) {
+    int timeout = -1;
+    {
+      absl::MutexLock lock(&timers_mutex_);
+      if (!timers_.empty()) {
+        timeout = kTimerTick.count();
+      }
+    }
+    int ready = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    if (ready < 0) {
+      if (errno != EINTR) {
+        LOG(ERROR) << "epoll_wait failed, errno = " << errno;
+      }
+      continue;
+    }
+    for (int i = 0; i < ready; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        RunPosted();
+        continue;
+      }
+      // The descriptor may have been removed by an earlier callback.
+      auto it = callbacks_.find(fd);
+      if (it == callbacks_.end()) {
+        continue;
+      }
+      std::shared_ptr<Callback> callback = it->second;
+      (*callback)(events[i].events);
+    }
+    RunTimers();
+  }
+}
+
+}  // namespace cppserver
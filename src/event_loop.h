@@ -0,0 +1,118 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_EVENT_LOOP_H_
+#define _CPPSERVER_EVENT_LOOP_H_
+
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+
+#include "timer_wheel.h"
+
+namespace cppserver {
+
+// An epoll loop that waits for file descriptors to become ready and runs
+// their callbacks. Everything runs on the thread that calls Run, so callbacks
+// must not block; hand slow work to a WorkerPool instead.
+//
+// Add and Remove may only be called on the loop thread (use Post from other
+// threads). Modify, Post and the timer functions may be called from any
+// thread.
+//
+// Timers are kept in a TimerWheel with kTimerTick resolution, and the loop
+// wakes once per tick while any are armed, so timeouts cost no system calls
+// of their own.
+class EventLoop {
+ public:
+  // Receives the ready events (EPOLLIN, EPOLLOUT, ...) for its descriptor.
+  using Callback = std::function<void(uint32_t events)>;
+
+  using TimerId = TimerWheel::TimerId;
+
+  static constexpr std::chrono::milliseconds kTimerTick{10};
+
+  EventLoop();
+  ~EventLoop();
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  // Starts watching `fd` for `events`.
+  void Add(int fd, uint32_t events, Callback callback);
+
+  // Changes the events watched for `fd`, e.g. to re-arm an EPOLLONESHOT
+  // descriptor once another thread is done with it.
+  void Modify(int fd, uint32_t events);
+
+  // Stops watching `fd`. Call this before closing it, since the descriptor
+  // number may be reused. The callback is destroyed once it isn't running.
+  void Remove(int fd);
+
+  // Runs `task` on the loop thread.
+  void Post(std::function<void()> task);
+
+  // Runs `callback` on the loop thread once `delay` has passed, rounded up
+  // to the tick.
+  TimerId AddTimer(std::chrono::steady_clock::duration delay,
+                   std::function<void()> callback);
+
+  // Disarms a timer, returning false if it has already fired. Once this
+  // returns, the callback is not running and won't run, unless this is
+  // called from the loop thread (e.g. by the callback itself), so state the
+  // callback refers to can be destroyed right after.
+  bool CancelTimer(TimerId id);
+
+  // Runs the loop on the calling thread until Stop is called.
+  void Run();
+
+  // Makes Run return. Safe to call from any thread.
+  void Stop();
+
+  bool InLoopThread() const {
+    return std::this_thread::get_id()
+        == loop_thread_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Runs the tasks queued by Post.
+  void RunPosted();
+
+  // Runs the callbacks of the timers that are due.
+  void RunTimers();
+
+  // Wakes the loop from epoll_wait.
+  void Wake();
+
+  int epoll_fd_;
+  // Written to wake the loop for posted tasks and Stop.
+  int wake_fd_;
+
+  std::atomic<bool> running_ {false};
+  // Read from any thread by InLoopThread. Only the loop thread can find its
+  // own id here, and it stored it itself, so relaxed ordering is enough.
+  std::atomic<std::thread::id> loop_thread_;
+
+  // Callbacks are shared so one can remove itself while it runs.
+  absl::flat_hash_map<int, std::shared_ptr<Callback>> callbacks_;
+
+  absl::Mutex posted_mutex_;
+  std::vector<std::function<void()>> posted_ ABSL_GUARDED_BY(posted_mutex_);
+
+  absl::Mutex timers_mutex_;
+  TimerWheel timers_ ABSL_GUARDED_BY(timers_mutex_);
+  // The timer whose callback is running, if any.
+  TimerId running_timer_ ABSL_GUARDED_BY(timers_mutex_) = 0;
+};
+
+}  // namespace cppserver
+
+#endif
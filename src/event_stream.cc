@@ -0,0 +1,219 @@
+// Copyright 2022 Daniel Liu
+
+#include "event_stream.h"
+
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+
+#include "event_loop.h"
+#include "socket.h"
+
+namespace cppserver {
+
+namespace {
+
+// The response head for every subscriber. There's no Content-Length, so the
+// stream lasts until the connection closes.
+constexpr std::string_view kEventStreamHead =
+    "HTTP/1.1 200 OK\r\n"
+    "Server: cppserver\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "X-Accel-Buffering: no\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Events written per sendmsg call.
+constexpr int kMaxEventsPerWrite = 64;
+
+}  // namespace
+
+std::string FormatServerSentEvent(uint64_t id, std::string_view event,
+                                  std::string_view data) {
+  std::string formatted = absl::StrCat("id: ", id, "\n");
+  if (!event.empty()) {
+    // A line break would end the field, and let the name add others.
+    std::string name(event);
+    name.erase(std::remove_if(name.begin(), name.end(),
+                              [](char c) { return c == '\r' || c == '\n'; }),
+               name.end());
+    absl::StrAppend(&formatted, "event: ", name, "\n");
+  }
+  // Clients end lines at CRLF, CR or LF, so each starts a new field.
+  size_t start = 0;
+  while (true) {
+    size_t end = data.find_first_of("\r\n", start);
+    absl::StrAppend(&formatted, "data: ", data.substr(start, end - start),
+                    "\n");
+    if (end == std::string_view::npos) {
+      break;
+    }
+    start = end + (data.substr(end, 2) == "\r\n" ? 2 : 1);
+  }
+  formatted += '\n';
+  return formatted;
+}
+
+EventChannel::EventChannel(EventLoop* loop, EventChannelOptions options)
+    : loop_{loop}, options_{options},
+      ring_(std::max<size_t>(options.backlog, 1)) {}
+
+uint64_t EventChannel::Publish(std::string_view data, std::string_view event) {
+  uint64_t id;
+  {
+    absl::MutexLock lock(&mutex_);
+    id = next_id_++;
+    ring_[id % ring_.size()] = std::make_shared<const std::string>(
+        FormatServerSentEvent(id, event, data));
+  }
+  if (!wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+    loop_->Post([self = shared_from_this()] { self->Wake(); });
+  }
+  return id;
+}
+
+void EventChannel::Subscribe(Socket socket,
+                             std::optional<uint64_t> last_event_id) {
+  socket.SetNonBlocking(true);
+  auto subscriber = std::make_shared<Subscriber>(Subscriber{
+      std::move(socket), 0, 0, kEventStreamHead});
+  {
+    absl::MutexLock lock(&mutex_);
+    uint64_t oldest = next_id_ > ring_.size() ? next_id_ - ring_.size() : 1;
+    subscriber->next = last_event_id && *last_event_id < next_id_
+        ? std::max(*last_event_id + 1, oldest)
+        : next_id_;
+  }
+  loop_->Post([self = shared_from_this(), subscriber] {
+    self->Add(subscriber);
+  });
+}
+
+void EventChannel::Add(std::shared_ptr<Subscriber> subscriber) {
+  int fd = subscriber->socket.GetFD();
+  Subscriber* added = subscriber.get();
+  subscribers_.emplace(fd, std::move(subscriber));
+  subscriber_count_.fetch_add(1, std::memory_order_relaxed);
+
+  // Subscribers don't send anything, so only hangups and writability
+  // matter.
+  loop_->Add(fd, EPOLLRDHUP,
+             [self = shared_from_this(), added, fd](uint32_t events) {
+               if ((events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+                   || ((events & EPOLLOUT) && !self->Write(*added))) {
+                 self->Remove(fd);
+               }
+             });
+  if (!Write(*added)) {
+    Remove(fd);
+  }
+}
+
+bool EventChannel::Write(Subscriber& subscriber) {
+  bool blocked = false;
+  while (!blocked) {
+    // Take references to the pending events, so they can be written without
+    // holding the lock even if they're overwritten meanwhile.
+    std::shared_ptr<const std::string> events[kMaxEventsPerWrite];
+    int count = 0;
+    {
+      absl::MutexLock lock(&mutex_);
+      uint64_t oldest = next_id_ > ring_.size() ? next_id_ - ring_.size() : 1;
+      if (subscriber.next < oldest) {
+        // Too far behind; the client reconnects with Last-Event-ID.
+        return false;
+      }
+      while (count < kMaxEventsPerWrite && subscriber.next + count < next_id_) {
+        events[count] = ring_[(subscriber.next + count) % ring_.size()];
+        ++count;
+      }
+    }
+
+    struct iovec iov[kMaxEventsPerWrite + 1];
+    int iovcnt = 0;
+    size_t requested = 0;
+    auto add = [&](const char* data, size_t size) {
+      iov[iovcnt].iov_base = const_cast<char*>(data);
+      iov[iovcnt].iov_len = size;
+      requested += size;
+      ++iovcnt;
+    };
+    if (!subscriber.head.empty()) {
+      add(subscriber.head.data(), subscriber.head.size());
+    }
+    for (int i = 0; i < count; ++i) {
+      size_t skip = i == 0 ? subscriber.offset : 0;
+      add(events[i]->data() + skip, events[i]->size() - skip);
+    }
+    if (iovcnt == 0) {
+      break;
+    }
+
+    ssize_t sent = subscriber.socket.SendVector(iov, iovcnt, MSG_NOSIGNAL);
+    if (sent < 0) {
+      return false;
+    }
+    blocked = static_cast<size_t>(sent) < requested;
+
+    size_t written = sent;
+    size_t head_written = std::min(written, subscriber.head.size());
+    subscriber.head.remove_prefix(head_written);
+    written -= head_written;
+    for (int i = 0; i < count && written > 0; ++i) {
+      size_t left = events[i]->size() - subscriber.offset;
+      if (written < left) {
+        subscriber.offset += written;
+        break;
+      }
+      written -= left;
+      subscriber.offset = 0;
+      ++subscriber.next;
+    }
+  }
+
+  if (blocked != subscriber.want_write) {
+    subscriber.want_write = blocked;
+    loop_->Modify(subscriber.socket.GetFD(),
+                  EPOLLRDHUP | (blocked ? EPOLLOUT : 0));
+  }
+  return true;
+}
+
+void EventChannel::Remove(int fd) {
+  auto it = subscribers_.find(fd);
+  if (it == subscribers_.end()) {
+    return;
+  }
+  loop_->Remove(fd);
+  subscribers_.erase(it);
+  subscriber_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void EventChannel::Wake() {
+  wake_pending_.store(false, std::memory_order_release);
+
+  // Subscribers waiting for writability pick up new events when the loop
+  // calls them.
+  std::vector<int> disconnected;
+  for (auto& [fd, subscriber] : subscribers_) {
+    if (!subscriber->want_write && !Write(*subscriber)) {
+      disconnected.push_back(fd);
+    }
+  }
+  for (int fd : disconnected) {
+    Remove(fd);
+  }
+}
+
+}  // namespace cppserver
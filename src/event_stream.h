@@ -0,0 +1,110 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_EVENT_STREAM_H_
+#define _CPPSERVER_EVENT_STREAM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+
+#include "event_loop.h"
+#include "socket.h"
+
+namespace cppserver {
+
+// Serializes one Server-Sent Event. Each line of `data`, ended by CRLF, CR
+// or LF, becomes its own "data:" field; `event` may be empty for the default
+// "message" type, and has any line breaks removed.
+std::string FormatServerSentEvent(uint64_t id, std::string_view event,
+                                  std::string_view data);
+
+struct EventChannelOptions {
+  // How many recent events are kept for subscribers that are behind or
+  // reconnecting with Last-Event-ID. Subscribers that fall further behind
+  // are disconnected, and resume from the oldest kept event when they
+  // reconnect.
+  size_t backlog = 1024;
+};
+
+// A `text/event-stream` that any number of connections subscribe to.
+// Published events are serialized once into a ring of shared buffers, and
+// each subscriber keeps only its position in the ring, so memory grows with
+// the backlog rather than with subscribers times events. Subscribers live on
+// the server's event loop, which writes to them as their sockets become
+// writable.
+//
+// Create channels with Server::CreateEventChannel.
+class EventChannel : public std::enable_shared_from_this<EventChannel> {
+ public:
+  EventChannel(EventLoop* loop, EventChannelOptions options);
+
+  EventChannel(const EventChannel&) = delete;
+  EventChannel& operator=(const EventChannel&) = delete;
+
+  // Sends an event to every subscriber and returns its id. Safe to call
+  // from any thread.
+  uint64_t Publish(std::string_view data, std::string_view event = "");
+
+  // Takes over a connection whose request has been read, and starts the
+  // stream on it. Events after `last_event_id`, the client's Last-Event-ID
+  // header, are replayed if they are still in the backlog; otherwise the
+  // stream starts with the next event.
+  void Subscribe(Socket socket, std::optional<uint64_t> last_event_id);
+
+  // The number of connected subscribers.
+  size_t Subscribers() const {
+    return subscriber_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Subscriber {
+    Socket socket;
+    // The next event to write, and how much of it has been written.
+    uint64_t next;
+    size_t offset = 0;
+    // The rest of the response head, written before any event.
+    std::string_view head;
+    // Whether the loop is watching for EPOLLOUT.
+    bool want_write = false;
+  };
+
+  // Adds a subscriber on the loop thread.
+  void Add(std::shared_ptr<Subscriber> subscriber);
+
+  // Writes what the subscriber hasn't received yet, until the socket would
+  // block. Returns false if it should be disconnected.
+  bool Write(Subscriber& subscriber);
+
+  void Remove(int fd);
+
+  // Writes newly published events to subscribers that were caught up.
+  void Wake();
+
+  EventLoop* loop_;
+  EventChannelOptions options_;
+
+  mutable absl::Mutex mutex_;
+  // Event `id` is at ring_[id % ring_.size()] while it's in the backlog.
+  std::vector<std::shared_ptr<const std::string>> ring_
+      ABSL_GUARDED_BY(mutex_);
+  // The id of the next event to be published. Ids start at 1.
+  uint64_t next_id_ ABSL_GUARDED_BY(mutex_) = 1;
+
+  // Set while a Wake is queued on the loop, so bursts of events share one.
+  std::atomic<bool> wake_pending_ {false};
+
+  // Only touched on the loop thread.
+  absl::flat_hash_map<int, std::shared_ptr<Subscriber>> subscribers_;
+  std::atomic<size_t> subscriber_count_ {0};
+};
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,207 @@
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+#include "event_loop.h"
+#include "event_stream.h"
+#include "socket.h"
+
+using namespace cppserver;
+
+namespace {
+
+constexpr std::string_view kHead =
+    "HTTP/1.1 200 OK\r\n"
+    "Server: cppserver\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "X-Accel-Buffering: no\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+EventChannelOptions Backlog(size_t backlog) {
+  EventChannelOptions options;
+  options.backlog = backlog;
+  return options;
+}
+
+// Runs an event loop on its own thread for the length of a test.
+class LoopThread {
+ public:
+  LoopThread() : thread_([this] { loop_.Run(); }) {}
+
+  ~LoopThread() {
+    // Posted, so it can't come before Run starts.
+    loop_.Post([this] { loop_.Stop(); });
+    thread_.join();
+  }
+
+  EventLoop* loop() { return &loop_; }
+
+ private:
+  EventLoop loop_;
+  std::thread thread_;
+};
+
+// Subscribes one end of a socket pair to `channel`, returning the other.
+Socket Subscribe(EventChannel& channel, std::optional<uint64_t> last_event_id,
+                 int buffer_size = 0) {
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  struct timeval timeout = {5, 0};
+  setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (buffer_size > 0) {
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer_size,
+               sizeof(buffer_size));
+  }
+  channel.Subscribe(Socket::FromFD(fds[0]), last_event_id);
+  return Socket::FromFD(fds[1]);
+}
+
+// Reads `size` bytes from `client`, or what arrives before it times out or
+// is closed.
+std::string Read(Socket& client, size_t size) {
+  std::string received(size, '\0');
+  size_t done = 0;
+  while (done < size) {
+    ssize_t result = client.Receive(received.data() + done, size - done);
+    if (result <= 0) {
+      break;
+    }
+    done += result;
+  }
+  received.resize(done);
+  return received;
+}
+
+// Reads until the server closes its end, returning whether it did.
+bool ReadToEnd(Socket& client) {
+  char buffer[64 * 1024];
+  ssize_t result;
+  while ((result = client.Receive(buffer, sizeof(buffer))) > 0) {
+  }
+  return result == 0;
+}
+
+// Waits for the loop thread to catch up with the channel's subscribers.
+bool WaitForSubscribers(const EventChannel& channel, size_t count) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (channel.Subscribers() != count) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(EventStreamTests, FormatsEvents) {
+  EXPECT_EQ(FormatServerSentEvent(7, "", "hello"), "id: 7\ndata: hello\n\n");
+  EXPECT_EQ(FormatServerSentEvent(8, "alert", "disk full"),
+            "id: 8\nevent: alert\ndata: disk full\n\n");
+}
+
+TEST(EventStreamTests, SplitsMultilineData) {
+  EXPECT_EQ(FormatServerSentEvent(1, "", "one\r\ntwo\n\nfour"),
+            "id: 1\ndata: one\ndata: two\ndata: \ndata: four\n\n");
+  EXPECT_EQ(FormatServerSentEvent(2, "", ""), "id: 2\ndata: \n\n");
+  EXPECT_EQ(FormatServerSentEvent(3, "", "a\rb\r\r\nc"),
+            "id: 3\ndata: a\ndata: b\ndata: \ndata: c\n\n");
+}
+
+TEST(EventStreamTests, KeepsEventNamesOnOneLine) {
+  EXPECT_EQ(FormatServerSentEvent(1, "alert\ndata: forged\r", "x"),
+            "id: 1\nevent: alertdata: forged\ndata: x\n\n");
+}
+
+TEST(EventStreamTests, NumbersEventsInOrder) {
+  EventLoop loop;
+  auto channel = std::make_shared<EventChannel>(&loop, Backlog(2));
+  EXPECT_EQ(channel->Publish("a"), 1);
+  EXPECT_EQ(channel->Publish("b"), 2);
+  EXPECT_EQ(channel->Publish("c"), 3);
+  EXPECT_EQ(channel->Subscribers(), 0);
+}
+
+TEST(EventStreamTests, StreamsPublishedEvents) {
+  LoopThread loop;
+  auto channel = std::make_shared<EventChannel>(loop.loop(),
+                                                EventChannelOptions{});
+  channel->Publish("before");
+  Socket client = Subscribe(*channel, std::nullopt);
+  ASSERT_TRUE(WaitForSubscribers(*channel, 1));
+  channel->Publish("a");
+  channel->Publish("b", "update");
+
+  std::string expected = absl::StrCat(
+      kHead, FormatServerSentEvent(2, "", "a"),
+      FormatServerSentEvent(3, "update", "b"));
+  EXPECT_EQ(Read(client, expected.size()), expected);
+
+  client.Close();
+  EXPECT_TRUE(WaitForSubscribers(*channel, 0));
+}
+
+TEST(EventStreamTests, ReplaysFromLastEventId) {
+  LoopThread loop;
+  auto channel = std::make_shared<EventChannel>(loop.loop(), Backlog(3));
+  for (int i = 1; i <= 5; ++i) {
+    channel->Publish(absl::StrCat(i));
+  }
+
+  // Within the backlog, the events after the last one seen.
+  Socket resumed = Subscribe(*channel, 3);
+  std::string expected = absl::StrCat(kHead, FormatServerSentEvent(4, "", "4"),
+                                      FormatServerSentEvent(5, "", "5"));
+  EXPECT_EQ(Read(resumed, expected.size()), expected);
+
+  // Beyond it, from the oldest event kept.
+  Socket behind = Subscribe(*channel, 1);
+  expected = absl::StrCat(kHead, FormatServerSentEvent(3, "", "3"),
+                          FormatServerSentEvent(4, "", "4"),
+                          FormatServerSentEvent(5, "", "5"));
+  EXPECT_EQ(Read(behind, expected.size()), expected);
+}
+
+TEST(EventStreamTests, WritesWhatDoesntFitLater) {
+  LoopThread loop;
+  auto channel = std::make_shared<EventChannel>(loop.loop(),
+                                                EventChannelOptions{});
+  Socket client = Subscribe(*channel, std::nullopt, 4096);
+  ASSERT_TRUE(WaitForSubscribers(*channel, 1));
+
+  // Far more than the socket holds, so most is written in pieces as the
+  // client reads.
+  std::string expected(kHead);
+  for (int i = 0; i < 100; ++i) {
+    std::string data(10000, 'a' + i % 26);
+    uint64_t id = channel->Publish(data);
+    expected += FormatServerSentEvent(id, "", data);
+  }
+  EXPECT_EQ(Read(client, expected.size()), expected);
+  EXPECT_EQ(channel->Subscribers(), 1);
+}
+
+TEST(EventStreamTests, DisconnectsSubscribersThatFallBehind) {
+  LoopThread loop;
+  auto channel = std::make_shared<EventChannel>(loop.loop(), Backlog(4));
+  Socket slow = Subscribe(*channel, std::nullopt, 4096);
+  ASSERT_TRUE(WaitForSubscribers(*channel, 1));
+
+  // The subscriber doesn't read while the ring wraps past it.
+  for (int i = 0; i < 64; ++i) {
+    channel->Publish(std::string(10000, 'x'));
+  }
+  EXPECT_TRUE(ReadToEnd(slow));
+  EXPECT_TRUE(WaitForSubscribers(*channel, 0));
+}
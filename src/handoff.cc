@@ -0,0 +1,176 @@
+// Copyright 2022 Daniel Liu
+
+#include "handoff.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+namespace cppserver {
+
+namespace {
+
+// Where systemd puts the first passed descriptor.
+constexpr int kListenFdsStart = 3;
+
+// How long a replacement waits for the running server to answer.
+constexpr int kHandoffTimeoutSeconds = 5;
+
+absl::Status ErrnoError(std::string_view operation) {
+  return absl::InternalError(
+      absl::StrCat(operation, " failed: ", std::strerror(errno)));
+}
+
+// Fills `addr` with `path`, returning false if it's too long.
+bool UnixAddress(const std::string& path, struct sockaddr_un* addr) {
+  std::memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  std::memcpy(addr->sun_path, path.data(), path.size());
+  return true;
+}
+
+}  // namespace
+
+std::optional<int> InheritedListener() {
+  const char* pid = std::getenv("LISTEN_PID");
+  const char* fds = std::getenv("LISTEN_FDS");
+  pid_t listen_pid;
+  int listen_fds;
+  bool ours = pid && fds && absl::SimpleAtoi(pid, &listen_pid)
+      && listen_pid == getpid() && absl::SimpleAtoi(fds, &listen_fds)
+      && listen_fds >= 1;
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+  if (!ours) {
+    return std::nullopt;
+  }
+  fcntl(kListenFdsStart, F_SETFD, FD_CLOEXEC);
+  return kListenFdsStart;
+}
+
+absl::StatusOr<int> ListenForHandoff(const std::string& path) {
+  struct sockaddr_un addr;
+  if (!UnixAddress(path, &addr)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid handoff socket path: ", path));
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return ErrnoError("socket");
+  }
+  // A socket file left behind by an earlier server, or the one that handed
+  // off to this one, is replaced.
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0
+      || listen(fd, 1) < 0) {
+    auto status = ErrnoError("bind");
+    close(fd);
+    return status;
+  }
+  return fd;
+}
+
+absl::Status HandOff(int handoff_fd, int listener) {
+  int channel = accept4(handoff_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (channel < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+      return absl::UnavailableError("No replacement is waiting");
+    }
+    return ErrnoError("accept");
+  }
+  auto status = SendFD(channel, listener);
+  close(channel);
+  return status;
+}
+
+absl::StatusOr<int> RequestListener(const std::string& path) {
+  struct sockaddr_un addr;
+  if (!UnixAddress(path, &addr)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid handoff socket path: ", path));
+  }
+  int channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (channel < 0) {
+    return ErrnoError("socket");
+  }
+  if (connect(channel, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) < 0) {
+    int error = errno;
+    close(channel);
+    if (error == ENOENT || error == ECONNREFUSED) {
+      return absl::NotFoundError(
+          absl::StrCat("No server is listening at ", path));
+    }
+    errno = error;
+    return ErrnoError("connect");
+  }
+  struct timeval timeout = {kHandoffTimeoutSeconds, 0};
+  setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  auto fd = ReceiveFD(channel);
+  close(channel);
+  return fd;
+}
+
+absl::Status SendFD(int channel, int fd) {
+  char byte = 'L';
+  struct iovec iov = {&byte, 1};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  struct msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+  if (sendmsg(channel, &message, MSG_NOSIGNAL) < 0) {
+    return ErrnoError("sendmsg");
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> ReceiveFD(int channel) {
+  char byte;
+  struct iovec iov = {&byte, 1};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  struct msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t received = recvmsg(channel, &message, MSG_CMSG_CLOEXEC);
+  if (received < 0) {
+    return ErrnoError("recvmsg");
+  }
+  struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+  if (received == 0 || !header || header->cmsg_level != SOL_SOCKET
+      || header->cmsg_type != SCM_RIGHTS
+      || header->cmsg_len != CMSG_LEN(sizeof(int))) {
+    return absl::UnavailableError("No descriptor was received");
+  }
+  int fd;
+  std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+  return fd;
+}
+
+}  // namespace cppserver
@@ -0,0 +1,45 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_HANDOFF_H_
+#define _CPPSERVER_HANDOFF_H_
+
+#include <optional>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace cppserver {
+
+// Passing a listening socket from a running server to its replacement, so
+// the socket, and the connections queued on it, are never closed during a
+// restart. The running server listens on a Unix socket at a known path; the
+// replacement connects to it and receives the listening socket's descriptor
+// (SCM_RIGHTS), after which the old server stops accepting.
+
+// The listening socket passed by systemd-style socket activation
+// (LISTEN_PID and LISTEN_FDS), if there is one. The variables are cleared,
+// so child processes don't take the socket for theirs.
+std::optional<int> InheritedListener();
+
+// Starts listening for replacements at `path`, replacing any socket file
+// already there. Returns the nonblocking listening descriptor.
+absl::StatusOr<int> ListenForHandoff(const std::string& path);
+
+// Accepts a replacement on `handoff_fd` and sends it `listener`. Returns
+// Unavailable if no replacement is waiting.
+absl::Status HandOff(int handoff_fd, int listener);
+
+// Asks the server listening for replacements at `path` for its listening
+// socket. Returns NotFound if no server is there.
+absl::StatusOr<int> RequestListener(const std::string& path);
+
+// Sends `fd` over the connected Unix socket `channel`.
+absl::Status SendFD(int channel, int fd);
+
+// Receives a descriptor sent with SendFD.
+absl::StatusOr<int> ReceiveFD(int channel);
+
+}  // namespace cppserver
+
+#endif
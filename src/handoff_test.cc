@@ -0,0 +1,88 @@
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+#include "handoff.h"
+
+using namespace cppserver;
+
+namespace {
+
+// Whether `a` and `b` refer to the same open file.
+bool SameFile(int a, int b) {
+  struct stat a_stat, b_stat;
+  return fstat(a, &a_stat) == 0 && fstat(b, &b_stat) == 0
+      && a_stat.st_dev == b_stat.st_dev && a_stat.st_ino == b_stat.st_ino;
+}
+
+}  // namespace
+
+TEST(HandoffTests, SendsDescriptors) {
+  int channel[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, channel), 0);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_TRUE(SendFD(channel[0], listener).ok());
+  auto received = ReceiveFD(channel[1]);
+  ASSERT_TRUE(received.ok()) << received.status();
+  EXPECT_NE(*received, listener);
+  EXPECT_TRUE(SameFile(*received, listener));
+
+  // Closing the channel without sending one is an error, not a hang.
+  close(channel[0]);
+  EXPECT_FALSE(ReceiveFD(channel[1]).ok());
+  close(channel[1]);
+  close(*received);
+  close(listener);
+}
+
+TEST(HandoffTests, HandsOffToAReplacement) {
+  std::string path = absl::StrCat(testing::TempDir(), "/handoff", getpid());
+  EXPECT_TRUE(absl::IsNotFound(RequestListener(path).status()));
+
+  auto handoff = ListenForHandoff(path);
+  ASSERT_TRUE(handoff.ok()) << handoff.status();
+  EXPECT_TRUE(absl::IsUnavailable(HandOff(*handoff, 0)));
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  std::thread replacement([&] {
+    auto received = RequestListener(path);
+    ASSERT_TRUE(received.ok()) << received.status();
+    EXPECT_TRUE(SameFile(*received, listener));
+    close(*received);
+  });
+  absl::Status status;
+  do {
+    status = HandOff(*handoff, listener);
+  } while (absl::IsUnavailable(status));
+  EXPECT_TRUE(status.ok()) << status;
+  replacement.join();
+
+  // The replacement then takes over the path.
+  auto next = ListenForHandoff(path);
+  ASSERT_TRUE(next.ok()) << next.status();
+  close(*handoff);
+  close(*next);
+  close(listener);
+  unlink(path.c_str());
+}
+
+TEST(HandoffTests, OnlyInheritsListenersForThisProcess) {
+  setenv("LISTEN_PID", "1", 1);
+  setenv("LISTEN_FDS", "1", 1);
+  EXPECT_FALSE(InheritedListener());
+  EXPECT_EQ(getenv("LISTEN_FDS"), nullptr);
+
+  setenv("LISTEN_PID", std::to_string(getpid()).c_str(), 1);
+  setenv("LISTEN_FDS", "1", 1);
+  EXPECT_EQ(InheritedListener(), 3);
+  EXPECT_FALSE(InheritedListener());
+}
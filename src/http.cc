@@ -2,18 +2,47 @@
 
 #include "http.h"
 
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
 #include <optional>
+#include <random>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/log/log.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
 #include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
 
+#include "compression.h"
+#include "http_date.h"
+#include "logging.h"
+#include "socket.h"
 #include "template.h"
+#include "url.h"
 
 namespace cppserver {
 
@@ -58,120 +87,582 @@ std::optional<int> DetermineRemainingHTTPContentLength(const std::string& msg) {
   return {};
 }
 
-std::optional<HTTPRequest> ParseHTTPRequest(const std::string& msg) {
-  std::vector<std::string> lines = absl::StrSplit(msg, "\n");
+std::optional<HTTPRequest> ParseHTTPRequest(
+    std::string_view msg, std::pmr::memory_resource* resource) {
+  // Lines are viewed in place rather than split into strings, so the only
+  // allocations are the request's own fields.
+  auto next_line = [&msg]() -> std::optional<std::string_view> {
+    if (msg.empty()) {
+      return {};
+    }
+    size_t end = msg.find('\n');
+    std::string_view line = msg.substr(0, end);
+    msg.remove_prefix(end == std::string_view::npos ? msg.size() : end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    return line;
+  };
 
-  if (size(lines) < 1) {
+  auto request_line = next_line();
+  if (!request_line) {
     return {};
   }
-
-  std::vector<std::string> request_line = absl::StrSplit(lines[0], " ");
-  if (size(request_line) != 3) {
+  size_t first_space = request_line->find(' ');
+  size_t second_space = request_line->find(' ', first_space + 1);
+  if (first_space == std::string_view::npos
+      || second_space == std::string_view::npos
+      || request_line->find(' ', second_space + 1) != std::string_view::npos) {
     return {};
   }
 
-  HTTPRequest request;
-  request.method = request_line[0];
-  request.target = request_line[1];
-  request.version = request_line[2];
+  HTTPRequest request(resource);
+  request.method = request_line->substr(0, first_space);
+  request.target = request_line->substr(
+      first_space + 1, second_space - first_space - 1);
+  request.version = request_line->substr(second_space + 1);
 
-  // Parse headers
-  bool past_headers = false;
-  for (int i = 1; i < size(lines); ++i) {
-    auto line = lines[i];
+  // Parse headers, up to the blank line before the body.
+  while (auto line = next_line()) {
+    if (line->empty()) {
+      request.body = msg;
+      break;
+    }
+    size_t colon = line->find(':');
+    if (colon == 0 || colon == std::string_view::npos) {
+      return {};
+    }
+    request.headers.emplace_back(
+        line->substr(0, colon),
+        absl::StripAsciiWhitespace(line->substr(colon + 1)));
+  }
 
-    if (line == "\r") {
-      past_headers = true;
+  return request;
+}
+
+std::optional<std::vector<ByteRange>> ParseRangeHeader(std::string_view header,
+                                                       off_t size) {
+  header = absl::StripAsciiWhitespace(header);
+  if (!absl::StartsWith(header, "bytes=")) {
+    return {};
+  }
+  header.remove_prefix(sizeof("bytes=") - 1);
+
+  std::vector<ByteRange> ranges;
+  bool found_spec = false;
+  for (std::string_view spec : absl::StrSplit(header, ',')) {
+    spec = absl::StripAsciiWhitespace(spec);
+    if (spec.empty()) {
       continue;
     }
+    found_spec = true;
 
-    if (!past_headers) {
-      std::vector<std::string> parts = absl::StrSplit(line, ": ");
-      if (parts.size() != 2) {
+    size_t dash = spec.find('-');
+    if (dash == std::string_view::npos) {
+      return {};
+    }
+    std::string_view first_str = spec.substr(0, dash);
+    std::string_view last_str = spec.substr(dash + 1);
+
+    int64_t first;
+    int64_t last;
+    if (first_str.empty()) {
+      // "-N" means the last N bytes.
+      int64_t suffix_length;
+      if (!absl::SimpleAtoi(last_str, &suffix_length) || suffix_length < 0) {
+        return {};
+      }
+      if (suffix_length == 0 || size == 0) {
+        continue;
+      }
+      first = std::max<int64_t>(0, size - suffix_length);
+      last = size - 1;
+    } else {
+      if (!absl::SimpleAtoi(first_str, &first) || first < 0) {
+        return {};
+      }
+      if (last_str.empty()) {
+        last = size - 1;
+      } else if (!absl::SimpleAtoi(last_str, &last) || last < first) {
         return {};
       }
+      if (first >= size) {
+        continue;
+      }
+      last = std::min<int64_t>(last, size - 1);
+    }
+    ranges.push_back({first, last - first + 1});
+  }
+  if (!found_spec) {
+    return {};
+  }
 
-      request.headers.emplace_back(parts[0], parts[1]);
+  // Merge overlapping and adjacent ranges so clients can't make us send the
+  // same bytes many times over.
+  std::sort(ranges.begin(), ranges.end(),
+            [](const ByteRange& a, const ByteRange& b) {
+              return a.offset < b.offset;
+            });
+  std::vector<ByteRange> merged;
+  for (const auto& range : ranges) {
+    if (!merged.empty()
+        && range.offset <= merged.back().offset + merged.back().length) {
+      off_t end = std::max(merged.back().offset + merged.back().length,
+                           range.offset + range.length);
+      merged.back().length = end - merged.back().offset;
     } else {
-      request.body += line;
-      if (i != size(lines) - 1) {
-        request.body += "\n";
+      merged.push_back(range);
+    }
+  }
+  return merged;
+}
+
+std::optional<std::string_view> HTTPRequest::GetHeader(
+    std::string_view key) const {
+  for (const auto& [header_key, value] : headers) {
+    if (absl::EqualsIgnoreCase(header_key, key)) {
+      return value;
+    }
+  }
+  return {};
+}
+
+std::string_view HTTPRequest::Path() const {
+  std::string_view path = target;
+  return path.substr(0, path.find_first_of("?#"));
+}
+
+std::string_view HTTPRequest::RawQuery() const {
+  std::string_view query = target;
+  size_t question = query.find('?');
+  if (question == std::string_view::npos) {
+    return {};
+  }
+  query.remove_prefix(question + 1);
+  return query.substr(0, query.find('#'));
+}
+
+const UrlParams& HTTPRequest::Query() const {
+  return query_.Get(RawQuery());
+}
+
+const UrlParams& HTTPRequest::Form() const {
+  std::string_view content_type = GetHeader("Content-Type").value_or("");
+  content_type = content_type.substr(0, content_type.find(';'));
+  if (!absl::EqualsIgnoreCase(absl::StripAsciiWhitespace(content_type),
+                              "application/x-www-form-urlencoded")) {
+    return form_.Get({});
+  }
+  return form_.Get(body);
+}
+
+namespace {
+
+struct HTTPStatus {
+  int code;
+  std::string_view status_line;
+};
+
+#define CPPSERVER_HTTP_STATUS(code, reason) \
+  {code, "HTTP/1.1 " #code " " reason "\r\n"}
+
+constexpr HTTPStatus kHTTPStatuses[] = {
+  CPPSERVER_HTTP_STATUS(101, "Switching Protocols"),
+  CPPSERVER_HTTP_STATUS(200, "OK"),
+  CPPSERVER_HTTP_STATUS(201, "Created"),
+  CPPSERVER_HTTP_STATUS(202, "Accepted"),
+  CPPSERVER_HTTP_STATUS(204, "No Content"),
+  CPPSERVER_HTTP_STATUS(206, "Partial Content"),
+  CPPSERVER_HTTP_STATUS(304, "Not Modified"),
+  CPPSERVER_HTTP_STATUS(400, "Bad Request"),
+  CPPSERVER_HTTP_STATUS(401, "Unauthorized"),
+  CPPSERVER_HTTP_STATUS(403, "Forbidden"),
+  CPPSERVER_HTTP_STATUS(404, "Not Found"),
+  CPPSERVER_HTTP_STATUS(405, "Method Not Allowed"),
+  CPPSERVER_HTTP_STATUS(416, "Range Not Satisfiable"),
+  CPPSERVER_HTTP_STATUS(413, "Content Too Large"),
+  CPPSERVER_HTTP_STATUS(418, "I'm a teapot"),
+  CPPSERVER_HTTP_STATUS(426, "Upgrade Required"),
+  CPPSERVER_HTTP_STATUS(429, "Too Many Requests"),
+  CPPSERVER_HTTP_STATUS(451, "Unavailable For Legal Reasons"),
+  CPPSERVER_HTTP_STATUS(500, "Internal Server Error"),
+  CPPSERVER_HTTP_STATUS(503, "Service Unavailable"),
+};
+
+#undef CPPSERVER_HTTP_STATUS
+
+constexpr std::string_view kCommonHeaderLines[] = {
+  "Content-Type: text/html; charset=utf-8\r\n",
+  "Content-Type: text/plain; charset=utf-8\r\n",
+  "Content-Type: text/css; charset=utf-8\r\n",
+  "Content-Type: text/javascript; charset=utf-8\r\n",
+  "Content-Type: application/json\r\n",
+  "Content-Type: application/octet-stream\r\n",
+  "Connection: close\r\n",
+  "Connection: keep-alive\r\n",
+  "Content-Encoding: gzip\r\n",
+  "Content-Encoding: deflate\r\n",
+  "Content-Encoding: br\r\n",
+  "Vary: Accept-Encoding\r\n",
+  "Accept-Ranges: bytes\r\n",
+};
+
+constexpr std::string_view kContentTypePrefix = "Content-Type: ";
+
+constexpr std::string_view kServerHeaderLine = "Server: cppserver\r\n";
+constexpr size_t kDateHeaderLineSize = sizeof("Date: \r\n") - 1 + kHTTPDateSize;
+
+constexpr std::string_view kHeaderSeparator = ": ";
+constexpr std::string_view kCRLF = "\r\n";
+constexpr std::string_view kContentLength = "Content-Length: ";
+
+// Longest possible status line for codes missing from kHTTPStatuses.
+constexpr size_t kMaxUnknownStatusLineSize = sizeof("HTTP/1.1 -2147483648 Unknown\r\n");
+
+char* Append(char* out, std::string_view str) {
+  std::memcpy(out, str.data(), str.size());
+  return out + str.size();
+}
+
+// Validators for a file, cached until the file changes on disk.
+struct FileValidators {
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  struct timespec mtime;
+
+  // Quoted strong entity tag, derived from the file's size and contents.
+  std::string etag;
+};
+
+absl::Mutex file_validators_mutex;
+std::unordered_map<std::string, FileValidators> file_validators
+    ABSL_GUARDED_BY(file_validators_mutex);
+
+bool IsSameFile(const FileValidators& validators, const struct stat& st) {
+  return validators.device == st.st_dev && validators.inode == st.st_ino
+      && validators.size == st.st_size
+      && validators.mtime.tv_sec == st.st_mtim.tv_sec
+      && validators.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+// Returns the validators for the file at `path`, hashing it only if it
+// changed since it was last seen.
+std::optional<FileValidators> GetFileValidators(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return {};
+  }
+
+  {
+    absl::ReaderMutexLock lock(&file_validators_mutex);
+    auto it = file_validators.find(path);
+    if (it != file_validators.end() && IsSameFile(it->second, st)) {
+      return it->second;
+    }
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return {};
+  }
+  uLong crc = crc32(0, nullptr, 0);
+  char buffer[64 * 1024];
+  while (file) {
+    file.read(buffer, sizeof(buffer));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer), file.gcount());
+  }
+
+  FileValidators validators {st.st_dev, st.st_ino, st.st_size, st.st_mtim,
+      absl::StrFormat("\"%x-%08x\"", st.st_size, crc)};
+  absl::MutexLock lock(&file_validators_mutex);
+  file_validators[path] = validators;
+  return validators;
+}
+
+// Encodings HTTPResponse::Compress may apply to a response.
+constexpr ContentEncoding kOnTheFlyEncodings[] = {
+  ContentEncoding::kBrotli, ContentEncoding::kGzip, ContentEncoding::kDeflate,
+};
+
+// Returns the ETag of the representation `etag` describes once compressed
+// on the fly with `encoding`, e.g. "1f-8a2b3c4d-gzip" for "1f-8a2b3c4d".
+std::string EncodedETag(std::string_view etag, ContentEncoding encoding) {
+  if (!absl::EndsWith(etag, "\"")) {
+    return std::string(etag);
+  }
+  etag.remove_suffix(1);
+  return absl::StrCat(etag, "-", ContentEncodingName(encoding), "\"");
+}
+
+// Returns the ETag of the copy an If-None-Match header shows the client
+// has: `etag`, or one of its variants compressed on the fly, using weak
+// comparison. Returns nothing if the client has neither.
+std::optional<std::string> MatchIfNoneMatch(std::string_view if_none_match,
+                                            std::string_view etag) {
+  auto strip_weak = [](std::string_view tag) {
+    tag = absl::StripAsciiWhitespace(tag);
+    if (absl::StartsWith(tag, "W/")) {
+      tag.remove_prefix(2);
+    }
+    return tag;
+  };
+  std::string_view opaque = strip_weak(etag);
+  for (std::string_view candidate : absl::StrSplit(if_none_match, ',')) {
+    candidate = absl::StripAsciiWhitespace(candidate);
+    if (candidate == "*" || strip_weak(candidate) == opaque) {
+      return std::string(etag);
+    }
+    for (auto encoding : kOnTheFlyEncodings) {
+      if (strip_weak(candidate) == EncodedETag(opaque, encoding)) {
+        return EncodedETag(etag, encoding);
       }
     }
   }
+  return {};
+}
+
+// If the client's cached copy, described by the request's conditional
+// headers, is still fresh, returns that copy's ETag (see MatchIfNoneMatch).
+std::optional<std::string> IsNotModified(const HTTPRequest& request,
+                                         std::string_view etag,
+                                         std::optional<time_t> last_modified) {
+  if (request.method != "GET" && request.method != "HEAD") {
+    return {};
+  }
+  // If-None-Match takes precedence over If-Modified-Since.
+  if (auto if_none_match = request.GetHeader("If-None-Match")) {
+    return MatchIfNoneMatch(*if_none_match, etag);
+  }
+  if (auto if_modified_since = request.GetHeader("If-Modified-Since")) {
+    auto since = ParseHTTPDate(*if_modified_since);
+    if (since && last_modified && *last_modified <= *since) {
+      return std::string(etag);
+    }
+  }
+  return {};
+}
 
-  return request;
+// Returns true if a Range header should be honored given the request's
+// If-Range, which must match the current representation exactly. Ranges are
+// only served uncompressed, so tags of compressed variants never match.
+bool IfRangeMatches(const HTTPRequest& request,
+                    const FileValidators& validators) {
+  auto if_range = request.GetHeader("If-Range");
+  if (!if_range) {
+    return true;
+  }
+  std::string_view value = absl::StripAsciiWhitespace(*if_range);
+  if (absl::StartsWith(value, "\"")) {
+    return value == validators.etag;
+  }
+  if (absl::StartsWith(value, "W/")) {
+    // Weak tags never match for ranges.
+    return false;
+  }
+  auto date = ParseHTTPDate(value);
+  return date && *date == validators.mtime.tv_sec;
 }
 
-HTTPResponse::HTTPResponse(int status_code)
-    : version_{"HTTP/1.1"},
-      status_code_{status_code} {
-  switch (status_code) {
-    case 200:
-      status_message_ = "OK";
-      break;
-    case 201:
-      status_message_ = "Created";
-      break;
-    case 202:
-      status_message_ = "Accepted";
-      break;
-    case 204:
-      status_message_ = "No Content";
-      break;
-    case 400:
-      status_message_ = "Bad Request";
-      break;
-    case 401:
-      status_message_ = "Unauthorized";
-      break;
-    case 403:
-      status_message_ = "Forbidden";
-      break;
-    case 404:
-      status_message_ = "Not Found";
-      break;
-    case 418:
-      status_message_ = "I'm a teapot";
-      break;
-    case 451:
-      status_message_ = "Unavailable For Legal Reasons";
-      break;
-    case 500:
-      status_message_ = "Internal Server Error";
-      break;
-    default:
-      status_message_ = "Unknown";
+std::string NewMultipartBoundary() {
+  thread_local std::mt19937_64 generator {std::random_device{}()};
+  return absl::StrFormat("cppserver-%016x", generator());
+}
+
+}  // namespace
+
+std::string_view CommonHeaderLine(CommonHeader header) {
+  return kCommonHeaderLines[static_cast<size_t>(header)];
+}
+
+HTTPResponse::HTTPResponse(int status_code) {
+  SetStatus(status_code);
+}
+
+void HTTPResponse::SetStatus(int status_code) {
+  status_code_ = status_code;
+  status_line_ = {};
+  for (const auto& status : kHTTPStatuses) {
+    if (status.code == status_code) {
+      status_line_ = status.status_line;
       break;
+    }
   }
 }
 
 void HTTPResponse::LoadBodyFromFile(const std::string& path) {
   std::filesystem::path file_path = HTTPResponse::kserver_path_ + path;
-  LOG(INFO) << "Loading file " << file_path;
+  CPPSERVER_LOG(INFO) << "Loading file " << file_path;
 
   if (!std::filesystem::exists(file_path)) {
     LOG(WARNING) << "File not found!";
-    status_code_ = 404;
-    status_message_ = "Not Found";
+    SetStatus(404);
   }
 
   std::ifstream file(file_path);
   std::string content((std::istreambuf_iterator<char>(file)),
                       std::istreambuf_iterator<char>());
-  body_ = content;
+  body_ = std::move(content);
+}
+
+void HTTPResponse::LoadBodyFromFile(const std::string& path,
+                                    const HTTPRequest& request) {
+  std::string selected_path = path;
+  ContentEncoding encoding = ContentEncoding::kIdentity;
+
+  auto accept_encoding = request.GetHeader("Accept-Encoding");
+  if (accept_encoding && std::filesystem::exists(kserver_path_ + path)) {
+    // Serving precompressed files doesn't need brotli support in this build.
+    std::vector<ContentEncoding> available;
+    for (auto candidate : {ContentEncoding::kBrotli, ContentEncoding::kGzip}) {
+      if (std::filesystem::exists(
+              kserver_path_ + path + std::string(ContentEncodingExtension(candidate)))) {
+        available.push_back(candidate);
+      }
+    }
+    encoding = NegotiateContentEncoding(*accept_encoding, available);
+    selected_path += ContentEncodingExtension(encoding);
+  }
+
+  // Each variant has its own contents, and therefore its own ETag.
+  std::string file_path = kserver_path_ + selected_path;
+  auto validators = GetFileValidators(file_path);
+  if (validators) {
+    char last_modified[kHTTPDateSize];
+    FormatHTTPDate(validators->mtime.tv_sec, last_modified);
+    auto cached_etag = IsNotModified(request, validators->etag,
+                                     validators->mtime.tv_sec);
+    // A client revalidating a copy compressed on the fly is told that copy
+    // is still good, under its own ETag.
+    bool cached_compressed = cached_etag && *cached_etag != validators->etag;
+    AddHeader("ETag", cached_etag ? *cached_etag : validators->etag);
+    AddHeader("Last-Modified", std::string(last_modified, kHTTPDateSize));
+    if (cached_compressed) {
+      AddHeader(CommonHeader::kVaryAcceptEncoding);
+    } else {
+      AddHeader(CommonHeader::kAcceptRangesBytes);
+    }
+
+    if (cached_etag) {
+      SetStatus(304);
+      if (!cached_compressed) {
+        SetContentEncoding(encoding);
+      }
+      return;
+    }
+
+    std::optional<std::vector<ByteRange>> ranges;
+    auto range_header = request.GetHeader("Range");
+    if (range_header && request.method == "GET"
+        && IfRangeMatches(request, *validators)) {
+      ranges = ParseRangeHeader(*range_header, validators->size);
+    }
+
+    if (ranges && ranges->empty()) {
+      SetStatus(416);
+      AddHeader("Content-Range",
+                absl::StrFormat("bytes */%d", validators->size));
+      return;
+    }
+    if (ranges && size(*ranges) <= kmax_ranges_) {
+      SetStatus(206);
+      SetFileBody(file_path, validators->size, *ranges);
+      SetContentEncoding(encoding);
+      return;
+    }
+    if (validators->size >= kmin_sendfile_size_) {
+      SetFileBody(file_path, validators->size, {{0, validators->size}});
+      SetContentEncoding(encoding);
+      return;
+    }
+  }
+
+  LoadBodyFromFile(selected_path);
+  SetContentEncoding(encoding);
+}
+
+HTTPResponse::FileBody::~FileBody() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void HTTPResponse::SetFileBody(const std::string& file_path, off_t size,
+                               const std::vector<ByteRange>& ranges) {
+  int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(WARNING) << "Failed to open " << file_path;
+    SetStatus(500);
+    return;
+  }
+  auto file_body = std::make_shared<FileBody>();
+  file_body->fd = fd;
+
+  if (ranges.size() == 1) {
+    file_body->segments.push_back({"", ranges[0]});
+    if (status_code_ == 206) {
+      AddHeader("Content-Range", absl::StrFormat(
+          "bytes %d-%d/%d", ranges[0].offset,
+          ranges[0].offset + ranges[0].length - 1, size));
+    }
+  } else {
+    std::string boundary = NewMultipartBoundary();
+    std::string content_type {ContentType()};
+    for (const auto& range : ranges) {
+      std::string prefix = absl::StrCat("\r\n--", boundary, "\r\n");
+      if (!content_type.empty()) {
+        absl::StrAppend(&prefix, "Content-Type: ", content_type, "\r\n");
+      }
+      absl::StrAppend(&prefix, absl::StrFormat(
+          "Content-Range: bytes %d-%d/%d\r\n\r\n", range.offset,
+          range.offset + range.length - 1, size));
+      file_body->segments.push_back({std::move(prefix), range});
+    }
+    file_body->suffix = absl::StrCat("\r\n--", boundary, "--\r\n");
+    ReplaceContentType("multipart/byteranges; boundary=" + boundary);
+  }
+
+  body_.clear();
+  file_body_ = std::move(file_body);
+}
+
+void HTTPResponse::ReplaceContentType(const std::string& content_type) {
+  size_t kept = 0;
+  for (size_t i = 0; i < num_common_headers_; ++i) {
+    if (!absl::StartsWith(common_headers_[i], kContentTypePrefix)) {
+      common_headers_[kept++] = common_headers_[i];
+    }
+  }
+  num_common_headers_ = kept;
+  headers_.erase(std::remove_if(headers_.begin(), headers_.end(),
+                                [](const auto& header) {
+                                  return absl::EqualsIgnoreCase(header.first,
+                                                                "Content-Type");
+                                }),
+                 headers_.end());
+  AddHeader("Content-Type", content_type);
+}
+
+size_t HTTPResponse::BodySize() const {
+  if (!file_body_) {
+    return size(body_);
+  }
+  size_t total = size(file_body_->suffix);
+  for (const auto& segment : file_body_->segments) {
+    total += size(segment.prefix) + segment.range.length;
+  }
+  return total;
 }
 
 void HTTPResponse::RenderTemplateFile(
     const std::string& path, 
     const std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY>& context) {
   std::filesystem::path file_path = HTTPResponse::kserver_path_ + path;
-  LOG(INFO) << "Loading template file " << file_path;
+  CPPSERVER_LOG(INFO) << "Loading template file " << file_path;
 
   if (!std::filesystem::exists(file_path)) {
     LOG(WARNING) << "File not found!";
-    status_code_ = 404;
-    status_message_ = "Not Found";
+    SetStatus(404);
   }
 
   std::ifstream file(file_path);
@@ -180,22 +671,279 @@ void HTTPResponse::RenderTemplateFile(
   auto rendered = templates::RenderTemplate(content, context);
   if (!rendered.ok()) {
     LOG(WARNING) << "Failed to render template!";
-    status_code_ = 500;
-    status_message_ = "Internal Server Error";
+    SetStatus(500);
   }
-  body_ = rendered.value();
+  body_ = std::move(rendered).value();
+}
+
+void HTTPResponse::AddHeader(CommonHeader header) {
+  if (num_common_headers_ == kmax_common_headers_) {
+    LOG(ERROR) << "Too many common headers; dropping "
+               << CommonHeaderLine(header);
+    return;
+  }
+  common_headers_[num_common_headers_++] = CommonHeaderLine(header);
+}
+
+void HTTPResponse::RemoveCommonHeader(CommonHeader header) {
+  std::string_view line = CommonHeaderLine(header);
+  auto end = std::remove(common_headers_.begin(),
+                         common_headers_.begin() + num_common_headers_, line);
+  num_common_headers_ = end - common_headers_.begin();
+}
+
+void HTTPResponse::SetContentEncoding(ContentEncoding encoding) {
+  content_encoding_ = encoding;
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      AddHeader(CommonHeader::kContentEncodingGzip);
+      break;
+    case ContentEncoding::kDeflate:
+      AddHeader(CommonHeader::kContentEncodingDeflate);
+      break;
+    case ContentEncoding::kBrotli:
+      AddHeader(CommonHeader::kContentEncodingBrotli);
+      break;
+    case ContentEncoding::kIdentity:
+      return;
+  }
+  AddHeader(CommonHeader::kVaryAcceptEncoding);
+}
+
+std::string_view HTTPResponse::ContentType() const {
+  for (size_t i = 0; i < num_common_headers_; ++i) {
+    std::string_view line = common_headers_[i];
+    if (absl::StartsWith(line, kContentTypePrefix)) {
+      line.remove_prefix(kContentTypePrefix.size());
+      line.remove_suffix(kCRLF.size());
+      return line;
+    }
+  }
+  for (const auto& [key, value] : headers_) {
+    if (absl::EqualsIgnoreCase(key, "Content-Type")) {
+      return value;
+    }
+  }
+  return {};
+}
+
+std::optional<std::string_view> HTTPResponse::GetHeader(
+    std::string_view key) const {
+  for (size_t i = 0; i < num_common_headers_; ++i) {
+    std::string_view line = common_headers_[i];
+    if (line.size() > key.size() && line[key.size()] == ':'
+        && absl::EqualsIgnoreCase(line.substr(0, key.size()), key)) {
+      line.remove_prefix(key.size() + 1);
+      line.remove_suffix(kCRLF.size());
+      return absl::StripLeadingAsciiWhitespace(line);
+    }
+  }
+  for (const auto& [header_key, value] : headers_) {
+    if (absl::EqualsIgnoreCase(header_key, key)) {
+      return value;
+    }
+  }
+  return {};
+}
+
+void HTTPResponse::Compress(const HTTPRequest& request,
+                            const CompressionPolicy& policy) {
+  // Bodiless responses, like a 304 for a compressed copy, are left alone.
+  if (content_encoding_ != ContentEncoding::kIdentity || file_body_
+      || body_.empty()
+      || !policy.ShouldCompress(ContentType(), size(body_))) {
+    return;
+  }
+
+  auto accept_encoding = request.GetHeader("Accept-Encoding");
+  std::vector<ContentEncoding> available;
+  if (IsContentEncodingSupported(ContentEncoding::kBrotli)) {
+    available.push_back(ContentEncoding::kBrotli);
+  }
+  available.push_back(ContentEncoding::kGzip);
+  available.push_back(ContentEncoding::kDeflate);
+  ContentEncoding encoding = NegotiateContentEncoding(
+      accept_encoding.value_or(""), available);
+  if (encoding == ContentEncoding::kIdentity) {
+    // Caches still need to know the response depends on Accept-Encoding.
+    AddHeader(CommonHeader::kVaryAcceptEncoding);
+    return;
+  }
+
+  auto compressed = cppserver::Compress(body_, encoding, policy);
+  if (!compressed.ok()) {
+    LOG(WARNING) << "Failed to compress response: " << compressed.status();
+    return;
+  }
+  body_ = std::move(compressed).value();
+  SetContentEncoding(encoding);
+  // The compressed body is a representation of its own, so it needs its own
+  // ETag, and ranges of it can't be served, since they're cut from the file.
+  for (auto& [key, value] : headers_) {
+    if (absl::EqualsIgnoreCase(key, "ETag")) {
+      value = EncodedETag(value, encoding);
+    }
+  }
+  RemoveCommonHeader(CommonHeader::kAcceptRangesBytes);
+}
+
+void HTTPResponse::RenderTemplateFile(
+    const std::string& path,
+    const std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY>& context,
+    const HTTPRequest& request) {
+  auto validators = GetFileValidators(kserver_path_ + path);
+  if (validators) {
+    // The rendered output depends on both the template and the context, and
+    // isn't byte-for-byte stable across template engine changes, hence weak.
+    std::string_view file_tag = validators->etag;
+    file_tag.remove_suffix(1);
+    std::string etag = absl::StrFormat("W/%s-%x\"", file_tag,
+                                       templates::HashTemplateContext(context));
+    auto cached_etag = IsNotModified(request, etag, {});
+    AddHeader("ETag", cached_etag ? *cached_etag : etag);
+
+    if (cached_etag) {
+      SetStatus(304);
+      return;
+    }
+  }
+
+  RenderTemplateFile(path, context);
+}
+
+size_t HTTPResponse::HeaderBlockSize(bool close_connection) const {
+  size_t size = status_line_.empty() ? kMaxUnknownStatusLineSize
+                                     : status_line_.size();
+  size += kServerHeaderLine.size() + kDateHeaderLineSize;
+  if (close_connection) {
+    size += CommonHeaderLine(CommonHeader::kConnectionClose).size();
+  }
+  for (size_t i = 0; i < num_common_headers_; ++i) {
+    size += common_headers_[i].size();
+  }
+  for (const auto& [key, value] : headers_) {
+    size += key.size() + kHeaderSeparator.size() + value.size() + kCRLF.size();
+  }
+  // Content-Length, its value (at most 20 digits) and the blank line.
+  size += kContentLength.size() + 20 + 2 * kCRLF.size();
+  return size;
+}
+
+size_t HTTPResponse::RenderHeaderBlock(char* out,
+                                       bool close_connection) const {
+  char* it = out;
+  if (!status_line_.empty()) {
+    it = Append(it, status_line_);
+  } else {
+    it += std::snprintf(it, kMaxUnknownStatusLineSize, "HTTP/1.1 %d Unknown\r\n",
+                        status_code_);
+  }
+  it = Append(it, kServerHeaderLine);
+  it = Append(it, CurrentDateHeader());
+  for (size_t i = 0; i < num_common_headers_; ++i) {
+    it = Append(it, common_headers_[i]);
+  }
+  if (close_connection) {
+    it = Append(it, CommonHeaderLine(CommonHeader::kConnectionClose));
+  }
+  for (const auto& [key, value] : headers_) {
+    it = Append(it, key);
+    it = Append(it, kHeaderSeparator);
+    it = Append(it, value);
+    it = Append(it, kCRLF);
+  }
+  // 1xx, 204 and 304 responses never have a body, and a Content-Length on
+  // them would describe a body that isn't there.
+  if (status_code_ >= 200 && status_code_ != 204 && status_code_ != 304) {
+    it = Append(it, kContentLength);
+    it = std::to_chars(it, it + 20, BodySize()).ptr;
+    it = Append(it, kCRLF);
+  }
+  it = Append(it, kCRLF);
+  return it - out;
 }
 
 std::string HTTPResponse::ToString() const {
-  std::string status_line = version_ + " " + std::to_string(status_code_) + " " 
-    + status_message_ + "\r\n";
-  std::string headers = "";
-  for (auto header : headers_) {
-    headers += header.first + ": " + header.second + "\r\n";
-  }
-  headers += "Content-Length: " + std::to_string(size(body_)) + "\r\n";
-  headers += "\r\n";
-  return status_line + headers + body_;
+  std::string result;
+  result.resize(HeaderBlockSize() + BodySize());
+  char* it = result.data() + RenderHeaderBlock(result.data());
+  if (!file_body_) {
+    it = Append(it, body_);
+  } else {
+    for (const auto& segment : file_body_->segments) {
+      it = Append(it, segment.prefix);
+      ssize_t read = pread(file_body_->fd, it, segment.range.length,
+                           segment.range.offset);
+      if (read != segment.range.length) {
+        LOG(WARNING) << "Short read while serializing file body";
+      }
+      it += segment.range.length;
+    }
+    it = Append(it, file_body_->suffix);
+  }
+  result.resize(it - result.data());
+  return result;
+}
+
+ssize_t HTTPResponse::WriteTo(Socket& socket, bool close_connection) const {
+  char stack_buffer[kheader_stack_buffer_size_];
+  std::unique_ptr<char[]> heap_buffer;
+  char* header = stack_buffer;
+
+  size_t header_capacity = HeaderBlockSize(close_connection);
+  if (header_capacity > sizeof(stack_buffer)) {
+    heap_buffer = std::make_unique<char[]>(header_capacity);
+    header = heap_buffer.get();
+  }
+  size_t header_size = RenderHeaderBlock(header, close_connection);
+
+  if (!file_body_) {
+    struct iovec iov[2] = {
+      {header, header_size},
+      {const_cast<char*>(body_.data()), size(body_)},
+    };
+    return socket.SendVector(iov, body_.empty() ? 1 : 2, MSG_NOSIGNAL);
+  }
+
+  // Send each part's in-memory prefix (the header block goes with the first),
+  // then its range straight from the file. MSG_MORE lets the kernel coalesce
+  // the prefix with the file data into full segments.
+  ssize_t total = 0;
+  for (size_t i = 0; i < size(file_body_->segments); ++i) {
+    const auto& segment = file_body_->segments[i];
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (i == 0) {
+      iov[iovcnt++] = {header, header_size};
+    }
+    if (!segment.prefix.empty()) {
+      iov[iovcnt++] = {const_cast<char*>(segment.prefix.data()),
+                       size(segment.prefix)};
+    }
+    if (iovcnt > 0) {
+      ssize_t sent = socket.SendVector(iov, iovcnt, MSG_MORE | MSG_NOSIGNAL);
+      if (sent < 0) {
+        return -1;
+      }
+      total += sent;
+    }
+    ssize_t sent = socket.SendFile(file_body_->fd, segment.range.offset,
+                                   segment.range.length);
+    if (sent < 0) {
+      return -1;
+    }
+    total += sent;
+  }
+  if (!file_body_->suffix.empty()) {
+    struct iovec iov = {const_cast<char*>(file_body_->suffix.data()),
+                        size(file_body_->suffix)};
+    ssize_t sent = socket.SendVector(&iov, 1, MSG_NOSIGNAL);
+    if (sent < 0) {
+      return -1;
+    }
+    total += sent;
+  }
+  return total;
 }
 
 const std::string HTTPResponse::kserver_path_ = "src/server/";
@@ -3,30 +3,133 @@
 #ifndef _CPPSERVER_HTTP_PARSER_H_
 #define _CPPSERVER_HTTP_PARSER_H_
 
+#include <sys/types.h>
+
+#include <array>
 #include <filesystem>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "compression.h"
+#include "multipart.h"
+#include "socket.h"
 #include "template.h"
+#include "url.h"
 
 namespace cppserver {
 
 std::optional<int> DetermineRemainingHTTPContentLength(const std::string& msg);
 
+// A parsed request. Its strings and containers can be allocated from a
+// per-request arena (see RequestArena); copies use the default allocator, so
+// they may outlive the arena.
 struct HTTPRequest {
-  std::string method;
-  std::string target;
-  std::string version;
+  HTTPRequest() = default;
+  explicit HTTPRequest(std::pmr::memory_resource* resource)
+      : method{resource}, target{resource}, version{resource},
+        headers{resource}, body{resource} {}
+
+  std::pmr::string method;
+  std::pmr::string target;
+  std::pmr::string version;
+
+  std::pmr::vector<std::pair<std::pmr::string, std::pmr::string>> headers;
+
+  std::pmr::string body;
+
+  // The parts of a multipart/form-data body, for endpoints that accept them
+  // (see EndpointOptions::multipart). The body is left empty in that case.
+  std::shared_ptr<const MultipartFormData> multipart;
+
+  // Returns the value of the first header named `key` (case-insensitive),
+  // if present.
+  std::optional<std::string_view> GetHeader(std::string_view key) const;
+
+  // The target without its query string.
+  std::string_view Path() const;
+
+  // The target's query string, without the leading '?'.
+  std::string_view RawQuery() const;
+
+  // The query parameters, parsed on first use.
+  const UrlParams& Query() const;
+
+  // The parameters of an application/x-www-form-urlencoded body, parsed on
+  // first use. Empty for other kinds of body.
+  const UrlParams& Form() const;
+
+ private:
+  // Parsed parameters, cached by the first call that needs them. They point
+  // into the request's strings, so copies start out unparsed.
+  class LazyUrlParams {
+   public:
+    LazyUrlParams() = default;
+    LazyUrlParams(const LazyUrlParams&) {}
+    LazyUrlParams& operator=(const LazyUrlParams&) {
+      params_.reset();
+      return *this;
+    }
+
+    const UrlParams& Get(std::string_view source) const {
+      if (!params_) {
+        params_.emplace(source);
+      }
+      return *params_;
+    }
 
-  std::vector<std::pair<std::string, std::string>> headers;
+   private:
+    mutable std::optional<UrlParams> params_;
+  };
 
-  std::string body;
+  LazyUrlParams query_;
+  LazyUrlParams form_;
 };
 
-std::optional<HTTPRequest> ParseHTTPRequest(const std::string& msg);
+// Parses a request. Its memory is allocated from `resource`.
+std::optional<HTTPRequest> ParseHTTPRequest(
+    std::string_view msg,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+// A range of bytes within a representation.
+struct ByteRange {
+  off_t offset;
+  off_t length;
+};
+
+// Parses the value of a Range header for a representation of `size` bytes.
+// Returns no value if the header is malformed or uses a unit other than
+// bytes, in which case it should be ignored. Otherwise returns the
+// satisfiable ranges, sorted with overlapping and adjacent ranges merged;
+// an empty list means the range is not satisfiable.
+std::optional<std::vector<ByteRange>> ParseRangeHeader(std::string_view header,
+                                                       off_t size);
+
+// Commonly used headers, kept as preformatted lines so responses can
+// reference them without allocating.
+enum class CommonHeader {
+  kContentTypeHTML,
+  kContentTypePlainText,
+  kContentTypeCSS,
+  kContentTypeJavaScript,
+  kContentTypeJSON,
+  kContentTypeOctetStream,
+  kConnectionClose,
+  kConnectionKeepAlive,
+  kContentEncodingGzip,
+  kContentEncodingDeflate,
+  kContentEncodingBrotli,
+  kVaryAcceptEncoding,
+  kAcceptRangesBytes,
+};
+
+// Returns the "<key>: <value>\r\n" line for `header`.
+std::string_view CommonHeaderLine(CommonHeader header);
 
 class HTTPResponse {
  public:
@@ -38,29 +141,159 @@ class HTTPResponse {
     headers_.push_back({key, value});
   }
 
+  // Adds one of the preformatted common headers. Prefer this over the
+  // string overload where possible, since it doesn't allocate.
+  // At most kmax_common_headers_ common headers can be added.
+  void AddHeader(CommonHeader header);
+
   void SetBody(const std::string& body) {
     body_ = body;
   }
 
+  void SetBody(std::string&& body) {
+    body_ = std::move(body);
+  }
+
   void LoadBodyFromFile(const std::string& path);
 
+  // Like LoadBodyFromFile, but if `request` accepts it and a precompressed
+  // sibling (`path` + ".br" or ".gz") exists, serves that instead, so the
+  // compression cost is paid once at deploy time.
+  //
+  // Also adds a strong ETag and Last-Modified for the file. If the request's
+  // If-None-Match or If-Modified-Since shows the client already has it, or
+  // has it as compressed by Compress, the status becomes 304 and the file
+  // isn't read.
+  //
+  // Range requests (subject to If-Range) are answered with 206 Partial
+  // Content, using multipart/byteranges for several ranges. Ranges and large
+  // files are sent straight from the file with sendfile rather than being
+  // read into memory, so they aren't compressed on the fly. Set the
+  // Content-Type before calling this.
+  void LoadBodyFromFile(const std::string& path, const HTTPRequest& request);
+
   void RenderTemplateFile(
       const std::string& path, 
       const std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY>& context);
 
+  // Like RenderTemplateFile, but adds a weak ETag derived from the template
+  // file and `context`. If the request's If-None-Match matches it, the status
+  // becomes 304 and the template is neither read nor rendered.
+  void RenderTemplateFile(
+      const std::string& path,
+      const std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY>& context,
+      const HTTPRequest& request);
+
+  int StatusCode() const { return status_code_; }
+
+  // Returns the value of the Content-Type header, or an empty string if no
+  // content type was set.
+  std::string_view ContentType() const;
+
+  // Returns the value of the first header named `key` (case-insensitive),
+  // including common headers, if present.
+  std::optional<std::string_view> GetHeader(std::string_view key) const;
+
+  // Compresses the body according to `policy` and the request's
+  // Accept-Encoding header. Does nothing if the body is already encoded,
+  // too small, or of a content type the policy doesn't allow. A compressed
+  // response gets its own ETag, with the encoding appended, and no longer
+  // accepts ranges.
+  void Compress(const HTTPRequest& request, const CompressionPolicy& policy);
+
+  // Returns the in-memory body. Empty if the body is sent from a file.
+  const std::string& Body() const { return body_; }
+
+  // Serializes the full response (status line, headers and body) into a
+  // single string. Prefer WriteTo when sending over a socket, since this
+  // copies the body.
   std::string ToString() const;
 
+  // Sends the response over `socket` without copying the body: the status
+  // line and headers are rendered into a stack buffer, and both the header
+  // block and the body are handed to the kernel as one scatter-gather write.
+  // `close_connection` adds Connection: close, so responses shared between
+  // connections don't need to be modified. Returns the number of bytes sent,
+  // or -1 on failure.
+  ssize_t WriteTo(Socket& socket, bool close_connection = false) const;
+
+  // Returns true if the body is sent from a file rather than memory.
+  bool HasFileBody() const { return file_body_ != nullptr; }
+
  private:
+  // Header blocks at most this large are rendered on the stack in WriteTo.
+  static constexpr size_t kheader_stack_buffer_size_ = 1024;
+
+  // Whole files at least this large are sent with sendfile instead of being
+  // read into body_.
+  static constexpr off_t kmin_sendfile_size_ = 1024 * 1024;
+
+  // Requests for more ranges than this are served the whole file instead.
+  static constexpr size_t kmax_ranges_ = 16;
+
+  // A body sent from a file, as a sequence of byte ranges each preceded by
+  // an in-memory prefix (the part headers for multipart/byteranges).
+  struct FileBody {
+    struct Segment {
+      std::string prefix;
+      ByteRange range;
+    };
+
+    ~FileBody();
+
+    int fd;
+    std::vector<Segment> segments;
+    std::string suffix;
+  };
+
+  static constexpr size_t kmax_common_headers_ = 8;
+
   static const std::string kserver_path_;
 
-  std::string version_;
+  void SetStatus(int status_code);
+
+  void SetContentEncoding(ContentEncoding encoding);
+
+  void RemoveCommonHeader(CommonHeader header);
+
+  // Replaces any Content-Type header with `content_type`.
+  void ReplaceContentType(const std::string& content_type);
+
+  // Sends `ranges` of the file at `file_path` (of `size` bytes) as the body.
+  void SetFileBody(const std::string& file_path, off_t size,
+                   const std::vector<ByteRange>& ranges);
+
+  // Returns the size of the body, whether in memory or sent from a file.
+  size_t BodySize() const;
+
+  // Returns the size of the rendered status line and headers, including the
+  // trailing blank line.
+  size_t HeaderBlockSize(bool close_connection = false) const;
+
+  // Renders the status line and headers into `out`, which must be at least
+  // HeaderBlockSize() bytes long. Returns the number of bytes written.
+  size_t RenderHeaderBlock(char* out, bool close_connection = false) const;
+
   int status_code_;
-  std::string status_message_;
+
+  // Precomputed "HTTP/1.1 <code> <reason>\r\n" line for status_code_, or
+  // empty if the status code isn't in the status table.
+  std::string_view status_line_;
+
+  // Lines of the common headers added to this response. Date and Server
+  // are always sent and aren't stored here.
+  std::array<std::string_view, kmax_common_headers_> common_headers_;
+  size_t num_common_headers_ = 0;
+
+  ContentEncoding content_encoding_ = ContentEncoding::kIdentity;
 
   // Don't add Content-Length header to this, it is automatically added.
   std::vector<std::pair<std::string, std::string>> headers_;
 
   std::string body_;
+
+  // If set, the body is sent from this file and body_ is unused.
+  std::shared_ptr<const FileBody> file_body_;
 };
 
 }  // namespace cppserver
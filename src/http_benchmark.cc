@@ -0,0 +1,101 @@
+// Copyright 2022 Daniel Liu
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "arena.h"
+#include "http.h"
+
+namespace {
+
+// What a browser typically sends for a page load.
+const std::string kBrowserGet =
+    "GET /path/some%20page/ HTTP/1.1\r\n"
+    "Host: localhost:8000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:105.0) Gecko/20100101 "
+    "Firefox/105.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=4f1c2a0e9b7d4c3a8e6f5d2b1a0c9e8f; theme=dark\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "\r\n";
+
+std::string MakePost(size_t body_size) {
+  return "POST /api/items HTTP/1.1\r\n"
+         "Host: localhost:8000\r\n"
+         "User-Agent: curl/7.85.0\r\n"
+         "Accept: */*\r\n"
+         "Content-Type: application/json\r\n"
+         "Content-Length: " + std::to_string(body_size) + "\r\n"
+         "\r\n" + std::string(body_size, 'x');
+}
+
+void BM_ParseHTTPRequestGet(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cppserver::ParseHTTPRequest(kBrowserGet));
+  }
+  state.SetBytesProcessed(state.iterations() * kBrowserGet.size());
+}
+BENCHMARK(BM_ParseHTTPRequestGet);
+
+// As the server parses: into a fresh arena for each request.
+void BM_ParseHTTPRequestGetArena(benchmark::State& state) {
+  for (auto _ : state) {
+    cppserver::RequestArena arena;
+    benchmark::DoNotOptimize(
+        cppserver::ParseHTTPRequest(kBrowserGet, arena.Resource()));
+  }
+  state.SetBytesProcessed(state.iterations() * kBrowserGet.size());
+}
+BENCHMARK(BM_ParseHTTPRequestGetArena);
+
+void BM_ParseHTTPRequestPost(benchmark::State& state) {
+  std::string request = MakePost(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cppserver::ParseHTTPRequest(request));
+  }
+  state.SetBytesProcessed(state.iterations() * request.size());
+}
+BENCHMARK(BM_ParseHTTPRequestPost)->Arg(256)->Arg(64 << 10);
+
+void BM_DetermineRemainingHTTPContentLengthGet(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        cppserver::DetermineRemainingHTTPContentLength(kBrowserGet));
+  }
+}
+BENCHMARK(BM_DetermineRemainingHTTPContentLengthGet);
+
+// Only the headers and the start of the body have arrived.
+void BM_DetermineRemainingHTTPContentLengthPartialPost(
+    benchmark::State& state) {
+  std::string request = MakePost(64 << 10).substr(0, 1024);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        cppserver::DetermineRemainingHTTPContentLength(request));
+  }
+}
+BENCHMARK(BM_DetermineRemainingHTTPContentLengthPartialPost);
+
+void BM_HTTPResponseToString(benchmark::State& state) {
+  cppserver::HTTPResponse response(200);
+  response.AddHeader(cppserver::CommonHeader::kContentTypeHTML);
+  response.AddHeader("Cache-Control", "no-cache");
+  response.AddHeader("Set-Cookie", "session=4f1c2a0e9b7d4c3a8e6f5d2b1a0c9e8f");
+  response.SetBody(std::string(state.range(0), 'x'));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(response.ToString());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HTTPResponseToString)->Arg(512)->Arg(64 << 10);
+
+}  // namespace
@@ -0,0 +1,99 @@
+// Copyright 2022 Daniel Liu
+
+#include "http_date.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace cppserver {
+
+namespace {
+
+constexpr std::string_view kDateHeaderPrefix = "Date: ";
+constexpr std::string_view kCRLF = "\r\n";
+
+std::atomic<time_t> current_time {0};
+
+void RunClock() {
+  while (true) {
+    auto now = std::chrono::system_clock::now();
+    current_time.store(std::chrono::system_clock::to_time_t(now),
+                       std::memory_order_relaxed);
+    // Wake up just after the next second boundary.
+    auto next_second = std::chrono::ceil<std::chrono::seconds>(now);
+    if (next_second == now) {
+      next_second += std::chrono::seconds(1);
+    }
+    std::this_thread::sleep_until(next_second);
+  }
+}
+
+void StartClock() {
+  static std::once_flag started;
+  std::call_once(started, [] {
+    current_time.store(std::time(nullptr), std::memory_order_relaxed);
+    std::thread(RunClock).detach();
+  });
+}
+
+}  // namespace
+
+size_t FormatHTTPDate(time_t time, char* out) {
+  struct tm tm;
+  gmtime_r(&time, &tm);
+  // strftime needs room for the null terminator, which we then drop.
+  char buffer[kHTTPDateSize + 1];
+  std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  std::memcpy(out, buffer, kHTTPDateSize);
+  return kHTTPDateSize;
+}
+
+std::optional<time_t> ParseHTTPDate(std::string_view date) {
+  if (date.size() != kHTTPDateSize) {
+    return {};
+  }
+  // strptime needs a null-terminated string.
+  char buffer[kHTTPDateSize + 1];
+  std::memcpy(buffer, date.data(), kHTTPDateSize);
+  buffer[kHTTPDateSize] = '\0';
+
+  struct tm tm = {};
+  const char* end = strptime(buffer, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (end == nullptr || *end != '\0') {
+    return {};
+  }
+  return timegm(&tm);
+}
+
+time_t CurrentHTTPTime() {
+  StartClock();
+  return current_time.load(std::memory_order_relaxed);
+}
+
+std::string_view CurrentDateHeader() {
+  struct CachedDateHeader {
+    time_t time = -1;
+    char line[kDateHeaderPrefix.size() + kHTTPDateSize + kCRLF.size()];
+  };
+  thread_local CachedDateHeader cached;
+
+  time_t now = CurrentHTTPTime();
+  if (now != cached.time) {
+    char* it = cached.line;
+    std::memcpy(it, kDateHeaderPrefix.data(), kDateHeaderPrefix.size());
+    it += kDateHeaderPrefix.size();
+    it += FormatHTTPDate(now, it);
+    std::memcpy(it, kCRLF.data(), kCRLF.size());
+    cached.time = now;
+  }
+  return {cached.line, sizeof(cached.line)};
+}
+
+}  // namespace cppserver
@@ -0,0 +1,34 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_HTTP_DATE_H_
+#define _CPPSERVER_HTTP_DATE_H_
+
+#include <ctime>
+#include <optional>
+#include <string_view>
+
+namespace cppserver {
+
+// Length of an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+constexpr size_t kHTTPDateSize = 29;
+
+// Formats `time` as an IMF-fixdate into `out`, which must be at least
+// kHTTPDateSize bytes long. Returns the number of bytes written.
+size_t FormatHTTPDate(time_t time, char* out);
+
+// Parses an IMF-fixdate, as sent in e.g. If-Modified-Since.
+std::optional<time_t> ParseHTTPDate(std::string_view date);
+
+// Returns the current time, in seconds, as last published by the server
+// clock. The clock is a background timer that ticks once per second, so
+// this is a single atomic load rather than a syscall.
+time_t CurrentHTTPTime();
+
+// Returns the "Date: <IMF-fixdate>\r\n" header line for the current second.
+// The line is cached per thread and only reformatted when the clock ticks,
+// so the returned view is valid until the calling thread calls this again.
+std::string_view CurrentDateHeader();
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,58 @@
+
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+#include "http_date.h"
+
+using namespace cppserver;
+
+namespace {
+
+// The IMF-fixdate format from RFC 7231, section 7.1.1.1.
+std::string ReferenceDate(time_t time) {
+  return absl::FormatTime("%a, %d %b %Y %H:%M:%S GMT", absl::FromTimeT(time),
+                          absl::UTCTimeZone());
+}
+
+std::string FormatDate(time_t time) {
+  char buffer[kHTTPDateSize];
+  size_t size = FormatHTTPDate(time, buffer);
+  EXPECT_EQ(size, kHTTPDateSize);
+  return std::string(buffer, size);
+}
+
+}  // namespace
+
+TEST(HTTPDateTests, FormatsIMFFixdate) {
+  EXPECT_EQ(FormatDate(784111777), "Sun, 06 Nov 1994 08:49:37 GMT");
+  // The epoch, a leap day, the end of a year and the 32-bit limit.
+  for (time_t time : {time_t{0}, time_t{951782400}, time_t{1672531199},
+                      time_t{2147483647}, absl::ToTimeT(absl::Now())}) {
+    EXPECT_EQ(FormatDate(time), ReferenceDate(time)) << time;
+  }
+}
+
+TEST(HTTPDateTests, ParsesWhatItFormats) {
+  for (time_t time : {time_t{0}, time_t{784111777}, time_t{951782400},
+                      absl::ToTimeT(absl::Now())}) {
+    EXPECT_EQ(ParseHTTPDate(ReferenceDate(time)), time) << time;
+  }
+  EXPECT_FALSE(ParseHTTPDate("Sunday, 06-Nov-94 08:49:37 GMT").has_value());
+  EXPECT_FALSE(ParseHTTPDate("").has_value());
+}
+
+TEST(HTTPDateTests, CurrentDateHeader) {
+  std::string_view header = CurrentDateHeader();
+  ASSERT_EQ(header.size(), 6 + kHTTPDateSize + 2);
+  EXPECT_EQ(header.substr(0, 6), "Date: ");
+  EXPECT_EQ(header.substr(header.size() - 2), "\r\n");
+  auto date = ParseHTTPDate(header.substr(6, kHTTPDateSize));
+  ASSERT_TRUE(date.has_value());
+  EXPECT_LE(std::abs(*date - std::time(nullptr)), 2);
+}
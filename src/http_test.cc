@@ -0,0 +1,324 @@
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "compression.h"
+#include "http.h"
+#include "socket.h"
+
+using namespace cppserver;
+
+namespace {
+
+std::vector<std::pair<off_t, off_t>> AsPairs(
+    const std::vector<ByteRange>& ranges) {
+  std::vector<std::pair<off_t, off_t>> pairs;
+  for (const auto& range : ranges) {
+    pairs.emplace_back(range.offset, range.length);
+  }
+  return pairs;
+}
+
+// Requests src/server/static/index.html with the given extra header lines.
+HTTPResponse GetStaticFile(const std::string& headers,
+                           const CompressionPolicy* policy = nullptr) {
+  auto request = ParseHTTPRequest(
+      "GET /static/index.html HTTP/1.1\r\nHost: x\r\n" + headers + "\r\n");
+  EXPECT_TRUE(request.has_value());
+  HTTPResponse response(200);
+  response.AddHeader(CommonHeader::kContentTypeHTML);
+  response.LoadBodyFromFile("static/index.html", *request);
+  if (policy) {
+    response.Compress(*request, *policy);
+  }
+  return response;
+}
+
+std::string HeaderOf(const HTTPResponse& response, std::string_view key) {
+  return std::string(response.GetHeader(key).value_or(""));
+}
+
+// Sends `response` over a socketpair and returns what arrives at the other
+// end. The other end is drained on its own thread, so the response may be
+// larger than the socket buffers. With `interrupt_sends`, the sender gets a
+// small buffer and is signalled after every read, so a blocked sendmsg
+// returns after only part of the response has gone through and the rest has
+// to be resumed.
+std::string SendOverSocket(const HTTPResponse& response,
+                           bool close_connection = false,
+                           bool interrupt_sends = false) {
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  if (interrupt_sends) {
+    int buffer_size = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer_size,
+               sizeof(buffer_size));
+    // Without SA_RESTART, so the signal cuts the send short. The handler is
+    // left installed, since a signal may still be pending when this returns.
+    struct sigaction action = {};
+    action.sa_handler = [](int) {};
+    sigaction(SIGUSR1, &action, nullptr);
+  }
+  std::string received;
+  std::thread reader([&received, fd = fds[1], interrupt_sends,
+                      sender_thread = pthread_self()] {
+    char buffer[4096];
+    ssize_t result;
+    while ((result = read(fd, buffer, sizeof(buffer))) > 0) {
+      received.append(buffer, result);
+      if (interrupt_sends) {
+        pthread_kill(sender_thread, SIGUSR1);
+      }
+    }
+  });
+  Socket sender = Socket::FromFD(fds[0]);
+  ssize_t sent = response.WriteTo(sender, close_connection);
+  sender.Close();
+  reader.join();
+  close(fds[1]);
+  EXPECT_EQ(sent, static_cast<ssize_t>(received.size()));
+  return received;
+}
+
+}  // namespace
+
+TEST(RangeHeaderTests, SingleRange) {
+  auto ranges = ParseRangeHeader("bytes=0-499", 1000);
+  ASSERT_TRUE(ranges.has_value());
+  EXPECT_EQ(AsPairs(*ranges), (std::vector<std::pair<off_t, off_t>>{{0, 500}}));
+}
+
+TEST(RangeHeaderTests, OpenEndedRange) {
+  auto ranges = ParseRangeHeader("bytes=900-", 1000);
+  ASSERT_TRUE(ranges.has_value());
+  EXPECT_EQ(AsPairs(*ranges), (std::vector<std::pair<off_t, off_t>>{{900, 100}}));
+}
+
+TEST(RangeHeaderTests, SuffixRange) {
+  auto ranges = ParseRangeHeader("bytes=-100", 1000);
+  ASSERT_TRUE(ranges.has_value());
+  EXPECT_EQ(AsPairs(*ranges), (std::vector<std::pair<off_t, off_t>>{{900, 100}}));
+}
+
+TEST(RangeHeaderTests, LastByteIsClamped) {
+  auto ranges = ParseRangeHeader("bytes=500-5000", 1000);
+  ASSERT_TRUE(ranges.has_value());
+  EXPECT_EQ(AsPairs(*ranges), (std::vector<std::pair<off_t, off_t>>{{500, 500}}));
+}
+
+TEST(RangeHeaderTests, MultipleRangesAreSortedAndMerged) {
+  auto ranges = ParseRangeHeader("bytes=500-599, 0-99, 50-149, 150-199", 1000);
+  ASSERT_TRUE(ranges.has_value());
+  EXPECT_EQ(AsPairs(*ranges),
+            (std::vector<std::pair<off_t, off_t>>{{0, 200}, {500, 100}}));
+}
+
+TEST(RangeHeaderTests, UnsatisfiableRange) {
+  auto ranges = ParseRangeHeader("bytes=1000-1100", 1000);
+  ASSERT_TRUE(ranges.has_value());
+  EXPECT_TRUE(ranges->empty());
+}
+
+TEST(RangeHeaderTests, MalformedRangesAreIgnored) {
+  EXPECT_FALSE(ParseRangeHeader("items=0-1", 1000).has_value());
+  EXPECT_FALSE(ParseRangeHeader("bytes=", 1000).has_value());
+  EXPECT_FALSE(ParseRangeHeader("bytes=5", 1000).has_value());
+  EXPECT_FALSE(ParseRangeHeader("bytes=10-5", 1000).has_value());
+  EXPECT_FALSE(ParseRangeHeader("bytes=a-b", 1000).has_value());
+}
+
+TEST(HTTPResponseTests, ToStringIncludesContentLength) {
+  HTTPResponse response(404);
+  response.AddHeader(CommonHeader::kContentTypePlainText);
+  response.SetBody("missing");
+  std::string serialized = response.ToString();
+  EXPECT_EQ(serialized.rfind("HTTP/1.1 404 Not Found\r\n", 0), 0);
+  EXPECT_NE(serialized.find("Content-Type: text/plain; charset=utf-8\r\n"),
+            std::string::npos);
+  EXPECT_NE(serialized.find("Content-Length: 7\r\n\r\nmissing"),
+            std::string::npos);
+}
+
+TEST(HTTPResponseTests, NotModifiedHasNoContentLength) {
+  HTTPResponse response(304);
+  EXPECT_EQ(response.ToString().find("Content-Length"), std::string::npos);
+}
+
+TEST(HTTPResponseTests, WriteToCanCloseTheConnection) {
+  HTTPResponse response(200);
+  response.SetBody("shared");
+  std::string kept = SendOverSocket(response);
+  std::string closed = SendOverSocket(response, true);
+  EXPECT_EQ(kept.find("Connection: close\r\n"), std::string::npos);
+  EXPECT_NE(closed.find("Connection: close\r\n"), std::string::npos);
+  EXPECT_EQ(closed.substr(closed.size() - 6), "shared");
+  // The response itself is left as it was.
+  EXPECT_EQ(response.ToString().find("Connection: close"), std::string::npos);
+}
+
+TEST(HTTPResponseTests, WriteToSpillsLargeHeaderBlocksToTheHeap) {
+  HTTPResponse response(200);
+  for (int i = 0; i < 8; ++i) {
+    response.AddHeader("X-Padding-" + std::to_string(i), std::string(200, 'a'));
+  }
+  response.SetBody("body");
+  ASSERT_GT(response.ToString().size(), 1024);
+  EXPECT_EQ(SendOverSocket(response), response.ToString());
+}
+
+TEST(HTTPResponseTests, WriteToResumesPartialSends) {
+  HTTPResponse response(200);
+  std::string body(256 * 1024, '\0');
+  for (size_t i = 0; i < body.size(); ++i) {
+    body[i] = 'a' + i % 26;
+  }
+  response.SetBody(std::move(body));
+  EXPECT_EQ(SendOverSocket(response, false, true), response.ToString());
+}
+
+TEST(HTTPResponseTests, WriteToSendsFileRangesAfterTheHeader) {
+  HTTPResponse single = GetStaticFile("Range: bytes=0-9\r\n");
+  ASSERT_EQ(single.StatusCode(), 206);
+  ASSERT_TRUE(single.HasFileBody());
+  std::string received = SendOverSocket(single);
+  EXPECT_EQ(received, single.ToString());
+  EXPECT_EQ(received.find("\r\n\r\n") + 4, received.size() - 10);
+
+  HTTPResponse multiple = GetStaticFile("Range: bytes=0-4,20-29\r\n");
+  ASSERT_EQ(multiple.StatusCode(), 206);
+  ASSERT_TRUE(multiple.HasFileBody());
+  received = SendOverSocket(multiple);
+  EXPECT_EQ(received, multiple.ToString());
+  EXPECT_NE(received.find("Content-Range: bytes 20-29/"), std::string::npos);
+}
+
+TEST(HTTPRequestTests, SplitsQueryFromPath) {
+  auto request = ParseHTTPRequest(
+      "GET /path/x/?a=1&b=hello+world#frag HTTP/1.1\r\nHost: x\r\n\r\n");
+  ASSERT_TRUE(request.has_value());
+  EXPECT_EQ(request->Path(), "/path/x/");
+  EXPECT_EQ(request->RawQuery(), "a=1&b=hello+world");
+  EXPECT_EQ(request->Query().Get("b"), "hello world");
+
+  // Copies parse their own strings rather than reusing the original's.
+  HTTPRequest copy = *request;
+  request->target = "/other?b=changed";
+  EXPECT_EQ(copy.Query().Get("b"), "hello world");
+}
+
+TEST(HTTPRequestTests, ParsesFormBodies) {
+  auto request = ParseHTTPRequest(
+      "POST /login HTTP/1.1\r\n"
+      "Content-Type: application/x-www-form-urlencoded; charset=utf-8\r\n"
+      "Content-Length: 27\r\n"
+      "\r\n"
+      "user=jane&password=p%40ss+1");
+  ASSERT_TRUE(request.has_value());
+  EXPECT_EQ(request->Form().Get("user"), "jane");
+  EXPECT_EQ(request->Form().Get("password"), "p@ss 1");
+
+  request->headers = {{"Content-Type", "text/plain"}};
+  HTTPRequest plain = *request;
+  EXPECT_TRUE(plain.Form().empty());
+}
+
+TEST(HTTPRequestTests, ParsesIntoArena) {
+  std::pmr::monotonic_buffer_resource arena;
+  auto request = ParseHTTPRequest(
+      "POST /items HTTP/1.1\r\n"
+      "Host:localhost\r\n"
+      "X-Note: a: b\r\n"
+      "\r\n"
+      "line one\r\n\r\nline three",
+      &arena);
+  ASSERT_TRUE(request.has_value());
+  EXPECT_EQ(request->version, "HTTP/1.1");
+  EXPECT_EQ(request->GetHeader("host"), "localhost");
+  EXPECT_EQ(request->GetHeader("X-Note"), "a: b");
+  EXPECT_EQ(request->body, "line one\r\n\r\nline three");
+  EXPECT_EQ(request->headers.get_allocator().resource(), &arena);
+  EXPECT_EQ(request->body.get_allocator().resource(), &arena);
+
+  // Copies may outlive the arena.
+  HTTPRequest copy = *request;
+  EXPECT_NE(copy.body.get_allocator().resource(), &arena);
+}
+
+TEST(ConditionalRequestTests, IfNoneMatch) {
+  HTTPResponse full = GetStaticFile("");
+  ASSERT_EQ(full.StatusCode(), 200);
+  std::string etag = HeaderOf(full, "ETag");
+  ASSERT_FALSE(etag.empty());
+  EXPECT_FALSE(full.Body().empty());
+  EXPECT_EQ(HeaderOf(full, "Accept-Ranges"), "bytes");
+
+  HTTPResponse cached = GetStaticFile("If-None-Match: \"x\", " + etag
+                                      + "\r\n");
+  EXPECT_EQ(cached.StatusCode(), 304);
+  EXPECT_TRUE(cached.Body().empty());
+  EXPECT_EQ(HeaderOf(cached, "ETag"), etag);
+  // Weak comparison applies.
+  EXPECT_EQ(GetStaticFile("If-None-Match: W/" + etag + "\r\n").StatusCode(),
+            304);
+  EXPECT_EQ(GetStaticFile("If-None-Match: \"stale\"\r\n").StatusCode(), 200);
+}
+
+TEST(ConditionalRequestTests, IfModifiedSince) {
+  HTTPResponse full = GetStaticFile("");
+  std::string last_modified = HeaderOf(full, "Last-Modified");
+  ASSERT_FALSE(last_modified.empty());
+  EXPECT_EQ(GetStaticFile("If-Modified-Since: " + last_modified + "\r\n")
+                .StatusCode(), 304);
+  EXPECT_EQ(GetStaticFile("If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT"
+                          "\r\n").StatusCode(), 200);
+  // If-None-Match takes precedence.
+  EXPECT_EQ(GetStaticFile("If-None-Match: \"stale\"\r\nIf-Modified-Since: "
+                          + last_modified + "\r\n").StatusCode(), 200);
+}
+
+TEST(ConditionalRequestTests, IfRange) {
+  std::string etag = HeaderOf(GetStaticFile(""), "ETag");
+  HTTPResponse partial = GetStaticFile("Range: bytes=0-9\r\nIf-Range: " + etag
+                                       + "\r\n");
+  EXPECT_EQ(partial.StatusCode(), 206);
+  EXPECT_EQ(HeaderOf(partial, "Content-Range").rfind("bytes 0-9/", 0), 0);
+  // Anything but the exact current tag gets the whole file.
+  EXPECT_EQ(GetStaticFile("Range: bytes=0-9\r\nIf-Range: \"stale\"\r\n")
+                .StatusCode(), 200);
+  EXPECT_EQ(GetStaticFile("Range: bytes=0-9\r\nIf-Range: W/" + etag
+                          + "\r\n").StatusCode(), 200);
+}
+
+TEST(ConditionalRequestTests, CompressedVariantsHaveTheirOwnETag) {
+  CompressionPolicy policy;
+  policy.min_size = 0;
+  std::string etag = HeaderOf(GetStaticFile(""), "ETag");
+  std::string gzip_etag = etag.substr(0, etag.size() - 1) + "-gzip\"";
+
+  HTTPResponse compressed = GetStaticFile("Accept-Encoding: gzip\r\n",
+                                          &policy);
+  EXPECT_EQ(HeaderOf(compressed, "Content-Encoding"), "gzip");
+  EXPECT_EQ(HeaderOf(compressed, "ETag"), gzip_etag);
+  EXPECT_FALSE(compressed.GetHeader("Accept-Ranges").has_value());
+
+  HTTPResponse cached = GetStaticFile(
+      "Accept-Encoding: gzip\r\nIf-None-Match: " + gzip_etag + "\r\n",
+      &policy);
+  EXPECT_EQ(cached.StatusCode(), 304);
+  EXPECT_EQ(HeaderOf(cached, "ETag"), gzip_etag);
+  EXPECT_EQ(HeaderOf(cached, "Vary"), "Accept-Encoding");
+  EXPECT_FALSE(cached.GetHeader("Accept-Ranges").has_value());
+
+  // The compressed tag doesn't validate ranges of the uncompressed file.
+  EXPECT_EQ(GetStaticFile("Range: bytes=0-9\r\nIf-Range: " + gzip_etag
+                          + "\r\n").StatusCode(), 200);
+}
@@ -0,0 +1,856 @@
+// Copyright 2022 Daniel Liu
+
+#include "json.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+
+#include "template.h"
+
+namespace cppserver {
+
+namespace {
+
+// For each byte, the character following the backslash in its escape, 'u'
+// for bytes written as \u00XX, or 0 if the byte is copied as is.
+constexpr std::array<char, 256> MakeEscapeTable() {
+  std::array<char, 256> table {};
+  for (int c = 0; c < 0x20; ++c) {
+    table[c] = 'u';
+  }
+  table['"'] = '"';
+  table['\\'] = '\\';
+  table['\b'] = 'b';
+  table['\f'] = 'f';
+  table['\n'] = 'n';
+  table['\r'] = 'r';
+  table['\t'] = 't';
+  return table;
+}
+
+constexpr std::array<char, 256> kEscape = MakeEscapeTable();
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+// Returns the length of the run of bytes at the start of [begin, end) that
+// don't need escaping.
+size_t CleanPrefixLength(const char* begin, const char* end) {
+  const char* it = begin;
+#ifdef __SSE2__
+  // A byte needs escaping if it's a control character (<= 0x1F unsigned),
+  // a quote or a backslash.
+  const __m128i control_max = _mm_set1_epi8(0x1F);
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  while (end - it >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+    __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max),
+                                     control_max);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                   _mm_cmpeq_epi8(chunk, backslash));
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(control, special));
+    if (mask != 0) {
+      return it - begin + __builtin_ctz(mask);
+    }
+    it += 16;
+  }
+#endif
+  while (it != end && !kEscape[static_cast<unsigned char>(*it)]) {
+    ++it;
+  }
+  return it - begin;
+}
+
+// Deeper documents are rejected, which bounds the recursion in
+// ToTemplateValue.
+constexpr size_t kMaxDepth = 1024;
+
+// The characters of interest in a 64-byte block of JSON text, one bit per
+// byte.
+struct BlockMasks {
+  uint64_t quote = 0;
+  uint64_t backslash = 0;
+  // {}[]:,
+  uint64_t op = 0;
+  uint64_t whitespace = 0;
+  // Bytes <= 0x1F, which must be escaped inside strings.
+  uint64_t control = 0;
+};
+
+BlockMasks ClassifyBlock(const char* block) {
+  BlockMasks masks;
+#ifdef __SSE2__
+  const __m128i control_max = _mm_set1_epi8(0x1F);
+  for (int i = 0; i < 4; ++i) {
+    __m128i chunk = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(block + 16 * i));
+    auto is = [chunk](char c) {
+      return _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c));
+    };
+    auto bits = [i](__m128i matches) {
+      return static_cast<uint64_t>(
+          static_cast<uint16_t>(_mm_movemask_epi8(matches))) << (16 * i);
+    };
+    masks.quote |= bits(is('"'));
+    masks.backslash |= bits(is('\\'));
+    masks.op |= bits(_mm_or_si128(
+        _mm_or_si128(_mm_or_si128(is('{'), is('}')),
+                     _mm_or_si128(is('['), is(']'))),
+        _mm_or_si128(is(':'), is(','))));
+    masks.whitespace |= bits(_mm_or_si128(_mm_or_si128(is(' '), is('\t')),
+                                          _mm_or_si128(is('\n'), is('\r'))));
+    masks.control |= bits(_mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max),
+                                         control_max));
+  }
+#else
+  for (int i = 0; i < 64; ++i) {
+    uint64_t bit = uint64_t{1} << i;
+    unsigned char c = block[i];
+    switch (c) {
+      case '"': masks.quote |= bit; break;
+      case '\\': masks.backslash |= bit; break;
+      case '{': case '}': case '[': case ']': case ':': case ',':
+        masks.op |= bit;
+        break;
+      case ' ': case '\t': case '\n': case '\r':
+        masks.whitespace |= bit;
+        break;
+    }
+    if (c <= 0x1F) {
+      masks.control |= bit;
+    }
+  }
+#endif
+  return masks;
+}
+
+// Bit i of the result is the XOR of bits 0 through i of `bits`. Applied to
+// the unescaped quotes, this marks the bytes inside strings (including the
+// opening quote but not the closing one).
+uint64_t PrefixXor(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+// Appends the offsets of the structural characters in `json` to
+// `structurals`: brackets, colons and commas outside strings, opening
+// quotes, and the first character of each other scalar.
+absl::Status IndexStructurals(std::string_view json,
+                              std::vector<uint32_t>* structurals) {
+  // State carried between blocks: whether the first byte is escaped, whether
+  // it starts inside a string, and whether the last byte was part of a
+  // scalar.
+  uint64_t escaped_carry = 0;
+  uint64_t in_string_carry = 0;
+  uint64_t scalar_carry = 0;
+  char padded[64];
+  for (size_t offset = 0; offset < json.size(); offset += 64) {
+    const char* block = json.data() + offset;
+    size_t length = std::min<size_t>(64, json.size() - offset);
+    if (length < 64) {
+      // Spaces are whitespace, so the padding adds no structurals.
+      std::memset(padded, ' ', sizeof(padded));
+      std::memcpy(padded, block, length);
+      block = padded;
+    }
+    BlockMasks masks = ClassifyBlock(block);
+
+    // A backslash escapes the next byte, unless it's escaped itself.
+    // Backslashes are rare enough outside of long escaped strings that
+    // walking them one at a time is cheaper than the branch-free version.
+    uint64_t escaped = escaped_carry;
+    escaped_carry = 0;
+    for (uint64_t backslashes = masks.backslash; backslashes != 0;
+         backslashes &= backslashes - 1) {
+      int i = __builtin_ctzll(backslashes);
+      if (escaped & (uint64_t{1} << i)) {
+        continue;
+      }
+      if (i == 63) {
+        escaped_carry = 1;
+      } else {
+        escaped |= uint64_t{2} << i;
+      }
+    }
+
+    uint64_t quotes = masks.quote & ~escaped;
+    uint64_t in_string = PrefixXor(quotes) ^ in_string_carry;
+    in_string_carry = (in_string >> 63) ? ~uint64_t{0} : 0;
+    if (masks.control & in_string) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Unescaped control character in JSON string at offset ",
+          offset + __builtin_ctzll(masks.control & in_string)));
+    }
+
+    uint64_t scalars =
+        ~(masks.op | masks.whitespace | masks.quote | in_string);
+    uint64_t structural = (masks.op & ~in_string) | (quotes & in_string)
+        | (scalars & ~((scalars << 1) | scalar_carry));
+    scalar_carry = scalars >> 63;
+
+    for (; structural != 0; structural &= structural - 1) {
+      structurals->push_back(offset + __builtin_ctzll(structural));
+    }
+  }
+  if (in_string_carry) {
+    return absl::InvalidArgumentError("Unterminated JSON string");
+  }
+  return absl::OkStatus();
+}
+
+bool IsValueStart(char c) {
+  return c == '"' || c == '-' || (c >= '0' && c <= '9') || c == 't'
+      || c == 'f' || c == 'n';
+}
+
+// Checks that the structurals form a single JSON value, and records where
+// each array and object ends.
+absl::Status CheckStructure(std::string_view json,
+                            const std::vector<uint32_t>& structurals,
+                            std::vector<uint32_t>* closing) {
+  enum class Expect { kValue, kFirstElement, kFirstKey, kKey, kColon, kNext };
+
+  closing->assign(structurals.size(), 0);
+  // The structural indexes of the enclosing brackets.
+  std::vector<uint32_t> open;
+  Expect expect = Expect::kValue;
+  for (uint32_t i = 0; i < structurals.size(); ++i) {
+    char c = json[structurals[i]];
+    bool close = false;
+    bool valid = true;
+    switch (expect) {
+      case Expect::kFirstElement:
+        if (c == ']') {
+          close = true;
+          break;
+        }
+        [[fallthrough]];
+      case Expect::kValue:
+        if (c == '{' || c == '[') {
+          if (open.size() == kMaxDepth) {
+            return absl::InvalidArgumentError("JSON text is nested too deeply");
+          }
+          open.push_back(i);
+          expect = c == '{' ? Expect::kFirstKey : Expect::kFirstElement;
+        } else {
+          valid = IsValueStart(c);
+          expect = Expect::kNext;
+        }
+        break;
+      case Expect::kFirstKey:
+        if (c == '}') {
+          close = true;
+          break;
+        }
+        [[fallthrough]];
+      case Expect::kKey:
+        valid = c == '"';
+        expect = Expect::kColon;
+        break;
+      case Expect::kColon:
+        valid = c == ':';
+        expect = Expect::kValue;
+        break;
+      case Expect::kNext: {
+        if (open.empty()) {
+          valid = false;
+          break;
+        }
+        bool object = json[structurals[open.back()]] == '{';
+        if (c == ',') {
+          expect = object ? Expect::kKey : Expect::kValue;
+        } else {
+          close = c == (object ? '}' : ']');
+          valid = close;
+        }
+        break;
+      }
+    }
+    if (!valid) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Unexpected '", std::string_view(&c, 1), "' in JSON text at offset ",
+          structurals[i]));
+    }
+    if (close) {
+      (*closing)[open.back()] = i;
+      open.pop_back();
+      expect = Expect::kNext;
+    }
+  }
+  if (expect != Expect::kNext || !open.empty()) {
+    return absl::InvalidArgumentError("Unexpected end of JSON text");
+  }
+  return absl::OkStatus();
+}
+
+bool IsDelimiter(char c) {
+  switch (c) {
+    case ' ': case '\t': case '\n': case '\r': case '"':
+    case '{': case '}': case '[': case ']': case ':': case ',':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the offset of the quote closing the string opened at
+// `open_quote`. Indexing has checked that it's terminated.
+size_t StringEnd(std::string_view json, size_t open_quote,
+                 bool* has_escapes) {
+  const char* it = json.data() + open_quote + 1;
+  const char* end = json.data() + json.size();
+  *has_escapes = false;
+  while (true) {
+    // Strings can't hold control characters, so the clean run stops only
+    // at a quote or a backslash.
+    it += CleanPrefixLength(it, end);
+    if (*it == '"') {
+      return it - json.data();
+    }
+    *has_escapes = true;
+    it += 2;
+  }
+}
+
+bool ParseHex4(const char* it, const char* end, uint32_t* code) {
+  if (end - it < 4) {
+    return false;
+  }
+  *code = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = it[i];
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    *code = *code << 4 | digit;
+  }
+  return true;
+}
+
+void AppendUtf8(uint32_t code, std::string* out) {
+  if (code < 0x80) {
+    out->push_back(code);
+  } else if (code < 0x800) {
+    out->push_back(0xC0 | (code >> 6));
+    out->push_back(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    out->push_back(0xE0 | (code >> 12));
+    out->push_back(0x80 | ((code >> 6) & 0x3F));
+    out->push_back(0x80 | (code & 0x3F));
+  } else {
+    out->push_back(0xF0 | (code >> 18));
+    out->push_back(0x80 | ((code >> 12) & 0x3F));
+    out->push_back(0x80 | ((code >> 6) & 0x3F));
+    out->push_back(0x80 | (code & 0x3F));
+  }
+}
+
+// Appends the contents of a string, between its quotes, to `out`.
+absl::Status UnescapeJsonString(std::string_view escaped, std::string* out) {
+  const char* it = escaped.data();
+  const char* end = it + escaped.size();
+  while (it != end) {
+    const char* backslash =
+        static_cast<const char*>(std::memchr(it, '\\', end - it));
+    if (backslash == nullptr) {
+      out->append(it, end);
+      break;
+    }
+    out->append(it, backslash);
+    // The string is terminated, so every backslash escapes something.
+    it = backslash + 1;
+    char c = *it++;
+    switch (c) {
+      case '"': case '\\': case '/': out->push_back(c); break;
+      case 'b': out->push_back('\b'); break;
+      case 'f': out->push_back('\f'); break;
+      case 'n': out->push_back('\n'); break;
+      case 'r': out->push_back('\r'); break;
+      case 't': out->push_back('\t'); break;
+      case 'u': {
+        uint32_t code;
+        if (!ParseHex4(it, end, &code)) {
+          return absl::InvalidArgumentError("Invalid \\u escape in JSON string");
+        }
+        it += 4;
+        if (code >= 0xD800 && code < 0xE000) {
+          // UTF-16 surrogates must come in high-low pairs.
+          uint32_t low;
+          if (code >= 0xDC00 || end - it < 6 || it[0] != '\\'
+              || it[1] != 'u' || !ParseHex4(it + 2, end, &low)
+              || low < 0xDC00 || low >= 0xE000) {
+            return absl::InvalidArgumentError(
+                "Unpaired surrogate in JSON string");
+          }
+          it += 6;
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        AppendUtf8(code, out);
+        break;
+      }
+      default:
+        return absl::InvalidArgumentError("Invalid escape in JSON string");
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Checks `text` against the JSON number grammar, which is stricter than
+// from_chars: no '+', leading zeros, or missing digits around '.'.
+bool IsJsonNumber(std::string_view text, bool* integer) {
+  size_t i = 0;
+  auto digits = [&] {
+    size_t start = i;
+    while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+      ++i;
+    }
+    return i - start;
+  };
+  if (i < text.size() && text[i] == '-') {
+    ++i;
+  }
+  size_t leading = digits();
+  if (leading == 0 || (leading > 1 && text[i - leading] == '0')) {
+    return false;
+  }
+  *integer = true;
+  if (i < text.size() && text[i] == '.') {
+    ++i;
+    *integer = false;
+    if (digits() == 0) {
+      return false;
+    }
+  }
+  if (i < text.size() && (text[i] == 'e' || text[i] == 'E')) {
+    ++i;
+    *integer = false;
+    if (i < text.size() && (text[i] == '+' || text[i] == '-')) {
+      ++i;
+    }
+    if (digits() == 0) {
+      return false;
+    }
+  }
+  return i == text.size();
+}
+
+absl::Status InvalidNumber(std::string_view text) {
+  return absl::InvalidArgumentError(absl::StrCat("Invalid JSON number: ", text));
+}
+
+}  // namespace
+
+void AppendJsonString(std::string_view str, std::string* out) {
+  out->push_back('"');
+  const char* it = str.data();
+  const char* end = it + str.size();
+  while (it != end) {
+    size_t clean = CleanPrefixLength(it, end);
+    out->append(it, clean);
+    it += clean;
+    if (it == end) {
+      break;
+    }
+
+    unsigned char c = *it++;
+    char escape = kEscape[c];
+    if (escape == 'u') {
+      char encoded[] = {'\\', 'u', '0', '0', kHexDigits[c >> 4],
+                        kHexDigits[c & 0xF]};
+      out->append(encoded, sizeof(encoded));
+    } else {
+      char encoded[] = {'\\', escape};
+      out->append(encoded, sizeof(encoded));
+    }
+  }
+  out->push_back('"');
+}
+
+void AppendJsonNumber(double value, std::string* out) {
+  if (!std::isfinite(value)) {
+    out->append("null");
+    return;
+  }
+  // The longest shortest-form double is 24 characters, e.g.
+  // -2.2250738585072014e-308.
+  char buffer[32];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out->append(buffer, result.ptr);
+}
+
+void AppendJson(const templates::TEMPLATE_OBJECT_ANY& value,
+                std::string* out) {
+  if (const auto* str = std::get_if<std::string>(&value)) {
+    AppendJsonString(*str, out);
+  } else if (const auto* integer = std::get_if<int>(&value)) {
+    char buffer[16];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), *integer);
+    out->append(buffer, result.ptr);
+  } else if (const auto* number = std::get_if<double>(&value)) {
+    AppendJsonNumber(*number, out);
+  } else if (const auto* boolean = std::get_if<bool>(&value)) {
+    out->append(*boolean ? "true" : "false");
+  } else if (const auto* object = std::get_if<templates::TemplateObject>(
+                 &value)) {
+    AppendJson(*object, out);
+  } else {
+    AppendJson(std::get<templates::TemplateList>(value), out);
+  }
+}
+
+void AppendJson(const templates::TemplateObject& object, std::string* out) {
+  out->push_back('{');
+  bool first = true;
+  for (const auto& [key, value] : object) {
+    if (!first) {
+      out->push_back(',');
+    }
+    first = false;
+    AppendJsonString(key, out);
+    out->push_back(':');
+    AppendJson(value, out);
+  }
+  out->push_back('}');
+}
+
+void AppendJson(const templates::TemplateList& list, std::string* out) {
+  // The list is stored in a hash map, so put the elements in index order.
+  std::vector<std::pair<int, const templates::TEMPLATE_OBJECT_ANY*>> elements;
+  elements.reserve(list.size());
+  for (const auto& [index, value] : list) {
+    elements.emplace_back(index, &value);
+  }
+  std::sort(elements.begin(), elements.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  out->push_back('[');
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (i > 0) {
+      out->push_back(',');
+    }
+    AppendJson(*elements[i].second, out);
+  }
+  out->push_back(']');
+}
+
+absl::StatusOr<JsonDocument> JsonDocument::Parse(std::string_view json) {
+  if (json.size() >= std::numeric_limits<uint32_t>::max()) {
+    return absl::InvalidArgumentError("JSON text is too large");
+  }
+  JsonDocument document(json);
+  absl::Status status = IndexStructurals(json, &document.structurals_);
+  if (!status.ok()) {
+    return status;
+  }
+  status = CheckStructure(json, document.structurals_, &document.closing_);
+  if (!status.ok()) {
+    return status;
+  }
+  return document;
+}
+
+uint32_t JsonDocument::Skip(uint32_t index) const {
+  char c = At(index);
+  return c == '{' || c == '[' ? closing_[index] + 1 : index + 1;
+}
+
+JsonValue JsonValue::Iterator::operator*() const {
+  return JsonValue(document_, object_ ? index_ + 2 : index_);
+}
+
+JsonValue::Iterator& JsonValue::Iterator::operator++() {
+  uint32_t next = document_->Skip(object_ ? index_ + 2 : index_);
+  // Either a comma or the closing bracket, which is where end() points.
+  if (document_->At(next) == ',') {
+    ++next;
+  }
+  index_ = next;
+  return *this;
+}
+
+JsonType JsonValue::Type() const {
+  switch (document_->At(index_)) {
+    case '{': return JsonType::kObject;
+    case '[': return JsonType::kArray;
+    case '"': return JsonType::kString;
+    case 't': case 'f': return JsonType::kBool;
+    case 'n': return JsonType::kNull;
+    default: return JsonType::kNumber;
+  }
+}
+
+std::string_view JsonValue::Raw() const {
+  std::string_view json = document_->json_;
+  size_t begin = document_->structurals_[index_];
+  size_t end;
+  switch (json[begin]) {
+    case '{': case '[':
+      end = document_->structurals_[document_->closing_[index_]] + 1;
+      break;
+    case '"': {
+      bool has_escapes;
+      end = StringEnd(json, begin, &has_escapes) + 1;
+      break;
+    }
+    default:
+      end = begin + 1;
+      while (end < json.size() && !IsDelimiter(json[end])) {
+        ++end;
+      }
+  }
+  return json.substr(begin, end - begin);
+}
+
+absl::StatusOr<bool> JsonValue::GetBool() const {
+  std::string_view raw = Raw();
+  if (raw == "true") {
+    return true;
+  } else if (raw == "false") {
+    return false;
+  }
+  return absl::InvalidArgumentError("JSON value is not a boolean");
+}
+
+absl::StatusOr<int64_t> JsonValue::GetInt() const {
+  if (Type() != JsonType::kNumber) {
+    return absl::InvalidArgumentError("JSON value is not a number");
+  }
+  std::string_view raw = Raw();
+  bool integer;
+  if (!IsJsonNumber(raw, &integer)) {
+    return InvalidNumber(raw);
+  } else if (!integer) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("JSON number is not an integer: ", raw));
+  }
+  int64_t value;
+  auto result = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+  if (result.ec != std::errc()) {
+    return absl::OutOfRangeError(absl::StrCat("JSON number out of range: ", raw));
+  }
+  return value;
+}
+
+absl::StatusOr<double> JsonValue::GetDouble() const {
+  if (Type() != JsonType::kNumber) {
+    return absl::InvalidArgumentError("JSON value is not a number");
+  }
+  std::string_view raw = Raw();
+  bool integer;
+  if (!IsJsonNumber(raw, &integer)) {
+    return InvalidNumber(raw);
+  }
+  double value;
+  auto result = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+  if (result.ec != std::errc()) {
+    return absl::OutOfRangeError(absl::StrCat("JSON number out of range: ", raw));
+  }
+  return value;
+}
+
+absl::StatusOr<std::string_view> JsonValue::GetString(
+    std::string* scratch) const {
+  if (Type() != JsonType::kString) {
+    return absl::InvalidArgumentError("JSON value is not a string");
+  }
+  std::string_view json = document_->json_;
+  size_t begin = document_->structurals_[index_] + 1;
+  bool has_escapes;
+  size_t end = StringEnd(json, begin - 1, &has_escapes);
+  std::string_view contents = json.substr(begin, end - begin);
+  if (!has_escapes) {
+    return contents;
+  }
+  scratch->clear();
+  absl::Status status = UnescapeJsonString(contents, scratch);
+  if (!status.ok()) {
+    return status;
+  }
+  return std::string_view(*scratch);
+}
+
+absl::StatusOr<JsonValue> JsonValue::Find(std::string_view key) const {
+  if (Type() != JsonType::kObject) {
+    return absl::InvalidArgumentError("JSON value is not an object");
+  }
+  std::string scratch;
+  for (JsonValue value : *this) {
+    absl::StatusOr<std::string_view> name = value.Key(&scratch);
+    if (!name.ok()) {
+      return name.status();
+    }
+    if (*name == key) {
+      return value;
+    }
+  }
+  return absl::NotFoundError(absl::StrCat("No JSON member named \"", key, "\""));
+}
+
+absl::StatusOr<std::string_view> JsonValue::Key(std::string* scratch) const {
+  if (index_ < 2 || document_->At(index_ - 1) != ':') {
+    return absl::FailedPreconditionError("JSON value is not an object member");
+  }
+  return JsonValue(document_, index_ - 2).GetString(scratch);
+}
+
+JsonValue::Iterator JsonValue::begin() const {
+  char c = document_->At(index_);
+  if (c != '{' && c != '[') {
+    return end();
+  }
+  // Empty containers begin at their closing bracket.
+  return Iterator(document_, index_ + 1, c == '{');
+}
+
+JsonValue::Iterator JsonValue::end() const {
+  char c = document_->At(index_);
+  if (c != '{' && c != '[') {
+    return Iterator(document_, index_, false);
+  }
+  return Iterator(document_, document_->closing_[index_], c == '{');
+}
+
+absl::StatusOr<templates::TEMPLATE_OBJECT_ANY>
+JsonValue::ToTemplateValue() const {
+  std::string scratch;
+  return ToTemplateValue(&scratch);
+}
+
+absl::StatusOr<templates::TEMPLATE_OBJECT_ANY> JsonValue::ToTemplateValue(
+    std::string* scratch) const {
+  using templates::TEMPLATE_OBJECT_ANY;
+  switch (Type()) {
+    case JsonType::kString: {
+      absl::StatusOr<std::string_view> str = GetString(scratch);
+      if (!str.ok()) {
+        return str.status();
+      }
+      return TEMPLATE_OBJECT_ANY(std::string(*str));
+    }
+    case JsonType::kNumber: {
+      std::string_view raw = Raw();
+      bool integer;
+      if (!IsJsonNumber(raw, &integer)) {
+        return InvalidNumber(raw);
+      }
+      if (integer) {
+        int value;
+        auto result =
+            std::from_chars(raw.data(), raw.data() + raw.size(), value);
+        if (result.ec == std::errc()) {
+          return TEMPLATE_OBJECT_ANY(value);
+        }
+      }
+      absl::StatusOr<double> value = GetDouble();
+      if (!value.ok()) {
+        return value.status();
+      }
+      return TEMPLATE_OBJECT_ANY(*value);
+    }
+    case JsonType::kBool: {
+      absl::StatusOr<bool> value = GetBool();
+      if (!value.ok()) {
+        return value.status();
+      }
+      return TEMPLATE_OBJECT_ANY(*value);
+    }
+    case JsonType::kNull:
+      if (Raw() != "null") {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Invalid JSON literal: ", Raw()));
+      }
+      return TEMPLATE_OBJECT_ANY(std::string());
+    case JsonType::kObject: {
+      templates::TemplateObject object;
+      for (JsonValue member : *this) {
+        absl::StatusOr<std::string_view> key = member.Key(scratch);
+        if (!key.ok()) {
+          return key.status();
+        }
+        // The scratch buffer is reused for the value, so copy the key first.
+        std::string name(*key);
+        absl::StatusOr<TEMPLATE_OBJECT_ANY> value =
+            member.ToTemplateValue(scratch);
+        if (!value.ok()) {
+          return value.status();
+        }
+        if (!member.IsNull()) {
+          object[name] = *std::move(value);
+        }
+      }
+      return TEMPLATE_OBJECT_ANY(std::move(object));
+    }
+    case JsonType::kArray: {
+      templates::TemplateList list;
+      int index = 0;
+      for (JsonValue element : *this) {
+        absl::StatusOr<TEMPLATE_OBJECT_ANY> value =
+            element.ToTemplateValue(scratch);
+        if (!value.ok()) {
+          return value.status();
+        }
+        list[index++] = *std::move(value);
+      }
+      return TEMPLATE_OBJECT_ANY(std::move(list));
+    }
+  }
+  return absl::InternalError("Unknown JSON type");
+}
+
+absl::StatusOr<std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY>>
+JsonValue::ToTemplateContext() const {
+  if (Type() != JsonType::kObject) {
+    return absl::InvalidArgumentError("JSON value is not an object");
+  }
+  std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY> context;
+  std::string scratch;
+  for (JsonValue member : *this) {
+    absl::StatusOr<std::string_view> key = member.Key(&scratch);
+    if (!key.ok()) {
+      return key.status();
+    }
+    std::string name(*key);
+    absl::StatusOr<templates::TEMPLATE_OBJECT_ANY> value =
+        member.ToTemplateValue(&scratch);
+    if (!value.ok()) {
+      return value.status();
+    }
+    if (!member.IsNull()) {
+      context[name] = *std::move(value);
+    }
+  }
+  return context;
+}
+
+}  // namespace cppserver
@@ -0,0 +1,169 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_JSON_H_
+#define _CPPSERVER_JSON_H_
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/status/statusor.h"
+
+#include "template.h"
+
+namespace cppserver {
+
+// Appends `value` to `out` as JSON. Strings are escaped as needed and
+// otherwise copied as is, so they should be UTF-8. Doubles are written in
+// the shortest form that reads back as the same value, or as null if they
+// aren't finite. Lists are written in index order; object members are
+// written in the map's iteration order.
+//
+//    std::string body;
+//    AppendJson(templates::TemplateObject{{"id", 7}, {"tags", tags}}, &body);
+void AppendJson(const templates::TEMPLATE_OBJECT_ANY& value, std::string* out);
+void AppendJson(const templates::TemplateObject& object, std::string* out);
+void AppendJson(const templates::TemplateList& list, std::string* out);
+
+// Returns `value` encoded as JSON.
+template <typename T>
+std::string ToJson(const T& value) {
+  std::string out;
+  AppendJson(value, &out);
+  return out;
+}
+
+// Appends `str` to `out` as a quoted JSON string.
+void AppendJsonString(std::string_view str, std::string* out);
+
+// Appends `value` to `out` in its shortest round-trip form.
+void AppendJsonNumber(double value, std::string* out);
+
+class JsonDocument;
+
+enum class JsonType { kNull, kBool, kNumber, kString, kArray, kObject };
+
+// A value in a JsonDocument. Values are read on demand: nothing is decoded
+// until it's asked for, and scalars that are never read aren't checked
+// beyond their first character. Values are cheap to copy and refer to the
+// document, which must outlive them.
+class JsonValue {
+ public:
+  // Iterates over an array's elements, or an object's member values.
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = JsonValue;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = JsonValue;
+
+    JsonValue operator*() const;
+    Iterator& operator++();
+    bool operator==(const Iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+   private:
+    friend class JsonValue;
+
+    Iterator(const JsonDocument* document, uint32_t index, bool object)
+        : document_{document}, index_{index}, object_{object} {}
+
+    const JsonDocument* document_;
+    // The structural index of the element, or of the member's key.
+    uint32_t index_;
+    bool object_;
+  };
+
+  JsonType Type() const;
+  bool IsNull() const { return Type() == JsonType::kNull; }
+
+  absl::StatusOr<bool> GetBool() const;
+  absl::StatusOr<int64_t> GetInt() const;
+  absl::StatusOr<double> GetDouble() const;
+
+  // Returns the string's contents. Strings without escapes are returned as
+  // views into the document; others are unescaped into `scratch`.
+  absl::StatusOr<std::string_view> GetString(std::string* scratch) const;
+
+  // The value's JSON text, as it appears in the document.
+  std::string_view Raw() const;
+
+  // Returns the value of an object's first member named `key`, or NotFound.
+  // Members are scanned in order, skipping nested values without looking
+  // inside them.
+  absl::StatusOr<JsonValue> Find(std::string_view key) const;
+
+  // For a value reached by iterating over an object, its member name.
+  absl::StatusOr<std::string_view> Key(std::string* scratch) const;
+
+  // Arrays and objects only; other values have no elements.
+  Iterator begin() const;
+  Iterator end() const;
+
+  // Builds the template value for this value directly from the document.
+  // Integers that fit become ints and other numbers doubles. Templates have
+  // no null, so null members are left out of objects and null elements
+  // become empty strings.
+  absl::StatusOr<templates::TEMPLATE_OBJECT_ANY> ToTemplateValue() const;
+
+  // Builds a RenderTemplate context from an object's members.
+  absl::StatusOr<std::unordered_map<std::string, templates::TEMPLATE_OBJECT_ANY>>
+  ToTemplateContext() const;
+
+ private:
+  friend class JsonDocument;
+
+  JsonValue(const JsonDocument* document, uint32_t index)
+      : document_{document}, index_{index} {}
+
+  absl::StatusOr<templates::TEMPLATE_OBJECT_ANY> ToTemplateValue(
+      std::string* scratch) const;
+
+  const JsonDocument* document_;
+  // The value's position in the document's structural index.
+  uint32_t index_;
+};
+
+// A parsed JSON text. Parsing only finds the structural characters (brackets,
+// colons, commas and the starts of strings and scalars) and checks that they
+// nest properly; values are decoded when they're read through JsonValue.
+// The document refers to the text it was parsed from, and must not be moved
+// while values from it are in use.
+//
+//    auto document = JsonDocument::Parse(request.body);
+//    if (!document.ok()) { /* 400 */ }
+//    auto name = document->Root().Find("name");
+class JsonDocument {
+ public:
+  // Rejects text that isn't well-formed JSON structurally, e.g. unbalanced
+  // brackets, missing commas or unterminated strings.
+  static absl::StatusOr<JsonDocument> Parse(std::string_view json);
+
+  JsonValue Root() const { return JsonValue(this, 0); }
+
+ private:
+  friend class JsonValue;
+
+  explicit JsonDocument(std::string_view json) : json_{json} {}
+
+  char At(uint32_t index) const { return json_[structurals_[index]]; }
+
+  // The structural index just past the value at `index`.
+  uint32_t Skip(uint32_t index) const;
+
+  std::string_view json_;
+  // Offsets of the structural characters, in order.
+  std::vector<uint32_t> structurals_;
+  // For each opening bracket, the structural index of its closing bracket.
+  std::vector<uint32_t> closing_;
+};
+
+}  // namespace cppserver
+
+#endif
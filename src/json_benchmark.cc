@@ -0,0 +1,163 @@
+// Copyright 2022 Daniel Liu
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "json.h"
+#include "template.h"
+
+using cppserver::templates::TEMPLATE_OBJECT_ANY;
+using cppserver::templates::TemplateList;
+using cppserver::templates::TemplateObject;
+
+namespace {
+
+// A typical API response: a page of records with a few fields each.
+TemplateList MakeRecords(int count) {
+  TemplateList records;
+  for (int i = 0; i < count; ++i) {
+    records[i] = TemplateObject{
+      {"id", i},
+      {"name", "User \"" + std::to_string(i) + "\" of the example team"},
+      {"bio", std::string("Writes C++ and reviews pull requests.\n")},
+      {"score", i * 1.25 + 0.1},
+      {"active", i % 2 == 0},
+      {"tags", TemplateList{"admin", "reviewer", "on-call"}},
+    };
+  }
+  return records;
+}
+
+void BM_AppendJson(benchmark::State& state) {
+  TemplateList records = MakeRecords(state.range(0));
+  std::string out;
+  for (auto _ : state) {
+    out.clear();
+    cppserver::AppendJson(records, &out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * out.size());
+}
+BENCHMARK(BM_AppendJson)->Arg(10)->Arg(100)->Arg(1000);
+
+// What handlers did before: build the text with operator+, to_string and a
+// byte-at-a-time escaper.
+std::string NaiveEscape(const std::string& str) {
+  std::string escaped = "\"";
+  for (char c : str) {
+    switch (c) {
+      case '"': escaped += "\\\""; break;
+      case '\\': escaped += "\\\\"; break;
+      case '\n': escaped += "\\n"; break;
+      case '\r': escaped += "\\r"; break;
+      case '\t': escaped += "\\t"; break;
+      default: escaped += c;
+    }
+  }
+  return escaped + "\"";
+}
+
+std::string NaiveJson(const TEMPLATE_OBJECT_ANY& value) {
+  if (auto* str = std::get_if<std::string>(&value)) {
+    return NaiveEscape(*str);
+  } else if (auto* integer = std::get_if<int>(&value)) {
+    return std::to_string(*integer);
+  } else if (auto* number = std::get_if<double>(&value)) {
+    return std::to_string(*number);
+  } else if (auto* boolean = std::get_if<bool>(&value)) {
+    return *boolean ? "true" : "false";
+  } else if (auto* object = std::get_if<TemplateObject>(&value)) {
+    std::string json = "{";
+    for (const auto& [key, member] : *object) {
+      if (json.size() > 1) {
+        json += ",";
+      }
+      json += NaiveEscape(key) + ":" + NaiveJson(member);
+    }
+    return json + "}";
+  }
+  const auto& list = std::get<TemplateList>(value);
+  std::string json = "[";
+  for (int i = 0; i < static_cast<int>(list.size()); ++i) {
+    if (i > 0) {
+      json += ",";
+    }
+    json += NaiveJson(list.at(i));
+  }
+  return json + "]";
+}
+
+void BM_NaiveJson(benchmark::State& state) {
+  TEMPLATE_OBJECT_ANY records = MakeRecords(state.range(0));
+  size_t size = 0;
+  for (auto _ : state) {
+    std::string json = NaiveJson(records);
+    size = json.size();
+    benchmark::DoNotOptimize(json.data());
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_NaiveJson)->Arg(10)->Arg(100)->Arg(1000);
+
+void BM_AppendJsonString(benchmark::State& state) {
+  std::string text(state.range(0), 'a');
+  // An escape every so often, as in prose with quotes and line breaks.
+  for (size_t i = 97; i < text.size(); i += 97) {
+    text[i] = i % 2 ? '"' : '\n';
+  }
+  std::string out;
+  for (auto _ : state) {
+    out.clear();
+    cppserver::AppendJsonString(text, &out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_AppendJsonString)->Arg(64)->Arg(4096);
+
+// Request bodies are the records above, as a client would send them.
+std::string MakeRecordsJson(int count) {
+  return cppserver::ToJson(MakeRecords(count));
+}
+
+void BM_ParseJson(benchmark::State& state) {
+  std::string json = MakeRecordsJson(state.range(0));
+  for (auto _ : state) {
+    auto document = cppserver::JsonDocument::Parse(json);
+    benchmark::DoNotOptimize(document.ok());
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_ParseJson)->Arg(10)->Arg(100)->Arg(1000);
+
+// A handler that only needs one field of the last record: parse, then skip
+// straight to it.
+void BM_ParseJsonAndFind(benchmark::State& state) {
+  std::string json = MakeRecordsJson(state.range(0));
+  std::string scratch;
+  for (auto _ : state) {
+    auto document = cppserver::JsonDocument::Parse(json);
+    cppserver::JsonValue last = document->Root();
+    for (cppserver::JsonValue record : document->Root()) {
+      last = record;
+    }
+    auto name = last.Find("name")->GetString(&scratch);
+    benchmark::DoNotOptimize(name->data());
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_ParseJsonAndFind)->Arg(10)->Arg(100)->Arg(1000);
+
+void BM_ParseJsonToTemplate(benchmark::State& state) {
+  std::string json = MakeRecordsJson(state.range(0));
+  for (auto _ : state) {
+    auto document = cppserver::JsonDocument::Parse(json);
+    auto value = document->Root().ToTemplateValue();
+    benchmark::DoNotOptimize(value.ok());
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_ParseJsonToTemplate)->Arg(10)->Arg(100)->Arg(1000);
+
+}  // namespace
@@ -0,0 +1,192 @@
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+#include "json.h"
+#include "template.h"
+
+using namespace cppserver;
+using templates::TemplateList;
+using templates::TemplateObject;
+
+TEST(JsonTests, WritesScalars) {
+  EXPECT_EQ(ToJson(templates::TEMPLATE_OBJECT_ANY(42)), "42");
+  EXPECT_EQ(ToJson(templates::TEMPLATE_OBJECT_ANY(-7)), "-7");
+  EXPECT_EQ(ToJson(templates::TEMPLATE_OBJECT_ANY(true)), "true");
+  EXPECT_EQ(ToJson(templates::TEMPLATE_OBJECT_ANY(false)), "false");
+  EXPECT_EQ(ToJson(templates::TEMPLATE_OBJECT_ANY(std::string("hi"))),
+            "\"hi\"");
+}
+
+TEST(JsonTests, WritesShortestRoundTripDoubles) {
+  auto json = [](double value) {
+    std::string out;
+    AppendJsonNumber(value, &out);
+    return out;
+  };
+  EXPECT_EQ(json(123.456), "123.456");
+  EXPECT_EQ(json(0.1 + 0.2), "0.30000000000000004");
+  EXPECT_EQ(json(3.0), "3");
+  EXPECT_EQ(json(1e21), "1e+21");
+  EXPECT_EQ(json(-2.2250738585072014e-308), "-2.2250738585072014e-308");
+  EXPECT_EQ(json(std::numeric_limits<double>::infinity()), "null");
+  EXPECT_EQ(json(std::nan("")), "null");
+}
+
+TEST(JsonTests, EscapesStrings) {
+  std::string out;
+  AppendJsonString("a\"b\\c\n\t\r\b\f\x01\x1f/\xc3\xa9", &out);
+  EXPECT_EQ(out, "\"a\\\"b\\\\c\\n\\t\\r\\b\\f\\u0001\\u001f/\xc3\xa9\"");
+}
+
+TEST(JsonTests, EscapesAtEveryOffset) {
+  // Long enough to exercise the vectorized path, with the escape landing at
+  // each position within a block.
+  for (size_t offset = 0; offset < 40; ++offset) {
+    std::string input(40, 'x');
+    input[offset] = '"';
+    std::string expected = "\"" + input.substr(0, offset) + "\\\""
+        + input.substr(offset + 1) + "\"";
+    std::string out;
+    AppendJsonString(input, &out);
+    EXPECT_EQ(out, expected) << offset;
+  }
+}
+
+TEST(JsonTests, WritesListsInIndexOrder) {
+  TemplateList list;
+  for (int i = 9; i >= 0; --i) {
+    list[i] = i * 10;
+  }
+  EXPECT_EQ(ToJson(list), "[0,10,20,30,40,50,60,70,80,90]");
+  EXPECT_EQ(ToJson(TemplateList{}), "[]");
+}
+
+TEST(JsonTests, WritesNestedValues) {
+  TemplateObject object = {
+    {"tags", TemplateList{"a", "b"}},
+  };
+  EXPECT_EQ(ToJson(object), "{\"tags\":[\"a\",\"b\"]}");
+  EXPECT_EQ(ToJson(TemplateList{TemplateObject{{"id", 1}}, 2.5}),
+            "[{\"id\":1},2.5]");
+}
+
+TEST(JsonTests, ParsesValuesOnDemand) {
+  std::string json = R"( {"id": 7, "name": "Ada", "score": -1.5e2,
+      "admin": false, "tags": ["x", "y"], "none": null} )";
+  auto document = JsonDocument::Parse(json);
+  ASSERT_TRUE(document.ok()) << document.status();
+  JsonValue root = document->Root();
+  EXPECT_EQ(root.Type(), JsonType::kObject);
+
+  std::string scratch;
+  EXPECT_EQ(*root.Find("id")->GetInt(), 7);
+  EXPECT_EQ(*root.Find("name")->GetString(&scratch), "Ada");
+  EXPECT_EQ(*root.Find("score")->GetDouble(), -150.0);
+  EXPECT_EQ(*root.Find("admin")->GetBool(), false);
+  EXPECT_TRUE(root.Find("none")->IsNull());
+  EXPECT_EQ(root.Find("tags")->Raw(), "[\"x\", \"y\"]");
+  EXPECT_EQ(root.Find("missing").status().code(), absl::StatusCode::kNotFound);
+  EXPECT_FALSE(root.Find("name")->GetInt().ok());
+  EXPECT_FALSE(root.Find("score")->GetInt().ok());
+
+  std::vector<std::string> keys;
+  for (JsonValue member : root) {
+    keys.emplace_back(*member.Key(&scratch));
+  }
+  EXPECT_EQ(keys, (std::vector<std::string>{"id", "name", "score", "admin",
+                                            "tags", "none"}));
+
+  std::vector<std::string> tags;
+  for (JsonValue tag : *root.Find("tags")) {
+    tags.emplace_back(*tag.GetString(&scratch));
+  }
+  EXPECT_EQ(tags, (std::vector<std::string>{"x", "y"}));
+}
+
+TEST(JsonTests, UnescapesStringsOnlyWhenNeeded) {
+  std::string json = R"(["plain", "a\"b\\c\/\né😀"])";
+  auto document = JsonDocument::Parse(json);
+  ASSERT_TRUE(document.ok()) << document.status();
+  std::string scratch;
+  auto it = document->Root().begin();
+  std::string_view plain = *(*it).GetString(&scratch);
+  EXPECT_EQ(plain, "plain");
+  // Unescaped strings point into the document.
+  EXPECT_EQ(plain.data(), json.data() + 2);
+  ++it;
+  EXPECT_EQ(*(*it).GetString(&scratch), "a\"b\\c/\n\xc3\xa9\xf0\x9f\x98\x80");
+
+  auto bad = JsonDocument::Parse(R"(["\ud83d", "\q"])");
+  ASSERT_TRUE(bad.ok());
+  for (JsonValue value : bad->Root()) {
+    EXPECT_FALSE(value.GetString(&scratch).ok());
+  }
+}
+
+TEST(JsonTests, HandlesStringsAcrossBlocks) {
+  // Quotes, escapes and runs of backslashes landing on every offset around
+  // the 64-byte block boundaries.
+  for (size_t padding = 0; padding < 140; ++padding) {
+    std::string json = "{\"" + std::string(padding, 'k') + "\":\"a\\\\\\\"{,"
+        + std::string(padding % 7, '\\') + std::string(padding % 7, '\\')
+        + "\",\"n\":[1,{}]}";
+    auto document = JsonDocument::Parse(json);
+    ASSERT_TRUE(document.ok()) << padding << ": " << document.status();
+    std::string scratch;
+    auto key = std::string(padding, 'k');
+    std::string expected = "a\\\"{," + std::string(padding % 7, '\\');
+    EXPECT_EQ(*document->Root().Find(key)->GetString(&scratch), expected)
+        << padding;
+    EXPECT_EQ(document->Root().Find("n")->Raw(), "[1,{}]") << padding;
+  }
+}
+
+TEST(JsonTests, RejectsMalformedText) {
+  for (std::string_view json : {"", " ", "{", "[1,]", "{\"a\" 1}", "{\"a\":}",
+                                "[1 2]", "{1:2}", "[1]]", "\"abc", "[\"a\nb\"]",
+                                "{\"a\":1,}", "[]{}", "x", "[\\\"a\"]"}) {
+    EXPECT_FALSE(JsonDocument::Parse(json).ok()) << json;
+  }
+  EXPECT_FALSE(JsonDocument::Parse(std::string(2000, '[')
+                                   + std::string(2000, ']')).ok());
+  // Scalars are checked when they're read.
+  auto document = JsonDocument::Parse("[tru, 01, -, 1.]");
+  ASSERT_TRUE(document.ok());
+  for (JsonValue value : document->Root()) {
+    EXPECT_FALSE(value.ToTemplateValue().ok()) << value.Raw();
+  }
+}
+
+TEST(JsonTests, BuildsTemplateContexts) {
+  auto document = JsonDocument::Parse(R"({"user": {"name": "Ada",
+      "langs": ["C++", "Go"], "age": 36, "big": 1e100, "id": 12345678901,
+      "active": true, "manager": null}, "items": [1, null]})");
+  ASSERT_TRUE(document.ok()) << document.status();
+  auto context = document->Root().ToTemplateContext();
+  ASSERT_TRUE(context.ok()) << context.status();
+
+  const auto& user = std::get<TemplateObject>(context->at("user"));
+  EXPECT_EQ(std::get<std::string>(user.at("name")), "Ada");
+  EXPECT_EQ(std::get<int>(user.at("age")), 36);
+  EXPECT_EQ(std::get<double>(user.at("big")), 1e100);
+  EXPECT_EQ(std::get<double>(user.at("id")), 12345678901.0);
+  EXPECT_EQ(std::get<bool>(user.at("active")), true);
+  EXPECT_FALSE(user.ContainsKey("manager"));
+  const auto& items = std::get<TemplateList>(context->at("items"));
+  EXPECT_EQ(std::get<int>(items.at(0)), 1);
+  EXPECT_EQ(std::get<std::string>(items.at(1)), "");
+
+  auto rendered = templates::RenderTemplate(
+      "{{user.name}}: {% for item in items %}[{{item}}]{% endfor %}",
+      *context);
+  ASSERT_TRUE(rendered.ok()) << rendered.status();
+  EXPECT_EQ(*rendered, "Ada: [1][]");
+}
@@ -0,0 +1,439 @@
+// Copyright 2022 Daniel Liu
+
+// A wrk-style HTTP load generator for measuring a running server end to end.
+//
+// Usage: loadgen [flags]
+//
+//   --host=127.0.0.1       Server address.
+//   --port=8000            Server port.
+//   --unix=PATH            Connect to the server's Unix socket at PATH
+//                          instead of --host and --port, e.g. to compare it
+//                          with loopback TCP.
+//   --connections=8        Concurrent connections, one thread each.
+//   --duration=10          Seconds to run for.
+//   --rate=0               Total requests per second. 0 sends as fast as
+//                          responses come back (closed loop); otherwise
+//                          requests are sent on a fixed schedule (open loop)
+//                          and latency is measured from when each request
+//                          was due, so a stalled server can't hide its delay.
+//   --pipeline=1           Requests in flight per connection.
+//   --keepalive=true       Reuse connections. With false, every request
+//                          uses a new connection.
+//   --target=PATH[:WEIGHT] Request PATH with relative WEIGHT. May be
+//                          repeated. Defaults to the routes served by main.
+//   --format=text|json     Report format.
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+#include "metrics.h"
+#include "socket.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Target {
+  std::string path;
+  int weight;
+};
+
+struct Options {
+  std::string host = "127.0.0.1";
+  in_port_t port = 8000;
+  std::string unix_path;
+  int connections = 8;
+  int duration_seconds = 10;
+  double rate = 0;
+  int pipeline = 1;
+  bool keepalive = true;
+  std::vector<Target> targets;
+  bool json = false;
+};
+
+// Exercises the static file, template and 404 paths of main.
+const std::vector<Target> kDefaultTargets = {
+  {"/", 4},
+  {"/path/loadgen/", 4},
+  {"/missing", 1},
+};
+
+// How long to wait for outstanding responses once the run is over.
+constexpr auto kResponseGracePeriod = std::chrono::seconds(1);
+
+// Totals across all connections.
+struct Results {
+  std::atomic<uint64_t> responses {0};
+  std::atomic<uint64_t> bytes {0};
+  std::atomic<uint64_t> errors {0};
+  std::atomic<uint64_t> connects {0};
+  std::atomic<uint64_t> connect_errors {0};
+  std::array<std::atomic<uint64_t>, 5> status_classes {};
+  cppserver::Histogram latency;
+};
+
+struct Response {
+  int status;
+  size_t size;
+  // The server will close the connection after this response.
+  bool close;
+};
+
+// Incrementally parses responses from the bytes received on a connection.
+class ResponseParser {
+ public:
+  void Append(const char* data, size_t size) { buffer_.append(data, size); }
+
+  // Removes the next complete response from the buffer, if one has arrived.
+  // Malformed responses have a status of -1.
+  std::optional<Response> Next() {
+    size_t header_end = buffer_.find("\r\n\r\n");
+    if (header_end == std::string::npos) {
+      return std::nullopt;
+    }
+    std::string_view headers(buffer_.data(), header_end);
+
+    Response response = {0, 0, false};
+    size_t space = headers.find(' ');
+    if (space == std::string_view::npos
+        || !absl::SimpleAtoi(headers.substr(space + 1, 3), &response.status)) {
+      response.status = -1;
+    }
+
+    size_t content_length = 0;
+    size_t line_start = headers.find("\r\n");
+    while (line_start != std::string_view::npos) {
+      line_start += 2;
+      size_t line_end = headers.find("\r\n", line_start);
+      std::string_view line = headers.substr(line_start, line_end - line_start);
+      size_t colon = line.find(':');
+      std::string_view name = line.substr(0, colon);
+      std::string_view value = colon == std::string_view::npos
+          ? "" : absl::StripAsciiWhitespace(line.substr(colon + 1));
+      if (absl::EqualsIgnoreCase(name, "content-length")) {
+        if (!absl::SimpleAtoi(value, &content_length)) {
+          response.status = -1;
+        }
+      } else if (absl::EqualsIgnoreCase(name, "connection")) {
+        response.close = absl::EqualsIgnoreCase(value, "close");
+      }
+      line_start = line_end;
+    }
+
+    response.size = header_end + 4 + content_length;
+    if (buffer_.size() < response.size) {
+      return std::nullopt;
+    }
+    buffer_.erase(0, response.size);
+    return response;
+  }
+
+ private:
+  std::string buffer_;
+};
+
+std::vector<std::string> BuildRequests(const Options& options) {
+  std::vector<std::string> requests;
+  for (const auto& target : options.targets) {
+    requests.push_back(absl::StrCat(
+        "GET ", target.path, " HTTP/1.1\r\n",
+        "Host: ", options.host, ":", options.port, "\r\n",
+        "User-Agent: cppserver-loadgen\r\n",
+        "Accept: */*\r\n",
+        "Connection: ", options.keepalive ? "keep-alive" : "close", "\r\n",
+        "\r\n"));
+  }
+  return requests;
+}
+
+void RunConnection(const Options& options, int index,
+                   const std::vector<std::string>& requests,
+                   Clock::time_point start, Clock::time_point deadline,
+                   Results* results) {
+  std::mt19937 rng(index);
+  std::vector<int> weights;
+  for (const auto& target : options.targets) {
+    weights.push_back(target.weight);
+  }
+  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+  // In open loop, each connection sends its share of the rate, staggered so
+  // that connections don't send in lockstep.
+  Clock::duration interval {};
+  Clock::time_point next_send = start;
+  if (options.rate > 0) {
+    interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.connections / options.rate));
+    next_send += interval * index / options.connections;
+  }
+
+  // The Unix socket path was checked when parsing flags.
+  bool unix_socket = !options.unix_path.empty();
+  cppserver::SocketSockAddr address = unix_socket
+      ? *cppserver::SocketSockAddr::Unix(options.unix_path)
+      : cppserver::SocketSockAddr(options.host, options.port);
+
+  while (Clock::now() < deadline) {
+    cppserver::Socket socket(unix_socket ? cppserver::SocketDomain::kUnix
+                                         : cppserver::SocketDomain::kIPV4,
+                             cppserver::SocketType::kTCP);
+    socket.Connect(address);
+    if (!socket) {
+      results->connect_errors.fetch_add(1, std::memory_order_relaxed);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+    results->connects.fetch_add(1, std::memory_order_relaxed);
+
+    ResponseParser parser;
+    // When each in-flight request was due to be sent.
+    std::deque<Clock::time_point> in_flight;
+    int sent_on_connection = 0;
+    bool open = true;
+    // Set once the server says it will close the connection.
+    bool closing = false;
+
+    while (open) {
+      auto now = Clock::now();
+      bool may_send = now < deadline && !closing
+          && static_cast<int>(in_flight.size()) < options.pipeline
+          && (options.keepalive || sent_on_connection == 0);
+
+      if (may_send && (options.rate <= 0 || now >= next_send)) {
+        const std::string& request = requests[pick(rng)];
+        struct iovec iov = {const_cast<char*>(request.data()), request.size()};
+        if (socket.SendVector(&iov, 1, MSG_NOSIGNAL) < 0) {
+          break;
+        }
+        in_flight.push_back(options.rate > 0 ? next_send : now);
+        next_send += interval;
+        ++sent_on_connection;
+        continue;
+      }
+
+      if (in_flight.empty()) {
+        if (now >= deadline) {
+          break;
+        }
+        if (!may_send) {
+          // The connection is closing; start a new one.
+          break;
+        }
+        std::this_thread::sleep_until(next_send);
+        continue;
+      }
+
+      // Wait for a response, waking up when the next request is due. Stop
+      // waiting for responses a while after the run ends.
+      auto wake = deadline + kResponseGracePeriod;
+      if (now >= wake) {
+        break;
+      }
+      if (may_send && options.rate > 0) {
+        wake = std::min(wake, next_send);
+      }
+      int timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+          wake - now).count();
+      struct pollfd pfd = {socket.GetFD(), POLLIN, 0};
+      if (poll(&pfd, 1, timeout_ms) == 0) {
+        continue;
+      }
+
+      auto received = socket.Receive<char>(16384);
+      if (!received || received->second <= 0) {
+        open = false;
+      } else {
+        parser.Append(received->first.get(), received->second);
+      }
+
+      auto done = Clock::now();
+      std::optional<Response> response;
+      while (!in_flight.empty() && (response = parser.Next())) {
+        int status = response->status;
+        if (status >= 100 && status < 600) {
+          results->status_classes[status / 100 - 1].fetch_add(
+              1, std::memory_order_relaxed);
+        } else {
+          results->errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        results->latency.Record(done - in_flight.front());
+        results->responses.fetch_add(1, std::memory_order_relaxed);
+        results->bytes.fetch_add(response->size, std::memory_order_relaxed);
+        in_flight.pop_front();
+        closing = closing || response->close;
+      }
+    }
+
+    // Requests still in flight when the connection closed were never
+    // answered, e.g. pipelined requests after a `Connection: close`.
+    results->errors.fetch_add(in_flight.size(), std::memory_order_relaxed);
+  }
+}
+
+void Report(const Options& options, const Results& results, double seconds) {
+  auto latency = results.latency.Collect();
+  uint64_t responses = results.responses.load();
+  double throughput = responses / seconds;
+  double mbps = results.bytes.load() / seconds / (1 << 20);
+  auto us = [&](double quantile) {
+    return latency.Quantile(quantile) / 1000.0;
+  };
+  uint64_t classes[5];
+  for (int i = 0; i < 5; ++i) {
+    classes[i] = results.status_classes[i].load();
+  }
+
+  if (options.json) {
+    printf("{\"connections\":%d,\"duration_s\":%.3f,\"rate\":%.1f,"
+           "\"pipeline\":%d,\"keepalive\":%s,\"responses\":%llu,"
+           "\"requests_per_s\":%.1f,\"mib_per_s\":%.3f,\"errors\":%llu,"
+           "\"connects\":%llu,\"connect_errors\":%llu,"
+           "\"status\":{\"1xx\":%llu,\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,"
+           "\"5xx\":%llu},\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,"
+           "\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+           options.connections, seconds, options.rate, options.pipeline,
+           options.keepalive ? "true" : "false",
+           static_cast<unsigned long long>(responses), throughput, mbps,
+           static_cast<unsigned long long>(results.errors.load()),
+           static_cast<unsigned long long>(results.connects.load()),
+           static_cast<unsigned long long>(results.connect_errors.load()),
+           static_cast<unsigned long long>(classes[0]),
+           static_cast<unsigned long long>(classes[1]),
+           static_cast<unsigned long long>(classes[2]),
+           static_cast<unsigned long long>(classes[3]),
+           static_cast<unsigned long long>(classes[4]), us(0.5), us(0.9),
+           us(0.99), us(0.999), us(1.0));
+    return;
+  }
+
+  printf("%d connections, %.1fs, pipeline %d, %s, %s\n", options.connections,
+         seconds, options.pipeline,
+         options.keepalive ? "keep-alive" : "connection per request",
+         options.rate > 0 ? absl::StrCat(options.rate, " req/s offered").c_str()
+                          : "closed loop");
+  printf("  %llu responses, %.1f req/s, %.2f MiB/s\n",
+         static_cast<unsigned long long>(responses), throughput, mbps);
+  printf("  status 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu\n",
+         static_cast<unsigned long long>(classes[1]),
+         static_cast<unsigned long long>(classes[2]),
+         static_cast<unsigned long long>(classes[3]),
+         static_cast<unsigned long long>(classes[4]));
+  printf("  %llu errors, %llu connects, %llu failed connects\n",
+         static_cast<unsigned long long>(results.errors.load()),
+         static_cast<unsigned long long>(results.connects.load()),
+         static_cast<unsigned long long>(results.connect_errors.load()));
+  printf("  latency p50 %.1fus, p90 %.1fus, p99 %.1fus, p99.9 %.1fus, "
+         "max %.1fus\n", us(0.5), us(0.9), us(0.99), us(0.999), us(1.0));
+}
+
+bool ParseFlag(std::string_view arg, Options* options) {
+  size_t equals = arg.find('=');
+  if (!absl::StartsWith(arg, "--") || equals == std::string_view::npos) {
+    return false;
+  }
+  std::string_view name = arg.substr(2, equals - 2);
+  std::string_view value = arg.substr(equals + 1);
+
+  if (name == "host") {
+    options->host = std::string(value);
+    return true;
+  } else if (name == "port") {
+    int port;
+    if (!absl::SimpleAtoi(value, &port) || port <= 0 || port > 65535) {
+      return false;
+    }
+    options->port = port;
+    return true;
+  } else if (name == "unix") {
+    options->unix_path = std::string(value);
+    return cppserver::SocketSockAddr::Unix(value).ok();
+  } else if (name == "connections") {
+    return absl::SimpleAtoi(value, &options->connections)
+        && options->connections > 0;
+  } else if (name == "duration") {
+    return absl::SimpleAtoi(value, &options->duration_seconds)
+        && options->duration_seconds > 0;
+  } else if (name == "rate") {
+    return absl::SimpleAtod(value, &options->rate) && options->rate >= 0;
+  } else if (name == "pipeline") {
+    return absl::SimpleAtoi(value, &options->pipeline)
+        && options->pipeline > 0;
+  } else if (name == "keepalive") {
+    return absl::SimpleAtob(value, &options->keepalive);
+  } else if (name == "target") {
+    Target target = {std::string(value), 1};
+    size_t colon = value.rfind(':');
+    if (colon != std::string_view::npos) {
+      target.path = std::string(value.substr(0, colon));
+      if (!absl::SimpleAtoi(value.substr(colon + 1), &target.weight)
+          || target.weight <= 0) {
+        return false;
+      }
+    }
+    options->targets.push_back(std::move(target));
+    return !options->targets.back().path.empty();
+  } else if (name == "format") {
+    options->json = value == "json";
+    return value == "json" || value == "text";
+  }
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    if (!ParseFlag(argv[i], &options)) {
+      fprintf(stderr, "Invalid flag %s; see the top of loadgen.cc for usage\n",
+              argv[i]);
+      return 2;
+    }
+  }
+  if (options.targets.empty()) {
+    options.targets = kDefaultTargets;
+  }
+  if (!options.keepalive) {
+    options.pipeline = 1;
+  }
+
+  std::vector<std::string> requests = BuildRequests(options);
+  Results results;
+
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::seconds(options.duration_seconds);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options.connections; ++i) {
+    threads.emplace_back(RunConnection, std::cref(options), i,
+                         std::cref(requests), start, deadline, &results);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  Report(options, results, seconds);
+  return results.responses.load() > 0 ? 0 : 1;
+}
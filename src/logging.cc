@@ -0,0 +1,182 @@
+// Copyright 2022 Daniel Liu
+
+#include "logging.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log_sink.h"
+#include "absl/strings/str_cat.h"
+
+namespace cppserver {
+
+namespace {
+
+std::atomic<uint64_t> next_sink_id {1};
+
+}  // namespace
+
+AsyncLogSink::AsyncLogSink(int fd)
+    : fd_{fd},
+      id_{next_sink_id.fetch_add(1, std::memory_order_relaxed)} {
+  drain_thread_ = std::thread(&AsyncLogSink::Run, this);
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_one();
+  drain_thread_.join();
+  Flush();
+}
+
+AsyncLogSink::Ring* AsyncLogSink::ThreadRing() {
+  thread_local RingLease lease;
+  if (lease.sink_id == id_) {
+    return lease.ring.get();
+  }
+
+  if (lease.ring) {
+    lease.ring->orphaned.store(true, std::memory_order_release);
+  }
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  if (!free_rings_.empty()) {
+    lease.ring = std::move(free_rings_.back());
+    free_rings_.pop_back();
+    lease.ring->orphaned.store(false, std::memory_order_relaxed);
+  } else {
+    lease.ring = std::make_shared<Ring>();
+  }
+  rings_.push_back(lease.ring);
+  lease.sink_id = id_;
+  return lease.ring.get();
+}
+
+void AsyncLogSink::Send(const absl::LogEntry& entry) {
+  absl::string_view severity = absl::LogSeverityName(entry.log_severity());
+  absl::string_view message = entry.text_message_with_newline();
+
+  if (entry.log_severity() == absl::LogSeverity::kFatal) {
+    Flush();
+    WriteAll(absl::StrCat("[", severity, "] ", message));
+    return;
+  }
+
+  Ring* ring = ThreadRing();
+  size_t length = std::min(severity.size() + 3 + message.size(), kring_size_);
+
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  uint64_t head = ring->head.load(std::memory_order_acquire);
+  if (kring_size_ - (tail - head) < length) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Copy the pieces in, wrapping around the end of the buffer as needed.
+  uint64_t position = tail;
+  size_t remaining = length;
+  auto append = [&](std::string_view piece) {
+    piece = piece.substr(0, std::min(piece.size(), remaining));
+    size_t index = position % kring_size_;
+    size_t first = std::min(piece.size(), kring_size_ - index);
+    std::memcpy(ring->data.get() + index, piece.data(), first);
+    std::memcpy(ring->data.get(), piece.data() + first, piece.size() - first);
+    position += piece.size();
+    remaining -= piece.size();
+  };
+  append("[");
+  append(severity);
+  append("] ");
+  append(message);
+  if (length == kring_size_) {
+    // Truncated; keep the line terminated.
+    ring->data[(tail + length - 1) % kring_size_] = '\n';
+  }
+
+  ring->tail.store(tail + length, std::memory_order_release);
+}
+
+void AsyncLogSink::DrainInto(std::string& batch) {
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  for (auto it = rings_.begin(); it != rings_.end();) {
+    Ring* ring = it->get();
+    // Read `orphaned` first: if it's set, the owning thread is gone and the
+    // tail read below is final.
+    bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+
+    size_t index = head % kring_size_;
+    size_t length = tail - head;
+    size_t first = std::min(length, kring_size_ - index);
+    batch.append(ring->data.get() + index, first);
+    batch.append(ring->data.get(), length - first);
+    ring->head.store(tail, std::memory_order_release);
+
+    uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      dropped_total_.fetch_add(dropped, std::memory_order_relaxed);
+      absl::StrAppend(&batch, "[WARNING] Dropped ", dropped,
+                      " log messages; log buffer full\n");
+    }
+
+    if (orphaned) {
+      free_rings_.push_back(std::move(*it));
+      it = rings_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void AsyncLogSink::WriteAll(const std::string& batch) {
+  size_t written = 0;
+  while (written < batch.size()) {
+    ssize_t result = write(fd_, batch.data() + written, batch.size() - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    written += result;
+  }
+}
+
+void AsyncLogSink::Flush() {
+  std::lock_guard<std::mutex> lock(drain_mutex_);
+  std::string batch;
+  DrainInto(batch);
+  WriteAll(batch);
+}
+
+void AsyncLogSink::Run() {
+  std::string batch;
+  batch.reserve(kring_size_);
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(stop_mutex_);
+      if (stop_cv_.wait_for(lock, kdrain_interval_, [this] { return stopping_; })) {
+        return;
+      }
+    }
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    batch.clear();
+    DrainInto(batch);
+    WriteAll(batch);
+  }
+}
+
+}  // namespace cppserver
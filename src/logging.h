@@ -0,0 +1,164 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_LOGGING_H_
+#define _CPPSERVER_LOGGING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/log.h"
+#include "absl/log/log_sink.h"
+
+// Messages below this severity are compiled out of CPPSERVER_LOG entirely.
+// Build with e.g. `--copt=-DCPPSERVER_MIN_LOG_LEVEL=1` to drop INFO.
+#ifndef CPPSERVER_MIN_LOG_LEVEL
+#define CPPSERVER_MIN_LOG_LEVEL 0
+#endif
+
+// Like LOG(severity), but checks the runtime minimum severity before
+// formatting anything, so a disabled message costs a single branch. Use this
+// on hot paths such as per-request logging.
+//
+//    CPPSERVER_LOG(INFO) << "Matched endpoint " << target;
+#define CPPSERVER_LOG(severity)                                              \
+  if (!::cppserver::IsLogSeverityEnabled(                                    \
+          ::cppserver::internal::kLogSeverity##severity)) {                  \
+  } else                                                                     \
+    LOG(severity)
+
+namespace cppserver {
+
+namespace internal {
+
+// Maps the severity names used with LOG to absl::LogSeverity values.
+constexpr absl::LogSeverity kLogSeverityINFO = absl::LogSeverity::kInfo;
+constexpr absl::LogSeverity kLogSeverityWARNING = absl::LogSeverity::kWarning;
+constexpr absl::LogSeverity kLogSeverityERROR = absl::LogSeverity::kError;
+constexpr absl::LogSeverity kLogSeverityFATAL = absl::LogSeverity::kFatal;
+
+inline std::atomic<int> min_log_severity {
+    static_cast<int>(absl::LogSeverity::kInfo)};
+
+}  // namespace internal
+
+// Sets the minimum severity logged through CPPSERVER_LOG.
+inline void SetMinLogSeverity(absl::LogSeverity severity) {
+  internal::min_log_severity.store(static_cast<int>(severity),
+                                   std::memory_order_relaxed);
+}
+
+inline bool IsLogSeverityEnabled(absl::LogSeverity severity) {
+  return static_cast<int>(severity) >= CPPSERVER_MIN_LOG_LEVEL
+      && static_cast<int>(severity)
+          >= internal::min_log_severity.load(std::memory_order_relaxed);
+}
+
+// A log sink that keeps I/O off the logging thread. Each thread formats its
+// messages into its own lock-free ring buffer, and a background thread drains
+// all buffers in batches with a single write. If a thread's buffer is full,
+// its messages are dropped and counted, and the drop count is reported in
+// the log once the buffer drains.
+//
+// FATAL messages are written synchronously, since the process is about to
+// abort.
+class AsyncLogSink : public absl::LogSink {
+ public:
+  // Writes log lines to `fd`, which isn't closed by the sink.
+  explicit AsyncLogSink(int fd);
+
+  // Stops the background thread after writing out everything buffered.
+  ~AsyncLogSink() override;
+
+  AsyncLogSink(const AsyncLogSink&) = delete;
+  AsyncLogSink& operator=(const AsyncLogSink&) = delete;
+
+  void Send(const absl::LogEntry& entry) override;
+
+  // Writes out everything buffered so far.
+  void Flush() override;
+
+  // Returns the total number of messages dropped because a buffer was full,
+  // as of the last time the buffers were drained.
+  uint64_t DroppedCount() const {
+    return dropped_total_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Per-thread buffer size. Messages longer than this are truncated.
+  static constexpr size_t kring_size_ = 64 * 1024;
+
+  // How often the background thread polls the buffers when idle.
+  static constexpr auto kdrain_interval_ = std::chrono::milliseconds(10);
+
+  // Single-producer, single-consumer byte ring. Only whole lines are
+  // published, so the consumer can forward any committed prefix verbatim.
+  struct Ring {
+    std::unique_ptr<char[]> data = std::make_unique<char[]>(kring_size_);
+
+    // Monotonic positions; the index into `data` is position % kring_size_.
+    alignas(64) std::atomic<uint64_t> head {0};  // Written by the consumer.
+    alignas(64) std::atomic<uint64_t> tail {0};  // Written by the producer.
+
+    std::atomic<uint64_t> dropped {0};
+
+    // Set when the owning thread exits, so the ring can be reused once
+    // drained.
+    std::atomic<bool> orphaned {false};
+  };
+
+  // Hands the calling thread's ring back to the sink when the thread exits.
+  struct RingLease {
+    ~RingLease() {
+      if (ring) {
+        ring->orphaned.store(true, std::memory_order_release);
+      }
+    }
+
+    uint64_t sink_id = 0;
+    std::shared_ptr<Ring> ring;
+  };
+
+  // Returns the calling thread's ring, registering one on first use.
+  Ring* ThreadRing();
+
+  // Appends the contents of every ring to `batch`.
+  void DrainInto(std::string& batch);
+
+  void WriteAll(const std::string& batch);
+
+  void Run();
+
+  int fd_;
+
+  // Distinguishes this sink from earlier ones in threads' leases.
+  uint64_t id_;
+
+  // Guards `rings_` and `free_rings_`; only taken when a thread first logs
+  // and by the consumer.
+  std::mutex rings_mutex_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::vector<std::shared_ptr<Ring>> free_rings_;
+
+  // Serializes consumers (the background thread and Flush).
+  std::mutex drain_mutex_;
+
+  std::atomic<uint64_t> dropped_total_ {0};
+
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_ = false;
+
+  std::thread drain_thread_;
+};
+
+}  // namespace cppserver
+
+#endif
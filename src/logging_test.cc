@@ -0,0 +1,186 @@
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "gtest/gtest.h"
+
+#include "logging.h"
+
+using namespace cppserver;
+
+namespace {
+
+// A sink writing to a temporary file, whose lines can be read back once the
+// sink is gone.
+class SinkFile {
+ public:
+  explicit SinkFile(const std::string& name)
+      : path_{testing::TempDir() + name} {
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    EXPECT_GE(fd_, 0);
+    sink_ = std::make_unique<AsyncLogSink>(fd_);
+  }
+
+  ~SinkFile() {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  AsyncLogSink& sink() { return *sink_; }
+
+  // Destroys the sink, which writes out everything buffered, and returns
+  // what it wrote. If `dropped` is set, flushes first to count every drop.
+  std::vector<std::string> Finish(uint64_t* dropped = nullptr) {
+    if (dropped) {
+      sink_->Flush();
+      *dropped = sink_->DroppedCount();
+    }
+    sink_.reset();
+    std::string contents;
+    char buffer[64 * 1024];
+    ssize_t result;
+    off_t offset = 0;
+    while ((result = pread(fd_, buffer, sizeof(buffer), offset)) > 0) {
+      contents.append(buffer, result);
+      offset += result;
+    }
+    EXPECT_TRUE(contents.empty() || contents.back() == '\n');
+    std::vector<std::string> lines = absl::StrSplit(contents, '\n');
+    lines.pop_back();
+    return lines;
+  }
+
+ private:
+  std::string path_;
+  int fd_;
+  std::unique_ptr<AsyncLogSink> sink_;
+};
+
+// Returns the drop count reported by a "Dropped N log messages" line, or 0.
+uint64_t ReportedDrops(const std::string& line) {
+  std::vector<std::string> words = absl::StrSplit(line, ' ');
+  uint64_t dropped = 0;
+  if (words.size() > 2 && words[0] == "[WARNING]" && words[1] == "Dropped") {
+    EXPECT_TRUE(absl::SimpleAtoi(words[2], &dropped)) << line;
+  }
+  return dropped;
+}
+
+}  // namespace
+
+TEST(AsyncLogSinkTests, KeepsEachThreadsLinesInOrder) {
+  // Each thread writes several times its ring's size, so its ring wraps
+  // around many times and may overflow.
+  constexpr int kThreads = 4;
+  constexpr int kMessages = 20000;
+  SinkFile file("logging_test_order.log");
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kMessages; ++i) {
+        LOG(INFO).ToSinkOnly(&file.sink()) << "thread " << t << " message "
+                                           << i;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  uint64_t dropped;
+  auto lines = file.Finish(&dropped);
+  std::vector<int> last(kThreads, -1);
+  uint64_t received = 0;
+  uint64_t reported = 0;
+  for (const auto& line : lines) {
+    if (uint64_t drops = ReportedDrops(line)) {
+      reported += drops;
+      continue;
+    }
+    std::vector<std::string> words = absl::StrSplit(line, ' ');
+    ASSERT_EQ(words.size(), 5) << line;
+    EXPECT_EQ(words[0], "[INFO]");
+    int t, i;
+    ASSERT_TRUE(absl::SimpleAtoi(words[2], &t) && t >= 0 && t < kThreads);
+    ASSERT_TRUE(absl::SimpleAtoi(words[4], &i));
+    EXPECT_GT(i, last[t]) << line;
+    last[t] = i;
+    ++received;
+  }
+  EXPECT_EQ(received + dropped, uint64_t{kThreads} * kMessages);
+  EXPECT_EQ(reported, dropped);
+}
+
+TEST(AsyncLogSinkTests, CountsDropsWhenFull) {
+  // Far more than a ring holds, faster than the sink drains it.
+  constexpr int kMessages = 200;
+  SinkFile file("logging_test_drops.log");
+  std::string message(16 * 1024, 'x');
+  for (int i = 0; i < kMessages; ++i) {
+    LOG(INFO).ToSinkOnly(&file.sink()) << message;
+  }
+
+  uint64_t dropped;
+  auto lines = file.Finish(&dropped);
+  EXPECT_GT(dropped, 0);
+  uint64_t received = 0;
+  uint64_t reported = 0;
+  for (const auto& line : lines) {
+    if (uint64_t drops = ReportedDrops(line)) {
+      reported += drops;
+    } else {
+      EXPECT_EQ(line, "[INFO] " + message);
+      ++received;
+    }
+  }
+  EXPECT_EQ(received + dropped, kMessages);
+  EXPECT_EQ(reported, dropped);
+}
+
+TEST(AsyncLogSinkTests, TruncatesLongMessages) {
+  SinkFile file("logging_test_truncate.log");
+  // Logged from a new thread, so it starts with an empty ring.
+  std::thread([&] {
+    LOG(WARNING).ToSinkOnly(&file.sink()) << std::string(100 * 1024, 'y');
+    LOG(INFO).ToSinkOnly(&file.sink()) << "after";
+  }).join();
+
+  uint64_t dropped;
+  auto lines = file.Finish(&dropped);
+  ASSERT_GE(lines.size(), 1);
+  // The line, with its newline, fills the ring exactly.
+  EXPECT_EQ(lines[0].size() + 1, 64 * 1024);
+  EXPECT_TRUE(absl::StartsWith(lines[0], "[WARNING] yyy"));
+  EXPECT_EQ(lines[0].find_first_not_of('y', 10), std::string::npos);
+  // The next message either fits after a drain or is counted.
+  bool logged = std::find(lines.begin(), lines.end(), "[INFO] after")
+      != lines.end();
+  EXPECT_EQ(logged ? 0 : 1, dropped);
+}
+
+TEST(AsyncLogSinkTests, DrainsOnShutdown) {
+  SinkFile file("logging_test_shutdown.log");
+  std::thread([&] {
+    for (int i = 0; i < 100; ++i) {
+      LOG(INFO).ToSinkOnly(&file.sink()) << "line " << i;
+    }
+  }).join();
+
+  // Nothing waits for the background thread before the sink is destroyed.
+  auto lines = file.Finish();
+  ASSERT_EQ(lines.size(), 100);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(lines[i], "[INFO] line " + std::to_string(i));
+  }
+}
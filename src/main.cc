@@ -1,60 +1,185 @@
 // Copyright 2022 Daniel Liu
 
 #include <signal.h>
+#include <unistd.h>
 
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "absl/log/initialize.h"
 #include "absl/log/log.h"
-#include "absl/log/log_sink.h"
 #include "absl/log/log_sink_registry.h"
+#include "absl/strings/str_cat.h"
 
+#include "access_log.h"
+#include "affinity.h"
+#include "event_stream.h"
 #include "http.h"
+#include "logging.h"
 #include "template.h"
 #include "server.h"
+#include "websocket.h"
 
-std::string IndexHandler(
-    cppserver::HTTPRequest request, 
-    [[maybe_unused]] std::unordered_map<std::string, std::string> params) {
+cppserver::HTTPResponse IndexHandler(
+    const cppserver::HTTPRequest& request,
+    [[maybe_unused]] const cppserver::EndpointParams& params) {
   cppserver::HTTPResponse response(200);
-  response.AddHeader("Content-Type", "text/html; encoding=utf-8");
-  response.LoadBodyFromFile("static/index.html");
-  return response.ToString();
+  response.AddHeader(cppserver::CommonHeader::kContentTypeHTML);
+  response.LoadBodyFromFile("static/index.html", request);
+  return response;
 }
 
-std::string PathHandler(
-    cppserver::HTTPRequest request, 
-    std::unordered_map<std::string, std::string> params) {
+cppserver::HTTPResponse PathHandler(
+    const cppserver::HTTPRequest& request,
+    const cppserver::EndpointParams& params) {
   cppserver::HTTPResponse response(200);
-  response.AddHeader("Content-Type", "text/html; encoding=utf-8");
-  response.LoadBodyFromFile("templates/path.html");
-  LOG(INFO) << "path = " << cppserver::UnquoteUrl(params["path"]);
-  response.RenderTemplateFile(
-      "templates/path.html", 
-      {{"path", cppserver::UnquoteUrl(params["path"])}});
-  return response.ToString();
+  response.AddHeader(cppserver::CommonHeader::kContentTypeHTML);
+  std::string path = cppserver::UnquoteUrl(params.at("path"));
+  CPPSERVER_LOG(INFO) << "path = " << path;
+  response.RenderTemplateFile("templates/path.html", {{"path", path}},
+                              request);
+  return response;
 }
 
-int main() {
-  // Set up logging.
-  struct LogSink : public absl::LogSink {
-    virtual void Send(const absl::LogEntry& entry) override {
-      std::cout << "[" << entry.log_severity() << "] ";
-      std::cout << entry.text_message_with_newline();
+cppserver::HTTPResponse UploadHandler(
+    const cppserver::HTTPRequest& request,
+    [[maybe_unused]] const cppserver::EndpointParams& params) {
+  if (!request.multipart) {
+    cppserver::HTTPResponse response(400);
+    response.AddHeader(cppserver::CommonHeader::kContentTypePlainText);
+    response.SetBody("Expected a multipart/form-data body\n");
+    return response;
+  }
+  std::string body;
+  for (const auto& part : request.multipart->Parts()) {
+    absl::StrAppend(&body, part->Name(), " ", part->Filename().value_or("-"),
+                    " ", part->Size(), "\n");
+  }
+  cppserver::HTTPResponse response(200);
+  response.AddHeader(cppserver::CommonHeader::kContentTypePlainText);
+  response.SetBody(std::move(body));
+  return response;
+}
+
+// Everyone connected to /chat/ receives every message sent by anyone, and
+// text messages are also streamed to /chat/events/ for clients that only
+// watch.
+cppserver::WebSocketGroup chat;
+std::shared_ptr<cppserver::EventChannel> chat_events;
+
+void ChatHandler([[maybe_unused]] const cppserver::HTTPRequest& request,
+                 [[maybe_unused]] const cppserver::EndpointParams& params,
+                 std::shared_ptr<cppserver::WebSocket> socket) {
+  socket->OnMessage([](cppserver::WebSocket&, std::string_view message,
+                       bool binary) {
+    chat.Broadcast(message, binary);
+    if (!binary) {
+      chat_events->Publish(message);
     }
-  };
+  });
+  socket->OnClose([](cppserver::WebSocket& closed) { chat.Remove(&closed); });
+  chat.Add(std::move(socket));
+}
+
+// Stopped on SIGTERM, after which it drains and main returns.
+cppserver::Server* server_to_stop = nullptr;
+
+void StopServer(int) {
+  if (server_to_stop) {
+    server_to_stop->Stop();
+  }
+}
 
-  auto sink = std::make_unique<LogSink>();
+int main() {
+  // Writes to a client that has gone away, or whose connection timed out,
+  // should fail rather than kill the server. sendfile has no MSG_NOSIGNAL.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Set up logging. Log lines are written to stdout by a background thread
+  // so request handling never blocks on it.
+  auto sink = std::make_unique<cppserver::AsyncLogSink>(STDOUT_FILENO);
   absl::AddLogSink(sink.get());
 
   absl::InitializeLog();
 
-  cppserver::Server server(8000);
+  // Set CPPSERVER_ACCESS_LOG to a path to record requests there; decode the
+  // file with `access_log_decode`.
+  std::unique_ptr<cppserver::AccessLog> access_log;
+  if (const char* path = std::getenv("CPPSERVER_ACCESS_LOG")) {
+    cppserver::AccessLog::Options options;
+    options.path = path;
+    auto opened = cppserver::AccessLog::Open(options);
+    if (opened.ok()) {
+      access_log = std::move(opened).value();
+    } else {
+      LOG(ERROR) << opened.status().message();
+    }
+  }
+
+  // CPPSERVER_LOOP_CPUS and CPPSERVER_WORKER_CPUS place the server's threads
+  // on CPU lists like "0-3,8"; set CPPSERVER_STEER_CONNECTIONS to also hand
+  // requests to workers on the NUMA node that received them.
+  cppserver::ServerOptions options;
+  auto cpus = [](const char* variable, std::vector<int>* cpus) {
+    if (const char* list = std::getenv(variable)) {
+      auto parsed = cppserver::ParseCpuList(list);
+      if (parsed.ok()) {
+        *cpus = std::move(parsed).value();
+      } else {
+        LOG(ERROR) << variable << ": " << parsed.status().message();
+      }
+    }
+  };
+  cpus("CPPSERVER_LOOP_CPUS", &options.placement.loop_cpus);
+  cpus("CPPSERVER_WORKER_CPUS", &options.placement.worker_cpus);
+  options.placement.steer_connections =
+      std::getenv("CPPSERVER_STEER_CONNECTIONS") != nullptr;
+
+  // Set CPPSERVER_UNIX_SOCKET to a path to serve a reverse proxy on the same
+  // host over a Unix socket instead of TCP.
+  if (const char* path = std::getenv("CPPSERVER_UNIX_SOCKET")) {
+    options.unix_path = path;
+  }
+
+  // Set CPPSERVER_HANDOFF_SOCKET to a path to restart without dropping
+  // connections: a new server started with the same path takes over the
+  // listening socket, and this one drains and exits.
+  if (const char* path = std::getenv("CPPSERVER_HANDOFF_SOCKET")) {
+    options.handoff_path = path;
+  }
+
+  cppserver::Server server(8000, options);
+  server_to_stop = &server;
+  signal(SIGTERM, StopServer);
+  server.SetAccessLog(access_log.get());
+  server.EnableMetricsEndpoint();
+
   server.AddEndpointHandler("/", IndexHandler);
-  server.AddEndpointHandler("/path/<path>/", PathHandler);
+  // The page depends only on the path, so rendered pages are cached. It's
+  // the first to go when the server is overloaded.
+  cppserver::EndpointOptions path_options;
+  path_options.cache = cppserver::ResponseCacheOptions();
+  path_options.priority = cppserver::RequestPriority::kSheddable;
+  server.AddEndpointHandler("/path/<path>/", PathHandler, path_options);
+  // Uploads are limited per client, since each one may write to disk.
+  cppserver::EndpointOptions upload_options;
+  upload_options.multipart = cppserver::MultipartOptions();
+  upload_options.rate_limit = cppserver::RateLimitOptions();
+  upload_options.rate_limit->rate = 1;
+  upload_options.rate_limit->burst = 5;
+  server.AddEndpointHandler("/upload/", UploadHandler, upload_options);
+  chat_events = server.CreateEventChannel();
+  server.AddEventStreamHandler("/chat/events/",
+      [](const cppserver::HTTPRequest&, const cppserver::EndpointParams&) {
+        return chat_events;
+      });
+  server.AddWebSocketHandler("/chat/", ChatHandler);
 
   return 0;
 }
@@ -0,0 +1,201 @@
+// Copyright 2022 Daniel Liu
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+namespace {
+
+// Histograms are exported with a bucket per power of two between these
+// bounds (about 1us and 34s). They line up exactly with the internal buckets.
+constexpr int kMinExportedBits = 10;
+constexpr int kMaxExportedBits = 35;
+
+std::string EscapeLabelValue(std::string_view value) {
+  std::string escaped;
+  for (char c : value) {
+    switch (c) {
+      case '\\': escaped += "\\\\"; break;
+      case '"': escaped += "\\\""; break;
+      case '\n': escaped += "\\n"; break;
+      default: escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Renders `{key="value",...}`, with `extra` appended as a final label.
+std::string FormatLabels(const MetricLabels& labels,
+                         std::string_view extra = "") {
+  if (labels.empty() && extra.empty()) {
+    return "";
+  }
+  std::string result = "{";
+  for (const auto& [key, value] : labels) {
+    if (result.size() > 1) {
+      result += ',';
+    }
+    absl::StrAppend(&result, key, "=\"", EscapeLabelValue(value), "\"");
+  }
+  if (!extra.empty()) {
+    if (result.size() > 1) {
+      result += ',';
+    }
+    result += extra;
+  }
+  result += '}';
+  return result;
+}
+
+}  // namespace
+
+uint64_t Counter::Value() const {
+  uint64_t total = 0;
+  for (const auto& shard : shards_) {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+Histogram::Snapshot Histogram::Collect() const {
+  Snapshot snapshot;
+  for (const auto& shard : shards_) {
+    for (size_t i = 0; i < kBuckets; ++i) {
+      uint64_t count = shard.counts[i].load(std::memory_order_relaxed);
+      snapshot.counts[i] += count;
+      snapshot.count += count;
+    }
+    snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+uint64_t Histogram::Snapshot::Quantile(double quantile) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(quantile * count));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return BucketLowerBound(i);
+    }
+  }
+  return BucketLowerBound(kBuckets - 1);
+}
+
+MetricsRegistry::Metric& MetricsRegistry::Add(std::string name,
+                                              std::string help, Type type,
+                                              MetricLabels labels) {
+  metrics_.push_back({std::move(name), std::move(help), type,
+                      std::move(labels), nullptr, nullptr, nullptr});
+  return metrics_.back();
+}
+
+Counter* MetricsRegistry::AddCounter(std::string name, std::string help,
+                                     MetricLabels labels) {
+  absl::MutexLock lock(&mutex_);
+  Metric& metric = Add(std::move(name), std::move(help), Type::kCounter,
+                       std::move(labels));
+  metric.counter = std::make_unique<Counter>();
+  return metric.counter.get();
+}
+
+Gauge* MetricsRegistry::AddGauge(std::string name, std::string help,
+                                 MetricLabels labels) {
+  absl::MutexLock lock(&mutex_);
+  Metric& metric = Add(std::move(name), std::move(help), Type::kGauge,
+                       std::move(labels));
+  metric.gauge = std::make_unique<Gauge>();
+  return metric.gauge.get();
+}
+
+Histogram* MetricsRegistry::AddHistogram(std::string name, std::string help,
+                                         MetricLabels labels) {
+  absl::MutexLock lock(&mutex_);
+  Metric& metric = Add(std::move(name), std::move(help), Type::kHistogram,
+                       std::move(labels));
+  metric.histogram = std::make_unique<Histogram>();
+  return metric.histogram.get();
+}
+
+std::string MetricsRegistry::RenderPrometheus() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  std::string result;
+
+  // Samples of a metric family must be contiguous, so render each name once,
+  // the first time it is seen, along with every later metric sharing it.
+  std::vector<bool> rendered(metrics_.size());
+  for (size_t i = 0; i < metrics_.size(); ++i) {
+    if (rendered[i]) {
+      continue;
+    }
+    const Metric& family = metrics_[i];
+    const char* type = family.type == Type::kCounter ? "counter"
+                       : family.type == Type::kGauge ? "gauge"
+                                                     : "histogram";
+    absl::StrAppend(&result, "# HELP ", family.name, " ", family.help, "\n");
+    absl::StrAppend(&result, "# TYPE ", family.name, " ", type, "\n");
+
+    for (size_t j = i; j < metrics_.size(); ++j) {
+      const Metric& metric = metrics_[j];
+      if (rendered[j] || metric.name != family.name) {
+        continue;
+      }
+      rendered[j] = true;
+
+      switch (metric.type) {
+        case Type::kCounter:
+          absl::StrAppend(&result, metric.name, FormatLabels(metric.labels),
+                          " ", metric.counter->Value(), "\n");
+          break;
+        case Type::kGauge:
+          absl::StrAppend(&result, metric.name, FormatLabels(metric.labels),
+                          " ", metric.gauge->Value(), "\n");
+          break;
+        case Type::kHistogram: {
+          Histogram::Snapshot snapshot = metric.histogram->Collect();
+          uint64_t cumulative = 0;
+          size_t bucket = 0;
+          for (int bits = kMinExportedBits; bits <= kMaxExportedBits;
+               ++bits) {
+            size_t end = Histogram::BucketIndex(uint64_t{1} << bits);
+            for (; bucket < end; ++bucket) {
+              cumulative += snapshot.counts[bucket];
+            }
+            std::string le = absl::StrFormat(
+                "le=\"%g\"", static_cast<double>(uint64_t{1} << bits) / 1e9);
+            absl::StrAppend(&result, metric.name, "_bucket",
+                            FormatLabels(metric.labels, le), " ", cumulative,
+                            "\n");
+          }
+          absl::StrAppend(&result, metric.name, "_bucket",
+                          FormatLabels(metric.labels, "le=\"+Inf\""), " ",
+                          snapshot.count, "\n");
+          absl::StrAppend(&result, metric.name, "_sum",
+                          FormatLabels(metric.labels), " ",
+                          absl::StrFormat("%.9f", snapshot.sum / 1e9), "\n");
+          absl::StrAppend(&result, metric.name, "_count",
+                          FormatLabels(metric.labels), " ", snapshot.count,
+                          "\n");
+          break;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+}  // namespace cppserver
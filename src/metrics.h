@@ -0,0 +1,180 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_METRICS_H_
+#define _CPPSERVER_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+namespace internal {
+
+// Metrics are split into this many shards, and each thread updates only its
+// own shard, so concurrent recording doesn't bounce cache lines between cores.
+constexpr size_t kMetricShards = 16;
+
+inline std::atomic<size_t> next_metric_shard {0};
+
+// The shard used by the calling thread.
+inline size_t MetricShard() {
+  thread_local const size_t shard =
+      next_metric_shard.fetch_add(1, std::memory_order_relaxed)
+      % kMetricShards;
+  return shard;
+}
+
+}  // namespace internal
+
+// A monotonically increasing count.
+class Counter {
+ public:
+  void Increment(uint64_t amount = 1) {
+    shards_[internal::MetricShard()].value.fetch_add(
+        amount, std::memory_order_relaxed);
+  }
+
+  uint64_t Value() const;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value {0};
+  };
+
+  std::array<Shard, internal::kMetricShards> shards_;
+};
+
+// A value that can go up and down, such as the number of open connections.
+class Gauge {
+ public:
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  void Add(int64_t amount) {
+    value_.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_ {0};
+};
+
+// A log-linear (HDR-style) histogram of durations in nanoseconds. Every power
+// of two is split into kSubBuckets linear buckets, so recorded values keep
+// about 12% precision from nanoseconds up to tens of minutes while recording
+// stays a couple of relaxed atomic adds.
+class Histogram {
+ public:
+  static constexpr int kSubBucketBits = 3;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  // Values at or above 2^kMaxBits nanoseconds (about 36 minutes) are clamped.
+  static constexpr int kMaxBits = 42;
+  static constexpr size_t kBuckets =
+      (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+  // Merged counts from all shards.
+  struct Snapshot {
+    std::array<uint64_t, kBuckets> counts {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    // The smallest recorded value v such that at least `quantile` of the
+    // values are <= v, to the precision of the bucket it falls in.
+    uint64_t Quantile(double quantile) const;
+  };
+
+  void Record(uint64_t value) {
+    Shard& shard = shards_[internal::MetricShard()];
+    shard.counts[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void Record(std::chrono::nanoseconds duration) {
+    Record(duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0);
+  }
+
+  Snapshot Collect() const;
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < 2 * kSubBuckets) {
+      return value;
+    }
+    if (value >= uint64_t{1} << kMaxBits) {
+      return kBuckets - 1;
+    }
+    int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+    return shift * kSubBuckets + (value >> shift);
+  }
+
+  // The smallest value that falls in bucket `index`.
+  static uint64_t BucketLowerBound(size_t index) {
+    if (index < 2 * kSubBuckets) {
+      return index;
+    }
+    int shift = index / kSubBuckets - 1;
+    return (index - shift * kSubBuckets) << shift;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, kBuckets> counts {};
+    std::atomic<uint64_t> sum {0};
+  };
+
+  std::array<Shard, internal::kMetricShards> shards_;
+};
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Owns a set of named metrics and renders them in the Prometheus text
+// exposition format. Adding metrics takes a lock; recording into them never
+// does, and the returned pointers stay valid for the registry's lifetime.
+//
+//    Counter* requests = registry.AddCounter(
+//        "requests_total", "Requests served.", {{"route", "/"}});
+//    requests->Increment();
+class MetricsRegistry {
+ public:
+  Counter* AddCounter(std::string name, std::string help,
+                      MetricLabels labels = {});
+
+  Gauge* AddGauge(std::string name, std::string help,
+                  MetricLabels labels = {});
+
+  // Histograms record nanoseconds and are exported in seconds.
+  Histogram* AddHistogram(std::string name, std::string help,
+                          MetricLabels labels = {});
+
+  std::string RenderPrometheus() const;
+
+ private:
+  enum class Type { kCounter, kGauge, kHistogram };
+
+  struct Metric {
+    std::string name;
+    std::string help;
+    Type type;
+    MetricLabels labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  Metric& Add(std::string name, std::string help, Type type,
+              MetricLabels labels) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  mutable absl::Mutex mutex_;
+  std::vector<Metric> metrics_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace cppserver
+
+#endif
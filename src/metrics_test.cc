@@ -0,0 +1,89 @@
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "metrics.h"
+
+using namespace cppserver;
+
+TEST(HistogramTests, SmallValuesAreExact) {
+  for (uint64_t value = 0; value < 2 * Histogram::kSubBuckets; ++value) {
+    EXPECT_EQ(Histogram::BucketLowerBound(Histogram::BucketIndex(value)),
+              value);
+  }
+}
+
+TEST(HistogramTests, BucketsAreContiguous) {
+  for (size_t i = 1; i < Histogram::kBuckets; ++i) {
+    uint64_t lower = Histogram::BucketLowerBound(i);
+    EXPECT_EQ(Histogram::BucketIndex(lower), i);
+    EXPECT_EQ(Histogram::BucketIndex(lower - 1), i - 1);
+  }
+}
+
+TEST(HistogramTests, RelativeErrorIsBounded) {
+  for (uint64_t value = 1; value < (uint64_t{1} << 40); value = value * 3 + 1) {
+    uint64_t lower = Histogram::BucketLowerBound(Histogram::BucketIndex(value));
+    EXPECT_LE(lower, value);
+    EXPECT_LE(value - lower, value / Histogram::kSubBuckets);
+  }
+}
+
+TEST(HistogramTests, LargeValuesAreClamped) {
+  EXPECT_EQ(Histogram::BucketIndex(UINT64_MAX), Histogram::kBuckets - 1);
+}
+
+TEST(HistogramTests, Quantiles) {
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.Record(value);
+  }
+  auto snapshot = histogram.Collect();
+  EXPECT_EQ(snapshot.count, 1000);
+  EXPECT_EQ(snapshot.sum, 500500);
+  EXPECT_NEAR(snapshot.Quantile(0.5), 500, 500 / Histogram::kSubBuckets);
+  EXPECT_NEAR(snapshot.Quantile(0.99), 990, 990 / Histogram::kSubBuckets);
+}
+
+TEST(CounterTests, SumsShardsAcrossThreads) {
+  Counter counter;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&counter] {
+      for (int j = 0; j < 1000; ++j) {
+        counter.Increment();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(counter.Value(), 8000);
+}
+
+TEST(MetricsRegistryTests, RendersPrometheusText) {
+  MetricsRegistry registry;
+  registry.AddCounter("requests_total", "Requests.", {{"route", "/a"}})
+      ->Increment(3);
+  registry.AddGauge("connections", "Connections.")->Set(2);
+  registry.AddCounter("requests_total", "Requests.", {{"route", "/\"b\""}})
+      ->Increment();
+  registry.AddHistogram("latency_seconds", "Latency.")->Record(1500);
+
+  std::string text = registry.RenderPrometheus();
+  EXPECT_NE(text.find("# TYPE requests_total counter\n"
+                      "requests_total{route=\"/a\"} 3\n"
+                      "requests_total{route=\"/\\\"b\\\"\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("connections 2\n"), std::string::npos);
+  EXPECT_NE(text.find("latency_seconds_bucket{le=\"1.024e-06\"} 0\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("latency_seconds_bucket{le=\"2.048e-06\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("latency_seconds_bucket{le=\"+Inf\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("latency_seconds_count 1\n"), std::string::npos);
+}
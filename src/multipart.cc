@@ -0,0 +1,402 @@
+// Copyright 2022 Daniel Liu
+
+#include "multipart.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+
+namespace cppserver {
+
+namespace {
+
+// Removes surrounding quotes and backslash escapes from a parameter value.
+std::string UnquoteParameter(std::string_view value) {
+  if (value.size() < 2 || value.front() != '"' || value.back() != '"') {
+    return std::string(value);
+  }
+  value = value.substr(1, value.size() - 2);
+  std::string result;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '\\' && i + 1 < value.size()) {
+      ++i;
+    }
+    result += value[i];
+  }
+  return result;
+}
+
+// Splits `type; key=value; ...` into the type and its parameters.
+std::pair<std::string_view, std::vector<std::pair<std::string, std::string>>>
+ParseParameterizedHeader(std::string_view header) {
+  std::vector<std::pair<std::string, std::string>> parameters;
+  std::vector<std::string_view> parts = absl::StrSplit(header, ';');
+  for (size_t i = 1; i < parts.size(); ++i) {
+    std::string_view part = absl::StripAsciiWhitespace(parts[i]);
+    size_t equals = part.find('=');
+    if (equals == std::string_view::npos) {
+      continue;
+    }
+    parameters.emplace_back(
+        absl::AsciiStrToLower(
+            absl::StripAsciiWhitespace(part.substr(0, equals))),
+        UnquoteParameter(absl::StripAsciiWhitespace(part.substr(equals + 1))));
+  }
+  return {absl::StripAsciiWhitespace(parts[0]), std::move(parameters)};
+}
+
+// Creates an unnamed file to hold a large part.
+absl::StatusOr<int> CreateSpillFile(const std::string& directory) {
+  int fd;
+  if (directory.empty()) {
+    fd = memfd_create("cppserver-multipart", MFD_CLOEXEC);
+  } else {
+    fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR)) {
+      // The filesystem doesn't support O_TMPFILE; unlink a named file.
+      std::string path = absl::StrCat(directory, "/cppserver-multipart-XXXXXX");
+      fd = mkostemp(path.data(), O_CLOEXEC);
+      if (fd >= 0) {
+        unlink(path.c_str());
+      }
+    }
+  }
+  if (fd < 0) {
+    return absl::InternalError(absl::StrCat(
+        "Failed to create a file for a multipart part: ", strerror(errno)));
+  }
+  return fd;
+}
+
+absl::Status WriteFully(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t result = write(fd, data.data(), data.size());
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::InternalError(absl::StrCat(
+          "Failed to write a multipart part: ", strerror(errno)));
+    }
+    data.remove_prefix(result);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+std::optional<std::string> MultipartBoundary(std::string_view content_type) {
+  auto [type, parameters] = ParseParameterizedHeader(content_type);
+  if (!absl::EqualsIgnoreCase(type, "multipart/form-data")) {
+    return std::nullopt;
+  }
+  for (auto& [key, value] : parameters) {
+    // RFC 2046 limits boundaries to 70 characters.
+    if (key == "boundary" && !value.empty() && value.size() <= 70) {
+      return std::move(value);
+    }
+  }
+  return std::nullopt;
+}
+
+MultipartParser::MultipartParser(std::string_view boundary,
+                                 MultipartSink* sink)
+    : sink_{sink}, delimiter_{absl::StrCat("\r\n--", boundary)} {
+  size_t length = delimiter_.size();
+  skip_.fill(length);
+  for (size_t i = 0; i + 1 < length; ++i) {
+    skip_[static_cast<unsigned char>(delimiter_[i])] = length - 1 - i;
+  }
+  // The first delimiter may start the body without a preceding line break.
+  buffer_ = "\r\n";
+}
+
+size_t MultipartParser::FindDelimiter(std::string_view data) const {
+  size_t length = delimiter_.size();
+  if (data.size() < length) {
+    return std::string_view::npos;
+  }
+  char last = delimiter_.back();
+  size_t i = 0;
+  while (i <= data.size() - length) {
+    char c = data[i + length - 1];
+    if (c == last
+        && std::memcmp(data.data() + i, delimiter_.data(), length - 1) == 0) {
+      return i;
+    }
+    i += skip_[static_cast<unsigned char>(c)];
+  }
+  return std::string_view::npos;
+}
+
+absl::Status MultipartParser::ParseHeaders(std::string_view block) {
+  MultipartPartHeaders headers;
+  bool has_disposition = false;
+  for (std::string_view line : absl::StrSplit(block, "\r\n")) {
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return absl::InvalidArgumentError("Malformed multipart part header");
+    }
+    std::string_view key = absl::StripAsciiWhitespace(line.substr(0, colon));
+    std::string_view value =
+        absl::StripAsciiWhitespace(line.substr(colon + 1));
+
+    if (absl::EqualsIgnoreCase(key, "Content-Disposition")) {
+      auto [type, parameters] = ParseParameterizedHeader(value);
+      has_disposition = absl::EqualsIgnoreCase(type, "form-data");
+      for (auto& [parameter, parameter_value] : parameters) {
+        if (parameter == "name") {
+          headers.name = std::move(parameter_value);
+        } else if (parameter == "filename") {
+          headers.filename = std::move(parameter_value);
+        }
+      }
+    } else if (absl::EqualsIgnoreCase(key, "Content-Type")) {
+      headers.content_type = std::string(value);
+    }
+    headers.headers.emplace_back(key, value);
+  }
+  if (!has_disposition) {
+    return absl::InvalidArgumentError(
+        "Multipart part has no form-data Content-Disposition");
+  }
+  return sink_->OnPartBegin(std::move(headers));
+}
+
+absl::Status MultipartParser::Feed(std::string_view data) {
+  if (state_ == State::kDone) {
+    // Anything after the closing delimiter is ignored.
+    return absl::OkStatus();
+  }
+  buffer_.append(data);
+
+  // Bytes of buffer_ consumed so far.
+  size_t consumed = 0;
+  // Bytes that must be held back in case they start a delimiter.
+  size_t held_back = delimiter_.size() - 1;
+  absl::Status status = absl::OkStatus();
+  bool need_more = false;
+
+  while (status.ok() && !need_more) {
+    std::string_view rest(buffer_.data() + consumed,
+                          buffer_.size() - consumed);
+    switch (state_) {
+      case State::kPreamble: {
+        size_t found = FindDelimiter(rest);
+        if (found == std::string_view::npos) {
+          consumed += rest.size() > held_back ? rest.size() - held_back : 0;
+          need_more = true;
+        } else {
+          consumed += found + delimiter_.size();
+          state_ = State::kAfterDelimiter;
+        }
+        break;
+      }
+
+      case State::kAfterDelimiter: {
+        if (rest.size() < 2) {
+          need_more = true;
+        } else if (absl::StartsWith(rest, "--")) {
+          consumed = buffer_.size();
+          state_ = State::kDone;
+          need_more = true;
+        } else {
+          // The delimiter may be followed by whitespace before its line
+          // break.
+          size_t line_end = rest.find("\r\n");
+          if (line_end == std::string_view::npos) {
+            if (!absl::StripAsciiWhitespace(rest).empty()
+                || rest.size() > kmax_header_size_) {
+              status = absl::InvalidArgumentError("Malformed multipart body");
+            }
+            need_more = true;
+          } else if (!absl::StripAsciiWhitespace(rest.substr(0, line_end))
+                          .empty()) {
+            status = absl::InvalidArgumentError("Malformed multipart body");
+          } else {
+            consumed += line_end + 2;
+            state_ = State::kHeaders;
+          }
+        }
+        break;
+      }
+
+      case State::kHeaders: {
+        size_t header_end;
+        size_t block_end;
+        if (absl::StartsWith(rest, "\r\n")) {
+          header_end = 0;
+          block_end = 2;
+        } else {
+          header_end = rest.find("\r\n\r\n");
+          block_end = header_end + 4;
+        }
+        if (header_end == std::string_view::npos) {
+          if (rest.size() > kmax_header_size_) {
+            status = absl::InvalidArgumentError(
+                "Multipart part headers are too large");
+          }
+          need_more = true;
+        } else {
+          status = ParseHeaders(rest.substr(0, header_end));
+          consumed += block_end;
+          state_ = State::kBody;
+        }
+        break;
+      }
+
+      case State::kBody: {
+        size_t found = FindDelimiter(rest);
+        if (found == std::string_view::npos) {
+          if (rest.size() > held_back) {
+            status = sink_->OnPartData(rest.substr(0, rest.size() - held_back));
+            consumed += rest.size() - held_back;
+          }
+          need_more = true;
+        } else {
+          if (found > 0) {
+            status = sink_->OnPartData(rest.substr(0, found));
+          }
+          if (status.ok()) {
+            status = sink_->OnPartEnd();
+          }
+          consumed += found + delimiter_.size();
+          state_ = State::kAfterDelimiter;
+        }
+        break;
+      }
+
+      case State::kDone:
+        need_more = true;
+        break;
+    }
+  }
+
+  buffer_.erase(0, consumed);
+  return status;
+}
+
+absl::Status MultipartParser::Finish() {
+  if (state_ != State::kDone) {
+    return absl::InvalidArgumentError(
+        "Multipart body ended before its closing delimiter");
+  }
+  return absl::OkStatus();
+}
+
+MultipartPart::~MultipartPart() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+absl::Status MultipartPart::Append(std::string_view data,
+                                   const MultipartOptions& options) {
+  if (size_ + static_cast<off_t>(data.size()) > options.max_part_size) {
+    return absl::OutOfRangeError("Multipart part is too large");
+  }
+  size_ += data.size();
+
+  if (fd_ < 0) {
+    if (memory_.size() + data.size() <= options.memory_limit) {
+      memory_.append(data);
+      return absl::OkStatus();
+    }
+    auto fd = CreateSpillFile(options.spill_directory);
+    if (!fd.ok()) {
+      return fd.status();
+    }
+    fd_ = *fd;
+    auto status = WriteFully(fd_, memory_);
+    std::string().swap(memory_);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return WriteFully(fd_, data);
+}
+
+absl::StatusOr<size_t> MultipartPart::Read(off_t offset, char* data,
+                                           size_t size) const {
+  if (offset >= size_) {
+    return 0;
+  }
+  size = std::min<size_t>(size, size_ - offset);
+  if (fd_ < 0) {
+    std::memcpy(data, memory_.data() + offset, size);
+    return size;
+  }
+  while (true) {
+    ssize_t result = pread(fd_, data, size, offset);
+    if (result >= 0) {
+      return result;
+    }
+    if (errno != EINTR) {
+      return absl::InternalError(absl::StrCat(
+          "Failed to read a multipart part: ", strerror(errno)));
+    }
+  }
+}
+
+absl::StatusOr<std::string> MultipartPart::ReadAll() const {
+  if (fd_ < 0) {
+    return memory_;
+  }
+  std::string result(size_, '\0');
+  size_t total = 0;
+  while (total < result.size()) {
+    auto read = Read(total, result.data() + total, result.size() - total);
+    if (!read.ok()) {
+      return read.status();
+    }
+    if (*read == 0) {
+      return absl::DataLossError("Multipart part file was truncated");
+    }
+    total += *read;
+  }
+  return result;
+}
+
+absl::Status MultipartFormData::OnPartBegin(MultipartPartHeaders headers) {
+  if (parts_.size() >= options_.max_parts) {
+    return absl::OutOfRangeError("Multipart body has too many parts");
+  }
+  parts_.push_back(std::make_unique<MultipartPart>(std::move(headers)));
+  return absl::OkStatus();
+}
+
+absl::Status MultipartFormData::OnPartData(std::string_view data) {
+  return parts_.back()->Append(data, options_);
+}
+
+absl::Status MultipartFormData::OnPartEnd() {
+  return absl::OkStatus();
+}
+
+const MultipartPart* MultipartFormData::Find(std::string_view name) const {
+  for (const auto& part : parts_) {
+    if (part->Name() == name) {
+      return part.get();
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace cppserver
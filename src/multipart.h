@@ -0,0 +1,169 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_MULTIPART_H_
+#define _CPPSERVER_MULTIPART_H_
+
+#include <sys/types.h>
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace cppserver {
+
+// Returns the boundary of a multipart/form-data Content-Type, if it is one.
+std::optional<std::string> MultipartBoundary(std::string_view content_type);
+
+// The headers of one part of a multipart body.
+struct MultipartPartHeaders {
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  // From Content-Disposition.
+  std::string name;
+  std::optional<std::string> filename;
+
+  // Defaults to text/plain, as in RFC 7578.
+  std::string content_type = "text/plain";
+};
+
+// Receives the parts of a multipart body as the parser finds them. Data for
+// a part may arrive in any number of pieces.
+class MultipartSink {
+ public:
+  virtual ~MultipartSink() = default;
+
+  virtual absl::Status OnPartBegin(MultipartPartHeaders headers) = 0;
+  virtual absl::Status OnPartData(std::string_view data) = 0;
+  virtual absl::Status OnPartEnd() = 0;
+};
+
+// Incrementally splits a multipart body into parts, so a body of any size
+// can be parsed as it arrives. Delimiters are found with a
+// Boyer-Moore-Horspool search, and only a delimiter's length of data is held
+// back between calls.
+class MultipartParser {
+ public:
+  MultipartParser(std::string_view boundary, MultipartSink* sink);
+
+  // Parses the next piece of the body.
+  absl::Status Feed(std::string_view data);
+
+  // Checks that the body ended with the closing delimiter.
+  absl::Status Finish();
+
+ private:
+  enum class State { kPreamble, kAfterDelimiter, kHeaders, kBody, kDone };
+
+  // Part headers larger than this are rejected.
+  static constexpr size_t kmax_header_size_ = 16 * 1024;
+
+  // Returns the offset of the first delimiter in `data`, or npos.
+  size_t FindDelimiter(std::string_view data) const;
+
+  absl::Status ParseHeaders(std::string_view block);
+
+  MultipartSink* sink_;
+  // "\r\n--" followed by the boundary.
+  std::string delimiter_;
+  // Horspool shift for each byte value.
+  std::array<size_t, 256> skip_;
+
+  State state_ = State::kPreamble;
+  // Bytes received but not yet consumed.
+  std::string buffer_;
+};
+
+// Options for collecting multipart bodies into MultipartFormData.
+struct MultipartOptions {
+  // Parts larger than this are moved out of memory into a file.
+  size_t memory_limit = 64 * 1024;
+
+  // Large parts go to an unnamed file in this directory, or to a memfd if
+  // empty. Use a disk-backed directory to keep large uploads out of RAM.
+  std::string spill_directory = "/var/tmp";
+
+  // Bodies with more parts than this are rejected.
+  size_t max_parts = 64;
+
+  // Parts larger than this are rejected.
+  off_t max_part_size = off_t{4} << 30;
+};
+
+// One part of a multipart body. Small parts are held in memory; larger ones
+// are kept in an unnamed file and read back on demand.
+class MultipartPart {
+ public:
+  explicit MultipartPart(MultipartPartHeaders headers)
+      : headers_{std::move(headers)} {}
+
+  ~MultipartPart();
+
+  MultipartPart(const MultipartPart&) = delete;
+  MultipartPart& operator=(const MultipartPart&) = delete;
+
+  const std::string& Name() const { return headers_.name; }
+  const std::optional<std::string>& Filename() const {
+    return headers_.filename;
+  }
+  const std::string& ContentType() const { return headers_.content_type; }
+  const MultipartPartHeaders& Headers() const { return headers_; }
+
+  off_t Size() const { return size_; }
+
+  // Reads up to `size` bytes starting at `offset`, returning how many were
+  // read; 0 means the end of the part.
+  absl::StatusOr<size_t> Read(off_t offset, char* data, size_t size) const;
+
+  // Returns the whole part. Prefer Read or FileDescriptor for large parts.
+  absl::StatusOr<std::string> ReadAll() const;
+
+  // The file holding the part, if it was too large to keep in memory. It can
+  // be read with pread, sent with sendfile or given a name with linkat.
+  std::optional<int> FileDescriptor() const {
+    return fd_ >= 0 ? std::optional<int>(fd_) : std::nullopt;
+  }
+
+ private:
+  friend class MultipartFormData;
+
+  absl::Status Append(std::string_view data, const MultipartOptions& options);
+
+  MultipartPartHeaders headers_;
+  off_t size_ = 0;
+  std::string memory_;
+  int fd_ = -1;
+};
+
+// Collects the parts of a multipart body, spilling large parts to files so
+// memory use stays bounded regardless of the upload size.
+class MultipartFormData : public MultipartSink {
+ public:
+  explicit MultipartFormData(MultipartOptions options = {})
+      : options_{std::move(options)} {}
+
+  absl::Status OnPartBegin(MultipartPartHeaders headers) override;
+  absl::Status OnPartData(std::string_view data) override;
+  absl::Status OnPartEnd() override;
+
+  const std::vector<std::unique_ptr<MultipartPart>>& Parts() const {
+    return parts_;
+  }
+
+  // Returns the first part named `name`.
+  const MultipartPart* Find(std::string_view name) const;
+
+ private:
+  MultipartOptions options_;
+  std::vector<std::unique_ptr<MultipartPart>> parts_;
+};
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,109 @@
+
+#include <string>
+#include <string_view>
+
+#include "gtest/gtest.h"
+
+#include "multipart.h"
+
+using namespace cppserver;
+
+namespace {
+
+const std::string kBody =
+    "preamble\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"title\"\r\n"
+    "\r\n"
+    "Hello\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"file\"; filename=\"a \\\"b\\\".txt\"\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "\r\n"
+    "line one\r\n--XyW is not a delimiter\r\n"
+    "--XyZ--\r\n"
+    "epilogue";
+
+}  // namespace
+
+TEST(MultipartTests, ParsesBoundary) {
+  EXPECT_EQ(MultipartBoundary("multipart/form-data; boundary=abc"), "abc");
+  EXPECT_EQ(MultipartBoundary("Multipart/Form-Data;boundary=\"a b\""), "a b");
+  EXPECT_FALSE(MultipartBoundary("multipart/form-data"));
+  EXPECT_FALSE(MultipartBoundary("text/plain; boundary=abc"));
+}
+
+TEST(MultipartTests, ParsesParts) {
+  MultipartFormData form_data;
+  MultipartParser parser("XyZ", &form_data);
+  ASSERT_TRUE(parser.Feed(kBody).ok());
+  ASSERT_TRUE(parser.Finish().ok());
+
+  ASSERT_EQ(form_data.Parts().size(), 2);
+  const MultipartPart* title = form_data.Find("title");
+  ASSERT_NE(title, nullptr);
+  EXPECT_EQ(*title->ReadAll(), "Hello");
+  EXPECT_EQ(title->ContentType(), "text/plain");
+  EXPECT_FALSE(title->Filename());
+
+  const MultipartPart* file = form_data.Find("file");
+  ASSERT_NE(file, nullptr);
+  EXPECT_EQ(*file->ReadAll(), "line one\r\n--XyW is not a delimiter");
+  EXPECT_EQ(file->Filename(), "a \"b\".txt");
+  EXPECT_EQ(file->ContentType(), "application/octet-stream");
+}
+
+TEST(MultipartTests, ParsesBodiesSplitAtEveryOffset) {
+  for (size_t split = 0; split <= kBody.size(); ++split) {
+    MultipartFormData form_data;
+    MultipartParser parser("XyZ", &form_data);
+    ASSERT_TRUE(parser.Feed(std::string_view(kBody).substr(0, split)).ok());
+    ASSERT_TRUE(parser.Feed(std::string_view(kBody).substr(split)).ok());
+    ASSERT_TRUE(parser.Finish().ok()) << split;
+    ASSERT_EQ(form_data.Parts().size(), 2) << split;
+    EXPECT_EQ(*form_data.Parts()[0]->ReadAll(), "Hello") << split;
+  }
+}
+
+TEST(MultipartTests, RejectsTruncatedBodies) {
+  MultipartFormData form_data;
+  MultipartParser parser("XyZ", &form_data);
+  ASSERT_TRUE(parser.Feed(kBody.substr(0, kBody.size() / 2)).ok());
+  EXPECT_FALSE(parser.Finish().ok());
+}
+
+TEST(MultipartTests, SpillsLargePartsToFiles) {
+  MultipartOptions options;
+  options.memory_limit = 16;
+  options.spill_directory = "";
+  MultipartFormData form_data(options);
+  MultipartParser parser("XyZ", &form_data);
+
+  std::string content;
+  for (int i = 0; i < 10000; ++i) {
+    content += static_cast<char>('a' + i % 26);
+  }
+  ASSERT_TRUE(parser.Feed(
+      "--XyZ\r\nContent-Disposition: form-data; name=\"big\"\r\n\r\n").ok());
+  for (size_t i = 0; i < content.size(); i += 100) {
+    ASSERT_TRUE(parser.Feed(content.substr(i, 100)).ok());
+  }
+  ASSERT_TRUE(parser.Feed("\r\n--XyZ--").ok());
+  ASSERT_TRUE(parser.Finish().ok());
+
+  const MultipartPart* part = form_data.Find("big");
+  ASSERT_NE(part, nullptr);
+  EXPECT_TRUE(part->FileDescriptor());
+  EXPECT_EQ(part->Size(), content.size());
+  EXPECT_EQ(*part->ReadAll(), content);
+}
+
+TEST(MultipartTests, EnforcesLimits) {
+  MultipartOptions options;
+  options.max_part_size = 4;
+  MultipartFormData form_data(options);
+  MultipartParser parser("XyZ", &form_data);
+  EXPECT_FALSE(parser.Feed(
+      "--XyZ\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n"
+      "too long\r\n--XyZ--").ok());
+}
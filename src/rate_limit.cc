@@ -0,0 +1,158 @@
+// Copyright 2022 Daniel Liu
+
+#include "rate_limit.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "absl/status/status.h"
+
+#include "socket.h"
+
+namespace cppserver {
+
+namespace {
+
+// A client's slot is only taken over once its bucket has been full this
+// long, so a client returning just as its slot is reused is rare enough not
+// to matter.
+constexpr uint64_t kReclaimAfter = 1'000'000'000;
+
+// splitmix64's finalizer, so neighbouring addresses spread over the table.
+uint64_t Mix(uint64_t key) {
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111eb;
+  return key ^ (key >> 31);
+}
+
+}  // namespace
+
+absl::Status ValidateRateLimitOptions(const RateLimitOptions& options) {
+  if (!std::isfinite(options.rate) || options.rate <= 0) {
+    return absl::InvalidArgumentError("Rate limits need a positive rate");
+  }
+  // The interval between requests is in whole nanoseconds.
+  if (options.rate > 1e9) {
+    return absl::InvalidArgumentError(
+        "Rate limits allow at most one request per nanosecond");
+  }
+  // Bucket times are nanoseconds on the steady clock; leave plenty of room
+  // above them for a full bucket.
+  if (1e9 / options.rate * std::max<uint32_t>(options.burst, 1) > 0x1p62) {
+    return absl::InvalidArgumentError("Rate limit is too slow to track");
+  }
+  return absl::OkStatus();
+}
+
+uint64_t RateLimitKey(const SocketSockAddr& peer) {
+  const struct sockaddr& addr = peer.rawValue();
+  if (addr.sa_family == AF_INET) {
+    struct sockaddr_in addr_in;
+    std::memcpy(&addr_in, &addr, sizeof(addr_in));
+    return (uint64_t{AF_INET} << 32) | ntohl(addr_in.sin_addr.s_addr);
+  }
+  if (addr.sa_family != AF_INET6) {
+    return 0;
+  }
+  struct sockaddr_in6 addr_in6;
+  std::memcpy(&addr_in6, &addr, sizeof(addr_in6));
+  const uint8_t* bytes = addr_in6.sin6_addr.s6_addr;
+  // IPv4 clients of a dual-stack socket share their IPv4 key.
+  if (IN6_IS_ADDR_V4MAPPED(&addr_in6.sin6_addr)) {
+    uint32_t address;
+    std::memcpy(&address, bytes + 12, sizeof(address));
+    return (uint64_t{AF_INET} << 32) | ntohl(address);
+  }
+  uint64_t prefix = 0;
+  for (int i = 0; i < 8; ++i) {
+    prefix = (prefix << 8) | bytes[i];
+  }
+  // The top bit keeps these apart from IPv4 keys, and from 0.
+  return Mix(prefix) | (uint64_t{1} << 63);
+}
+
+RateLimiter::RateLimiter(RateLimitOptions options)
+    : interval_{static_cast<uint64_t>(1e9 / options.rate)},
+      tolerance_{interval_ * (std::max<uint32_t>(options.burst, 1) - 1)} {
+  shard_size_ = kMaxProbes;
+  while (shard_size_ * kShards < options.capacity) {
+    shard_size_ *= 2;
+  }
+  for (Shard& shard : shards_) {
+    shard.slots = std::make_unique<Slot[]>(shard_size_);
+  }
+}
+
+std::chrono::nanoseconds RateLimiter::Take(
+    uint64_t client, std::chrono::steady_clock::time_point now_in) {
+  uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      now_in.time_since_epoch()).count();
+  Slot* slot = Find(client, now);
+  if (!slot) {
+    return std::chrono::nanoseconds(0);
+  }
+  uint64_t full_at = slot->full_at.load(std::memory_order_relaxed);
+  while (true) {
+    uint64_t start = std::max(full_at, now);
+    if (start - now > tolerance_) {
+      return std::chrono::nanoseconds(start - now - tolerance_);
+    }
+    if (slot->full_at.compare_exchange_weak(full_at, start + interval_,
+                                            std::memory_order_relaxed)) {
+      return std::chrono::nanoseconds(0);
+    }
+  }
+}
+
+RateLimiter::Slot* RateLimiter::Find(uint64_t client, uint64_t now) {
+  uint64_t hash = Mix(client);
+  Shard& shard = shards_[hash >> 60];
+  size_t mask = shard_size_ - 1;
+  // Lost races to claim a slot are retried, in case the winner was the
+  // same client.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    Slot* free = nullptr;
+    uint64_t free_owner = 0;
+    for (size_t i = 0; i < kMaxProbes; ++i) {
+      Slot& slot = shard.slots[(hash + i) & mask];
+      uint64_t owner = slot.client.load(std::memory_order_acquire);
+      if (owner == client) {
+        return &slot;
+      }
+      if (owner == 0) {
+        // Slots are never emptied, so the client isn't further on.
+        if (!free) {
+          free = &slot;
+          free_owner = 0;
+        }
+        break;
+      }
+      if (!free
+          && slot.full_at.load(std::memory_order_relaxed) + kReclaimAfter
+              <= now) {
+        free = &slot;
+        free_owner = owner;
+      }
+    }
+    if (!free) {
+      return nullptr;
+    }
+    // A reused slot's bucket is already full, as a new one would be.
+    if (free->client.compare_exchange_strong(free_owner, client,
+                                             std::memory_order_acq_rel)) {
+      return free;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace cppserver
@@ -0,0 +1,90 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_RATE_LIMIT_H_
+#define _CPPSERVER_RATE_LIMIT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "absl/status/status.h"
+
+#include "socket.h"
+
+namespace cppserver {
+
+struct RateLimitOptions {
+  // Requests per second each client may sustain.
+  double rate = 10;
+  // Requests a client may make at once after a pause.
+  uint32_t burst = 20;
+  // Clients tracked at once, across all shards. Clients that can't be
+  // tracked because their part of the table is full aren't limited.
+  size_t capacity = 64 * 1024;
+};
+
+// Checks that `options` describe a limit the limiter can keep: a finite rate
+// of at most one request per nanosecond, whose burst spans a representable
+// time. Returns InvalidArgument otherwise.
+absl::Status ValidateRateLimitOptions(const RateLimitOptions& options);
+
+// The key for rate limiting requests from `peer`: its IPv4 address, or the
+// /64 prefix of its IPv6 address, since a single host is usually handed a
+// whole /64. Returns 0 for peers without an IP address, like those on a Unix
+// socket.
+uint64_t RateLimitKey(const SocketSockAddr& peer);
+
+// A token bucket per client, kept in a fixed-size open-addressing table so
+// checking a request takes no lock and no allocation.
+//
+// Each bucket is stored as the time at which it will be full again (GCRA),
+// so taking a token is a single compare-and-swap, and buckets don't need
+// refilling. A bucket that has been full for a while is the same as no
+// bucket, so its slot is reused for the next new client that hashes near
+// it; nothing has to sweep the table. Thread-safe.
+class RateLimiter {
+ public:
+  // `options` must pass ValidateRateLimitOptions.
+  explicit RateLimiter(RateLimitOptions options);
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  // Takes a token from `client`'s bucket, where `client` is nonzero.
+  // Returns zero if there was one, or else how long until there will be.
+  std::chrono::nanoseconds Take(uint64_t client,
+                                std::chrono::steady_clock::time_point now);
+
+ private:
+  static constexpr size_t kShards = 16;
+  // Slots searched for a client before giving up on tracking it.
+  static constexpr size_t kMaxProbes = 8;
+
+  struct Slot {
+    // 0 while the slot has never been used.
+    std::atomic<uint64_t> client {0};
+    // When the bucket is full again, in nanoseconds on the steady clock.
+    std::atomic<uint64_t> full_at {0};
+  };
+
+  // Each shard is a separate allocation, probed only within itself.
+  struct Shard {
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  // The client's slot, or null if there's no room for it.
+  Slot* Find(uint64_t client, uint64_t now);
+
+  // Nanoseconds each request adds to its bucket's `full_at`.
+  uint64_t interval_;
+  // How far ahead of now `full_at` may be for a request to be allowed.
+  uint64_t tolerance_;
+  // Slots per shard, a power of 2.
+  size_t shard_size_;
+  Shard shards_[kShards];
+};
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,137 @@
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "rate_limit.h"
+#include "socket.h"
+
+using namespace cppserver;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+namespace {
+
+const std::chrono::steady_clock::time_point kStart{std::chrono::hours(1)};
+
+RateLimitOptions Limit(double rate, uint32_t burst) {
+  RateLimitOptions options;
+  options.rate = rate;
+  options.burst = burst;
+  return options;
+}
+
+}  // namespace
+
+TEST(RateLimiterTests, AllowsABurstThenTheRate) {
+  RateLimiter limiter(Limit(10, 3));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(limiter.Take(1, kStart), nanoseconds(0));
+  }
+  EXPECT_EQ(limiter.Take(1, kStart), milliseconds(100));
+  EXPECT_EQ(limiter.Take(1, kStart + milliseconds(60)), milliseconds(40));
+  EXPECT_EQ(limiter.Take(1, kStart + milliseconds(100)), nanoseconds(0));
+  EXPECT_EQ(limiter.Take(1, kStart + milliseconds(100)), milliseconds(100));
+
+  // Other clients have their own buckets.
+  EXPECT_EQ(limiter.Take(2, kStart + milliseconds(100)), nanoseconds(0));
+
+  // After a pause the whole burst is available again, and no more.
+  auto later = kStart + std::chrono::seconds(10);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(limiter.Take(1, later), nanoseconds(0));
+  }
+  EXPECT_GT(limiter.Take(1, later), nanoseconds(0));
+}
+
+TEST(RateLimiterTests, ReusesSlotsOfIdleClients) {
+  // A single slot per probe window in each shard is plenty to fill up.
+  RateLimitOptions options = Limit(1, 1);
+  options.capacity = 1;
+  RateLimiter limiter(options);
+  uint64_t client = 1;
+  int limited = 0;
+  for (; client <= 1000; ++client) {
+    if (limiter.Take(client, kStart) == nanoseconds(0)
+        && limiter.Take(client, kStart) > nanoseconds(0)) {
+      ++limited;
+    }
+  }
+  // Once the table is full, new clients aren't tracked.
+  EXPECT_EQ(limited, 16 * 8);
+
+  // Once their buckets have been full for a while, the slots go to new
+  // clients.
+  auto later = kStart + std::chrono::seconds(5);
+  EXPECT_EQ(limiter.Take(client, later), nanoseconds(0));
+  EXPECT_GT(limiter.Take(client, later), nanoseconds(0));
+}
+
+TEST(RateLimiterTests, CountsConcurrentRequests) {
+  RateLimiter limiter(Limit(1, 100));
+  std::atomic<int> allowed = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 1000; ++j) {
+        if (limiter.Take(7, kStart) == nanoseconds(0)) {
+          ++allowed;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(allowed, 100);
+}
+
+TEST(RateLimiterTests, KeysByIPv4Address) {
+  SocketSockAddr first("10.0.0.1", 1234);
+  SocketSockAddr second("10.0.0.1", 5678);
+  SocketSockAddr other("10.0.0.2", 1234);
+  EXPECT_NE(RateLimitKey(first), 0);
+  EXPECT_EQ(RateLimitKey(first), RateLimitKey(second));
+  EXPECT_NE(RateLimitKey(first), RateLimitKey(other));
+}
+
+TEST(RateLimiterTests, KeysByIPv6Prefix) {
+  auto ipv6 = [](const char* text) {
+    struct sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(1234);
+    EXPECT_EQ(inet_pton(AF_INET6, text, &addr.sin6_addr), 1) << text;
+    return SocketSockAddr(reinterpret_cast<const struct sockaddr*>(&addr),
+                          sizeof(addr));
+  };
+  uint64_t key = RateLimitKey(ipv6("2001:db8:1:2::1"));
+  EXPECT_NE(key, 0);
+  // Hosts within a /64 share a bucket; other /64s don't.
+  EXPECT_EQ(RateLimitKey(ipv6("2001:db8:1:2:ffff::9")), key);
+  EXPECT_NE(RateLimitKey(ipv6("2001:db8:1:3::1")), key);
+  // Mapped IPv4 addresses are keyed like IPv4 peers.
+  EXPECT_EQ(RateLimitKey(ipv6("::ffff:10.0.0.1")),
+            RateLimitKey(SocketSockAddr("10.0.0.1", 80)));
+
+  auto unix_addr = SocketSockAddr::Unix("/tmp/rate_limit_test.sock");
+  ASSERT_TRUE(unix_addr.ok());
+  EXPECT_EQ(RateLimitKey(*unix_addr), 0);
+}
+
+TEST(RateLimitTests, ValidatesOptions) {
+  EXPECT_TRUE(ValidateRateLimitOptions({}).ok());
+  EXPECT_TRUE(ValidateRateLimitOptions(Limit(1.0 / 86400, 1)).ok());
+  for (double rate : {0.0, -1.0, std::nan(""), HUGE_VAL, 2e9, 1e-12}) {
+    EXPECT_TRUE(absl::IsInvalidArgument(
+        ValidateRateLimitOptions(Limit(rate, 20)))) << rate;
+  }
+}
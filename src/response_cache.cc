@@ -0,0 +1,189 @@
+// Copyright 2022 Daniel Liu
+
+#include "response_cache.h"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/functional/function_ref.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+
+#include "http.h"
+#include "metrics.h"
+
+namespace cppserver {
+
+ResponseCache::ResponseCache(ResponseCacheOptions options, Counter* hits,
+                             Counter* misses)
+    : options_{std::move(options)}, hits_{hits}, misses_{misses} {}
+
+std::optional<std::string> ResponseCache::Key(
+    const HTTPRequest& request) const {
+  if (request.method != "GET") {
+    return {};
+  }
+  for (auto header : {"If-None-Match", "If-Modified-Since", "If-Range",
+                      "Range"}) {
+    if (request.GetHeader(header)) {
+      return {};
+    }
+  }
+
+  // Header values can't contain line breaks, so they separate the fields.
+  // A missing header is distinguished from an empty one.
+  std::string key(request.method);
+  key += '\n';
+  key += request.target;
+  auto append_header = [&](std::string_view name) {
+    key += '\n';
+    if (auto value = request.GetHeader(name)) {
+      key += '=';
+      key += absl::StripAsciiWhitespace(*value);
+    }
+  };
+  append_header("Accept-Encoding");
+  for (const auto& name : options_.key_headers) {
+    append_header(name);
+  }
+  return key;
+}
+
+bool ResponseCache::IsStorable(const HTTPResponse& response) {
+  if (response.StatusCode() != 200 || response.GetHeader("Set-Cookie")) {
+    return false;
+  }
+  // File bodies would hold a descriptor open for the entry's lifetime, and
+  // take no memory to be charged for.
+  if (response.HasFileBody()) {
+    return false;
+  }
+  if (auto cache_control = response.GetHeader("Cache-Control")) {
+    for (std::string_view directive : absl::StrSplit(*cache_control, ',')) {
+      directive = absl::StripAsciiWhitespace(directive);
+      if (absl::EqualsIgnoreCase(directive, "no-store")
+          || absl::EqualsIgnoreCase(directive, "private")) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+ResponseCache::Shard& ResponseCache::ShardFor(const std::string& key) {
+  return shards_[absl::Hash<std::string>{}(key) % kshards_];
+}
+
+std::shared_ptr<const HTTPResponse> ResponseCache::GetOrRender(
+    const std::string& key, absl::FunctionRef<HTTPResponse()> render) {
+  Shard& shard = ShardFor(key);
+  shard.mutex.Lock();
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    if (it->second.expires > std::chrono::steady_clock::now()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+      std::shared_ptr<const HTTPResponse> cached = it->second.response;
+      shard.mutex.Unlock();
+      if (hits_) {
+        hits_->Increment();
+      }
+      return cached;
+    }
+    Erase(shard, it);
+  }
+
+  auto [flight_it, inserted] = shard.flights.try_emplace(key);
+  if (!inserted) {
+    // Another request is rendering this key; share its response.
+    std::shared_ptr<Flight> flight = flight_it->second;
+    shard.mutex.Unlock();
+    flight->done.WaitForNotification();
+    if (flight->response) {
+      if (hits_) {
+        hits_->Increment();
+      }
+      return flight->response;
+    }
+    // The response was only for the request that rendered it, or rendering
+    // failed.
+    if (misses_) {
+      misses_->Increment();
+    }
+    return std::make_shared<const HTTPResponse>(render());
+  }
+  std::shared_ptr<Flight> flight = flight_it->second =
+      std::make_shared<Flight>();
+  shard.mutex.Unlock();
+
+  if (misses_) {
+    misses_->Increment();
+  }
+  std::shared_ptr<const HTTPResponse> response;
+  // Runs even if `render` throws, so waiters aren't left hanging.
+  absl::Cleanup finish_flight = [&] {
+    {
+      absl::MutexLock lock(&shard.mutex);
+      shard.flights.erase(key);
+      if (response && IsStorable(*response)) {
+        Insert(shard, key, response);
+        flight->response = response;
+      }
+    }
+    flight->done.Notify();
+  };
+  response = std::make_shared<const HTTPResponse>(render());
+  // Returned through a copy: returning `response` itself would move it out
+  // before `finish_flight` stores it.
+  std::shared_ptr<const HTTPResponse> result = response;
+  return result;
+}
+
+void ResponseCache::Erase(
+    Shard& shard, absl::flat_hash_map<std::string, Entry>::iterator it) {
+  shard.bytes -= it->second.bytes;
+  shard.lru.erase(it->second.lru);
+  shard.entries.erase(it);
+}
+
+void ResponseCache::Insert(Shard& shard, const std::string& key,
+                           std::shared_ptr<const HTTPResponse> response) {
+  size_t bytes = key.size() + response->Body().size() + kentry_overhead_;
+  size_t budget = options_.max_bytes / kshards_;
+  if (bytes > budget) {
+    return;
+  }
+
+  auto existing = shard.entries.find(key);
+  if (existing != shard.entries.end()) {
+    Erase(shard, existing);
+  }
+  while (shard.bytes + bytes > budget) {
+    Erase(shard, shard.entries.find(shard.lru.back()));
+  }
+
+  shard.lru.push_front(key);
+  shard.entries.emplace(
+      key, Entry{std::move(response),
+                 std::chrono::steady_clock::now() + options_.ttl, bytes,
+                 shard.lru.begin()});
+  shard.bytes += bytes;
+}
+
+size_t ResponseCache::Bytes() const {
+  size_t bytes = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock lock(&shard.mutex);
+    bytes += shard.bytes;
+  }
+  return bytes;
+}
+
+}  // namespace cppserver
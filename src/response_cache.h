@@ -0,0 +1,120 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_RESPONSE_CACHE_H_
+#define _CPPSERVER_RESPONSE_CACHE_H_
+
+#include <array>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+
+#include "http.h"
+#include "metrics.h"
+
+namespace cppserver {
+
+struct ResponseCacheOptions {
+  // How long a response is served from the cache after it's rendered.
+  std::chrono::milliseconds ttl = std::chrono::seconds(60);
+
+  // Upper bound on the size of the cached responses. The least recently used
+  // responses are evicted to stay under it.
+  size_t max_bytes = 64 * 1024 * 1024;
+
+  // Request headers whose values are part of the cache key, e.g. "Cookie"
+  // for per-user pages. Accept-Encoding is always part of the key.
+  std::vector<std::string> key_headers;
+};
+
+// Caches whole responses for an endpoint whose output depends only on the
+// request method, target and a few headers. Entries are spread over
+// independently locked shards, and concurrent misses on the same key are
+// coalesced so a burst of requests for a cold page renders it once.
+//
+//    std::optional<std::string> key = cache.Key(request);
+//    std::shared_ptr<const HTTPResponse> response = key
+//        ? cache.GetOrRender(*key, render)
+//        : std::make_shared<const HTTPResponse>(render());
+class ResponseCache {
+ public:
+  // `hits` and `misses`, if given, count lookups.
+  explicit ResponseCache(ResponseCacheOptions options,
+                         Counter* hits = nullptr, Counter* misses = nullptr);
+
+  // Returns the cache key for `request`, or no value if it must bypass the
+  // cache. Only GET requests without conditional or Range headers are
+  // cached, since the others' responses depend on what the client has.
+  std::optional<std::string> Key(const HTTPRequest& request) const;
+
+  // Returns the response cached under `key`, or calls `render` to produce it.
+  // While one call renders a key, others for the same key wait and share its
+  // result if it can be stored: only 200 responses with an in-memory body
+  // that don't set cookies or opt out with Cache-Control are, and for others
+  // each waiting call renders its own. Cached responses are shared rather
+  // than copied, so send them with HTTPResponse::WriteTo as they are.
+  std::shared_ptr<const HTTPResponse> GetOrRender(
+      const std::string& key, absl::FunctionRef<HTTPResponse()> render);
+
+  // The total size charged for cached responses.
+  size_t Bytes() const;
+
+ private:
+  static constexpr size_t kshards_ = 16;
+
+  // Charged per entry on top of the key and body, for the headers and
+  // bookkeeping.
+  static constexpr size_t kentry_overhead_ = 256;
+
+  struct Entry {
+    std::shared_ptr<const HTTPResponse> response;
+    std::chrono::steady_clock::time_point expires;
+    size_t bytes;
+    // Position in the shard's LRU list.
+    std::list<std::string>::iterator lru;
+  };
+
+  // A render in progress, shared with requests waiting on it.
+  struct Flight {
+    absl::Notification done;
+    // Set before `done` if the response can be shared.
+    std::shared_ptr<const HTTPResponse> response;
+  };
+
+  struct alignas(64) Shard {
+    mutable absl::Mutex mutex;
+    absl::flat_hash_map<std::string, Entry> entries ABSL_GUARDED_BY(mutex);
+    // Keys from most to least recently used.
+    std::list<std::string> lru ABSL_GUARDED_BY(mutex);
+    absl::flat_hash_map<std::string, std::shared_ptr<Flight>> flights
+        ABSL_GUARDED_BY(mutex);
+    size_t bytes ABSL_GUARDED_BY(mutex) = 0;
+  };
+
+  static bool IsStorable(const HTTPResponse& response);
+
+  Shard& ShardFor(const std::string& key);
+
+  void Erase(Shard& shard, absl::flat_hash_map<std::string, Entry>::iterator it)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.mutex);
+
+  void Insert(Shard& shard, const std::string& key,
+              std::shared_ptr<const HTTPResponse> response)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard.mutex);
+
+  ResponseCacheOptions options_;
+  Counter* hits_;
+  Counter* misses_;
+  std::array<Shard, kshards_> shards_;
+};
+
+}  // namespace cppserver
+
+#endif
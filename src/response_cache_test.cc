@@ -0,0 +1,197 @@
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "gtest/gtest.h"
+
+#include "http.h"
+#include "response_cache.h"
+
+using namespace cppserver;
+
+namespace {
+
+HTTPRequest Get(std::string target) {
+  HTTPRequest request;
+  request.method = "GET";
+  request.target = std::move(target);
+  request.version = "HTTP/1.1";
+  return request;
+}
+
+HTTPResponse Ok(std::string body) {
+  HTTPResponse response(200);
+  response.SetBody(std::move(body));
+  return response;
+}
+
+}  // namespace
+
+TEST(ResponseCacheTests, ReusesResponses) {
+  ResponseCache cache({});
+  int renders = 0;
+  auto render = [&] { return Ok("rendered " + std::to_string(++renders)); };
+
+  auto key = cache.Key(Get("/a"));
+  ASSERT_TRUE(key);
+  EXPECT_EQ(cache.GetOrRender(*key, render)->Body(), "rendered 1");
+  EXPECT_EQ(cache.GetOrRender(*key, render)->Body(), "rendered 1");
+  EXPECT_EQ(cache.GetOrRender(*cache.Key(Get("/b")), render)->Body(),
+            "rendered 2");
+}
+
+TEST(ResponseCacheTests, SharesHitsWithoutCopying) {
+  ResponseCache cache({});
+  auto render = [] { return Ok(std::string(64 * 1024, 'x')); };
+  auto first = cache.GetOrRender("key", render);
+  auto second = cache.GetOrRender("key", render);
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_EQ(first->Body().data(), second->Body().data());
+}
+
+TEST(ResponseCacheTests, KeysOnSelectedHeaders) {
+  ResponseCacheOptions options;
+  options.key_headers = {"Cookie"};
+  ResponseCache cache(options);
+  HTTPRequest a = Get("/");
+  a.headers.emplace_back("Cookie", "user=a");
+  HTTPRequest b = Get("/");
+  b.headers.emplace_back("Cookie", "user=b");
+  HTTPRequest gzip = Get("/");
+  gzip.headers.emplace_back("Accept-Encoding", "gzip");
+
+  EXPECT_NE(cache.Key(a), cache.Key(b));
+  EXPECT_NE(cache.Key(a), cache.Key(Get("/")));
+  EXPECT_NE(cache.Key(gzip), cache.Key(Get("/")));
+}
+
+TEST(ResponseCacheTests, BypassesConditionalAndUnsafeRequests) {
+  ResponseCache cache({});
+  HTTPRequest conditional = Get("/");
+  conditional.headers.emplace_back("If-None-Match", "\"x\"");
+  HTTPRequest post = Get("/");
+  post.method = "POST";
+
+  EXPECT_FALSE(cache.Key(conditional));
+  EXPECT_FALSE(cache.Key(post));
+}
+
+TEST(ResponseCacheTests, DoesNotStorePrivateResponses) {
+  ResponseCache cache({});
+  int renders = 0;
+  auto render = [&] {
+    ++renders;
+    HTTPResponse response = Ok("private");
+    response.AddHeader("Cache-Control", "private, max-age=60");
+    return response;
+  };
+  cache.GetOrRender("key", render);
+  cache.GetOrRender("key", render);
+  EXPECT_EQ(renders, 2);
+
+  cache.GetOrRender("missing", [] { return HTTPResponse(404); });
+  EXPECT_EQ(cache.Bytes(), 0);
+}
+
+TEST(ResponseCacheTests, ExpiresEntries) {
+  ResponseCacheOptions options;
+  options.ttl = std::chrono::milliseconds(10);
+  ResponseCache cache(options);
+  int renders = 0;
+  auto render = [&] { ++renders; return Ok("body"); };
+  cache.GetOrRender("key", render);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  cache.GetOrRender("key", render);
+  EXPECT_EQ(renders, 2);
+}
+
+TEST(ResponseCacheTests, EvictsToStayWithinBudget) {
+  ResponseCacheOptions options;
+  options.max_bytes = 1024 * 1024;
+  ResponseCache cache(options);
+  for (int i = 0; i < 1000; ++i) {
+    cache.GetOrRender(std::to_string(i),
+                      [] { return Ok(std::string(4096, 'x')); });
+    EXPECT_LE(cache.Bytes(), 1024 * 1024);
+  }
+  EXPECT_GT(cache.Bytes(), 512 * 1024);
+}
+
+TEST(ResponseCacheTests, CoalescesConcurrentMisses) {
+  ResponseCache cache({});
+  std::atomic<int> renders = 0;
+  std::atomic<bool> release = false;
+  auto render = [&] {
+    ++renders;
+    while (!release) {
+      std::this_thread::yield();
+    }
+    return Ok("shared");
+  };
+
+  std::vector<std::thread> threads;
+  std::atomic<int> matches = 0;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&] {
+      if (cache.GetOrRender("key", render)->Body() == "shared") {
+        ++matches;
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  release = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(renders, 1);
+  EXPECT_EQ(matches, 8);
+}
+
+TEST(ResponseCacheTests, DoesNotSharePrivateResponses) {
+  ResponseCache cache({});
+  std::atomic<int> renders = 0;
+  std::atomic<bool> release = false;
+  auto render = [&] {
+    int session = ++renders;
+    // Hold the first render so the others wait on it.
+    while (session == 1 && !release) {
+      std::this_thread::yield();
+    }
+    HTTPResponse response = Ok("welcome");
+    response.AddHeader("Set-Cookie", "session=" + std::to_string(session));
+    return response;
+  };
+
+  absl::Mutex mutex;
+  std::set<std::string> cookies;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&] {
+      auto response = cache.GetOrRender("key", render);
+      absl::MutexLock lock(&mutex);
+      cookies.insert(std::string(*response->GetHeader("Set-Cookie")));
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  release = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(renders, 8);
+  EXPECT_EQ(cookies.size(), 8);
+}
+
+TEST(ResponseCacheTests, RecoversFromFailedRenders) {
+  ResponseCache cache({});
+  EXPECT_THROW(cache.GetOrRender("key", []() -> HTTPResponse {
+    throw std::runtime_error("render failed");
+  }), std::runtime_error);
+  EXPECT_EQ(cache.GetOrRender("key", [] { return Ok("rendered"); })->Body(),
+            "rendered");
+}
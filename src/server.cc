@@ -2,64 +2,443 @@
 
 #include "src/server.h"
 
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/types.h>
-
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
 #include <optional>
-#include <queue>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/synchronization/mutex.h"
 
+#include "access_log.h"
+#include "affinity.h"
+#include "admission.h"
+#include "arena.h"
+#include "endpoint_pattern.h"
+#include "event_stream.h"
+#include "handoff.h"
 #include "http.h"
+#include "logging.h"
+#include "metrics.h"
+#include "multipart.h"
+#include "rate_limit.h"
+#include "response_cache.h"
 #include "socket.h"
+#include "websocket.h"
+#include "worker_pool.h"
 
 namespace cppserver {
 
-const size_t kMAX_CONCURRENCY = 8;
+const size_t kHEADER_CHUNK_SIZE = 8 * 1024;
+const size_t kRECEIVE_CHUNK_SIZE = 32 * 1024;
+const size_t kMAX_HEADER_SIZE = 64 * 1024;
+
+namespace {
+
+// Whether the connection stays open after `request`. Only HTTP/1.1 clients
+// get keep-alive, and only for bodies delimited by Content-Length.
+bool KeepAlive(const HTTPRequest& request) {
+  if (request.version != "HTTP/1.1" || request.GetHeader("Transfer-Encoding")) {
+    return false;
+  }
+  if (auto connection = request.GetHeader("Connection")) {
+    for (std::string_view option : absl::StrSplit(*connection, ',')) {
+      if (absl::EqualsIgnoreCase(absl::StripAsciiWhitespace(option),
+                                 "close")) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Pins the calling thread, if `cpus` is set, logging rather than failing if
+// it can't.
+void PinThread(const std::vector<int>& cpus, std::string_view thread) {
+  if (cpus.empty()) {
+    return;
+  }
+  if (auto status = PinCurrentThread(cpus); !status.ok()) {
+    LOG(ERROR) << "Failed to place the " << thread << " thread: "
+               << status.message();
+  }
+}
+
+// The response to a request turned away before its body is read. The
+// connection is closed after it, since the body is left unread.
+std::string RejectionResponse(std::string_view status,
+                              std::chrono::seconds retry_after) {
+  return absl::StrCat("HTTP/1.1 ", status, "\r\n"
+                      "Server: cppserver\r\n"
+                      "Retry-After: ", retry_after.count(), "\r\n"
+                      "Content-Length: 0\r\n"
+                      "Connection: close\r\n"
+                      "\r\n");
+}
+
+}  // namespace
+
+// Shutting the connection down wakes the blocked call, which then fails.
+class Server::StallTimer {
+ public:
+  StallTimer(EventLoop* loop, int fd) : loop_{loop}, fd_{fd} {}
+  ~StallTimer() { Stop(); }
+
+  // Starts the countdown, or restarts it after progress.
+  void Start(std::chrono::milliseconds timeout) {
+    Stop();
+    timer_ = loop_->AddTimer(timeout, [this] {
+      expired_.store(true, std::memory_order_relaxed);
+      shutdown(fd_, SHUT_RDWR);
+    });
+  }
+
+  // Once this returns, the connection won't be shut down.
+  void Stop() {
+    if (timer_ != 0) {
+      loop_->CancelTimer(timer_);
+      timer_ = 0;
+    }
+  }
+
+  bool Expired() const { return expired_.load(std::memory_order_relaxed); }
+
+ private:
+  EventLoop* loop_;
+  int fd_;
+  EventLoop::TimerId timer_ = 0;
+  std::atomic<bool> expired_ {false};
+};
+
+Server::Connection::Connection(Socket socket_in, SocketSockAddr peer_in,
+                               Server* server_in)
+    : socket{std::move(socket_in)}, peer{peer_in},
+      start_time{std::chrono::system_clock::now()},
+      start{std::chrono::steady_clock::now()}, server{server_in} {
+  server->active_connections_->Add(1);
+  absl::MutexLock lock(&server->connections_mutex_);
+  server->connections_.insert(this);
+}
 
-Server::Server(in_port_t port_in) 
-    : port_{port_in}, 
-      socket_ {cppserver::SocketDomain::kIPV4,
-          cppserver::SocketType::kTCP} {
+Server::Connection::~Connection() {
+  server->active_connections_->Add(-1);
+  absl::MutexLock lock(&server->connections_mutex_);
+  server->connections_.erase(this);
+}
+
+Server::Server(in_port_t port_in, ServerOptions options)
+    : port_{port_in}, timeouts_{options.timeouts},
+      max_body_size_{options.max_body_size},
+      placement_{options.placement}, cpu_nodes_{CpuNodes()},
+      admission_{options.admission},
+      shed_response_{RejectionResponse("503 Service Unavailable",
+                                       options.admission.retry_after)},
+      unix_path_{std::move(options.unix_path)},
+      socket_ {unix_path_.empty() ? cppserver::SocketDomain::kIPV4
+                                  : cppserver::SocketDomain::kUnix,
+          cppserver::SocketType::kTCP},
+      stop_fd_{eventfd(0, EFD_CLOEXEC)},
+      handoff_path_{std::move(options.handoff_path)},
+      drain_timeout_{options.drain_timeout},
+      workers_{options.worker_threads,
+               WorkerGroups(options.worker_threads),
+               [this](size_t index) { StartWorker(index); }} {
+  parse_time_ = metrics_.AddHistogram(
+      "cppserver_parse_duration_seconds", "Time spent parsing requests.");
+  handler_time_ = metrics_.AddHistogram(
+      "cppserver_handler_duration_seconds",
+      "Time spent in endpoint handlers, including response compression.");
+  send_time_ = metrics_.AddHistogram(
+      "cppserver_send_duration_seconds", "Time spent sending responses.");
+  active_connections_ = metrics_.AddGauge(
+      "cppserver_active_connections", "Connections currently being handled.");
+  worker_backlog_ = metrics_.AddGauge(
+      "cppserver_worker_backlog", "Requests waiting for a worker thread.");
+  queue_delay_ = metrics_.AddHistogram(
+      "cppserver_queue_delay_seconds",
+      "Time requests waited for a worker thread.");
+  shed_requests_ = metrics_.AddCounter(
+      "cppserver_shed_requests_total",
+      "Requests answered with a 503 because the server was overloaded.");
+  unmatched_metrics_ = AddEndpointMetrics("");
+
+  loop_thread_ = std::thread([this] {
+    PinThread(placement_.loop_cpus, "event loop");
+    loop_.Run();
+  });
   listening_thread_ = std::thread(&Server::ListenForConnections, this);
 }
 
-void Server::AddEndpointHandler(
-    std::string endpoint, 
-    std::function<std::string(
-        HTTPRequest, std::unordered_map<std::string, std::string>)> handler) {
-  endpoint_handlers_mutex_.WriterLock();
-  std::vector<std::string> components;
-  // Get each component (within <>).
-  std::regex component_regex("<(.*)>");
-  std::sregex_iterator component_it(endpoint.begin(), endpoint.end(), 
-      component_regex);
-  std::sregex_iterator component_end;
-  while (component_it != component_end) {
-    std::smatch match = *component_it;
-    components.push_back(match[1]);
-    ++component_it;
-  }
-  // Preprocess the string, replacing `<.*>` with `(.*)`.
-  std::regex endpoint_regex {std::regex_replace(endpoint, 
-      std::regex("<.*>"), "(.*)")};
-  
+void Server::AddEndpointHandler(std::string endpoint, EndpointHandler handler,
+                                EndpointOptions options) {
   LOG(INFO) << "Adding endpoint handler for endpoint " << endpoint;
 
-  endpoint_handlers_.push_back({
-      std::regex(endpoint_regex), components, handler});
+  auto entry = std::make_unique<Endpoint>(Endpoint{
+      EndpointPattern(endpoint), std::move(handler), std::move(options),
+      AddEndpointMetrics(endpoint), nullptr, nullptr, nullptr});
+  if (entry->options.cache) {
+    entry->cache = std::make_unique<ResponseCache>(
+        *entry->options.cache,
+        metrics_.AddCounter("cppserver_response_cache_hits_total",
+                            "Requests answered from the response cache.",
+                            {{"route", endpoint}}),
+        metrics_.AddCounter("cppserver_response_cache_misses_total",
+                            "Requests rendered for the response cache.",
+                            {{"route", endpoint}}));
+  }
+  if (entry->options.rate_limit) {
+    if (auto status = ValidateRateLimitOptions(*entry->options.rate_limit);
+        !status.ok()) {
+      LOG(FATAL) << "Invalid rate limit for endpoint " << endpoint << ": "
+                 << status.message();
+    }
+    entry->rate_limiter =
+        std::make_unique<RateLimiter>(*entry->options.rate_limit);
+    entry->rate_limited = metrics_.AddCounter(
+        "cppserver_rate_limited_requests_total",
+        "Requests answered with a 429 because the client exceeded the "
+        "route's rate limit.",
+        {{"route", endpoint}});
+  }
+
+  endpoint_handlers_mutex_.WriterLock();
+  endpoint_handlers_.push_back(std::move(entry));
+  endpoint_handlers_mutex_.WriterUnlock();
+}
+
+void Server::AddWebSocketHandler(std::string endpoint,
+                                 WebSocketHandler handler) {
+  LOG(INFO) << "Adding WebSocket handler for endpoint " << endpoint;
+
+  // Valid handshakes are upgraded before the handler would run, so it only
+  // answers the rest.
+  auto reject = [](const HTTPRequest& request, const EndpointParams&) {
+    auto handshake = AcceptWebSocket(request);
+    bool bad_version = absl::IsFailedPrecondition(handshake.status());
+    HTTPResponse response(bad_version ? 426 : 400);
+    if (bad_version) {
+      response.AddHeader("Sec-WebSocket-Version", "13");
+    }
+    response.AddHeader(CommonHeader::kContentTypePlainText);
+    response.SetBody(std::string(handshake.status().message()));
+    return response;
+  };
+  auto entry = std::make_unique<Endpoint>(Endpoint{
+      EndpointPattern(endpoint), std::move(reject), {},
+      AddEndpointMetrics(endpoint), std::move(handler), nullptr, nullptr});
+
+  endpoint_handlers_mutex_.WriterLock();
+  endpoint_handlers_.push_back(std::move(entry));
+  endpoint_handlers_mutex_.WriterUnlock();
+}
+
+std::shared_ptr<EventChannel> Server::CreateEventChannel(
+    EventChannelOptions options) {
+  return std::make_shared<EventChannel>(&loop_, options);
+}
+
+void Server::AddEventStreamHandler(std::string endpoint,
+                                   EventStreamHandler handler) {
+  LOG(INFO) << "Adding event stream handler for endpoint " << endpoint;
+
+  // Subscriptions are taken over before the handler would run, so it only
+  // answers other methods and unknown channels.
+  auto reject = [](const HTTPRequest& request, const EndpointParams&) {
+    HTTPResponse response(request.method == "GET" ? 404 : 405);
+    response.AddHeader(CommonHeader::kContentTypePlainText);
+    if (response.StatusCode() == 405) {
+      response.AddHeader("Allow", "GET");
+    }
+    return response;
+  };
+  auto entry = std::make_unique<Endpoint>(Endpoint{
+      EndpointPattern(endpoint), std::move(reject), {},
+      AddEndpointMetrics(endpoint), nullptr, std::move(handler), nullptr});
+
+  endpoint_handlers_mutex_.WriterLock();
+  endpoint_handlers_.push_back(std::move(entry));
   endpoint_handlers_mutex_.WriterUnlock();
 }
 
+void Server::EnableMetricsEndpoint(std::string endpoint) {
+  EndpointOptions options;
+  options.priority = RequestPriority::kCritical;
+  AddEndpointHandler(std::move(endpoint),
+      [this](const HTTPRequest&, const EndpointParams&) {
+        HTTPResponse response(200);
+        response.AddHeader("Content-Type", "text/plain; version=0.0.4");
+        response.SetBody(metrics_.RenderPrometheus());
+        return response;
+      },
+      options);
+}
+
+Server::EndpointMetrics Server::AddEndpointMetrics(
+    const std::string& endpoint) {
+  // Requests that match no endpoint are labeled with an empty route.
+  EndpointMetrics endpoint_metrics;
+  endpoint_metrics.latency = metrics_.AddHistogram(
+      "cppserver_request_duration_seconds",
+      "Time from accepting a request to finishing its response.",
+      {{"route", endpoint}});
+  for (int i = 0; i < 5; ++i) {
+    endpoint_metrics.responses[i] = metrics_.AddCounter(
+        "cppserver_responses_total", "Responses sent, by status class.",
+        {{"route", endpoint}, {"code", absl::StrCat(i + 1, "xx")}});
+  }
+  endpoint_metrics.in_flight = metrics_.AddGauge(
+      "cppserver_in_flight_requests", "Requests being handled.",
+      {{"route", endpoint}});
+  return endpoint_metrics;
+}
+
+void Server::EndpointMetrics::Record(int status,
+                                     std::chrono::nanoseconds duration) const {
+  latency->Record(duration);
+  if (status >= 100 && status < 600) {
+    responses[status / 100 - 1]->Increment();
+  }
+}
+
+void Server::SetAccessLog(AccessLog* access_log) {
+  access_log_.store(access_log, std::memory_order_release);
+}
+
 Server::~Server() {
   listening_thread_.join();
+  Drain();
+  loop_.Stop();
+  loop_thread_.join();
+  close(stop_fd_);
+  if (handoff_fd_ >= 0) {
+    close(handoff_fd_);
+  }
 }
 
-void Server::ListenForConnections() {
-  socket_.Bind(cppserver::SocketSockAddr("127.0.0.1", port_));
-  socket_.Listen(kMAX_CONCURRENCY);
+void Server::Stop() {
+  uint64_t one = 1;
+  [[maybe_unused]] ssize_t result = write(stop_fd_, &one, sizeof(one));
+}
+
+void Server::Drain() {
+  draining_.store(true, std::memory_order_relaxed);
+  // Idle connections have nothing to finish. Those reading headers finish
+  // their request, which then closes them.
+  loop_.Post([this] {
+    std::vector<Connection*> idle;
+    for (const auto& [fd, connection] : idle_connections_) {
+      idle.push_back(connection);
+    }
+    for (Connection* connection : idle) {
+      CloseConnection(*connection);
+    }
+  });
+
+  absl::MutexLock lock(&connections_mutex_);
+  auto drained = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(connections_mutex_) {
+    return connections_.empty();
+  };
+  if (connections_mutex_.AwaitWithTimeout(
+          absl::Condition(&drained),
+          absl::FromChrono(drain_timeout_))) {
+    return;
+  }
+  LOG(WARNING) << "Closing " << connections_.size()
+               << " connections that didn't finish draining";
+  // Shutting them down wakes whichever thread has them, which then lets go.
+  for (Connection* connection : connections_) {
+    shutdown(connection->socket.GetFD(), SHUT_RDWR);
+  }
+  connections_mutex_.Await(absl::Condition(&drained));
+}
+
+void Server::StartWorker(size_t index) {
+  if (!placement_.worker_cpus.empty()) {
+    PinThread({placement_.worker_cpus[index % placement_.worker_cpus.size()]},
+              "worker");
+  }
+  RequestArena::PrepareThread();
+}
+
+std::vector<size_t> Server::WorkerGroups(size_t threads) const {
+  std::vector<size_t> groups(threads, 0);
+  if (!placement_.worker_cpus.empty()) {
+    for (size_t i = 0; i < threads; ++i) {
+      groups[i] = NodeOf(
+          placement_.worker_cpus[i % placement_.worker_cpus.size()]);
+    }
+  }
+  return groups;
+}
+
+size_t Server::NodeOf(int cpu) const {
+  return cpu >= 0 && static_cast<size_t>(cpu) < cpu_nodes_.size()
+      ? cpu_nodes_[cpu] : 0;
+}
+
+void Server::OpenListener() {
+  std::optional<int> inherited = InheritedListener();
+  if (inherited) {
+    LOG(INFO) << "Using the listening socket passed by the service manager";
+  } else if (!handoff_path_.empty()) {
+    auto handed_off = RequestListener(handoff_path_);
+    if (handed_off.ok()) {
+      LOG(INFO) << "Took over the listening socket of the running server";
+      inherited = *handed_off;
+    } else if (!absl::IsNotFound(handed_off.status())) {
+      LOG(ERROR) << "Failed to take over the listening socket: "
+                 << handed_off.status().message();
+    }
+  }
+
+  if (inherited) {
+    socket_ = Socket::FromFD(*inherited);
+  } else if (!unix_path_.empty()) {
+    auto addr = SocketSockAddr::Unix(unix_path_);
+    if (!addr.ok()) {
+      LOG(FATAL) << addr.status().message();
+      return;
+    }
+    // A socket file left by an earlier server would make bind fail.
+    unlink(unix_path_.c_str());
+    socket_.Bind(*addr);
+    socket_.Listen(SOMAXCONN);
+  } else {
+    // Connections left in TIME_WAIT by a previous server mustn't keep this
+    // one from binding.
+    int reuse = 1;
+    setsockopt(socket_.GetFD(), SOL_SOCKET, SO_REUSEADDR, &reuse,
+               sizeof(reuse));
+    socket_.Bind(cppserver::SocketSockAddr("127.0.0.1", port_));
+    // Long-lived connections (event streams, WebSockets) reconnect in
+    // bursts, so leave room for them to queue while earlier ones are handed
+    // off.
+    socket_.Listen(SOMAXCONN);
+  }
+  // The listening thread waits in poll, so it can be stopped.
+  socket_.SetNonBlocking(true);
 
   if (!socket_) {
     LOG(ERROR) << "Failed to bind/listen";
@@ -68,113 +447,515 @@ void Server::ListenForConnections() {
     return;
   }
 
-  LOG(INFO) << "Server listening on port " << port_;
+  if (handoff_path_.empty()) {
+    return;
+  }
+  auto handoff = ListenForHandoff(handoff_path_);
+  if (!handoff.ok()) {
+    LOG(ERROR) << "Failed to listen for replacements: "
+               << handoff.status().message();
+    return;
+  }
+  handoff_fd_ = *handoff;
+  loop_.Post([this, fd = handoff_fd_] {
+    loop_.Add(fd, EPOLLIN, [this, fd](uint32_t) {
+      auto status = HandOff(fd, socket_.GetFD());
+      if (absl::IsUnavailable(status)) {
+        return;
+      }
+      if (!status.ok()) {
+        LOG(ERROR) << "Failed to hand off: " << status.message();
+        return;
+      }
+      // The replacement accepts from the same socket from now on.
+      LOG(INFO) << "Handed the listening socket to a replacement";
+      loop_.Remove(fd);
+      Stop();
+    });
+  });
+}
 
-  std::queue<std::thread> threads;
+void Server::ListenForConnections() {
+  PinThread(placement_.loop_cpus, "listener");
+  OpenListener();
+  if (!socket_) {
+    return;
+  }
 
+  if (unix_path_.empty()) {
+    LOG(INFO) << "Server listening on port " << port_;
+  } else {
+    LOG(INFO) << "Server listening on " << unix_path_;
+  }
+
+  struct pollfd fds[] = {{socket_.GetFD(), POLLIN, 0}, {stop_fd_, POLLIN, 0}};
   while (true) {
-    while (size(threads) > kMAX_CONCURRENCY) {
-      threads.front().join();
-      threads.pop();
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+      LOG(ERROR) << "poll failed, errno = " << errno;
+      return;
+    }
+    if (fds[1].revents) {
+      LOG(INFO) << "Stopped accepting connections";
+      return;
+    }
+    if (!fds[0].revents) {
+      continue;
     }
-
     auto accept = socket_.Accept();
-    if (!socket_) {
-      LOG(ERROR) << "Failed to accept connection!";
+    if (!accept) {
+      if (!socket_) {
+        LOG(ERROR) << "Listening socket failed: " << socket_.Status().message();
+        return;
+      }
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS
+          || errno == ENOMEM) {
+        // Retrying right away would spin until a connection closes.
+        LOG(ERROR) << "Failed to accept connection, errno = " << errno;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
       continue;
     }
 
-    auto client = std::move(accept.value().first);
-    std::thread client_thread {&Server::HandleMessage, this, 
-        std::move(client)};
-    threads.emplace(std::move(client_thread));
+    auto& [client, peer] = *accept;
+    client.SetNonBlocking(true);
+    size_t worker_group =
+        placement_.steer_connections ? NodeOf(client.IncomingCpu()) : 0;
+    auto connection = std::make_shared<Connection>(std::move(client), peer,
+                                                   this);
+    connection->worker_group = worker_group;
+    loop_.Post([this, connection = std::move(connection)]() mutable {
+      WatchConnection(std::move(connection), false);
+    });
   }
 }
 
-void Server::HandleMessage(Socket client) {
-  std::string msg = "";
-  bool receiving = true;
-  std::optional<int> remaining_bytes = {};
+void Server::WatchConnection(std::shared_ptr<Connection> connection,
+                             bool idle) {
+  if (idle && connection->buffer.empty()
+      && draining_.load(std::memory_order_relaxed)) {
+    // Nothing more is wanted from it.
+    return;
+  }
+  connection->idle = idle && connection->buffer.empty();
+  if (connection->idle) {
+    idle_connections_[connection->socket.GetFD()] = connection.get();
+  }
+  if (idle && !connection->buffer.empty()) {
+    // The next request was pipelined behind the last one.
+    connection->start_time = std::chrono::system_clock::now();
+    connection->start = std::chrono::steady_clock::now();
+  }
+  ArmConnectionTimer(*connection,
+                     connection->idle ? timeouts_.idle : timeouts_.header);
+  // The callback holds the connection, so removing the descriptor from the
+  // loop closes it.
+  loop_.Add(connection->socket.GetFD(), EPOLLIN | EPOLLRDHUP,
+            [this, connection](uint32_t) { ReadConnection(connection); });
+
+  // Pipelined requests may have arrived along with the last one.
+  if (connection->buffer.find("\r\n\r\n") != std::string::npos) {
+    DispatchConnection(connection);
+  }
+}
 
-  do {
-    int bytes_to_receive = 256;
-    if (remaining_bytes) {
-      bytes_to_receive = remaining_bytes.value();
+void Server::ArmConnectionTimer(Connection& connection,
+                                std::chrono::milliseconds timeout) {
+  int fd = connection.socket.GetFD();
+  connection.timer = loop_.AddTimer(timeout, [this, fd] {
+    CPPSERVER_LOG(INFO) << "Closing connection " << fd << " on timeout";
+    idle_connections_.erase(fd);
+    loop_.Remove(fd);
+  });
+}
+
+void Server::ReadConnection(const std::shared_ptr<Connection>& connection) {
+  // Where to resume looking for the blank line.
+  size_t searched =
+      connection->buffer.size() > 3 ? connection->buffer.size() - 3 : 0;
+  char chunk[kHEADER_CHUNK_SIZE];
+  while (true) {
+    ssize_t result = connection->socket.Receive(chunk, sizeof(chunk));
+    if (result > 0) {
+      if (connection->idle) {
+        // The next request has started, so it gets the header timeout.
+        connection->idle = false;
+        idle_connections_.erase(connection->socket.GetFD());
+        connection->start_time = std::chrono::system_clock::now();
+        connection->start = std::chrono::steady_clock::now();
+        loop_.CancelTimer(connection->timer);
+        ArmConnectionTimer(*connection, timeouts_.header);
+      }
+      connection->buffer.append(chunk, result);
+      if (static_cast<size_t>(result) == sizeof(chunk)
+          && connection->buffer.size() <= kMAX_HEADER_SIZE) {
+        continue;
+      }
+      break;
+    }
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (!connection->idle) {
+      LOG(ERROR) << "Connection closed before the end of the headers";
     }
+    CloseConnection(*connection);
+    return;
+  }
 
-    auto recvd = client.Receive<char>(bytes_to_receive);
+  if (connection->buffer.find("\r\n\r\n", searched) != std::string::npos) {
+    DispatchConnection(connection);
+  } else if (connection->buffer.size() > kMAX_HEADER_SIZE) {
+    LOG(ERROR) << "Request headers are too large";
+    CloseConnection(*connection);
+  }
+}
 
-    if (!recvd) {
-      LOG(ERROR) << "Failed to receive message!";
-      LOG(ERROR) << "Error message: " << client.Status().message();
-      LOG(ERROR) << errno;
-      continue;
+void Server::CloseConnection(Connection& connection) {
+  int fd = connection.socket.GetFD();
+  loop_.CancelTimer(connection.timer);
+  idle_connections_.erase(fd);
+  // May destroy the connection.
+  loop_.Remove(fd);
+}
+
+void Server::DispatchConnection(
+    const std::shared_ptr<Connection>& connection) {
+  loop_.CancelTimer(connection->timer);
+  loop_.Remove(connection->socket.GetFD());
+  connection->socket.SetNonBlocking(false);
+  connection->dispatched = std::chrono::steady_clock::now();
+  workers_.Submit([this, connection] { HandleMessage(connection); },
+                  connection->worker_group);
+  worker_backlog_->Set(workers_.QueueLength());
+}
+
+absl::Status Server::ReceiveBody(
+    Socket& client, HTTPRequest& request, std::string_view* received_in,
+    const std::optional<MultipartOptions>& multipart, size_t max_body_size,
+    StallTimer& stall) {
+  size_t content_length = 0;
+  if (auto header = request.GetHeader("Content-Length")) {
+    if (!absl::SimpleAtoi(*header, &content_length)) {
+      return absl::InvalidArgumentError("Malformed Content-Length");
+    }
+  }
+  // Anything past the body belongs to the next request.
+  std::string_view received = received_in->substr(0, content_length);
+  received_in->remove_prefix(received.size());
+  size_t remaining = content_length - received.size();
+
+  // The body gets `body`, plus the time the bytes received so far take at
+  // body_min_rate. Only bytes that arrive earn time, so a client that falls
+  // behind the rate runs out of it whatever Content-Length it declared.
+  auto body_start = std::chrono::steady_clock::now();
+  size_t body_received = received.size();
+  auto allowed = [&] {
+    auto timeout = timeouts_.body;
+    if (size_t rate = timeouts_.body_min_rate) {
+      timeout += std::chrono::milliseconds(
+          body_received / rate * 1000 + body_received % rate * 1000 / rate);
+    }
+    return timeout;
+  };
+  auto armed = allowed();
+  auto progress = [&](size_t bytes) {
+    body_received += bytes;
+    // Re-arming takes the loop's timer lock, so the deadline is only moved
+    // once it is getting close.
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - body_start);
+    if (armed - elapsed > timeouts_.body / 2 || allowed() <= armed) {
+      return;
     }
+    armed = allowed();
+    stall.Start(armed - elapsed);
+  };
+  if (remaining > 0) {
+    stall.Start(armed);
+  }
 
-    if (recvd->second > 0) {
-      msg += std::string(recvd->first.get(), recvd->second);
+  std::optional<std::string> boundary;
+  if (multipart) {
+    if (auto content_type = request.GetHeader("Content-Type")) {
+      boundary = MultipartBoundary(*content_type);
+    }
+  }
 
-      if (remaining_bytes) {
-        LOG(INFO) << "Need to read in " << *remaining_bytes << " bytes";
-        remaining_bytes = remaining_bytes.value() - recvd->second;
-      } else {
-        auto remaining = cppserver::DetermineRemainingHTTPContentLength(msg);
-        if (remaining) {
-          remaining_bytes = remaining.value();
-          LOG(INFO) << "Can calculate end of message... " << *remaining_bytes 
-              << " bytes remaining";
-        }
+  if (!boundary) {
+    if (content_length > max_body_size) {
+      return absl::OutOfRangeError("Request body is too large");
+    }
+    // Receive straight into the body. It grows as data arrives rather than
+    // by what the client claims it will send.
+    request.body.assign(received);
+    while (remaining > 0) {
+      size_t size = request.body.size();
+      request.body.resize(size + std::min(remaining, kRECEIVE_CHUNK_SIZE));
+      ssize_t result = client.Receive(request.body.data() + size,
+                                      request.body.size() - size);
+      if (result <= 0) {
+        return absl::UnavailableError("Connection closed during the body");
       }
-    } else {
-      receiving = false;
-    }      
-  } while (receiving && (!remaining_bytes || remaining_bytes.value() > 0));
+      request.body.resize(size + result);
+      remaining -= result;
+      progress(result);
+    }
+    return absl::OkStatus();
+  }
 
-  auto parsed = ParseHTTPRequest(msg);
+  // Multipart bodies are parsed as they arrive rather than buffered, and
+  // large parts go to files, so memory use doesn't grow with the upload.
+  auto form_data = std::make_shared<MultipartFormData>(*multipart);
+  MultipartParser parser(*boundary, form_data.get());
+  auto status = parser.Feed(received);
+  std::pmr::string chunk(kRECEIVE_CHUNK_SIZE, '\0',
+                         request.body.get_allocator());
+  while (status.ok() && remaining > 0) {
+    ssize_t result =
+        client.Receive(chunk.data(), std::min(remaining, chunk.size()));
+    if (result <= 0) {
+      return absl::UnavailableError("Connection closed during the body");
+    }
+    status = parser.Feed(std::string_view(chunk.data(), result));
+    remaining -= result;
+    progress(result);
+  }
+  if (status.ok()) {
+    status = parser.Finish();
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  request.multipart = std::move(form_data);
+  return absl::OkStatus();
+}
+
+void Server::HandleMessage(std::shared_ptr<Connection> connection) {
+  worker_backlog_->Set(workers_.QueueLength());
+  auto queue_delay = std::chrono::steady_clock::now() - connection->dispatched;
+  queue_delay_->Record(queue_delay);
+  auto start_time = connection->start_time;
+  auto start = connection->start;
+  Socket& client = connection->socket;
+  const SocketSockAddr& peer = connection->peer;
+
+  // Everything allocated for the request comes from here and is released
+  // at once when it's done.
+  RequestArena arena;
+
+  // The loop has read up to the end of the header block. The body is read
+  // once the endpoint is known, since that decides how it's handled.
+  std::string_view buffer = connection->buffer;
+  size_t header_end = buffer.find("\r\n\r\n") + 4;
+  std::string_view head = buffer.substr(0, header_end);
+  std::string_view received_body = buffer.substr(header_end);
+
+  auto parse_start = std::chrono::steady_clock::now();
+  auto parsed = ParseHTTPRequest(head, arena.Resource());
+  parse_time_->Record(std::chrono::steady_clock::now() - parse_start);
   if (!parsed) {
     LOG(ERROR) << "Failed to parse HTTP request!" << std::endl;
     return;
   }
-  HTTPRequest request = parsed.value();
+  HTTPRequest request = std::move(*parsed);
 
-  LOG(INFO) << request.method << " " << request.target;
-  LOG(INFO) << "Found " << size(request.headers) << " headers";
-  LOG(INFO) << "Found body = " << request.body << ";";
+  CPPSERVER_LOG(INFO) << request.method << " " << request.target;
+  CPPSERVER_LOG(INFO) << "Found " << size(request.headers) << " headers";
+
+  auto log_access = [&](int status, ssize_t sent) {
+    AccessLog* access_log = access_log_.load(std::memory_order_acquire);
+    if (!access_log) {
+      return;
+    }
+    AccessLogRecord record = {};
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        start_time.time_since_epoch()).count();
+    record.latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    record.bytes_sent = sent > 0 ? sent : 0;
+    record.status = status;
+    record.method = ParseAccessLogMethod(request.method);
+    record.SetTarget(request.target);
+    record.SetPeer(peer);
+    access_log->Record(record);
+  };
 
   // Look through endpoints, find the first one that matches the request.
+  const Endpoint* endpoint = nullptr;
+  std::optional<EndpointParams> url_components;
 
   endpoint_handlers_mutex_.ReaderLock();
-  for (auto [path, component_names, handler] : endpoint_handlers_) {
-    std::smatch match;
-    if (std::regex_match(request.target, match, path)) {
-      endpoint_handlers_mutex_.ReaderUnlock();
-      LOG(INFO) << "Matched endpoint " << request.target;
-
-      std::unordered_map<std::string, std::string> url_components;
-      for (size_t i = 0; i < size(component_names); ++i) {
-        LOG(INFO) << component_names[i] << " = " << match[i + 1];
-        url_components[component_names[i]] = match[i + 1];
+  for (const auto& candidate : endpoint_handlers_) {
+    url_components = candidate->pattern.Match(request.Path(),
+                                              arena.Resource());
+    if (url_components) {
+      endpoint = candidate.get();
+      break;
+    }
+  }
+  endpoint_handlers_mutex_.ReaderUnlock();
+
+  // Answers with a preformatted response, before the body is read.
+  auto reject = [&](int status, std::string_view rejection) {
+    auto sent = client.Send(rejection.data(), rejection.size(), MSG_NOSIGNAL);
+    (endpoint ? endpoint->metrics : unmatched_metrics_)
+        .Record(status, std::chrono::steady_clock::now() - start);
+    log_access(status, sent);
+  };
+
+  // Clients over the route's limit are turned away before anything else is
+  // done for them.
+  if (endpoint && endpoint->rate_limiter) {
+    if (uint64_t client_key = RateLimitKey(peer)) {
+      auto wait = endpoint->rate_limiter->Take(
+          client_key, std::chrono::steady_clock::now());
+      if (wait > std::chrono::nanoseconds(0)) {
+        endpoint->rate_limited->Increment();
+        reject(429, RejectionResponse(
+            "429 Too Many Requests",
+            std::chrono::ceil<std::chrono::seconds>(wait)));
+        return;
       }
+    }
+  }
 
-      std::string response = handler(request, std::move(url_components));
-      auto sent = client.Send(response.c_str(), response.size());
-      LOG(INFO) << "Sent " << sent << " response bytes";
+  if (endpoint && endpoint->websocket) {
+    if (auto handshake = AcceptWebSocket(request); handshake.ok()) {
+      auto sent = handshake->WriteTo(client);
+      endpoint->metrics.Record(101, std::chrono::steady_clock::now() - start);
+      log_access(101, sent);
+      if (sent < 0) {
+        return;
+      }
+      // The connection moves to the event loop; anything the client sent
+      // after the handshake is the start of its first frame.
+      auto websocket = std::make_shared<WebSocket>(std::move(client), peer,
+                                                   &loop_);
+      endpoint->websocket(request, *url_components, websocket);
+      loop_.Post([websocket, received = std::string(received_body)]() mutable {
+        websocket->Start(std::move(received));
+      });
       return;
     }
   }
-  endpoint_handlers_mutex_.ReaderUnlock();
 
-  LOG(INFO) << "Could not match endpoint " << request.target;
+  if (endpoint && endpoint->event_stream && request.method == "GET") {
+    if (auto channel = endpoint->event_stream(request, *url_components)) {
+      std::optional<uint64_t> last_event_id;
+      if (auto header = request.GetHeader("Last-Event-ID")) {
+        uint64_t id;
+        if (absl::SimpleAtoi(*header, &id)) {
+          last_event_id = id;
+        }
+      }
+      endpoint->metrics.Record(200, std::chrono::steady_clock::now() - start);
+      log_access(200, 0);
+      // The channel writes the response head along with the first events.
+      channel->Subscribe(std::move(client), last_event_id);
+      return;
+    }
+  }
 
-  HTTPResponse response(404);
+  // Shed before reading the body, so turning a request away costs as little
+  // as possible.
+  auto priority = endpoint ? endpoint->options.priority
+                           : RequestPriority::kNormal;
+  size_t max_in_flight = endpoint ? endpoint->options.max_in_flight : 0;
+  Gauge* in_flight = (endpoint ? endpoint->metrics : unmatched_metrics_)
+      .in_flight;
+  in_flight->Add(1);
+  bool admitted = admission_.Admit(queue_delay, priority,
+                                   std::chrono::steady_clock::now());
+  if (admitted && max_in_flight > 0
+      && in_flight->Value() > static_cast<int64_t>(max_in_flight)) {
+    admitted = false;
+  }
+  if (!admitted) {
+    in_flight->Add(-1);
+    shed_requests_->Increment();
+    reject(503, shed_response_);
+    return;
+  }
 
-  response.AddHeader("Content-Type", "text/html; charset=utf-8");
-  response.SetBody("<h1>404 Page Not Found</h1>");
+  StallTimer stall(&loop_, client.GetFD());
+  auto body_status = ReceiveBody(
+      client, request, &received_body,
+      endpoint ? endpoint->options.multipart : std::nullopt,
+      endpoint && endpoint->options.max_body_size
+          ? *endpoint->options.max_body_size : max_body_size_,
+      stall);
+  stall.Stop();
+  if (absl::IsUnavailable(body_status)) {
+    in_flight->Add(-1);
+    LOG(ERROR) << (stall.Expired() ? "Timed out reading the body"
+                                   : body_status.message());
+    return;
+  }
+  CPPSERVER_LOG(INFO) << "Found body of " << size(request.body) << " bytes";
 
-  std::string response_str = response.ToString();
+  auto handler_start = std::chrono::steady_clock::now();
+  HTTPResponse response(404);
+  // Set instead of `response` for responses from the cache, which may be
+  // shared with other requests and so are sent without changes.
+  std::shared_ptr<const HTTPResponse> cached;
+  if (!body_status.ok()) {
+    CPPSERVER_LOG(INFO) << "Rejected request body: " << body_status.message();
+    response = HTTPResponse(absl::IsOutOfRange(body_status) ? 413 : 400);
+    response.AddHeader(CommonHeader::kContentTypePlainText);
+    response.SetBody(std::string(body_status.message()));
+  } else if (endpoint) {
+    CPPSERVER_LOG(INFO) << "Matched endpoint " << request.target;
+    for (const auto& [name, value] : *url_components) {
+      CPPSERVER_LOG(INFO) << name << " = " << value;
+    }
+    auto render = [&] {
+      HTTPResponse rendered = endpoint->handler(request, *url_components);
+      rendered.Compress(request, endpoint->options.compression);
+      return rendered;
+    };
+    std::optional<std::string> cache_key;
+    if (endpoint->cache) {
+      cache_key = endpoint->cache->Key(request);
+    }
+    if (cache_key) {
+      cached = endpoint->cache->GetOrRender(*cache_key, render);
+    } else {
+      response = render();
+    }
+    handler_time_->Record(std::chrono::steady_clock::now() - handler_start);
+  } else {
+    CPPSERVER_LOG(INFO) << "Could not match endpoint " << request.target;
+    response.AddHeader(CommonHeader::kContentTypeHTML);
+    response.SetBody("<h1>404 Page Not Found</h1>");
+  }
 
-  auto sent = client.Send(response_str.c_str(), response_str.size());
-  LOG(INFO) << "Sent " << sent << " response bytes";
+  // A rejected body may not have been read, so the connection can't be
+  // reused after it. A draining server lets every connection go.
+  bool keep_alive = body_status.ok() && KeepAlive(request)
+      && !draining_.load(std::memory_order_relaxed);
+  const HTTPResponse& sent_response = cached ? *cached : response;
+  auto send_start = std::chrono::steady_clock::now();
+  stall.Start(timeouts_.write);
+  auto sent = sent_response.WriteTo(client, !keep_alive);
+  stall.Stop();
+  in_flight->Add(-1);
+  auto end = std::chrono::steady_clock::now();
+  send_time_->Record(end - send_start);
+  (endpoint ? endpoint->metrics : unmatched_metrics_)
+      .Record(sent_response.StatusCode(), end - start);
+  CPPSERVER_LOG(INFO) << "Sent " << sent << " response bytes";
+  log_access(sent_response.StatusCode(), sent);
+
+  if (!keep_alive || sent < 0 || stall.Expired()) {
+    return;
+  }
+  // Keep what followed the request, the start of the next one, and wait for
+  // the rest on the loop.
+  connection->buffer.erase(0, received_body.data() - connection->buffer.data());
+  client.SetNonBlocking(true);
+  loop_.Post([this, connection = std::move(connection)]() mutable {
+    WatchConnection(std::move(connection), true);
+  });
 }
 
 }  // namespace cppserver
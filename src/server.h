@@ -5,30 +5,168 @@
 
 #include <sys/types.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <optional>
-#include <regex>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "absl/synchronization/mutex.h"
 
+#include "access_log.h"
+#include "admission.h"
+#include "compression.h"
+#include "endpoint_pattern.h"
+#include "event_loop.h"
+#include "event_stream.h"
 #include "http.h"
+#include "metrics.h"
+#include "multipart.h"
+#include "rate_limit.h"
+#include "response_cache.h"
 #include "url.h"
 #include "socket.h"
+#include "websocket.h"
+#include "worker_pool.h"
 
 namespace cppserver {
 
+// Handlers receive the parsed request and the values of any `<param_name>`
+// components in the matched endpoint, and return the response to send. Both
+// are allocated from the request's arena and released once the response is
+// sent; copy anything that must outlive the request.
+using EndpointHandler = std::function<HTTPResponse(const HTTPRequest&,
+                                                   const EndpointParams&)>;
+
+// WebSocket handlers receive the upgrade request, its endpoint parameters
+// and the new connection, on which they set the message and close callbacks.
+// The connection stays open after the handler returns, until either side
+// closes it.
+using WebSocketHandler = std::function<void(const HTTPRequest&,
+                                            const EndpointParams&,
+                                            std::shared_ptr<WebSocket>)>;
+
+// Event stream handlers pick the channel a request subscribes to, e.g. by
+// an endpoint parameter, or return null to answer 404.
+using EventStreamHandler = std::function<std::shared_ptr<EventChannel>(
+    const HTTPRequest&, const EndpointParams&)>;
+
+// Per-endpoint configuration.
+struct EndpointOptions {
+  // How responses from this endpoint are compressed on the fly. Responses
+  // that are already encoded (e.g. precompressed static files) are left as is.
+  CompressionPolicy compression;
+
+  // If set, multipart/form-data bodies are parsed as they arrive into
+  // HTTPRequest::multipart instead of being buffered in HTTPRequest::body.
+  std::optional<MultipartOptions> multipart;
+
+  // If set, responses are cached and reused for identical requests. Only
+  // use this for handlers whose output depends on nothing but the request
+  // target and ResponseCacheOptions::key_headers.
+  std::optional<ResponseCacheOptions> cache;
+
+  // Which requests are shed first when the server is overloaded.
+  RequestPriority priority = RequestPriority::kNormal;
+
+  // If nonzero, requests beyond this many at once get a 503 rather than
+  // waiting for the others, e.g. to keep a slow route from taking every
+  // worker.
+  size_t max_in_flight = 0;
+
+  // If set, each client IP address may only make requests to this endpoint
+  // at this rate, and gets a 429 beyond it. Limits that fail
+  // ValidateRateLimitOptions are fatal.
+  std::optional<RateLimitOptions> rate_limit;
+
+  // Overrides ServerOptions::max_body_size for this endpoint.
+  std::optional<size_t> max_body_size;
+};
+
+// How long a connection may take at each stage before it's closed. Headers
+// are read on the event loop, so a client trickling them in holds no thread;
+// once a worker has the request, a read or write that stalls past its
+// timeout is cut off by shutting the connection down.
+struct ConnectionTimeouts {
+  // To send a request's headers, from the connection opening or the first
+  // byte of the request.
+  std::chrono::milliseconds header = std::chrono::seconds(10);
+  // To receive the whole request body: this long, plus the time the bytes
+  // received so far take at body_min_rate. Bytes only earn time once they
+  // arrive, so a client sending slower than that can only hold a worker for
+  // so long, however large a body it declares.
+  std::chrono::milliseconds body = std::chrono::seconds(30);
+  // In bytes per second. 0 gives every body just `body`.
+  size_t body_min_rate = 64 * 1024;
+  // For the next request on a keep-alive connection to start.
+  std::chrono::milliseconds idle = std::chrono::seconds(30);
+  // To send a whole response.
+  std::chrono::milliseconds write = std::chrono::seconds(60);
+};
+
+// Where the server's threads run, e.g. to keep them on one socket of a
+// multi-socket host. CPUs are numbered as in /proc/cpuinfo; by default the
+// scheduler places every thread.
+struct ThreadPlacement {
+  // CPUs the listener and event loop threads may run on.
+  std::vector<int> loop_cpus;
+  // CPUs to pin the workers to, one each in turn. Each worker sets up its
+  // buffers once pinned, so they're allocated on its NUMA node.
+  std::vector<int> worker_cpus;
+  // Hand each request to a worker on the NUMA node of the CPU that received
+  // the connection's packets (SO_INCOMING_CPU), if one is free.
+  bool steer_connections = false;
+};
+
+struct ServerOptions {
+  // If set, the server listens on a Unix socket at this path instead of the
+  // TCP port, e.g. behind a reverse proxy on the same host. Any file already
+  // at the path is replaced.
+  std::string unix_path;
+  ConnectionTimeouts timeouts;
+  // Requests that can't be handled in time are answered with a 503.
+  AdmissionOptions admission;
+  // Threads that handle requests once their headers have arrived.
+  size_t worker_threads = 8;
+  // Larger request bodies get a 413 without being read. Multipart bodies
+  // parsed with EndpointOptions::multipart are limited by MultipartOptions
+  // instead, since they aren't held in memory.
+  size_t max_body_size = 8 * 1024 * 1024;
+  ThreadPlacement placement;
+
+  // If set, the server listens for a replacement process at this Unix
+  // socket path, and on starting asks any server already there for its
+  // listening socket. A server that hands its socket off stops accepting
+  // and drains, so restarts drop no connections.
+  std::string handoff_path;
+  // How long a stopping server waits for open connections to finish their
+  // requests before cutting them off.
+  std::chrono::milliseconds drain_timeout = std::chrono::seconds(30);
+};
+
 class Server {
  public:
   // Starts the server running on the specified port.
-  Server(in_port_t port_in);
+  Server(in_port_t port_in, ServerOptions options = {});
 
-  // Wait for the listening thread to terminate.
+  // Waits for the server to stop accepting connections, by Stop or by
+  // handing off to a replacement, then for open connections to finish their
+  // requests, up to drain_timeout. WebSockets and event streams are closed
+  // without waiting.
   ~Server();
 
+  // Stops accepting connections. Safe to call from any thread, or a signal
+  // handler.
+  void Stop();
+
   // Add an endpoint handler.
   // Endpoints are matched in the order they are added.
   // The first endpoint that matches the request will be used.
@@ -38,33 +176,217 @@ class Server {
   // 
   //    server.AddEndpointHandler("/", IndexHandler);
   //    server.AddEndpointHandler("/posts/<post_id>/", PostHandler);
-  void AddEndpointHandler(
-      std::string endpoint, 
-      std::function<std::string(
-          HTTPRequest, std::unordered_map<std::string, std::string>)> handler);
+  void AddEndpointHandler(std::string endpoint, EndpointHandler handler,
+                          EndpointOptions options = {});
+
+  // Add an endpoint that accepts WebSocket connections. Requests that
+  // aren't valid WebSocket handshakes get a 400 or 426 response.
+  //
+  //    server.AddWebSocketHandler("/chat/<room>/", ChatHandler);
+  void AddWebSocketHandler(std::string endpoint, WebSocketHandler handler);
+
+  // Create a Server-Sent Events channel whose subscribers are served by
+  // this server. Publish to it from anywhere.
+  std::shared_ptr<EventChannel> CreateEventChannel(
+      EventChannelOptions options = {});
+
+  // Add an endpoint whose GET requests subscribe to a `text/event-stream`.
+  //
+  //    auto alerts = server.CreateEventChannel();
+  //    server.AddEventStreamHandler("/alerts/",
+  //        [alerts](const auto&, const auto&) { return alerts; });
+  //    alerts->Publish("disk full", "alert");
+  void AddEventStreamHandler(std::string endpoint, EventStreamHandler handler);
+
+  // Record every request to `access_log`, or stop recording if it is null.
+  // The log must outlive the server.
+  void SetAccessLog(AccessLog* access_log);
+
+  // Serve the server's metrics at `endpoint` in the Prometheus text format.
+  // Metrics are always collected; this only exposes them.
+  void EnableMetricsEndpoint(std::string endpoint = "/metrics");
+
+  // The registry holding the server's metrics. Applications may add their
+  // own metrics to it.
+  MetricsRegistry& Metrics() { return metrics_; }
 
  private:
+  // Metrics recorded for each endpoint.
+  struct EndpointMetrics {
+    Histogram* latency;
+    // Responses by status class, 1xx through 5xx.
+    std::array<Counter*, 5> responses;
+    // Requests being handled.
+    Gauge* in_flight;
+
+    void Record(int status, std::chrono::nanoseconds duration) const;
+  };
+
+  EndpointMetrics AddEndpointMetrics(const std::string& endpoint);
+
+  // A client connection. Each request's headers are read on the event
+  // loop, and the rest of it is handled on a worker.
+  struct Connection {
+    Connection(Socket socket, SocketSockAddr peer, Server* server);
+    ~Connection();
+
+    Socket socket;
+    SocketSockAddr peer;
+    // Received bytes not handled yet, starting with the next request.
+    std::string buffer;
+    // When the current request started arriving.
+    std::chrono::system_clock::time_point start_time;
+    std::chrono::steady_clock::time_point start;
+    // When the current request was queued for a worker.
+    std::chrono::steady_clock::time_point dispatched;
+    // The header or idle timeout, while the loop is reading.
+    EventLoop::TimerId timer = 0;
+    // Whether the connection is waiting for its next request.
+    bool idle = false;
+    // The worker group that handles its requests.
+    size_t worker_group = 0;
+    Server* server;
+  };
+
+  // Cuts off a connection that a worker is blocked on for too long.
+  class StallTimer;
+
   void ListenForConnections();
 
-  void HandleMessage(Socket socket);
+  // Takes over the listening socket from systemd or a running server, or
+  // else creates one, and starts listening for replacements.
+  void OpenListener();
+
+  // Closes idle connections and waits for the others.
+  void Drain();
+
+  // Runs on each worker thread before it takes requests.
+  void StartWorker(size_t index);
+
+  // The worker group of each worker thread: the NUMA node of its CPU.
+  std::vector<size_t> WorkerGroups(size_t threads) const;
+
+  // The NUMA node of `cpu`, which is also its workers' group.
+  size_t NodeOf(int cpu) const;
+
+  // Starts reading the connection's next request on the loop thread.
+  // `idle` is set between requests on a keep-alive connection.
+  void WatchConnection(std::shared_ptr<Connection> connection, bool idle);
+
+  // Closes the connection if it's still on the loop after `timeout`.
+  void ArmConnectionTimer(Connection& connection,
+                          std::chrono::milliseconds timeout);
+
+  // Reads what's available, and hands the connection to a worker once the
+  // headers are complete.
+  void ReadConnection(const std::shared_ptr<Connection>& connection);
+
+  // Stops reading and closes the connection, on the loop thread.
+  void CloseConnection(Connection& connection);
+
+  // Moves a connection whose headers are complete to a worker.
+  void DispatchConnection(const std::shared_ptr<Connection>& connection);
+
+  void HandleMessage(std::shared_ptr<Connection> connection);
+
+  // Reads the rest of the request body, given the part of it received with
+  // the headers, and advances `received` past the body. Returns Unavailable
+  // if the connection is lost or stalls, OutOfRange if the body is larger
+  // than `max_body_size`, and another error if it should be rejected.
+  absl::Status ReceiveBody(Socket& client, HTTPRequest& request,
+                           std::string_view* received,
+                           const std::optional<MultipartOptions>& multipart,
+                           size_t max_body_size, StallTimer& stall);
 
   // Server port.
   in_port_t port_;
 
+  ConnectionTimeouts timeouts_;
+  size_t max_body_size_;
+
+  ThreadPlacement placement_;
+  // The NUMA node of each CPU.
+  std::vector<int> cpu_nodes_;
+
+  // Server metrics, set up before the listening thread starts.
+  MetricsRegistry metrics_;
+  Histogram* parse_time_;
+  Histogram* handler_time_;
+  Histogram* send_time_;
+  Gauge* active_connections_;
+  Gauge* worker_backlog_;
+  Histogram* queue_delay_;
+  Counter* shed_requests_;
+  // Requests that didn't match any endpoint.
+  EndpointMetrics unmatched_metrics_;
+
+  AdmissionController admission_;
+  // The response to shed requests, formatted once.
+  std::string shed_response_;
+
+  // Listen here instead of on port_, if set.
+  std::string unix_path_;
   // Server socket.
   Socket socket_;
 
+  // Written to stop the listening thread.
+  int stop_fd_;
+  std::string handoff_path_;
+  // Where replacements connect, or -1.
+  int handoff_fd_ = -1;
+  std::chrono::milliseconds drain_timeout_;
+  // Set once the server stops accepting, so connections aren't kept alive.
+  std::atomic<bool> draining_ {false};
+
+  // Every open connection that hasn't been upgraded, to wait for when
+  // draining.
+  absl::Mutex connections_mutex_;
+  std::unordered_set<Connection*> connections_
+      ABSL_GUARDED_BY(connections_mutex_);
+  // Keep-alive connections waiting for their next request, by descriptor.
+  // Only used on the loop thread.
+  std::unordered_map<int, Connection*> idle_connections_;
+
   // Listening thread.
   std::thread listening_thread_;
 
-  // Endpoint handlers.
-  std::vector<std::tuple<std::regex, std::vector<std::string>, 
-      std::function<std::string(HTTPRequest, 
-                                std::unordered_map<std::string, std::string>)>>>
-      endpoint_handlers_;
+  // Watches connections while they're reading headers or idle, upgraded
+  // connections and event stream subscribers, so none of them hold a
+  // thread, and runs connection timeouts.
+  EventLoop loop_;
+  std::thread loop_thread_;
+
+  struct Endpoint {
+    EndpointPattern pattern;
+    EndpointHandler handler;
+    EndpointOptions options;
+    EndpointMetrics metrics;
+    // Set for WebSocket endpoints, whose `handler` answers requests that
+    // aren't valid handshakes.
+    WebSocketHandler websocket;
+    // Set for event stream endpoints, whose `handler` answers requests that
+    // don't subscribe.
+    EventStreamHandler event_stream;
+    // Null unless options.cache is set.
+    std::unique_ptr<ResponseCache> cache;
+    // Null unless options.rate_limit is set.
+    std::unique_ptr<RateLimiter> rate_limiter;
+    Counter* rate_limited = nullptr;
+  };
+
+  // Endpoint handlers. Endpoints are never removed, so pointers to them stay
+  // valid after the mutex is released.
+  std::vector<std::unique_ptr<const Endpoint>> endpoint_handlers_;
 
   // Mutex for endpoint handlers.
   absl::Mutex endpoint_handlers_mutex_;
+
+  // Not owned; null if requests are not being logged.
+  std::atomic<AccessLog*> access_log_ {nullptr};
+
+  // Handle requests once their headers have arrived. Declared last, so the
+  // threads are joined before anything their requests use is destroyed.
+  WorkerPool workers_;
 };
 
 }  // namespace cppserver
@@ -0,0 +1,154 @@
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "absl/cleanup/cleanup.h"
+#include "gtest/gtest.h"
+
+#include "endpoint_pattern.h"
+#include "http.h"
+#include "multipart.h"
+#include "server.h"
+#include "socket.h"
+
+using namespace cppserver;
+
+namespace {
+
+// Connects to the server at `path`, waiting for it to start listening.
+Socket Connect(const std::string& path) {
+  auto addr = SocketSockAddr::Unix(path);
+  EXPECT_TRUE(addr.ok());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (true) {
+    Socket client(SocketDomain::kUnix, SocketType::kTCP);
+    client.Connect(*addr);
+    if (client || std::chrono::steady_clock::now() > deadline) {
+      struct timeval timeout = {5, 0};
+      setsockopt(client.GetFD(), SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout));
+      return client;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+// Reads until the server closes the connection or stops sending.
+std::string ReadResponse(int fd) {
+  std::string received;
+  char buffer[4096];
+  ssize_t result;
+  while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    received.append(buffer, result);
+  }
+  return received;
+}
+
+}  // namespace
+
+TEST(ServerTests, CutsOffSlowBodies) {
+  std::string path = testing::TempDir() + "server_test.sock";
+  ServerOptions options;
+  options.unix_path = path;
+  options.timeouts.body = std::chrono::milliseconds(300);
+  options.timeouts.body_min_rate = 1000;
+  options.worker_threads = 1;
+  options.drain_timeout = std::chrono::seconds(1);
+  Server server(0, options);
+  absl::Cleanup stop = [&] { server.Stop(); };
+  server.AddEndpointHandler("/", [](const HTTPRequest& request,
+                                    const EndpointParams&) {
+    HTTPResponse response(200);
+    response.SetBody(std::string(request.body));
+    return response;
+  });
+  std::string head =
+      "POST / HTTP/1.1\r\nContent-Length: 10\r\nConnection: close\r\n\r\n";
+
+  // A body sent at once is answered.
+  Socket fast = Connect(path);
+  std::string request = head + "0123456789";
+  ASSERT_EQ(fast.Send(request.data(), request.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(request.size()));
+  std::string response = ReadResponse(fast.GetFD());
+  EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0);
+  EXPECT_NE(response.find("0123456789"), std::string::npos);
+
+  // One trickled in, each byte well within the timeout of the last, runs
+  // out of time as a whole.
+  Socket slow = Connect(path);
+  ASSERT_EQ(slow.Send(head.data(), head.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(head.size()));
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (slow.Send("x", 1, MSG_NOSIGNAL) != 1) {
+      break;
+    }
+  }
+  EXPECT_EQ(ReadResponse(slow.GetFD()), "");
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+}
+
+TEST(ServerTests, BodiesEarnTimeAsTheyArrive) {
+  std::string path = testing::TempDir() + "server_test.sock";
+  ServerOptions options;
+  options.unix_path = path;
+  options.timeouts.body = std::chrono::milliseconds(300);
+  options.timeouts.body_min_rate = 1000;
+  options.worker_threads = 1;
+  options.drain_timeout = std::chrono::seconds(1);
+  Server server(0, options);
+  absl::Cleanup stop = [&] { server.Stop(); };
+  server.AddEndpointHandler("/", [](const HTTPRequest& request,
+                                    const EndpointParams&) {
+    HTTPResponse response(200);
+    response.SetBody(std::to_string(request.body.size()));
+    return response;
+  });
+  EndpointOptions upload_options;
+  upload_options.multipart = MultipartOptions();
+  server.AddEndpointHandler("/upload/", [](const HTTPRequest&,
+                                           const EndpointParams&) {
+    return HTTPResponse(200);
+  }, upload_options);
+
+  // A body sent faster than the minimum rate may take longer than `body`.
+  Socket steady = Connect(path);
+  std::string head =
+      "POST / HTTP/1.1\r\nContent-Length: 2000\r\nConnection: close\r\n\r\n";
+  ASSERT_EQ(steady.Send(head.data(), head.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(head.size()));
+  std::string part(200, 'x');
+  for (int i = 0; i < 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(steady.Send(part.data(), part.size(), MSG_NOSIGNAL),
+              static_cast<ssize_t>(part.size()));
+  }
+  std::string response = ReadResponse(steady.GetFD());
+  EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0);
+  EXPECT_NE(response.find("2000"), std::string::npos);
+
+  // A huge declared upload earns nothing for bytes it hasn't sent, and
+  // multipart bodies aren't capped by size, so only the rate cuts it off.
+  Socket slow = Connect(path);
+  head = "POST /upload/ HTTP/1.1\r\n"
+         "Content-Type: multipart/form-data; boundary=b\r\n"
+         "Content-Length: 4294967296\r\n\r\n"
+         "--b\r\nContent-Disposition: form-data; name=\"f\"\r\n\r\n";
+  ASSERT_EQ(slow.Send(head.data(), head.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(head.size()));
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 30; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (slow.Send("xxxxxxxxxx", 10, MSG_NOSIGNAL) != 10) {
+      break;
+    }
+  }
+  EXPECT_EQ(ReadResponse(slow.GetFD()), "");
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+}
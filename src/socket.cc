@@ -2,22 +2,33 @@
 
 #include "socket.h"
 
+#include <fcntl.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
 
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 
 namespace cppserver {
 
 SocketSockAddr::SocketSockAddr(std::optional<std::string> address,
-                               in_port_t port) {
-  struct sockaddr_in addr_in;
+                               in_port_t port) : SocketSockAddr() {
+  struct sockaddr_in addr_in = {};
   if (address) {
     addr_in.sin_family = AF_INET;
     addr_in.sin_port = htons(port);
@@ -28,8 +39,32 @@ SocketSockAddr::SocketSockAddr(std::optional<std::string> address,
     addr_in.sin_addr.s_addr = INADDR_ANY;
   }
 
-  // Look, it's not my fault they decided to design it this way.
-  addr_ = absl::bit_cast<sockaddr>(addr_in);
+  std::memcpy(&addr_, &addr_in, sizeof(addr_in));
+  size_ = sizeof(addr_in);
+}
+
+SocketSockAddr::SocketSockAddr(const struct sockaddr* addr, socklen_t size)
+    : SocketSockAddr() {
+  size_ = std::min<socklen_t>(size, sizeof(addr_));
+  std::memcpy(&addr_, addr, size_);
+}
+
+absl::StatusOr<SocketSockAddr> SocketSockAddr::Unix(std::string_view path) {
+  struct sockaddr_un addr_un = {};
+  // The path has to leave room for its terminating null.
+  if (path.empty() || path.size() >= sizeof(addr_un.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid Unix socket path: ", path));
+  }
+  addr_un.sun_family = AF_UNIX;
+  std::memcpy(addr_un.sun_path, path.data(), path.size());
+
+  // Only the path itself counts, so getsockname and the peer's accept report
+  // the same length back.
+  SocketSockAddr addr;
+  addr.size_ = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+  std::memcpy(&addr.addr_, &addr_un, addr.size_);
+  return addr;
 }
 
 Socket::Socket(SocketDomain domain, SocketType type, int protocol) {
@@ -46,18 +81,30 @@ std::optional<std::pair<Socket, SocketSockAddr>> Socket::Accept() {
     return {};
   }
 
-  struct sockaddr addr;
+  struct sockaddr_storage addr;
   socklen_t addrlen = sizeof(addr);
 
-  int new_fd = accept(this->fd_, &addr, &addrlen);
+  int new_fd = accept(this->fd_, reinterpret_cast<struct sockaddr*>(&addr),
+                      &addrlen);
 
   if (new_fd < 0) {
-    status_ = absl::Status(absl::StatusCode::kInternal, "Accept failed");
+    switch (errno) {
+      // Nothing was pending on a nonblocking socket, the pending connection
+      // failed, or the process is out of descriptors or memory for now; the
+      // listening socket itself is fine.
+      case EAGAIN: case EINTR: case ECONNABORTED: case EPROTO: case EPERM:
+      case EMFILE: case ENFILE: case ENOBUFS: case ENOMEM:
+        break;
+      default:
+        status_ = absl::Status(absl::StatusCode::kInternal, "Accept failed");
+    }
     return {};
   }
 
   Socket new_socket(new_fd);
-  return std::make_pair(std::move(new_socket), SocketSockAddr(addr));
+  return std::make_pair(
+      std::move(new_socket),
+      SocketSockAddr(reinterpret_cast<struct sockaddr*>(&addr), addrlen));
 }
 
 void Socket::Bind(const SocketSockAddr& addr) {
@@ -67,7 +114,7 @@ void Socket::Bind(const SocketSockAddr& addr) {
 
   const struct sockaddr &addr_in = addr.rawValue();
 
-  int result = bind(this->fd_, &addr_in, sizeof(addr_in));
+  int result = bind(this->fd_, &addr_in, addr.size());
   if (result < 0) {
     status_ = absl::Status(absl::StatusCode::kInternal, "Bind failed");
     return;
@@ -81,7 +128,7 @@ void Socket::Connect(const SocketSockAddr& addr) {
 
   const struct sockaddr &addr_in = addr.rawValue();
 
-  int result = connect(this->fd_, &addr_in, sizeof(addr_in));
+  int result = connect(this->fd_, &addr_in, addr.size());
   if (result < 0) {
       status_ = absl::Status(absl::StatusCode::kInternal, "Connect failed");
       return;
@@ -100,6 +147,27 @@ void Socket::Listen(int backlog) {
   }
 }
 
+void Socket::SetNonBlocking(bool nonblocking) {
+  if (!status_.ok()) {
+    return;
+  }
+
+  int flags = fcntl(fd_, F_GETFL);
+  flags = nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  if (fcntl(fd_, F_SETFL, flags) < 0) {
+    status_ = absl::Status(absl::StatusCode::kInternal, "fcntl failed");
+  }
+}
+
+int Socket::IncomingCpu() const {
+  int cpu = -1;
+  socklen_t len = sizeof(cpu);
+  if (getsockopt(fd_, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0) {
+    return -1;
+  }
+  return cpu;
+}
+
 template <typename T>
 std::optional<std::pair<std::unique_ptr<T[]>, ssize_t>> Socket::Receive(
     size_t len, int flags) {
@@ -129,6 +197,18 @@ std::optional<std::pair<std::unique_ptr<T[]>, ssize_t>> Socket::Receive(
 template std::optional<std::pair<std::unique_ptr<char[]>, ssize_t>>
   Socket::Receive(size_t len, int flags);
 
+ssize_t Socket::Receive(void* data, size_t len, int flags) {
+  if (!status_.ok()) {
+    return -1;
+  }
+  ssize_t result = recv(fd_, data, len, flags);
+  if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+      && errno != EINTR) {
+    status_ = absl::Status(absl::StatusCode::kInternal, "Receive failed");
+  }
+  return result;
+}
+
 template <typename T>
 ssize_t Socket::Send(const T* data, size_t len, int flags) {
   if (!status_.ok()) {
@@ -145,4 +225,68 @@ ssize_t Socket::Send(const T* data, size_t len, int flags) {
 template ssize_t Socket::Send(const void* data, size_t len, int flags);
 template ssize_t Socket::Send(const char* data, size_t len, int flags);
 
+ssize_t Socket::SendVector(struct iovec* iov, int iovcnt, int flags) {
+  if (!status_.ok()) {
+    return -1;
+  }
+
+  ssize_t total = 0;
+  while (iovcnt > 0) {
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    ssize_t result = sendmsg(fd_, &msg, flags);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      status_ = absl::Status(absl::StatusCode::kInternal, "Send failed");
+      return -1;
+    }
+    total += result;
+
+    // Skip past fully written buffers, then trim the partially written one.
+    size_t written = result;
+    while (iovcnt > 0 && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  return total;
+}
+
+ssize_t Socket::SendFile(int in_fd, off_t offset, size_t len) {
+  if (!status_.ok()) {
+    return -1;
+  }
+
+  size_t total = 0;
+  while (total < len) {
+    ssize_t result = sendfile(fd_, in_fd, &offset, len - total);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status_ = absl::Status(absl::StatusCode::kInternal, "Send failed");
+      return -1;
+    }
+    if (result == 0) {
+      status_ = absl::Status(absl::StatusCode::kDataLoss,
+                             "File ended before all bytes were sent");
+      return -1;
+    }
+    total += result;
+  }
+  return total;
+}
+
 }  // namespace cppserver
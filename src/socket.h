@@ -6,10 +6,12 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
 #include "absl/status/status.h"
@@ -20,6 +22,7 @@ namespace cppserver {
 enum SocketDomain {
     kIPV4 = AF_INET,
     kIPV6 = AF_INET6,
+    kUnix = AF_UNIX,
 };
 
 enum SocketType {
@@ -27,21 +30,37 @@ enum SocketType {
     kUDP  = SOCK_DGRAM,
 };
 
-// A more user-friendly wrapper for `struct sockaddr`.
+// A more user-friendly wrapper for `struct sockaddr`. Any family fits, so
+// the same type holds TCP peers and Unix socket paths.
 class SocketSockAddr {
  public:
-  // Initializes the SockAddr struct with the given address and port.
+  // Initializes an IPv4 address with the given address and port.
   SocketSockAddr(std::optional<std::string> address, in_port_t port);
 
-  explicit SocketSockAddr(struct sockaddr addr) : addr_{addr} {}
+  // Copies the first `size` bytes of `addr`, e.g. as filled in by accept.
+  SocketSockAddr(const struct sockaddr* addr, socklen_t size);
 
-  const struct sockaddr& rawValue() const { return addr_; }
+  // The address of the Unix socket at `path`. Returns InvalidArgument if the
+  // path is empty or too long.
+  static absl::StatusOr<SocketSockAddr> Unix(std::string_view path);
+
+  const struct sockaddr& rawValue() const {
+    return *reinterpret_cast<const struct sockaddr*>(&addr_);
+  }
+
+  // The number of bytes of rawValue() in use, as passed to bind or connect.
+  socklen_t size() const { return size_; }
+
+  sa_family_t family() const { return addr_.ss_family; }
 
  private:
-  struct sockaddr addr_;
+  SocketSockAddr() : addr_{}, size_{0} {}
+
+  struct sockaddr_storage addr_;
+  socklen_t size_;
 };
 
-// A wrapper for the C websocket interface.
+// A wrapper for the C socket interface.
 class Socket {
  public:
   // Initializes the socket with the given domain and type.
@@ -60,6 +79,20 @@ class Socket {
     other.fd_ = -1;
   }
 
+  Socket& operator=(Socket&& other) {
+    if (this != &other) {
+      Close();
+      fd_ = other.fd_;
+      status_ = other.status_;
+      other.fd_ = -1;
+    }
+    return *this;
+  }
+
+  // Takes ownership of an open socket, e.g. one inherited from another
+  // process.
+  static Socket FromFD(int fd) { return Socket(fd); }
+
   // Checks if the socket is valid.
   operator bool() const { return status_.ok(); }
 
@@ -73,7 +106,9 @@ class Socket {
   void ClearStatus() { status_ = absl::OkStatus(); }
 
   // Accept a connection, returning a socket object to the connection as well
-  // as the socket's address and port.
+  // as the socket's address and port. Failures that only affect the pending
+  // connection, or that may pass (e.g. EMFILE), return nullopt and leave the
+  // socket usable; check errno to tell them apart.
   std::optional<std::pair<Socket, SocketSockAddr>> Accept();
 
   // Bind the socket to the given address and port.
@@ -93,16 +128,42 @@ class Socket {
   // Listen on the socket.
   void Listen(int backlog);
 
+  // Make reads and writes return instead of waiting when the socket isn't
+  // ready.
+  void SetNonBlocking(bool nonblocking);
+
+  // The CPU that handled the connection's most recently received packets
+  // (SO_INCOMING_CPU), or -1 if it isn't known.
+  int IncomingCpu() const;
+
   // Receive a message.
   template <typename T>
   std::optional<std::pair<std::unique_ptr<T[]>, ssize_t>> Receive(
     size_t len,
     int flags = 0);
 
+  // Receive up to `len` bytes into `data`, without allocating. Returns the
+  // number of bytes received, 0 if the peer closed the connection, or -1 on
+  // failure. On a nonblocking socket, also returns -1 with errno set to
+  // EAGAIN if nothing is available; that doesn't put the socket in an error
+  // state.
+  ssize_t Receive(void* data, size_t len, int flags = 0);
+
   // Send a message.
   template <typename T>
   ssize_t Send(const T* data, size_t len, int flags = 0);
 
+  // Send the buffers described by `iov` as a single scatter-gather write,
+  // retrying until every buffer has been sent. `iov` is modified to track
+  // partial writes. Returns the total number of bytes sent, or -1 on failure.
+  // On a nonblocking socket, stops early once the socket would block.
+  ssize_t SendVector(struct iovec* iov, int iovcnt, int flags = 0);
+
+  // Send `len` bytes of the file `in_fd`, starting at `offset`, without
+  // copying them through userspace. Returns the number of bytes sent, or -1
+  // on failure (including if the file ends early).
+  ssize_t SendFile(int in_fd, off_t offset, size_t len);
+
  private:
   // Private constructor used to return a socket based on file descriptor.
   explicit Socket(int fd) : fd_{fd}, status_{absl::OkStatus()} {}
@@ -0,0 +1,55 @@
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "socket.h"
+
+using namespace cppserver;
+
+TEST(SocketTests, SizesAddressesByFamily) {
+  SocketSockAddr inet("127.0.0.1", 8000);
+  EXPECT_EQ(inet.family(), AF_INET);
+  EXPECT_EQ(inet.size(), sizeof(struct sockaddr_in));
+
+  auto unix_addr = SocketSockAddr::Unix("/tmp/cppserver.sock");
+  ASSERT_TRUE(unix_addr.ok());
+  EXPECT_EQ(unix_addr->family(), AF_UNIX);
+  EXPECT_EQ(unix_addr->size(), offsetof(struct sockaddr_un, sun_path)
+                                   + sizeof("/tmp/cppserver.sock"));
+
+  EXPECT_FALSE(SocketSockAddr::Unix("").ok());
+  EXPECT_FALSE(SocketSockAddr::Unix(
+      std::string(sizeof(sockaddr_un::sun_path), 'a')).ok());
+}
+
+TEST(SocketTests, AcceptsOverUnixSockets) {
+  std::string path = testing::TempDir() + "socket_test.sock";
+  unlink(path.c_str());
+  auto addr = SocketSockAddr::Unix(path);
+  ASSERT_TRUE(addr.ok());
+
+  Socket listener(SocketDomain::kUnix, SocketType::kTCP);
+  listener.Bind(*addr);
+  listener.Listen(1);
+  ASSERT_TRUE(listener);
+
+  Socket client(SocketDomain::kUnix, SocketType::kTCP);
+  client.Connect(*addr);
+  ASSERT_TRUE(client);
+  auto accepted = listener.Accept();
+  ASSERT_TRUE(accepted);
+  EXPECT_EQ(accepted->second.family(), AF_UNIX);
+
+  ASSERT_EQ(client.Send("ping", 4), 4);
+  char received[4];
+  ASSERT_EQ(accepted->first.Receive(received, sizeof(received)), 4);
+  EXPECT_EQ(std::string(received, 4), "ping");
+  unlink(path.c_str());
+}
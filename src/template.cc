@@ -2,7 +2,10 @@
 
 #include "template.h"
 
+#include <charconv>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <regex>
 #include <stack>
 #include <string>
@@ -456,7 +459,12 @@ absl::StatusOr<std::string> EvaluateExpression(
   } else if (std::holds_alternative<int>(result)) {
     return std::to_string(std::get<int>(result));
   } else if (std::holds_alternative<double>(result)) {
-    return std::to_string(std::get<double>(result));
+    // The shortest form that reads back as the same value, rather than
+    // to_string's fixed six decimals.
+    char buffer[32];
+    auto converted = std::to_chars(buffer, buffer + sizeof(buffer),
+                                   std::get<double>(result));
+    return std::string(buffer, converted.ptr);
   } else if (std::holds_alternative<bool>(result)) {
     return std::to_string(std::get<bool>(result));
   } else {
@@ -607,7 +615,7 @@ absl::StatusOr<std::pair<std::string,
         if (condition) {
           auto rendered = RenderTemplateHelper(it, end, context, expr);
           if (!rendered.ok()) {
-            return evaluated.status();
+            return rendered.status();
           }
           auto [rendered_string, new_it] = rendered.value();
           result += rendered_string;
@@ -707,6 +715,7 @@ absl::StatusOr<std::pair<std::string,
             }
             ++it;
           }
+          return std::make_pair(result, it);
         }
       } else if (expr.command == "endif") {
         if (control_flow_context 
@@ -740,6 +749,52 @@ absl::StatusOr<std::string> RenderTemplate(
   return rendered.value().first;
 }
 
+namespace {
+
+size_t CombineHash(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+size_t HashTemplateValue(const TEMPLATE_OBJECT_ANY& value);
+
+// Maps are unordered, so their entries are combined with a commutative sum.
+template <typename K>
+size_t HashTemplateMap(const GeneralTemplateMap<K>& map) {
+  size_t hash = 0;
+  for (const auto& [key, value] : map) {
+    hash += CombineHash(std::hash<K>{}(key), HashTemplateValue(value));
+  }
+  return hash;
+}
+
+size_t HashTemplateValue(const TEMPLATE_OBJECT_ANY& value) {
+  size_t hash = value.index();
+  if (std::holds_alternative<std::string>(value)) {
+    return CombineHash(hash, std::hash<std::string>{}(std::get<std::string>(value)));
+  } else if (std::holds_alternative<int>(value)) {
+    return CombineHash(hash, std::hash<int>{}(std::get<int>(value)));
+  } else if (std::holds_alternative<double>(value)) {
+    return CombineHash(hash, std::hash<double>{}(std::get<double>(value)));
+  } else if (std::holds_alternative<bool>(value)) {
+    return CombineHash(hash, std::hash<bool>{}(std::get<bool>(value)));
+  } else if (std::holds_alternative<TemplateObject>(value)) {
+    return CombineHash(hash, HashTemplateMap(std::get<TemplateObject>(value)));
+  } else {
+    return CombineHash(hash, HashTemplateMap(std::get<TemplateList>(value)));
+  }
+}
+
+}  // namespace
+
+size_t HashTemplateContext(
+    const std::unordered_map<std::string, TEMPLATE_OBJECT_ANY>& context) {
+  size_t hash = 0;
+  for (const auto& [key, value] : context) {
+    hash += CombineHash(std::hash<std::string>{}(key), HashTemplateValue(value));
+  }
+  return hash;
+}
+
 }  // namespace templates
 
 }  // namespace cppserver
@@ -47,6 +47,9 @@ class GeneralTemplateMap {
 
   size_t size() const { return mapping_.size(); }
 
+  auto begin() const { return mapping_.begin(); }
+  auto end() const { return mapping_.end(); }
+
   bool ContainsKey(const K& key) const {
     return mapping_.find(key) != mapping_.end();
   }
@@ -70,6 +73,12 @@ absl::StatusOr<std::string> RenderTemplate(
     const std::string& template_str,
     const std::unordered_map<std::string, TEMPLATE_OBJECT_ANY>& context);
 
+// Hashes the contents of a template context. Equal contexts hash equally
+// regardless of insertion order, so this can be used to validate cached
+// renders without rendering.
+size_t HashTemplateContext(
+    const std::unordered_map<std::string, TEMPLATE_OBJECT_ANY>& context);
+
 }  // namespace templates
 
 }  // namespace cppserver
@@ -0,0 +1,75 @@
+// Copyright 2022 Daniel Liu
+
+#include <string>
+#include <unordered_map>
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+
+#include "template.h"
+
+using cppserver::templates::RenderTemplate;
+using cppserver::templates::TEMPLATE_OBJECT_ANY;
+using cppserver::templates::TemplateList;
+using cppserver::templates::TemplateObject;
+
+namespace {
+
+void BM_RenderTemplateSmall(benchmark::State& state) {
+  std::string template_str =
+      "<html><body><h1>You are at {{path}}</h1></body></html>";
+  std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
+    {"path", "docs/getting-started"},
+  };
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(RenderTemplate(template_str, context));
+  }
+}
+BENCHMARK(BM_RenderTemplateSmall);
+
+// A table with one row per item, as on a listing page.
+void BM_RenderTemplateLoop(benchmark::State& state) {
+  std::string template_str =
+      "<table>{% for item in items %}<tr><td>{{item.name}}</td>"
+      "<td>{{item.price + 1}}</td>{% if item.in_stock %}<td>In stock</td>"
+      "{% else %}<td>Sold out</td>{% endif %}</tr>{% endfor %}</table>";
+  TemplateList items;
+  for (int i = 0; i < state.range(0); ++i) {
+    items[i] = TemplateObject{
+      {"name", absl::StrCat("Item ", i)},
+      {"price", i * 3},
+      {"in_stock", i % 3 != 0},
+    };
+  }
+  std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
+    {"items", items},
+  };
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(RenderTemplate(template_str, context));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RenderTemplateLoop)->Arg(10)->Arg(100);
+
+// A long page that is mostly static text with scattered substitutions.
+void BM_RenderTemplateLarge(benchmark::State& state) {
+  std::string paragraph =
+      "<p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+      "eiusmod tempor incididunt ut labore et dolore magna aliqua.</p>\n";
+  std::string template_str;
+  while (template_str.size() < static_cast<size_t>(state.range(0))) {
+    absl::StrAppend(&template_str, "<h2>{{title}}</h2>\n", paragraph,
+                    "<p>Posted by {{user.name}}</p>\n", paragraph);
+  }
+  std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
+    {"title", "A fairly ordinary heading"},
+    {"user", TemplateObject{{"name", "Daniel"}}},
+  };
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(RenderTemplate(template_str, context));
+  }
+  state.SetBytesProcessed(state.iterations() * template_str.size());
+}
+BENCHMARK(BM_RenderTemplateLarge)->Arg(4 << 10)->Arg(16 << 10);
+
+}  // namespace
@@ -60,7 +60,7 @@ TEST(TemplateTests, DoubleExpressionTemplate) {
   std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
     {"name", 123.456}
   };
-  std::string expected = "Hello, 123.456000!";
+  std::string expected = "Hello, 123.456!";
   auto actual = RenderTemplate(template_str, context);
   EXPECT_TRUE(actual.ok());
   EXPECT_EQ(expected, actual.value());
@@ -87,7 +87,7 @@ TEST(TemplateTests, IntegerLiteralTemplate) {
 TEST(TemplateTests, DoubleLiteralTemplate) {
   std::string template_str = "Hello, {{123.456}}!";
   std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {};
-  std::string expected = "Hello, 123.456000!";
+  std::string expected = "Hello, 123.456!";
   auto actual = RenderTemplate(template_str, context);
   EXPECT_TRUE(actual.ok());
   EXPECT_EQ(expected, actual.value());
@@ -136,7 +136,7 @@ TEST(TemplateTests, IntegerAdditionFromContextTemplate) {
 TEST(TemplateTests, DoubleAdditionTemplate) {
   std::string template_str = "Hello, {{123.456 + 789.012}}!";
   std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {};
-  std::string expected = "Hello, 912.468000!";
+  std::string expected = "Hello, 912.468!";
   auto actual = RenderTemplate(template_str, context);
   EXPECT_TRUE(actual.ok());
   EXPECT_EQ(expected, actual.value());
@@ -147,7 +147,7 @@ TEST(TemplateTests, DoubleAdditionFromContextTemplate) {
   std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
     {"num", 789.012}
   };
-  std::string expected = "Hello, 912.468000!";
+  std::string expected = "Hello, 912.468!";
   auto actual = RenderTemplate(template_str, context);
   EXPECT_TRUE(actual.ok());
   EXPECT_EQ(expected, actual.value());
@@ -156,7 +156,7 @@ TEST(TemplateTests, DoubleAdditionFromContextTemplate) {
 TEST(TemplateTests, IntegerDoubleAdditionTemplate) {
   std::string template_str = "Hello, {{123 + 456.789}}!";
   std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {};
-  std::string expected = "Hello, 579.789000!";
+  std::string expected = "Hello, 579.789!";
   auto actual = RenderTemplate(template_str, context);
   EXPECT_TRUE(actual.ok());
   EXPECT_EQ(expected, actual.value());
@@ -294,3 +294,24 @@ TEST(TemplateTests, RepeatedIfTemplate) {
   EXPECT_TRUE(actual.ok());
   EXPECT_EQ(expected, actual.value());
 }
+
+TEST(TemplateTests, IfElseInForLoopTemplate) {
+  std::string template_str =
+      "{% for n in numbers %}{% if n == 1 %}one{% else %}other{% endif %} {% endfor %}";
+  std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
+    {"numbers", TemplateList{1, 2, 1}}
+  };
+  std::string expected = "one other one ";
+  auto actual = RenderTemplate(template_str, context);
+  EXPECT_TRUE(actual.ok());
+  EXPECT_EQ(expected, actual.value());
+}
+
+TEST(TemplateTests, ErrorInsideIfTemplate) {
+  std::string template_str = "{% if flag %}{{ 1 / 0 }}{% endif %}";
+  std::unordered_map<std::string, TEMPLATE_OBJECT_ANY> context = {
+    {"flag", true}
+  };
+  auto actual = RenderTemplate(template_str, context);
+  EXPECT_FALSE(actual.ok());
+}
@@ -0,0 +1,180 @@
+// Copyright 2022 Daniel Liu
+
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+namespace cppserver {
+
+namespace {
+
+// Each level's slot is picked by the next 6 bits of the expiry tick.
+constexpr int kSlotBits = 6;
+
+}  // namespace
+
+TimerWheel::TimerWheel(Clock::duration tick, Clock::time_point start)
+    : tick_{tick}, start_{start} {
+  heads_.fill(kNone);
+}
+
+TimerWheel::TimerId TimerWheel::Add(Clock::time_point deadline,
+                                    Callback callback) {
+  // Round up, so timers never fire early.
+  uint64_t expiry = 0;
+  if (deadline > start_) {
+    expiry = ((deadline - start_) + tick_ - Clock::duration(1)) / tick_;
+  }
+  constexpr uint64_t kMaxDelta = (uint64_t{1} << (kSlotBits * kLevels)) - 1;
+  expiry = std::min(expiry, current_ + kMaxDelta);
+
+  uint32_t index;
+  if (free_.empty()) {
+    index = timers_.size();
+    timers_.emplace_back();
+  } else {
+    index = free_.back();
+    free_.pop_back();
+  }
+  if (++generation_ == 0) {
+    ++generation_;
+  }
+  Timer& timer = timers_[index];
+  timer.callback = std::move(callback);
+  timer.id = (uint64_t{generation_} << 32) | index;
+  timer.expiry = expiry;
+  Place(index);
+  ++size_;
+  return timer.id;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+  uint32_t index = static_cast<uint32_t>(id);
+  if (id == 0 || index >= timers_.size() || timers_[index].id != id) {
+    return false;
+  }
+  Unlink(index);
+  Free(index);
+  --size_;
+  return true;
+}
+
+void TimerWheel::Advance(Clock::time_point now) {
+  if (now < start_) {
+    return;
+  }
+  uint64_t target = (now - start_) / tick_;
+  while (current_ < target) {
+    if (size_ == 0) {
+      // Nothing to fire or cascade, so skip the idle ticks.
+      current_ = target;
+      break;
+    }
+    ++current_;
+    // Each time a level wraps around, the next level's slot for the coming
+    // span is spread over the levels below.
+    for (int level = 1; level < kLevels; ++level) {
+      if (current_ & ((uint64_t{1} << (kSlotBits * level)) - 1)) {
+        break;
+      }
+      Cascade(level);
+    }
+    // Everything in the first level's slot is due on this tick.
+    int list = current_ & (kSlots - 1);
+    while (heads_[list] != kNone) {
+      uint32_t index = heads_[list];
+      Unlink(index);
+      Link(index, kExpiredList);
+    }
+  }
+}
+
+bool TimerWheel::PopExpired(TimerId* id, Callback* callback) {
+  uint32_t index = heads_[kExpiredList];
+  if (index == kNone) {
+    return false;
+  }
+  Unlink(index);
+  *id = timers_[index].id;
+  *callback = std::move(timers_[index].callback);
+  Free(index);
+  --size_;
+  return true;
+}
+
+void TimerWheel::Place(uint32_t index) {
+  uint64_t expiry = timers_[index].expiry;
+  if (expiry <= current_) {
+    Link(index, kExpiredList);
+    return;
+  }
+  // The lowest level whose span covers the wait.
+  uint64_t delta = expiry - current_;
+  int level = 0;
+  while (level < kLevels - 1
+         && delta >= (uint64_t{1} << (kSlotBits * (level + 1)))) {
+    ++level;
+  }
+  int slot = (expiry >> (kSlotBits * level)) & (kSlots - 1);
+  Link(index, level * kSlots + slot);
+}
+
+void TimerWheel::Link(uint32_t index, int list) {
+  Timer& timer = timers_[index];
+  timer.list = list;
+  if (list == kExpiredList) {
+    // Appended, so expired timers pop in deadline order.
+    timer.prev = expired_tail_;
+    timer.next = kNone;
+    if (expired_tail_ == kNone) {
+      heads_[list] = index;
+    } else {
+      timers_[expired_tail_].next = index;
+    }
+    expired_tail_ = index;
+    return;
+  }
+  timer.prev = kNone;
+  timer.next = heads_[list];
+  if (timer.next != kNone) {
+    timers_[timer.next].prev = index;
+  }
+  heads_[list] = index;
+}
+
+void TimerWheel::Unlink(uint32_t index) {
+  Timer& timer = timers_[index];
+  if (timer.prev == kNone) {
+    heads_[timer.list] = timer.next;
+  } else {
+    timers_[timer.prev].next = timer.next;
+  }
+  if (timer.next != kNone) {
+    timers_[timer.next].prev = timer.prev;
+  } else if (timer.list == kExpiredList) {
+    expired_tail_ = timer.prev;
+  }
+}
+
+void TimerWheel::Cascade(int level) {
+  int list = level * kSlots
+      + ((current_ >> (kSlotBits * level)) & (kSlots - 1));
+  uint32_t index = heads_[list];
+  heads_[list] = kNone;
+  while (index != kNone) {
+    uint32_t next = timers_[index].next;
+    Place(index);
+    index = next;
+  }
+}
+
+void TimerWheel::Free(uint32_t index) {
+  timers_[index].callback = nullptr;
+  timers_[index].id = 0;
+  free_.push_back(index);
+}
+
+}  // namespace cppserver
@@ -0,0 +1,106 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_TIMER_WHEEL_H_
+#define _CPPSERVER_TIMER_WHEEL_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace cppserver {
+
+// A hierarchical timing wheel: timers are hashed into slots by deadline, with
+// each level covering 64 times the span of the one below, and cascade down a
+// level as their deadline approaches. Adding and cancelling are O(1), and
+// advancing costs O(1) per tick plus the timers that expire or cascade, so
+// thousands of connection timeouts can be armed and cancelled per request
+// without a sorted structure or a timer per connection.
+//
+// Deadlines are rounded up to the next tick. Not thread-safe; EventLoop
+// wraps one for use from any thread.
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Never 0, so 0 can mean "no timer".
+  using TimerId = uint64_t;
+  using Callback = std::function<void()>;
+
+  static constexpr int kLevels = 4;
+  static constexpr int kSlots = 64;
+
+  // `start` is the wheel's time zero; ticks are counted from it.
+  TimerWheel(Clock::duration tick, Clock::time_point start);
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Arms a timer. Deadlines beyond the last level's span (64^4 ticks) are
+  // clamped to it.
+  TimerId Add(Clock::time_point deadline, Callback callback);
+
+  // Disarms a timer that hasn't been popped yet. Returns false if it has
+  // been, or was already cancelled.
+  bool Cancel(TimerId id);
+
+  // Moves the timers due by `now` to the expired list, in deadline order.
+  void Advance(Clock::time_point now);
+
+  // Removes the next expired timer, returning false if there are none.
+  bool PopExpired(TimerId* id, Callback* callback);
+
+  // Armed timers, including expired ones not yet popped.
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  Clock::duration tick() const { return tick_; }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  // The list index of the expired timers; the wheel's slots come first.
+  static constexpr int kExpiredList = kLevels * kSlots;
+
+  struct Timer {
+    Callback callback;
+    // 0 while the entry is free.
+    TimerId id = 0;
+    uint64_t expiry;
+    uint32_t prev;
+    uint32_t next;
+    uint16_t list;
+  };
+
+  // Puts a timer in the slot for its expiry, or the expired list if it's
+  // due.
+  void Place(uint32_t index);
+
+  void Link(uint32_t index, int list);
+  void Unlink(uint32_t index);
+
+  // Re-places the timers in a slot of a higher level.
+  void Cascade(int level);
+
+  void Free(uint32_t index);
+
+  Clock::duration tick_;
+  Clock::time_point start_;
+  // Ticks up to and including this one have been processed.
+  uint64_t current_ = 0;
+
+  // Timers live in a slab, so lists link them by index and ids can be
+  // checked against the entry they name.
+  std::vector<Timer> timers_;
+  std::vector<uint32_t> free_;
+  uint32_t generation_ = 0;
+  size_t size_ = 0;
+
+  // Heads of the slot lists and the expired list. Expired timers are
+  // appended, so that list also keeps its tail.
+  std::array<uint32_t, kExpiredList + 1> heads_;
+  uint32_t expired_tail_ = kNone;
+};
+
+}  // namespace cppserver
+
+#endif
@@ -0,0 +1,117 @@
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "timer_wheel.h"
+
+using namespace cppserver;
+using std::chrono::milliseconds;
+
+namespace {
+
+const TimerWheel::Clock::time_point kStart{};
+
+// Pops every expired timer, returning their ids in order.
+std::vector<TimerWheel::TimerId> PopAll(TimerWheel& wheel) {
+  std::vector<TimerWheel::TimerId> ids;
+  TimerWheel::TimerId id;
+  TimerWheel::Callback callback;
+  while (wheel.PopExpired(&id, &callback)) {
+    callback();
+    ids.push_back(id);
+  }
+  return ids;
+}
+
+}  // namespace
+
+TEST(TimerWheelTests, FiresOnTheFirstTickAtOrAfterTheDeadline) {
+  TimerWheel wheel(milliseconds(10), kStart);
+  int fired = 0;
+  auto id = wheel.Add(kStart + milliseconds(25), [&] { ++fired; });
+
+  wheel.Advance(kStart + milliseconds(29));
+  EXPECT_TRUE(PopAll(wheel).empty());
+  wheel.Advance(kStart + milliseconds(30));
+  EXPECT_EQ(PopAll(wheel), std::vector<TimerWheel::TimerId>{id});
+  EXPECT_EQ(fired, 1);
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTests, CancelsTimers) {
+  TimerWheel wheel(milliseconds(1), kStart);
+  auto cancelled = wheel.Add(kStart + milliseconds(5), [] { FAIL(); });
+  auto kept = wheel.Add(kStart + milliseconds(5), [] {});
+  EXPECT_EQ(wheel.size(), 2);
+  EXPECT_TRUE(wheel.Cancel(cancelled));
+  EXPECT_FALSE(wheel.Cancel(cancelled));
+
+  // The freed entry is reused, but the old id doesn't name the new timer.
+  auto reused = wheel.Add(kStart + milliseconds(100000), [] {});
+  EXPECT_FALSE(wheel.Cancel(cancelled));
+
+  wheel.Advance(kStart + milliseconds(10));
+  EXPECT_EQ(PopAll(wheel), std::vector<TimerWheel::TimerId>{kept});
+  EXPECT_FALSE(wheel.Cancel(kept));
+  EXPECT_TRUE(wheel.Cancel(reused));
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTests, CascadesAcrossLevels) {
+  TimerWheel wheel(milliseconds(1), kStart);
+  // One timer per level, plus one past the wheel's span.
+  std::vector<int64_t> deadlines = {63, 64, 4095, 4096, 262143, 262144,
+                                    20000000};
+  std::vector<TimerWheel::TimerId> ids;
+  for (int64_t deadline : deadlines) {
+    ids.push_back(wheel.Add(kStart + milliseconds(deadline), [] {}));
+  }
+  for (size_t i = 0; i + 1 < deadlines.size(); ++i) {
+    wheel.Advance(kStart + milliseconds(deadlines[i] - 1));
+    EXPECT_TRUE(PopAll(wheel).empty()) << deadlines[i];
+    wheel.Advance(kStart + milliseconds(deadlines[i]));
+    EXPECT_EQ(PopAll(wheel), std::vector<TimerWheel::TimerId>{ids[i]})
+        << deadlines[i];
+  }
+  // Clamped to 64^4 - 1 ticks.
+  wheel.Advance(kStart + milliseconds(16777215));
+  EXPECT_EQ(PopAll(wheel), std::vector<TimerWheel::TimerId>{ids.back()});
+}
+
+TEST(TimerWheelTests, MatchesASortedSchedule) {
+  std::mt19937 random(42);
+  TimerWheel wheel(milliseconds(1), kStart);
+  std::unordered_map<TimerWheel::TimerId, int64_t> deadlines;
+  int64_t now = 0;
+  for (int round = 0; round < 2000; ++round) {
+    for (int i = random() % 20; i > 0; --i) {
+      int64_t deadline = now + random() % (1 << (random() % 20));
+      deadlines[wheel.Add(kStart + milliseconds(deadline), [] {})] = deadline;
+    }
+    // Cancel a few at random.
+    if (!deadlines.empty() && random() % 4 == 0) {
+      auto it = deadlines.begin();
+      ASSERT_TRUE(wheel.Cancel(it->first));
+      deadlines.erase(it);
+    }
+    now += random() % 5000;
+    wheel.Advance(kStart + milliseconds(now));
+    int64_t previous = 0;
+    for (auto id : PopAll(wheel)) {
+      ASSERT_TRUE(deadlines.count(id));
+      EXPECT_LE(deadlines[id], now);
+      EXPECT_GE(deadlines[id], previous);
+      previous = deadlines[id];
+      deadlines.erase(id);
+    }
+    for (const auto& [id, deadline] : deadlines) {
+      ASSERT_GT(deadline, now);
+    }
+  }
+  EXPECT_EQ(wheel.size(), deadlines.size());
+}
@@ -2,48 +2,272 @@
 
 #include "url.h"
 
-#include <iterator>
-#include <regex>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
-#include "absl/strings/str_format.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace cppserver {
 
-std::string QuoteUrl(const std::string& str_in) {
-  static const std::string UNRESERVED_CHARACTERS = 
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~";
+namespace {
 
+constexpr std::array<bool, 256> MakeUnreservedTable() {
+  std::array<bool, 256> table {};
+  for (int c = 'A'; c <= 'Z'; ++c) {
+    table[c] = true;
+  }
+  for (int c = 'a'; c <= 'z'; ++c) {
+    table[c] = true;
+  }
+  for (int c = '0'; c <= '9'; ++c) {
+    table[c] = true;
+  }
+  for (char c : {'-', '.', '_', '~'}) {
+    table[static_cast<unsigned char>(c)] = true;
+  }
+  return table;
+}
+
+// Value of each hex digit, or -1 for other bytes.
+constexpr std::array<int8_t, 256> MakeHexValueTable() {
+  std::array<int8_t, 256> table {};
+  for (int c = 0; c < 256; ++c) {
+    table[c] = -1;
+  }
+  for (int c = '0'; c <= '9'; ++c) {
+    table[c] = c - '0';
+  }
+  for (int c = 'A'; c <= 'F'; ++c) {
+    table[c] = c - 'A' + 10;
+    table[c - 'A' + 'a'] = c - 'A' + 10;
+  }
+  return table;
+}
+
+constexpr std::array<bool, 256> kUnreserved = MakeUnreservedTable();
+constexpr std::array<int8_t, 256> kHexValue = MakeHexValueTable();
+constexpr char kHexDigits[] = "0123456789ABCDEF";
+
+// Returns the length of the run of unreserved characters at the start of
+// [begin, end).
+size_t UnreservedPrefixLength(const char* begin, const char* end) {
+  const char* it = begin;
+#ifdef __SSE2__
+  // Classify 16 bytes at a time. Bytes >= 0x80 compare as negative, so they
+  // fall outside every range below.
+  const __m128i lower_a = _mm_set1_epi8('a' - 1);
+  const __m128i lower_z = _mm_set1_epi8('z' + 1);
+  const __m128i digit_0 = _mm_set1_epi8('0' - 1);
+  const __m128i digit_9 = _mm_set1_epi8('9' + 1);
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i dash = _mm_set1_epi8('-');
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i underscore = _mm_set1_epi8('_');
+  const __m128i tilde = _mm_set1_epi8('~');
+  while (end - it >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+    __m128i folded = _mm_or_si128(chunk, case_bit);
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, lower_a),
+                                  _mm_cmplt_epi8(folded, lower_z));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, digit_0),
+                                  _mm_cmplt_epi8(chunk, digit_9));
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, dash), _mm_cmpeq_epi8(chunk, dot)),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, underscore),
+                     _mm_cmpeq_epi8(chunk, tilde)));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_or_si128(alpha, digit), special));
+    if (mask != 0xFFFF) {
+      return it - begin + __builtin_ctz(~mask);
+    }
+    it += 16;
+  }
+#endif
+  while (it != end && kUnreserved[static_cast<unsigned char>(*it)]) {
+    ++it;
+  }
+  return it - begin;
+}
+
+// Decodes [in, end) into `out`, which may equal `in`. Returns the end of the
+// output, or null if an escape is malformed.
+char* Unquote(const char* in, const char* end, char* out) {
+  while (in != end) {
+    // Escapes are often close together, so look a few bytes ahead before
+    // handing long runs to memchr, which is vectorized but costs a call.
+    const char* run_end = in;
+    const char* scan_end = end - in > 16 ? in + 16 : end;
+    while (run_end != scan_end && *run_end != '%') {
+      ++run_end;
+    }
+    if (run_end == scan_end && run_end != end) {
+      const char* percent = static_cast<const char*>(
+          std::memchr(run_end, '%', end - run_end));
+      run_end = percent ? percent : end;
+    }
+    if (out != in) {
+      std::memmove(out, in, run_end - in);
+    }
+    out += run_end - in;
+    in = run_end;
+    if (in == end) {
+      break;
+    }
+
+    if (end - in < 3) {
+      return nullptr;
+    }
+    int high = kHexValue[static_cast<unsigned char>(in[1])];
+    int low = kHexValue[static_cast<unsigned char>(in[2])];
+    if (high < 0 || low < 0) {
+      return nullptr;
+    }
+    *out++ = static_cast<char>(high << 4 | low);
+    in += 3;
+  }
+  return out;
+}
+
+}  // namespace
+
+std::string QuoteUrl(std::string_view str_in) {
+  // Every byte expands to at most three.
   std::string str_out;
-  for (char c : str_in) {
-    if (UNRESERVED_CHARACTERS.find(c) != std::string::npos) {
-      str_out += c;
-    } else {
-      str_out += "%" + absl::StrFormat("%02X", c);
+  str_out.resize(str_in.size() * 3);
+  char* out = str_out.data();
+
+  const char* it = str_in.data();
+  const char* end = it + str_in.size();
+  while (it != end) {
+    size_t run = UnreservedPrefixLength(it, end);
+    std::memcpy(out, it, run);
+    out += run;
+    it += run;
+
+    // Escape bytes until the next unreserved one.
+    while (it != end && !kUnreserved[static_cast<unsigned char>(*it)]) {
+      unsigned char c = *it++;
+      out[0] = '%';
+      out[1] = kHexDigits[c >> 4];
+      out[2] = kHexDigits[c & 0xF];
+      out += 3;
     }
   }
+
+  str_out.resize(out - str_out.data());
   return str_out;
 }
 
-std::string UnquoteUrl(const std::string& str_in) {
+std::string UnquoteUrl(std::string_view str_in) {
   std::string str_out;
-  auto it = str_in.begin();
-  auto end = str_in.end();
-  while (it != end) {
-    if (*it == '%') {
-      if (std::distance(it, end) < 3) {
-        return {};
-      }
-      std::string hex_str = std::string(it + 1, it + 3);
-      int hex_val = std::stoi(hex_str, nullptr, 16);
-      str_out += static_cast<char>(hex_val);
-      it += 3;
+  str_out.resize(str_in.size());
+  char* end = Unquote(str_in.data(), str_in.data() + str_in.size(),
+                      str_out.data());
+  if (!end) {
+    return {};
+  }
+  str_out.resize(end - str_out.data());
+  return str_out;
+}
+
+std::optional<std::string_view> UnquoteUrl(std::string_view str_in,
+                                           std::string* scratch) {
+  if (str_in.find('%') == std::string_view::npos) {
+    return str_in;
+  }
+  scratch->resize(str_in.size());
+  char* end = Unquote(str_in.data(), str_in.data() + str_in.size(),
+                      scratch->data());
+  if (!end) {
+    return std::nullopt;
+  }
+  return std::string_view(scratch->data(), end - scratch->data());
+}
+
+std::optional<std::string_view> UnquoteUrlInPlace(char* data, size_t size) {
+  char* end = Unquote(data, data + size, data);
+  if (!end) {
+    return std::nullopt;
+  }
+  return std::string_view(data, end - data);
+}
+
+std::string UnquoteFormComponent(std::string_view component) {
+  std::string decoded(component);
+  for (char& c : decoded) {
+    if (c == '+') {
+      c = ' ';
+    }
+  }
+  if (decoded.find('%') == std::string::npos) {
+    return decoded;
+  }
+  std::string scratch;
+  auto unquoted = UnquoteUrl(decoded, &scratch);
+  if (!unquoted) {
+    return decoded;
+  }
+  return std::string(*unquoted);
+}
+
+UrlParams::UrlParams(std::string_view source) {
+  while (!source.empty()) {
+    size_t separator = source.find('&');
+    std::string_view pair = source.substr(0, separator);
+    source.remove_prefix(
+        separator == std::string_view::npos ? source.size() : separator + 1);
+    if (pair.empty()) {
+      continue;
+    }
+    size_t equals = pair.find('=');
+    if (equals == std::string_view::npos) {
+      params_.emplace_back(pair, std::string_view());
     } else {
-      str_out += *it;
-      it++;
+      params_.emplace_back(pair.substr(0, equals), pair.substr(equals + 1));
     }
   }
-  return str_out;
+}
+
+bool UrlParams::KeyMatches(std::string_view raw, std::string_view key) {
+  if (raw.find_first_of("%+") == std::string_view::npos) {
+    return raw == key;
+  }
+  return UnquoteFormComponent(raw) == key;
+}
+
+std::optional<std::string> UrlParams::Get(std::string_view key) const {
+  for (const auto& [raw_key, raw_value] : params_) {
+    if (KeyMatches(raw_key, key)) {
+      return UnquoteFormComponent(raw_value);
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::string> UrlParams::GetAll(std::string_view key) const {
+  std::vector<std::string> values;
+  for (const auto& [raw_key, raw_value] : params_) {
+    if (KeyMatches(raw_key, key)) {
+      values.push_back(UnquoteFormComponent(raw_value));
+    }
+  }
+  return values;
+}
+
+bool UrlParams::Contains(std::string_view key) const {
+  for (const auto& [raw_key, raw_value] : params_) {
+    if (KeyMatches(raw_key, key)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 }
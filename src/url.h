@@ -3,14 +3,72 @@
 #ifndef _CPPSERVER_URL_H_
 #define _CPPSERVER_URL_H_
 
-#include <regex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
 
 namespace cppserver {
 
-std::string QuoteUrl(const std::string& str_in);
+// Percent-encodes every byte of `str_in` other than the unreserved characters
+// of RFC 3986 (letters, digits and "-._~").
+std::string QuoteUrl(std::string_view str_in);
+
+// Decodes percent-encoded bytes. Returns an empty string if `str_in`
+// contains a malformed escape.
+std::string UnquoteUrl(std::string_view str_in);
+
+// Like UnquoteUrl, but avoids copying: returns `str_in` itself if it contains
+// no escapes, and otherwise decodes into `scratch` and returns a view of it.
+// Returns no value if `str_in` contains a malformed escape.
+std::optional<std::string_view> UnquoteUrl(std::string_view str_in,
+                                           std::string* scratch);
+
+// Decodes the `size` bytes at `data` in place, which works since decoding
+// never lengthens the input. Returns the decoded bytes, which start at
+// `data`, or no value if the input contains a malformed escape.
+std::optional<std::string_view> UnquoteUrlInPlace(char* data, size_t size);
+
+// Decodes one key or value of a query string or form body, where '+' also
+// stands for a space. Malformed escapes are kept as they are.
+std::string UnquoteFormComponent(std::string_view component);
+
+// The `key=value` pairs of a query string or
+// application/x-www-form-urlencoded body, in order of appearance. Keys may
+// repeat. Pairs are kept as views into the source, which must outlive this,
+// and are only decoded when read.
+class UrlParams {
+ public:
+  UrlParams() = default;
+
+  // Splits `source` (without a leading '?') into pairs.
+  explicit UrlParams(std::string_view source);
+
+  // Returns the decoded value of the first pair named `key`.
+  std::optional<std::string> Get(std::string_view key) const;
+
+  // Returns the decoded values of every pair named `key`.
+  std::vector<std::string> GetAll(std::string_view key) const;
+
+  bool Contains(std::string_view key) const;
+
+  size_t size() const { return params_.size(); }
+  bool empty() const { return params_.empty(); }
+
+  // The still-encoded pairs.
+  auto begin() const { return params_.begin(); }
+  auto end() const { return params_.end(); }
+
+ private:
+  // Whether the encoded key `raw` decodes to `key`.
+  static bool KeyMatches(std::string_view raw, std::string_view key);
 
-std::string UnquoteUrl(const std::string& str_in);
+  absl::InlinedVector<std::pair<std::string_view, std::string_view>, 8>
+      params_;
+};
 
 }
 
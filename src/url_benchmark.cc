@@ -0,0 +1,64 @@
+// Copyright 2022 Daniel Liu
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "url.h"
+
+namespace {
+
+// A path segment with a few characters that need escaping.
+const std::string kPath = "docs/getting started/Caf\xc3\xa9 & Bar (2022).html";
+
+// Mostly characters that need escaping, as in form-encoded free text.
+const std::string kText =
+    "Hello, world! \"Quotes\" & <tags>, 100% {braces} [brackets] ~tilde~ "
+    "\xe4\xbd\xa0\xe5\xa5\xbd \xf0\x9f\x98\x80 #hash ?query=1&b=2";
+
+void BM_QuoteUrl(benchmark::State& state, const std::string& input) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cppserver::QuoteUrl(input));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK_CAPTURE(BM_QuoteUrl, path, kPath);
+BENCHMARK_CAPTURE(BM_QuoteUrl, text, kText);
+
+void BM_UnquoteUrl(benchmark::State& state, const std::string& input) {
+  std::string quoted = cppserver::QuoteUrl(input);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cppserver::UnquoteUrl(quoted));
+  }
+  state.SetBytesProcessed(state.iterations() * quoted.size());
+}
+BENCHMARK_CAPTURE(BM_UnquoteUrl, path, kPath);
+BENCHMARK_CAPTURE(BM_UnquoteUrl, text, kText);
+
+void BM_UnquoteUrlScratch(benchmark::State& state, const std::string& input) {
+  std::string quoted = cppserver::QuoteUrl(input);
+  std::string scratch;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cppserver::UnquoteUrl(quoted, &scratch));
+  }
+  state.SetBytesProcessed(state.iterations() * quoted.size());
+}
+BENCHMARK_CAPTURE(BM_UnquoteUrlScratch, path, kPath);
+BENCHMARK_CAPTURE(BM_UnquoteUrlScratch, text, kText);
+BENCHMARK_CAPTURE(BM_UnquoteUrlScratch, unescaped,
+                  std::string("/static/css/site-main.v2.min.css"));
+
+void BM_UnquoteUrlInPlace(benchmark::State& state, const std::string& input) {
+  std::string quoted = cppserver::QuoteUrl(input);
+  std::string buffer;
+  for (auto _ : state) {
+    buffer = quoted;
+    benchmark::DoNotOptimize(
+        cppserver::UnquoteUrlInPlace(buffer.data(), buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * quoted.size());
+}
+BENCHMARK_CAPTURE(BM_UnquoteUrlInPlace, path, kPath);
+BENCHMARK_CAPTURE(BM_UnquoteUrlInPlace, text, kText);
+
+}  // namespace
@@ -0,0 +1,94 @@
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "url.h"
+
+using namespace cppserver;
+
+TEST(UrlTests, QuoteLeavesUnreservedCharacters) {
+  std::string unreserved =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~";
+  EXPECT_EQ(QuoteUrl(unreserved), unreserved);
+}
+
+TEST(UrlTests, QuoteEscapesEveryOtherByte) {
+  for (int c = 0; c < 256; ++c) {
+    std::string input(1, static_cast<char>(c));
+    bool unreserved = isalnum(c) || c == '-' || c == '.' || c == '_'
+        || c == '~';
+    char expected[4];
+    snprintf(expected, sizeof(expected), "%%%02X", c);
+    EXPECT_EQ(QuoteUrl(input), unreserved ? input : expected) << c;
+  }
+}
+
+TEST(UrlTests, QuoteLongInputs) {
+  // Long enough to exercise the vectorized path, with escapes at varying
+  // offsets within a block.
+  for (size_t offset = 0; offset < 40; ++offset) {
+    std::string input(offset, 'a');
+    input += "/\xc3\xa9";
+    input += std::string(37, 'Z');
+    std::string expected(offset, 'a');
+    expected += "%2F%C3%A9";
+    expected += std::string(37, 'Z');
+    EXPECT_EQ(QuoteUrl(input), expected) << offset;
+  }
+}
+
+TEST(UrlTests, UnquoteRoundTrips) {
+  std::string input = "Caf\xc3\xa9 & Bar (2022)/100% {braces} ~tilde~";
+  EXPECT_EQ(UnquoteUrl(QuoteUrl(input)), input);
+}
+
+TEST(UrlTests, UnquoteAcceptsLowercaseHex) {
+  EXPECT_EQ(UnquoteUrl("a%2fb%c3%A9"), "a/b\xc3\xa9");
+}
+
+TEST(UrlTests, UnquoteRejectsMalformedEscapes) {
+  EXPECT_EQ(UnquoteUrl("abc%2"), "");
+  EXPECT_EQ(UnquoteUrl("abc%zz"), "");
+  EXPECT_EQ(UnquoteUrl("%"), "");
+}
+
+TEST(UrlTests, UnquoteWithScratchAvoidsCopies) {
+  std::string scratch;
+  std::string_view input = "/static/site.css";
+  auto result = UnquoteUrl(input, &scratch);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(result->data(), input.data());
+
+  result = UnquoteUrl("a%20b", &scratch);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(*result, "a b");
+  EXPECT_FALSE(UnquoteUrl("a%2", &scratch).has_value());
+}
+
+TEST(UrlTests, UnquoteInPlace) {
+  std::string buffer = "hello%20world%21";
+  auto result = UnquoteUrlInPlace(buffer.data(), buffer.size());
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(*result, "hello world!");
+  EXPECT_EQ(result->data(), buffer.data());
+}
+
+TEST(UrlParamsTests, ParsesPairsInOrder) {
+  UrlParams params("a=1&b=two&a=3&flag&&empty=");
+  ASSERT_EQ(params.size(), 5);
+  EXPECT_EQ(params.Get("a"), "1");
+  EXPECT_EQ(params.GetAll("a"), (std::vector<std::string>{"1", "3"}));
+  EXPECT_EQ(params.Get("flag"), "");
+  EXPECT_EQ(params.Get("empty"), "");
+  EXPECT_FALSE(params.Get("missing").has_value());
+  EXPECT_TRUE(params.Contains("b"));
+}
+
+TEST(UrlParamsTests, DecodesKeysAndValues) {
+  UrlParams params("full+name=Jane+Q.+Doe&caf%C3%A9=%E2%98%95&bad=%zz");
+  EXPECT_EQ(params.Get("full name"), "Jane Q. Doe");
+  EXPECT_EQ(params.Get("caf\xc3\xa9"), "\xe2\x98\x95");
+  EXPECT_EQ(params.Get("bad"), "%zz");
+}
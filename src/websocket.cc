@@ -0,0 +1,717 @@
+// Copyright 2022 Daniel Liu
+
+#include "websocket.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+
+#include "event_loop.h"
+#include "http.h"
+#include "socket.h"
+
+namespace cppserver {
+
+namespace {
+
+// Appended to the client's key before hashing (RFC 6455, section 1.3).
+constexpr std::string_view kAcceptGUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Frames written per sendmsg call.
+constexpr int kMaxFramesPerWrite = 64;
+
+constexpr uint32_t kReadEvents = EPOLLIN | EPOLLRDHUP;
+
+// The handshake only needs SHA-1 for a few dozen bytes, which doesn't
+// justify a crypto dependency.
+std::array<uint8_t, 20> Sha1(std::string_view data) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+
+  // Pad to a multiple of 64 bytes with a 1 bit, zeros and the bit length.
+  std::string message(data);
+  uint64_t bit_length = static_cast<uint64_t>(data.size()) * 8;
+  message += '\x80';
+  while (message.size() % 64 != 56) {
+    message += '\0';
+  }
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    message += static_cast<char>(bit_length >> shift);
+  }
+
+  for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      const auto* p =
+          reinterpret_cast<const uint8_t*>(message.data() + chunk + i * 4);
+      w[i] = uint32_t{p[0]} << 24 | uint32_t{p[1]} << 16 | uint32_t{p[2]} << 8
+          | uint32_t{p[3]};
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::array<uint8_t, 20> digest;
+  for (int i = 0; i < 20; ++i) {
+    digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+  }
+  return digest;
+}
+
+// Whether the comma-separated header `value` contains `token`.
+bool HasToken(std::string_view value, std::string_view token) {
+  for (std::string_view item : absl::StrSplit(value, ',')) {
+    if (absl::EqualsIgnoreCase(absl::StripAsciiWhitespace(item), token)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether a peer may send `code` in a close frame (RFC 6455, section 7.4).
+// 1005, 1006 and 1015 are reserved for reporting and never go on the wire.
+bool IsValidCloseCode(uint16_t code) {
+  return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) ||
+         (code >= 3000 && code <= 4999);
+}
+
+}  // namespace
+
+std::string WebSocketAcceptKey(std::string_view key) {
+  std::string keyed(key);
+  keyed += kAcceptGUID;
+  auto digest = Sha1(keyed);
+  return absl::Base64Escape(std::string_view(
+      reinterpret_cast<const char*>(digest.data()), digest.size()));
+}
+
+absl::StatusOr<HTTPResponse> AcceptWebSocket(const HTTPRequest& request) {
+  auto upgrade = request.GetHeader("Upgrade");
+  auto connection = request.GetHeader("Connection");
+  if (request.method != "GET" || !upgrade || !HasToken(*upgrade, "websocket")
+      || !connection || !HasToken(*connection, "upgrade")) {
+    return absl::InvalidArgumentError("Expected a WebSocket upgrade request");
+  }
+  auto version = request.GetHeader("Sec-WebSocket-Version");
+  if (!version || absl::StripAsciiWhitespace(*version) != "13") {
+    return absl::FailedPreconditionError(
+        "Only WebSocket protocol version 13 is supported");
+  }
+  auto key = request.GetHeader("Sec-WebSocket-Key");
+  std::string decoded;
+  if (!key || !absl::Base64Unescape(absl::StripAsciiWhitespace(*key), &decoded)
+      || decoded.size() != 16) {
+    return absl::InvalidArgumentError("Malformed Sec-WebSocket-Key");
+  }
+
+  HTTPResponse response(101);
+  response.AddHeader("Upgrade", "websocket");
+  response.AddHeader("Connection", "Upgrade");
+  response.AddHeader("Sec-WebSocket-Accept",
+                     WebSocketAcceptKey(absl::StripAsciiWhitespace(*key)));
+  return response;
+}
+
+void UnmaskWebSocketPayload(char* data, size_t size,
+                            std::array<uint8_t, 4> mask, size_t offset) {
+  // Rotate the key so byte 0 of `data` lines up with key[0].
+  uint8_t key[4];
+  for (int i = 0; i < 4; ++i) {
+    key[i] = mask[(offset + i) % 4];
+  }
+
+  // Every vector is a multiple of 4 bytes, so the key stays lined up.
+  size_t i = 0;
+#ifdef __SSE2__
+  uint32_t key_word;
+  std::memcpy(&key_word, key, sizeof(key_word));
+  const __m128i key_vector = _mm_set1_epi32(key_word);
+  for (; i + 64 <= size; i += 64) {
+    auto* p = reinterpret_cast<__m128i*>(data + i);
+    __m128i a = _mm_loadu_si128(p);
+    __m128i b = _mm_loadu_si128(p + 1);
+    __m128i c = _mm_loadu_si128(p + 2);
+    __m128i d = _mm_loadu_si128(p + 3);
+    _mm_storeu_si128(p, _mm_xor_si128(a, key_vector));
+    _mm_storeu_si128(p + 1, _mm_xor_si128(b, key_vector));
+    _mm_storeu_si128(p + 2, _mm_xor_si128(c, key_vector));
+    _mm_storeu_si128(p + 3, _mm_xor_si128(d, key_vector));
+  }
+  for (; i + 16 <= size; i += 16) {
+    auto* p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key_vector));
+  }
+#else
+  uint64_t key_word;
+  std::memcpy(&key_word, key, 4);
+  std::memcpy(reinterpret_cast<char*>(&key_word) + 4, key, 4);
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    word ^= key_word;
+    std::memcpy(data + i, &word, sizeof(word));
+  }
+#endif
+  for (; i < size; ++i) {
+    data[i] ^= key[i % 4];
+  }
+}
+
+bool IsValidUtf8(std::string_view text) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(text.data());
+  size_t size = text.size();
+  size_t i = 0;
+  while (i < size) {
+    uint8_t lead = bytes[i];
+    if (lead < 0x80) {
+      ++i;
+      continue;
+    }
+    // The length of the sequence, and the range of its second byte, which
+    // rules out overlong forms, surrogates and code points past U+10FFFF
+    // (RFC 3629, section 4).
+    size_t length;
+    uint8_t low = 0x80, high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3;
+      if (lead == 0xE0) {
+        low = 0xA0;
+      } else if (lead == 0xED) {
+        high = 0x9F;
+      }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4;
+      if (lead == 0xF0) {
+        low = 0x90;
+      } else if (lead == 0xF4) {
+        high = 0x8F;
+      }
+    } else {
+      return false;
+    }
+    if (size - i < length || bytes[i + 1] < low || bytes[i + 1] > high) {
+      return false;
+    }
+    for (size_t j = 2; j < length; ++j) {
+      if ((bytes[i + j] & 0xC0) != 0x80) {
+        return false;
+      }
+    }
+    i += length;
+  }
+  return true;
+}
+
+std::string MakeWebSocketFrame(WebSocketOpcode opcode,
+                               std::string_view payload, bool fin) {
+  std::string frame;
+  frame.reserve(payload.size() + 10);
+  frame += static_cast<char>((fin ? 0x80 : 0) | static_cast<uint8_t>(opcode));
+  if (payload.size() < 126) {
+    frame += static_cast<char>(payload.size());
+  } else if (payload.size() <= 0xFFFF) {
+    frame += static_cast<char>(126);
+    frame += static_cast<char>(payload.size() >> 8);
+    frame += static_cast<char>(payload.size());
+  } else {
+    frame += static_cast<char>(127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      frame += static_cast<char>(static_cast<uint64_t>(payload.size())
+                                 >> shift);
+    }
+  }
+  frame += payload;
+  return frame;
+}
+
+absl::StatusOr<size_t> ParseWebSocketFrame(char* buffer, size_t size,
+                                           size_t max_payload,
+                                           WebSocketFrame* frame) {
+  if (size < 2) {
+    return 0;
+  }
+  const auto* bytes = reinterpret_cast<const uint8_t*>(buffer);
+  if (bytes[0] & 0x70) {
+    return absl::InvalidArgumentError("Reserved bits set without extension");
+  }
+  uint8_t opcode = bytes[0] & 0x0F;
+  bool control = opcode & 0x08;
+  if (opcode > 0xA || (opcode > 0x2 && opcode < 0x8)) {
+    return absl::InvalidArgumentError("Unknown opcode");
+  }
+  if (!(bytes[1] & 0x80)) {
+    return absl::InvalidArgumentError("Client frames must be masked");
+  }
+
+  size_t header = 2;
+  uint64_t length = bytes[1] & 0x7F;
+  if (length == 126) {
+    header = 4;
+    if (size < header) {
+      return 0;
+    }
+    length = uint64_t{bytes[2]} << 8 | bytes[3];
+  } else if (length == 127) {
+    header = 10;
+    if (size < header) {
+      return 0;
+    }
+    length = 0;
+    for (int i = 2; i < 10; ++i) {
+      length = length << 8 | bytes[i];
+    }
+    if (length >> 63) {
+      return absl::InvalidArgumentError("Frame length out of range");
+    }
+  }
+  bool fin = bytes[0] & 0x80;
+  if (control && (length > 125 || !fin)) {
+    return absl::InvalidArgumentError("Malformed control frame");
+  }
+  if (length > max_payload) {
+    return absl::OutOfRangeError("Frame too large");
+  }
+
+  size_t total = header + 4 + length;
+  if (size < total) {
+    return 0;
+  }
+  std::array<uint8_t, 4> mask;
+  std::memcpy(mask.data(), buffer + header, 4);
+  char* payload = buffer + header + 4;
+  UnmaskWebSocketPayload(payload, length, mask);
+
+  frame->fin = fin;
+  frame->opcode = static_cast<WebSocketOpcode>(opcode);
+  frame->payload = std::string_view(payload, length);
+  return total;
+}
+
+WebSocket::WebSocket(Socket socket, SocketSockAddr peer, EventLoop* loop)
+    : socket_{std::move(socket)}, peer_{peer}, loop_{loop} {
+  socket_.SetNonBlocking(true);
+}
+
+void WebSocket::Start(std::string received) {
+  {
+    absl::MutexLock lock(&mutex_);
+    if (closed_) {
+      return;
+    }
+    registered_ = true;
+    loop_->Add(socket_.GetFD(), kReadEvents | (want_write_ ? EPOLLOUT : 0),
+               [self = shared_from_this()](uint32_t events) {
+                 self->HandleEvents(events);
+               });
+  }
+  input_ = std::move(received);
+  ProcessInput();
+}
+
+void WebSocket::HandleEvents(uint32_t events) {
+  if (torn_down_) {
+    return;
+  }
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    Teardown();
+    return;
+  }
+  if (events & EPOLLOUT) {
+    absl::MutexLock lock(&mutex_);
+    Flush();
+  }
+  if (events & (EPOLLIN | EPOLLRDHUP)) {
+    HandleReadable();
+  }
+}
+
+void WebSocket::HandleReadable() {
+  // Connections share one buffer per loop thread, so idle ones hold only
+  // what they've partly received.
+  static thread_local char scratch[64 * 1024];
+  ssize_t result = socket_.Receive(scratch, sizeof(scratch));
+  if (result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+                      && errno != EINTR)) {
+    Teardown();
+    return;
+  }
+  // Once closing, the client only has to close its end.
+  if (result > 0 && !closing_) {
+    input_.append(scratch, result);
+    ProcessInput();
+  }
+}
+
+void WebSocket::ProcessInput() {
+  size_t consumed = 0;
+  while (!torn_down_) {
+    WebSocketFrame frame;
+    auto parsed = ParseWebSocketFrame(input_.data() + consumed,
+                                      input_.size() - consumed,
+                                      kMaxMessageSize, &frame);
+    if (!parsed.ok()) {
+      Close(absl::IsOutOfRange(parsed.status()) ? kWebSocketMessageTooBig
+                                                : kWebSocketProtocolError);
+      FinishClosing();
+      return;
+    }
+    if (*parsed == 0) {
+      break;
+    }
+    consumed += *parsed;
+    if (!HandleFrame(frame)) {
+      FinishClosing();
+      return;
+    }
+  }
+  input_.erase(0, consumed);
+}
+
+bool WebSocket::HandleFrame(const WebSocketFrame& frame) {
+  switch (frame.opcode) {
+    case WebSocketOpcode::kText:
+    case WebSocketOpcode::kBinary:
+      if (in_message_) {
+        Close(kWebSocketProtocolError);
+        return false;
+      }
+      if (frame.fin) {
+        if (frame.opcode == WebSocketOpcode::kText
+            && !IsValidUtf8(frame.payload)) {
+          Close(kWebSocketInvalidPayload);
+          return false;
+        }
+        // Unfragmented messages are handed over without a copy.
+        if (on_message_) {
+          on_message_(*this, frame.payload,
+                      frame.opcode == WebSocketOpcode::kBinary);
+        }
+        return true;
+      }
+      in_message_ = true;
+      message_binary_ = frame.opcode == WebSocketOpcode::kBinary;
+      message_.assign(frame.payload);
+      return true;
+
+    case WebSocketOpcode::kContinuation:
+      if (!in_message_) {
+        Close(kWebSocketProtocolError);
+        return false;
+      }
+      if (message_.size() + frame.payload.size() > kMaxMessageSize) {
+        Close(kWebSocketMessageTooBig);
+        return false;
+      }
+      message_ += frame.payload;
+      if (frame.fin) {
+        if (!message_binary_ && !IsValidUtf8(message_)) {
+          Close(kWebSocketInvalidPayload);
+          return false;
+        }
+        in_message_ = false;
+        if (on_message_) {
+          on_message_(*this, message_, message_binary_);
+        }
+        message_.clear();
+        message_.shrink_to_fit();
+      }
+      return true;
+
+    case WebSocketOpcode::kPing:
+      Enqueue(std::make_shared<const std::string>(
+          MakeWebSocketFrame(WebSocketOpcode::kPong, frame.payload)));
+      return true;
+
+    case WebSocketOpcode::kPong:
+      return true;
+
+    case WebSocketOpcode::kClose:
+      // The body is empty, or a status code optionally followed by a UTF-8
+      // reason; anything else fails the connection instead of being echoed.
+      if (frame.payload.size() == 1) {
+        Close(kWebSocketProtocolError);
+        return false;
+      }
+      if (!frame.payload.empty()) {
+        uint16_t code = static_cast<uint8_t>(frame.payload[0]) << 8 |
+                        static_cast<uint8_t>(frame.payload[1]);
+        if (!IsValidCloseCode(code)) {
+          Close(kWebSocketProtocolError);
+          return false;
+        }
+        if (!IsValidUtf8(std::string_view(frame.payload).substr(2))) {
+          Close(kWebSocketInvalidPayload);
+          return false;
+        }
+      }
+      // Echo the client's status code, then finish closing.
+      {
+        absl::MutexLock lock(&mutex_);
+        if (!close_sent_ && !closed_) {
+          close_sent_ = true;
+          EnqueueLocked(std::make_shared<const std::string>(MakeWebSocketFrame(
+              WebSocketOpcode::kClose, frame.payload.substr(0, 2))));
+        }
+      }
+      return false;
+  }
+  return false;
+}
+
+void WebSocket::Send(std::string_view message, bool binary) {
+  Enqueue(std::make_shared<const std::string>(MakeWebSocketFrame(
+      binary ? WebSocketOpcode::kBinary : WebSocketOpcode::kText, message)));
+}
+
+void WebSocket::SendFrame(std::shared_ptr<const std::string> frame) {
+  Enqueue(std::move(frame));
+}
+
+void WebSocket::Close(uint16_t code, std::string_view reason) {
+  std::string payload;
+  payload += static_cast<char>(code >> 8);
+  payload += static_cast<char>(code);
+  // Control frames carry at most 125 bytes.
+  payload += reason.substr(0, 123);
+  auto frame = std::make_shared<const std::string>(
+      MakeWebSocketFrame(WebSocketOpcode::kClose, payload));
+
+  absl::MutexLock lock(&mutex_);
+  if (close_sent_ || closed_) {
+    return;
+  }
+  close_sent_ = true;
+  EnqueueLocked(std::move(frame));
+}
+
+bool WebSocket::IsOpen() const {
+  absl::MutexLock lock(&mutex_);
+  return !close_sent_ && !closed_;
+}
+
+void WebSocket::Enqueue(std::shared_ptr<const std::string> frame) {
+  absl::MutexLock lock(&mutex_);
+  // Nothing may follow a close frame.
+  if (close_sent_ || closed_) {
+    return;
+  }
+  EnqueueLocked(std::move(frame));
+}
+
+void WebSocket::EnqueueLocked(std::shared_ptr<const std::string> frame) {
+  if (outgoing_.bytes + frame->size() > kMaxQueuedBytes) {
+    AbortLocked();
+    return;
+  }
+  outgoing_.bytes += frame->size();
+  outgoing_.frames.push_back(std::move(frame));
+  // While the loop watches for writability, it does the writing, which
+  // keeps frames in order.
+  if (!want_write_) {
+    Flush();
+  }
+}
+
+void WebSocket::Flush() {
+  if (closed_) {
+    return;
+  }
+  while (!outgoing_.frames.empty()) {
+    struct iovec iov[kMaxFramesPerWrite];
+    int iovcnt = 0;
+    size_t requested = 0;
+    size_t offset = outgoing_.offset;
+    for (const auto& frame : outgoing_.frames) {
+      if (iovcnt == kMaxFramesPerWrite) {
+        break;
+      }
+      iov[iovcnt].iov_base = const_cast<char*>(frame->data()) + offset;
+      iov[iovcnt].iov_len = frame->size() - offset;
+      requested += iov[iovcnt].iov_len;
+      ++iovcnt;
+      offset = 0;
+    }
+    ssize_t sent = socket_.SendVector(iov, iovcnt, MSG_NOSIGNAL);
+    if (sent < 0) {
+      AbortLocked();
+      return;
+    }
+
+    outgoing_.bytes -= sent;
+    size_t written = outgoing_.offset + sent;
+    while (!outgoing_.frames.empty()
+           && written >= outgoing_.frames.front()->size()) {
+      written -= outgoing_.frames.front()->size();
+      outgoing_.frames.pop_front();
+    }
+    outgoing_.offset = written;
+    if (static_cast<size_t>(sent) < requested) {
+      // The socket's send buffer is full.
+      break;
+    }
+  }
+
+  bool want_write = !outgoing_.frames.empty();
+  if (!want_write && shut_down_when_flushed_) {
+    shut_down_when_flushed_ = false;
+    shutdown(socket_.GetFD(), SHUT_WR);
+  }
+  if (want_write != want_write_) {
+    want_write_ = want_write;
+    if (registered_) {
+      loop_->Modify(socket_.GetFD(),
+                    kReadEvents | (want_write ? EPOLLOUT : 0));
+    }
+  }
+}
+
+void WebSocket::AbortLocked() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  loop_->Post([self = shared_from_this()] { self->Teardown(); });
+}
+
+void WebSocket::FinishClosing() {
+  if (closing_) {
+    return;
+  }
+  closing_ = true;
+  input_.clear();
+  {
+    absl::MutexLock lock(&mutex_);
+    shut_down_when_flushed_ = true;
+    Flush();
+  }
+  loop_->AddTimer(kCloseTimeout, [weak = weak_from_this()] {
+    if (auto self = weak.lock()) {
+      self->Teardown();
+    }
+  });
+}
+
+void WebSocket::Teardown() {
+  if (torn_down_) {
+    return;
+  }
+  torn_down_ = true;
+  bool registered;
+  {
+    absl::MutexLock lock(&mutex_);
+    closed_ = true;
+    registered = registered_;
+    outgoing_ = {};
+  }
+  if (registered) {
+    loop_->Remove(socket_.GetFD());
+  }
+  socket_.Close();
+
+  // The callbacks often hold references to this connection, so drop them
+  // to break the cycle.
+  on_message_ = nullptr;
+  if (auto on_close = std::move(on_close_)) {
+    on_close_ = nullptr;
+    on_close(*this);
+  }
+}
+
+void WebSocketGroup::Add(std::shared_ptr<WebSocket> socket) {
+  absl::MutexLock lock(&mutex_);
+  sockets_.push_back(std::move(socket));
+}
+
+void WebSocketGroup::Remove(const WebSocket* socket) {
+  absl::MutexLock lock(&mutex_);
+  sockets_.erase(
+      std::remove_if(sockets_.begin(), sockets_.end(),
+                     [socket](const std::weak_ptr<WebSocket>& member) {
+                       auto locked = member.lock();
+                       return !locked || locked.get() == socket;
+                     }),
+      sockets_.end());
+}
+
+void WebSocketGroup::Broadcast(std::string_view message, bool binary) {
+  auto frame = std::make_shared<const std::string>(MakeWebSocketFrame(
+      binary ? WebSocketOpcode::kBinary : WebSocketOpcode::kText, message));
+
+  // Collect the members first so sending doesn't hold the group's lock.
+  std::vector<std::shared_ptr<WebSocket>> members;
+  {
+    absl::MutexLock lock(&mutex_);
+    members.reserve(sockets_.size());
+    for (const auto& member : sockets_) {
+      if (auto locked = member.lock(); locked && locked->IsOpen()) {
+        members.push_back(std::move(locked));
+      }
+    }
+    if (members.size() < sockets_.size()) {
+      sockets_.assign(members.begin(), members.end());
+    }
+  }
+  for (const auto& member : members) {
+    member->SendFrame(frame);
+  }
+}
+
+size_t WebSocketGroup::size() const {
+  absl::MutexLock lock(&mutex_);
+  return sockets_.size();
+}
+
+}  // namespace cppserver
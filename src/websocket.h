@@ -0,0 +1,234 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_WEBSOCKET_H_
+#define _CPPSERVER_WEBSOCKET_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+
+#include "event_loop.h"
+#include "http.h"
+#include "socket.h"
+
+namespace cppserver {
+
+// Frame opcodes from RFC 6455, section 5.2.
+enum class WebSocketOpcode : uint8_t {
+  kContinuation = 0x0,
+  kText = 0x1,
+  kBinary = 0x2,
+  kClose = 0x8,
+  kPing = 0x9,
+  kPong = 0xA,
+};
+
+// Close codes from RFC 6455, section 7.4.1.
+enum WebSocketCloseCode : uint16_t {
+  kWebSocketNormalClosure = 1000,
+  kWebSocketGoingAway = 1001,
+  kWebSocketProtocolError = 1002,
+  kWebSocketInvalidPayload = 1007,
+  kWebSocketPolicyViolation = 1008,
+  kWebSocketMessageTooBig = 1009,
+};
+
+// Computes the Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key.
+std::string WebSocketAcceptKey(std::string_view key);
+
+// Checks that `request` is a valid WebSocket opening handshake and returns
+// the 101 response that completes it. Returns InvalidArgument for malformed
+// handshakes and FailedPrecondition for unsupported protocol versions.
+absl::StatusOr<HTTPResponse> AcceptWebSocket(const HTTPRequest& request);
+
+// XORs `size` bytes at `data` with the 4-byte masking key, starting at byte
+// `offset` of the key (the position of `data` within the payload, mod 4).
+void UnmaskWebSocketPayload(char* data, size_t size,
+                            std::array<uint8_t, 4> mask, size_t offset = 0);
+
+// Checks that `text` is well-formed UTF-8, as text messages must be: no
+// overlong encodings, surrogates or code points past U+10FFFF.
+bool IsValidUtf8(std::string_view text);
+
+// Serializes an unmasked (server-to-client) frame.
+std::string MakeWebSocketFrame(WebSocketOpcode opcode,
+                               std::string_view payload, bool fin = true);
+
+// A frame received from a client.
+struct WebSocketFrame {
+  bool fin;
+  WebSocketOpcode opcode;
+  // Unmasked, and pointing into the buffer passed to ParseWebSocketFrame.
+  std::string_view payload;
+};
+
+// Parses and unmasks (in place) the client frame at the start of `buffer`,
+// returning the number of bytes it takes up, or 0 if `buffer` doesn't hold a
+// whole frame yet. Frames that break the protocol, or whose payload is
+// longer than `max_payload`, are errors; OutOfRange for the latter.
+absl::StatusOr<size_t> ParseWebSocketFrame(char* buffer, size_t size,
+                                           size_t max_payload,
+                                           WebSocketFrame* frame);
+
+// An open WebSocket connection. Its socket is watched by the server's event
+// loop, so idle connections cost no threads.
+//
+// Set the callbacks from the WebSocketHandler; they run on the event loop
+// thread, so they must not block. Everything else may be called from any
+// thread.
+class WebSocket : public std::enable_shared_from_this<WebSocket> {
+ public:
+  // Called with each complete message, and whether it's binary.
+  using MessageCallback =
+      std::function<void(WebSocket& socket, std::string_view message,
+                         bool binary)>;
+
+  // Called once when the connection is closed, for any reason.
+  using CloseCallback = std::function<void(WebSocket& socket)>;
+
+  // Largest message accepted from the client; longer messages close the
+  // connection with kWebSocketMessageTooBig.
+  static constexpr size_t kMaxMessageSize = 16 * 1024 * 1024;
+
+  // Connections whose unsent data grows past this are closed, so a slow
+  // subscriber can't make the server buffer without limit.
+  static constexpr size_t kMaxQueuedBytes = 8 * 1024 * 1024;
+
+  // How long the closing handshake may take once the close frames have been
+  // exchanged, for the client to read the last of the output and close.
+  static constexpr std::chrono::seconds kCloseTimeout{5};
+
+  // Takes over a connection whose handshake has been sent. Call Start to
+  // begin reading from it.
+  WebSocket(Socket socket, SocketSockAddr peer, EventLoop* loop);
+
+  WebSocket(const WebSocket&) = delete;
+  WebSocket& operator=(const WebSocket&) = delete;
+
+  void OnMessage(MessageCallback callback) {
+    on_message_ = std::move(callback);
+  }
+  void OnClose(CloseCallback callback) { on_close_ = std::move(callback); }
+
+  // Registers with the event loop. `received` holds any bytes read past the
+  // handshake. Must be called on the loop thread.
+  void Start(std::string received);
+
+  // Sends a text or binary message.
+  void Send(std::string_view message, bool binary = false);
+
+  // Sends a frame made by MakeWebSocketFrame. The buffer is shared rather
+  // than copied, so the same frame can be queued on many connections.
+  void SendFrame(std::shared_ptr<const std::string> frame);
+
+  // Starts the closing handshake. The connection is closed once the client
+  // answers.
+  void Close(uint16_t code = kWebSocketNormalClosure,
+             std::string_view reason = "");
+
+  bool IsOpen() const;
+
+  const SocketSockAddr& Peer() const { return peer_; }
+
+ private:
+  // Frames waiting to be written, and how much of the first has been.
+  struct Outgoing {
+    std::deque<std::shared_ptr<const std::string>> frames;
+    size_t offset = 0;
+    size_t bytes = 0;
+  };
+
+  void HandleEvents(uint32_t events);
+
+  // Reads what's available and handles the frames in it.
+  void HandleReadable();
+
+  // Handles the complete frames in input_.
+  void ProcessInput();
+
+  // Returns false if the connection should be torn down.
+  bool HandleFrame(const WebSocketFrame& frame);
+
+  // Queues a frame, starting the write right away if nothing is pending.
+  void Enqueue(std::shared_ptr<const std::string> frame);
+  void EnqueueLocked(std::shared_ptr<const std::string> frame)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Writes as much as the socket takes, and watches for writability if
+  // anything is left.
+  void Flush() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Ends the closing handshake once the close frame is queued: stops
+  // handling input, and once everything queued has been written, shuts down
+  // the write side so the client sees the end and closes the connection.
+  // The socket is torn down then, or after kCloseTimeout.
+  void FinishClosing();
+
+  // Stops watching the socket and closes it. Runs on the loop thread.
+  void Teardown();
+
+  // Closes the connection without a closing handshake, from any thread.
+  void AbortLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  Socket socket_;
+  SocketSockAddr peer_;
+  EventLoop* loop_;
+
+  MessageCallback on_message_;
+  CloseCallback on_close_;
+
+  // Only touched on the loop thread.
+  std::string input_;
+  std::string message_;
+  bool message_binary_ = false;
+  bool in_message_ = false;
+  // Set by FinishClosing; input is discarded from then on.
+  bool closing_ = false;
+  bool torn_down_ = false;
+
+  mutable absl::Mutex mutex_;
+  Outgoing outgoing_ ABSL_GUARDED_BY(mutex_);
+  // Whether Start has added the socket to the loop.
+  bool registered_ ABSL_GUARDED_BY(mutex_) = false;
+  // Whether the loop is watching for EPOLLOUT.
+  bool want_write_ ABSL_GUARDED_BY(mutex_) = false;
+  bool close_sent_ ABSL_GUARDED_BY(mutex_) = false;
+  // Set while the write side is to be shut down once outgoing_ drains.
+  bool shut_down_when_flushed_ ABSL_GUARDED_BY(mutex_) = false;
+  // Set once the socket is (about to be) closed; nothing is written after.
+  bool closed_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+// A set of connections that messages can be broadcast to, e.g. everyone
+// watching a dashboard. Connections leave the group when they close.
+class WebSocketGroup {
+ public:
+  void Add(std::shared_ptr<WebSocket> socket);
+
+  void Remove(const WebSocket* socket);
+
+  // Sends `message` to every open connection in the group. The frame is
+  // serialized once and its buffer shared by every connection.
+  void Broadcast(std::string_view message, bool binary = false);
+
+  size_t size() const;
+
+ private:
+  mutable absl::Mutex mutex_;
+  std::vector<std::weak_ptr<WebSocket>> sockets_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace cppserver
+
+#endif
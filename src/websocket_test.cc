@@ -0,0 +1,281 @@
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "absl/strings/escaping.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+#include "event_loop.h"
+#include "http.h"
+#include "socket.h"
+#include "websocket.h"
+
+using namespace cppserver;
+
+namespace {
+
+// Masks `payload` into a client frame, as a browser would send it.
+std::string ClientFrame(WebSocketOpcode opcode, std::string payload,
+                        bool fin = true) {
+  std::array<uint8_t, 4> mask = {0x37, 0xfa, 0x21, 0x3d};
+  std::string frame = MakeWebSocketFrame(opcode, "", fin);
+  frame.pop_back();
+  if (payload.size() < 126) {
+    frame += static_cast<char>(0x80 | payload.size());
+  } else {
+    frame += static_cast<char>(0x80 | 126);
+    frame += static_cast<char>(payload.size() >> 8);
+    frame += static_cast<char>(payload.size());
+  }
+  frame.append(reinterpret_cast<const char*>(mask.data()), 4);
+  UnmaskWebSocketPayload(payload.data(), payload.size(), mask);
+  return frame + payload;
+}
+
+// Runs an event loop on its own thread for the length of a test.
+class LoopThread {
+ public:
+  LoopThread() : thread_([this] { loop_.Run(); }) {}
+
+  ~LoopThread() {
+    // Posted, so it can't come before Run starts.
+    loop_.Post([this] { loop_.Stop(); });
+    thread_.join();
+  }
+
+  EventLoop* loop() { return &loop_; }
+
+ private:
+  EventLoop loop_;
+  std::thread thread_;
+};
+
+// A WebSocket on one end of a socket pair, with the client's end.
+struct Connected {
+  Connected(int server_fd, int client_fd, EventLoop* loop)
+      : socket{std::make_shared<WebSocket>(Socket::FromFD(server_fd),
+                                           SocketSockAddr("127.0.0.1", 0),
+                                           loop)},
+        client{Socket::FromFD(client_fd)} {}
+
+  std::shared_ptr<WebSocket> socket;
+  Socket client;
+  absl::Notification closed;
+};
+
+std::unique_ptr<Connected> Connect(EventLoop* loop) {
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  auto connected = std::make_unique<Connected>(fds[0], fds[1], loop);
+  struct timeval timeout = {5, 0};
+  setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  connected->socket->OnClose(
+      [closed = &connected->closed](WebSocket&) { closed->Notify(); });
+  loop->Post([socket = connected->socket] { socket->Start(""); });
+  return connected;
+}
+
+// Reads from `client` until the server closes its end.
+std::string ReadToEnd(Socket& client) {
+  std::string received;
+  char buffer[64 * 1024];
+  ssize_t result;
+  while ((result = client.Receive(buffer, sizeof(buffer))) > 0) {
+    received.append(buffer, result);
+  }
+  EXPECT_EQ(result, 0);
+  return received;
+}
+
+}  // namespace
+
+TEST(WebSocketTests, ComputesAcceptKey) {
+  // The example from RFC 6455, section 1.3.
+  EXPECT_EQ(WebSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ=="),
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+TEST(WebSocketTests, AcceptsHandshakes) {
+  HTTPRequest request;
+  request.method = "GET";
+  request.target = "/chat/";
+  request.version = "HTTP/1.1";
+  request.headers.emplace_back("Upgrade", "websocket");
+  request.headers.emplace_back("Connection", "keep-alive, Upgrade");
+  request.headers.emplace_back("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+  request.headers.emplace_back("Sec-WebSocket-Version", "13");
+
+  auto response = AcceptWebSocket(request);
+  ASSERT_TRUE(response.ok());
+  std::string rendered = response->ToString();
+  EXPECT_EQ(rendered.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0), 0);
+  EXPECT_NE(rendered.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="),
+            std::string::npos);
+  EXPECT_EQ(rendered.find("Content-Length"), std::string::npos);
+
+  request.headers.back().second = "8";
+  EXPECT_TRUE(absl::IsFailedPrecondition(AcceptWebSocket(request).status()));
+  request.headers.erase(request.headers.begin());
+  EXPECT_TRUE(absl::IsInvalidArgument(AcceptWebSocket(request).status()));
+}
+
+TEST(WebSocketTests, UnmasksAtEveryLengthAndOffset) {
+  std::array<uint8_t, 4> mask = {0x12, 0x34, 0x56, 0x78};
+  std::string plain;
+  for (int i = 0; i < 200; ++i) {
+    plain += static_cast<char>(i * 7);
+  }
+  for (size_t size = 0; size < plain.size(); ++size) {
+    for (size_t offset = 0; offset < 4; ++offset) {
+      std::string data = plain.substr(0, size);
+      UnmaskWebSocketPayload(data.data(), data.size(), mask, offset);
+      for (size_t i = 0; i < size; ++i) {
+        ASSERT_EQ(static_cast<uint8_t>(data[i]),
+                  static_cast<uint8_t>(plain[i] ^ mask[(offset + i) % 4]))
+            << size << " " << offset << " " << i;
+      }
+    }
+  }
+}
+
+TEST(WebSocketTests, ParsesFramesAsTheyArrive) {
+  std::string long_payload(300, 'x');
+  std::string stream = ClientFrame(WebSocketOpcode::kText, "Hello")
+      + ClientFrame(WebSocketOpcode::kBinary, long_payload);
+
+  WebSocketFrame frame;
+  for (size_t size = 0; size < 11; ++size) {
+    std::string partial = stream.substr(0, size);
+    auto parsed = ParseWebSocketFrame(partial.data(), size, 1024, &frame);
+    ASSERT_TRUE(parsed.ok());
+    EXPECT_EQ(*parsed, 0);
+  }
+
+  auto parsed = ParseWebSocketFrame(stream.data(), stream.size(), 1024, &frame);
+  ASSERT_TRUE(parsed.ok());
+  EXPECT_EQ(*parsed, 11);
+  EXPECT_TRUE(frame.fin);
+  EXPECT_EQ(frame.opcode, WebSocketOpcode::kText);
+  EXPECT_EQ(frame.payload, "Hello");
+
+  parsed = ParseWebSocketFrame(stream.data() + 11, stream.size() - 11, 1024,
+                               &frame);
+  ASSERT_TRUE(parsed.ok());
+  EXPECT_EQ(*parsed, stream.size() - 11);
+  EXPECT_EQ(frame.opcode, WebSocketOpcode::kBinary);
+  EXPECT_EQ(frame.payload, long_payload);
+}
+
+TEST(WebSocketTests, RejectsInvalidFrames) {
+  WebSocketFrame frame;
+  // Unmasked.
+  std::string unmasked = MakeWebSocketFrame(WebSocketOpcode::kText, "hi");
+  EXPECT_FALSE(ParseWebSocketFrame(unmasked.data(), unmasked.size(), 1024,
+                                   &frame).ok());
+  // Fragmented control frame.
+  std::string ping = ClientFrame(WebSocketOpcode::kPing, "", false);
+  EXPECT_FALSE(ParseWebSocketFrame(ping.data(), ping.size(), 1024,
+                                   &frame).ok());
+  // Too large, which is known from the header alone.
+  std::string large = ClientFrame(WebSocketOpcode::kText, std::string(2000, 'a'))
+      .substr(0, 4);
+  EXPECT_TRUE(absl::IsOutOfRange(
+      ParseWebSocketFrame(large.data(), large.size(), 1024, &frame).status()));
+}
+
+TEST(WebSocketTests, MakesFramesWithEachLengthEncoding) {
+  EXPECT_EQ(MakeWebSocketFrame(WebSocketOpcode::kText, "abc"),
+            std::string("\x81\x03" "abc"));
+  EXPECT_EQ(MakeWebSocketFrame(WebSocketOpcode::kBinary, std::string(126, 'a'))
+                .substr(0, 4),
+            std::string("\x82\x7e\x00\x7e", 4));
+  EXPECT_EQ(MakeWebSocketFrame(WebSocketOpcode::kBinary,
+                               std::string(65536, 'a')).substr(0, 10),
+            std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10));
+}
+
+TEST(WebSocketTests, ValidatesUtf8) {
+  EXPECT_TRUE(IsValidUtf8("plain ASCII"));
+  EXPECT_TRUE(IsValidUtf8("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+  EXPECT_FALSE(IsValidUtf8("\xc3"));                 // Truncated.
+  EXPECT_FALSE(IsValidUtf8("\xc0\xaf"));             // Overlong.
+  EXPECT_FALSE(IsValidUtf8("\xed\xa0\x80"));         // Surrogate.
+  EXPECT_FALSE(IsValidUtf8("\xf4\x90\x80\x80"));     // Past U+10FFFF.
+  EXPECT_FALSE(IsValidUtf8("\xe2\x28\xa1"));         // Bad continuation.
+}
+
+TEST(WebSocketTests, EchoesCloseAfterPendingOutput) {
+  LoopThread loop;
+  auto connected = Connect(loop.loop());
+  // More than the socket buffers hold, so the close echo has to wait.
+  std::string message(1024 * 1024, 'x');
+  for (int i = 0; i < 4; ++i) {
+    connected->socket->Send(message);
+  }
+  std::string close = ClientFrame(WebSocketOpcode::kClose, "\x03\xe8");
+  ASSERT_EQ(connected->client.Send(close.data(), close.size()),
+            static_cast<ssize_t>(close.size()));
+
+  std::string received = ReadToEnd(connected->client);
+  std::string frame = MakeWebSocketFrame(WebSocketOpcode::kText, message);
+  ASSERT_EQ(received.size(), 4 * frame.size() + 4);
+  EXPECT_EQ(received.substr(0, frame.size()), frame);
+  EXPECT_EQ(received.substr(4 * frame.size()), "\x88\x02\x03\xe8");
+
+  connected->client.Close();
+  EXPECT_TRUE(connected->closed.WaitForNotificationWithTimeout(
+      absl::Seconds(5)));
+}
+
+TEST(WebSocketTests, ClosesOnInvalidUtf8) {
+  LoopThread loop;
+  auto connected = Connect(loop.loop());
+  std::string frame = ClientFrame(WebSocketOpcode::kText, "\xc3\x28");
+  ASSERT_EQ(connected->client.Send(frame.data(), frame.size()),
+            static_cast<ssize_t>(frame.size()));
+  // Close with 1007.
+  EXPECT_EQ(ReadToEnd(connected->client), "\x88\x02\x03\xef");
+  connected->client.Close();
+  EXPECT_TRUE(connected->closed.WaitForNotificationWithTimeout(
+      absl::Seconds(5)));
+}
+
+TEST(WebSocketTests, ValidatesClosePayloads) {
+  struct Case {
+    std::string payload;
+    std::string reply;
+  };
+  const Case cases[] = {
+      // A lone byte can't hold a status code: 1002.
+      {"\x03", "\x88\x02\x03\xea"},
+      // 999, 1005 and 1015 are never valid on the wire: 1002.
+      {"\x03\xe7", "\x88\x02\x03\xea"},
+      {"\x03\xed", "\x88\x02\x03\xea"},
+      {"\x03\xf7", "\x88\x02\x03\xea"},
+      // A reason that isn't UTF-8: 1007.
+      {"\x03\xe8\xff", "\x88\x02\x03\xef"},
+      // A valid code and reason are echoed without the reason.
+      {"\x03\xe8" "bye", "\x88\x02\x03\xe8"},
+      {"\x0f\xa0", "\x88\x02\x0f\xa0"},
+  };
+  for (const Case& c : cases) {
+    LoopThread loop;
+    auto connected = Connect(loop.loop());
+    std::string frame = ClientFrame(WebSocketOpcode::kClose, c.payload);
+    ASSERT_EQ(connected->client.Send(frame.data(), frame.size()),
+              static_cast<ssize_t>(frame.size()));
+    EXPECT_EQ(ReadToEnd(connected->client), c.reply)
+        << absl::CHexEscape(c.payload);
+    connected->client.Close();
+    EXPECT_TRUE(connected->closed.WaitForNotificationWithTimeout(
+        absl::Seconds(5)));
+  }
+}
@@ -0,0 +1,82 @@
+// Copyright 2022 Daniel Liu
+
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+WorkerPool::WorkerPool(size_t threads, std::vector<size_t> groups,
+                       std::function<void(size_t)> on_start)
+    : on_start_{std::move(on_start)} {
+  groups.resize(threads, 0);
+  size_t group_count = 1;
+  for (size_t group : groups) {
+    group_count = std::max(group_count, group + 1);
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    tasks_.resize(group_count);
+  }
+  threads_.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    threads_.emplace_back(&WorkerPool::Work, this, i, groups[i]);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::Submit(std::function<void()> task, size_t group) {
+  absl::MutexLock lock(&mutex_);
+  tasks_[group < tasks_.size() ? group : 0].push_back(std::move(task));
+  ++queued_;
+}
+
+size_t WorkerPool::QueueLength() const {
+  absl::MutexLock lock(&mutex_);
+  return queued_;
+}
+
+void WorkerPool::Work(size_t index, size_t group) {
+  if (on_start_) {
+    on_start_(index);
+  }
+  while (true) {
+    std::function<void()> task;
+    {
+      absl::MutexLock lock(&mutex_);
+      auto ready = [this] { return stopping_ || queued_ > 0; };
+      mutex_.Await(absl::Condition(&ready));
+      if (queued_ == 0) {
+        return;
+      }
+      // The thread's own group first, then the others in turn.
+      for (size_t i = 0; i < tasks_.size(); ++i) {
+        auto& queue = tasks_[(group + i) % tasks_.size()];
+        if (!queue.empty()) {
+          task = std::move(queue.front());
+          queue.pop_front();
+          break;
+        }
+      }
+      --queued_;
+    }
+    task();
+  }
+}
+
+}  // namespace cppserver
@@ -0,0 +1,57 @@
+// Copyright 2022 Daniel Liu
+
+#ifndef _CPPSERVER_WORKER_POOL_H_
+#define _CPPSERVER_WORKER_POOL_H_
+
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace cppserver {
+
+// A fixed set of threads that run submitted tasks in order. Tasks may block,
+// e.g. on a client socket; one that blocks for long holds its thread.
+//
+// Threads may be split into groups, e.g. by NUMA node. Tasks submitted to a
+// group are run by its threads when one is free, and by any other thread
+// otherwise.
+class WorkerPool {
+ public:
+  // Starts `threads` threads. Thread i belongs to group `groups[i]`, or
+  // group 0 if `groups` is shorter. Each thread calls `on_start`, if set,
+  // with its index before running any tasks, e.g. to pin itself to a CPU.
+  explicit WorkerPool(size_t threads, std::vector<size_t> groups = {},
+                      std::function<void(size_t)> on_start = nullptr);
+
+  // Runs the tasks already submitted, then joins the threads.
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Queues `task` to run on the next free thread, preferring the threads in
+  // `group`. Safe to call from any thread.
+  void Submit(std::function<void()> task, size_t group = 0);
+
+  // Tasks waiting for a thread.
+  size_t QueueLength() const;
+
+ private:
+  void Work(size_t index, size_t group);
+
+  mutable absl::Mutex mutex_;
+  // Queued tasks by group.
+  std::vector<std::deque<std::function<void()>>> tasks_ ABSL_GUARDED_BY(mutex_);
+  size_t queued_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+
+  std::function<void(size_t)> on_start_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace cppserver
+
+#endif